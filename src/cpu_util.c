@@ -3,8 +3,15 @@
 #include <string.h>
 #include <math.h>
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "xgpu.h"
 #include "xgpu_info.h"
+#include "xgpu_signal.h"
 
 // Normally distributed random numbers with standard deviation of 2.5,
 // quantized to integer values and saturated to the range -7.0 to +7.0.  For
@@ -44,8 +51,12 @@ void xgpuRandomComplex(ComplexInput* random_num, long long unsigned int length)
     // than left shift by 4).
     // (i.e. {-112, -96, -80, ..., +80, +96, +112})
     //random_num[i] = ComplexInput( ((int)a) << 4, ((int)b) << 4 );
+#ifdef INT4
+    random_num[i].reim = ((((int)a) & 0xf) << 4) | (((int)b) & 0xf);
+#else
     random_num[i].real = ((int)a) << 4;
     random_num[i].imag = ((int)b) << 4;
+#endif
 
     // Uncomment next line to simulate all zeros for every input.
     // Interestingly, it does not give exactly zeros on the output.
@@ -54,23 +65,68 @@ void xgpuRandomComplex(ComplexInput* random_num, long long unsigned int length)
   }
 }
 
+int xgpuGenerateInput(ComplexInput *array_h, const XGPUSignal *signal) {
+  XGPUInfo sizing;
+  xgpuInfo(&sizing);
+  return xgpuGenerateInputSized(&sizing, array_h, signal);
+}
+
+// Every sample is independent of the others (see xgpu_signal.h), so the
+// samples are simply shared out between threads.
+int xgpuGenerateInputSized(const XGPUInfo *sizing, ComplexInput *array_h, const XGPUSignal *signal) {
+  const unsigned int nstation = sizing->nstation;
+  const unsigned int nfrequency = sizing->nfrequency;
+  const long long length = (long long)sizing->ntime * nfrequency * nstation * NPOL;
+  float *table = malloc((signal->nsource * (nstation+1) + 1) * sizeof(float));
+  long long i;
+
+  if(!table) {
+    return XGPU_OUT_OF_MEMORY;
+  }
+  signalTable(table, signal, nstation);
+
+#pragma omp parallel for schedule(static)
+  for(i=0; i<length; i++) {
+    unsigned int p = i % NPOL;
+    unsigned int s = (i / NPOL) % nstation;
+    unsigned int f = (i / ((long long)NPOL * nstation)) % nfrequency;
+    unsigned long long t = i / ((long long)NPOL * nstation * nfrequency);
+    float a, b;
+    signalSample(&a, &b, table, signal->nsource, nstation, nfrequency, signal->noise,
+		 signal->seed, signal->time + t, f, s, p);
+    quantizeSample(&array_h[i], a, b);
+  }
+
+  free(table);
+  return XGPU_OK;
+}
+
 void xgpuReorderMatrix(Complex *matrix) {
+  XGPUInfo sizing;
+  xgpuInfo(&sizing);
+  xgpuReorderMatrixSized(&sizing, matrix);
+}
+
+void xgpuReorderMatrixSized(const XGPUInfo *sizing, Complex *matrix) {
 
 #if MATRIX_ORDER == REGISTER_TILE_TRIANGULAR_ORDER
   // reorder the matrix from REGISTER_TILE_TRIANGULAR_ORDER to TRIANGULAR_ORDER
 
+  const int nstation = sizing->nstation;
+  const int nfrequency = sizing->nfrequency;
   int f, i, rx, j, ry, pol1, pol2;
-  size_t matLength = NFREQUENCY * ((NSTATION/2+1)*(NSTATION/4)*NPOL*NPOL*4) * (NPULSAR + 1);
+  size_t matLength = sizing->matLength;
   Complex *tmp = malloc(matLength * sizeof(Complex));
   memset(tmp, '0', matLength);
 
-  for(f=0; f<NFREQUENCY; f++) {
-    for(i=0; i<NSTATION/2; i++) {
+  // the pulsar bins follow one another like further channels
+  for(f=0; f<nfrequency*(NPULSAR+1); f++) {
+    for(i=0; i<nstation/2; i++) {
       for (rx=0; rx<2; rx++) {
 	for (j=0; j<=i; j++) {
 	  for (ry=0; ry<2; ry++) {
-	    int k = f*(NSTATION+1)*(NSTATION/2) + (2*i+rx)*(2*i+rx+1)/2 + 2*j+ry;
-	    int l = f*4*(NSTATION/2+1)*(NSTATION/4) + (2*ry+rx)*(NSTATION/2+1)*(NSTATION/4) + i*(i+1)/2 + j;
+	    int k = f*(nstation+1)*(nstation/2) + (2*i+rx)*(2*i+rx+1)/2 + 2*j+ry;
+	    int l = f*4*(nstation/2+1)*(nstation/4) + (2*ry+rx)*(nstation/2+1)*(nstation/4) + i*(i+1)/2 + j;
 	    for (pol1=0; pol1<NPOL; pol1++) {
 	      for (pol2=0; pol2<NPOL; pol2++) {
 		size_t tri_index = (k*NPOL+pol1)*NPOL+pol2;
@@ -99,14 +155,16 @@ void xgpuReorderMatrix(Complex *matrix) {
 #elif MATRIX_ORDER == REAL_IMAG_TRIANGULAR_ORDER
   // reorder the matrix from REAL_IMAG_TRIANGULAR_ORDER to TRIANGULAR_ORDER
   
+  const int nstation = sizing->nstation;
+  const int nfrequency = sizing->nfrequency;
   int f, i, j, pol1, pol2;
-  size_t matLength = NFREQUENCY * ((NSTATION+1)*(NSTATION/2)*NPOL*NPOL) * (NPULSAR + 1);
+  size_t matLength = sizing->matLength;
   Complex *tmp = malloc(matLength * sizeof(Complex));
 
-  for(f=0; f<NFREQUENCY; f++){
-    for(i=0; i<NSTATION; i++){
+  for(f=0; f<nfrequency*(NPULSAR+1); f++){
+    for(i=0; i<nstation; i++){
       for (j=0; j<=i; j++) {
-	int k = f*(NSTATION+1)*(NSTATION/2) + i*(i+1)/2 + j;
+	int k = f*(nstation+1)*(nstation/2) + i*(i+1)/2 + j;
         for (pol1=0; pol1<NPOL; pol1++) {
 	  for (pol2=0; pol2<NPOL; pol2++) {
 	    size_t index = (k*NPOL+pol1)*NPOL+pol2;
@@ -133,142 +191,403 @@ void xgpuReorderMatrix(Complex *matrix) {
 
 #define zabs(z) (sqrt(z.real*z.real+z.imag*z.imag))
 
+#ifndef FIXED_POINT
+#define TOL 1e-12
+#else
+#define TOL 1e-5
+#endif // FIXED_POINT
+
+// Elements of each channel compared by one task of xgpuCompareResultSized
+#define CHECK_BLOCK_BASELINES 256
+
+// Error of element gpu relative to cpu (see XGPUCheck)
+static inline double elementError(Complex gpu, Complex cpu)
+{
+  double gr = gpu.real, gi = gpu.imag;
+#if defined(FIXED_POINT) && !defined(DP4A)
+  gr = round(gr);
+  gi = round(gi);
+#endif
+  double cr = cpu.real, ci = cpu.imag;
+  double dr = cr - gr, di = ci - gi;
+  double c2 = cr*cr + ci*ci;
+  return c2 == 0 ? sqrt(gr*gr + gi*gi) : sqrt((dr*dr + di*di) / c2);
+}
+
+// Add mismatch to the n (of at most max) mismatches in list, which are kept
+// in index order, unless max of them have lower indices
+static void insertMismatch(XGPUMismatch *list, unsigned int *n, unsigned int max, const XGPUMismatch *mismatch)
+{
+  unsigned int k = *n;
+  if(k == max) {
+    if(max == 0 || list[max-1].index < mismatch->index) {
+      return;
+    }
+    k--;
+  } else {
+    (*n)++;
+  }
+  for(; k>0 && list[k-1].index > mismatch->index; k--) {
+    list[k] = list[k-1];
+  }
+  list[k] = *mismatch;
+}
+
+int xgpuCompareResult(const Complex *gpu, const Complex *cpu, XGPUCheck *check) {
+  XGPUInfo sizing;
+  xgpuInfo(&sizing);
+  return xgpuCompareResultSized(&sizing, gpu, cpu, check);
+}
+
+int xgpuCompareResultSized(const XGPUInfo *sizing, const Complex *gpu, const Complex *cpu, XGPUCheck *check) {
+
+  const unsigned int nbaseline = sizing->nbaseline;
+  const unsigned int nfrequency = sizing->nfrequency;
+  const unsigned int baseline_stride = check->baseline_stride ? check->baseline_stride : 1;
+  const unsigned int channel_stride = check->channel_stride ? check->channel_stride : 1;
+  const unsigned int baseline0 = check->phase % baseline_stride;
+  const unsigned int channel0 = check->phase % channel_stride;
+  const double tolerance = check->tolerance > 0 ? check->tolerance : TOL;
+  const long long unsigned int max_count = check->max_count;
+
+  // Sampled baselines of each channel, and sampled channels, and the tasks
+  // splitting them between threads in memory order
+  const long long nsample = baseline0 < nbaseline ? (nbaseline - baseline0 + baseline_stride - 1) / baseline_stride : 0;
+  const long long nchannel = channel0 < nfrequency ? (nfrequency - channel0 + channel_stride - 1) / channel_stride : 0;
+  const long long nblock = (nsample + CHECK_BLOCK_BASELINES - 1) / CHECK_BLOCK_BASELINES;
+
+  long long unsigned int compared = 0;
+  long long unsigned int count = 0;
+  double max_error = 0.0;
+  double sum_error = 0.0;
+  int stopped = 0;
+
+  check->nmismatch = 0;
+
+  #pragma omp parallel reduction(+:compared,sum_error) reduction(max:max_error)
+  {
+    XGPUMismatch *local = NULL;
+    unsigned int nlocal = 0;
+    long long task;
+
+    if(check->mismatch && check->max_mismatch) {
+      local = (XGPUMismatch *)malloc(check->max_mismatch*sizeof(XGPUMismatch));
+    }
+
+    // Each thread handles its tasks in memory order, so its first mismatches
+    // are the first of its share
+    #pragma omp for schedule(static)
+    for(task=0; task<nchannel*nblock; task++) {
+      int stop;
+      #pragma omp atomic read
+      stop = stopped;
+      if(stop) {
+        continue;
+      }
+
+      const unsigned int f = channel0 + (task / nblock) * channel_stride;
+      const long long first = (task % nblock) * CHECK_BLOCK_BASELINES;
+      const long long last = first + CHECK_BLOCK_BASELINES < nsample ? first + CHECK_BLOCK_BASELINES : nsample;
+      const size_t base = ((size_t)f*nbaseline + baseline0) * NPOL*NPOL;
+      double block_max = 0.0;
+      double block_sum = 0.0;
+      long long block_count = 0;
+      long long s;
+
+      #pragma omp simd reduction(max:block_max) reduction(+:block_sum,block_count)
+      for(s=first*NPOL*NPOL; s<last*NPOL*NPOL; s++) {
+        size_t index = base + (size_t)(s / (NPOL*NPOL)) * baseline_stride * NPOL*NPOL + s % (NPOL*NPOL);
+        double error = elementError(gpu[index], cpu[index]);
+        block_max = error > block_max ? error : block_max;
+        block_sum += error;
+        // NaN counts as differing
+        block_count += !(error <= tolerance);
+      }
+
+      compared += (last - first) * NPOL*NPOL;
+      sum_error += block_sum;
+      max_error = block_max > max_error ? block_max : max_error;
+      if(block_count == 0) {
+        continue;
+      }
+
+      long long unsigned int total;
+      #pragma omp atomic capture
+      total = count += block_count;
+      if(max_count && total >= max_count) {
+        #pragma omp atomic write
+        stopped = 1;
+      }
+
+      // Note which elements of the block differ
+      for(s=first; s<last && (local && nlocal < check->max_mismatch); s++) {
+        size_t k = (size_t)baseline0 + s * baseline_stride;
+        for(int p=0; p<NPOL*NPOL && nlocal < check->max_mismatch; p++) {
+          size_t index = ((size_t)f*nbaseline + k) * NPOL*NPOL + p;
+          double error = elementError(gpu[index], cpu[index]);
+          if(!(error <= tolerance)) {
+            XGPUMismatch *m = &local[nlocal++];
+            unsigned int i = (unsigned int)((sqrt(8.0*k + 1) - 1) / 2);
+            // Guard against rounding of the square root
+            while((size_t)i*(i+1)/2 > k) i--;
+            while((size_t)(i+1)*(i+2)/2 <= k) i++;
+            m->index = index;
+            m->f = f;
+            m->i = i;
+            m->j = k - (size_t)i*(i+1)/2;
+            m->pol1 = p / NPOL;
+            m->pol2 = p % NPOL;
+            m->error = error;
+          }
+        }
+      }
+    }
+
+    #pragma omp critical
+    for(unsigned int n=0; n<nlocal; n++) {
+      insertMismatch(check->mismatch, &check->nmismatch, check->max_mismatch, &local[n]);
+    }
+    free(local);
+  }
+
+  check->compared = compared;
+  check->count = count;
+  check->max_error = max_error;
+  check->mean_error = compared ? sum_error / compared : 0.0;
+  check->stopped = stopped;
+
+  return count != 0;
+}
+
 //check that GPU calculation matches the CPU
 //
 // verbose=0 means just print summary.
 // verbsoe=1 means print each differing baseline/channel.
 // verbose=2 and array_h!=0 means print each differing baseline and each input
 //           sample that contributed to it.
-#ifndef FIXED_POINT
-#define TOL 1e-12
-#else
-#define TOL 1e-5
-#endif // FIXED_POINT
 void xgpuCheckResult(Complex *gpu, Complex *cpu, int verbose, ComplexInput *array_h) {
+  XGPUInfo sizing;
+  xgpuInfo(&sizing);
+  xgpuCheckResultSized(&sizing, gpu, cpu, verbose, array_h);
+}
+
+void xgpuCheckResultSized(const XGPUInfo *sizing, Complex *gpu, Complex *cpu, int verbose, ComplexInput *array_h) {
+
+  const int nstation = sizing->nstation;
+  const int nfrequency = sizing->nfrequency;
+  const int ntime = sizing->ntime;
 
   printf("Checking result (tolerance == %g)...\n", TOL); fflush(stdout);
 
-  int errorCount=0;
-  double error = 0.0;
-  double maxError = 0.0;
-  int i, j, pol1, pol2, f, t;
-
-  for(i=0; i<NSTATION; i++){
-    for (j=0; j<=i; j++) {
-      for (pol1=0; pol1<NPOL; pol1++) {
-	for (pol2=0; pol2<NPOL; pol2++) {
-	  for(f=0; f<NFREQUENCY; f++){
-	    int k = f*(NSTATION+1)*(NSTATION/2) + i*(i+1)/2 + j;
-	    int index = (k*NPOL+pol1)*NPOL+pol2;
+  XGPUCheck check;
+  memset(&check, 0, sizeof(check));
+  xgpuCompareResultSized(sizing, gpu, cpu, &check);
 
-#if defined(FIXED_POINT) && !defined(DP4A)
-	    gpu[index].real = round(gpu[index].real);
-	    gpu[index].imag = round(gpu[index].imag);
-#endif
-	    if(zabs(cpu[index]) == 0) {
-	      error = zabs(gpu[index]);
-	    } else {
-              Complex delta;
-              delta.real = cpu[index].real - gpu[index].real;
-              delta.imag = cpu[index].imag - gpu[index].imag;
-	      error = zabs(delta) / zabs(cpu[index]);
-	    }
-	    if(error > maxError) {
-	      maxError = error;
-	    }
-	    if(error > TOL) {
-              if(verbose > 0) {
-                if (errorCount==0) printf("freq  i   j    k px py  linear   cpu.real      gpu.real     xcpu.imag      gpu.imag abs(cpu) abs(gpu)\n");
+  if(check.count && verbose > 0) {
+    // Compare again to find all of the differing elements
+    check.max_mismatch = check.count;
+    check.mismatch = (XGPUMismatch *)malloc(check.max_mismatch*sizeof(XGPUMismatch));
+    if(check.mismatch) {
+      xgpuCompareResultSized(sizing, gpu, cpu, &check);
+    }
+  }
+
+  unsigned int n;
+  int t;
+  for(n=0; n<check.nmismatch; n++) {
+    const XGPUMismatch *m = &check.mismatch[n];
+    int f = m->f, i = m->i, j = m->j, pol1 = m->pol1, pol2 = m->pol2;
+    int k = f*(nstation+1)*(nstation/2) + i*(i+1)/2 + j;
+    size_t index = m->index;
+
+    if (n==0) printf("freq  i   j    k px py  linear   cpu.real      gpu.real     xcpu.imag      gpu.imag abs(cpu) abs(gpu)\n");
 #ifndef DP4A
-                printf("%3d %3d %3d %4d %2d %2d %5d %12g  %12g  %12g  %12g (%g %g)\n", f, i, j, k, pol1, pol2, index,
-                       cpu[index].real, gpu[index].real, cpu[index].imag, gpu[index].imag, zabs(cpu[index]), zabs(gpu[index]));
+    printf("%3d %3d %3d %4d %2d %2d %5zu %12g  %12g  %12g  %12g (%g %g)\n", f, i, j, k, pol1, pol2, index,
+           cpu[index].real, gpu[index].real, cpu[index].imag, gpu[index].imag, zabs(cpu[index]), zabs(gpu[index]));
 #else
-                printf("%3d %3d %3d %4d %2d %2d %5d %12d  %12d  %12d  %12d (%g %g)\n", f, i, j, k, pol1, pol2, index,
-                       cpu[index].real, gpu[index].real, cpu[index].imag, gpu[index].imag, zabs(cpu[index]), zabs(gpu[index]));
+    printf("%3d %3d %3d %4d %2d %2d %5zu %12d  %12d  %12d  %12d (%g %g)\n", f, i, j, k, pol1, pol2, index,
+           cpu[index].real, gpu[index].real, cpu[index].imag, gpu[index].imag, zabs(cpu[index]), zabs(gpu[index]));
 #endif
-                if(verbose > 1 && array_h) {
-                  Complex sum;
-                  sum.real = 0;
-                  sum.imag = 0;
-                  for(t=0; t<NTIME; t++) {
-                    ComplexInput in0 = array_h[t*NFREQUENCY*NSTATION*2 + f*NSTATION*2 + i*2 + pol1];
-                    ComplexInput in1 = array_h[t*NFREQUENCY*NSTATION*2 + f*NSTATION*2 + j*2 + pol2];
-                    //Complex prod = convert(in0) * conj(convert(in1));
-                    Complex prod;
-                    prod.real = in0.real * in1.real + in0.imag * in1.imag;
-                    prod.imag = in0.imag * in1.real - in0.real * in1.imag;
-
-                    sum.real += prod.real;
-                    sum.imag += prod.imag;
-                    printf(" %4d (%4g,%4g) (%4g,%4g) -> (%6g, %6g)\n", t,
-                        //(float)real(in0), (float)imag(in0),
-                        //(float)real(in1), (float)imag(in1),
-                        //(float)real(prod), (float)imag(prod));
-                        (float)in0.real, (float)in0.imag,
-                        (float)in1.real, (float)in1.imag,
-                        (float)prod.real, (float)prod.imag);
-                  }
+    if(verbose > 1 && array_h) {
+      Complex sum;
+      sum.real = 0;
+      sum.imag = 0;
+      for(t=0; t<ntime; t++) {
+        ComplexInput in0 = array_h[t*nfrequency*nstation*2 + f*nstation*2 + i*2 + pol1];
+        ComplexInput in1 = array_h[t*nfrequency*nstation*2 + f*nstation*2 + j*2 + pol2];
+        //Complex prod = convert(in0) * conj(convert(in1));
+        Complex prod;
+        prod.real = XGPU_INPUT_REAL(in0) * XGPU_INPUT_REAL(in1) + XGPU_INPUT_IMAG(in0) * XGPU_INPUT_IMAG(in1);
+        prod.imag = XGPU_INPUT_IMAG(in0) * XGPU_INPUT_REAL(in1) - XGPU_INPUT_REAL(in0) * XGPU_INPUT_IMAG(in1);
+
+        sum.real += prod.real;
+        sum.imag += prod.imag;
+        printf(" %4d (%4g,%4g) (%4g,%4g) -> (%6g, %6g)\n", t,
+            //(float)real(in0), (float)imag(in0),
+            //(float)real(in1), (float)imag(in1),
+            //(float)real(prod), (float)imag(prod));
+            (float)XGPU_INPUT_REAL(in0), (float)XGPU_INPUT_IMAG(in0),
+            (float)XGPU_INPUT_REAL(in1), (float)XGPU_INPUT_IMAG(in1),
+            (float)prod.real, (float)prod.imag);
+      }
 #ifndef DP4A
-                  printf("                                 (%6g, %6g)\n", sum.real, sum.imag);
+      printf("                                 (%6g, %6g)\n", sum.real, sum.imag);
 #else
-                  printf("                                 (%6d, %6d)\n", sum.real, sum.imag);
+      printf("                                 (%6d, %6d)\n", sum.real, sum.imag);
 #endif
-                }
-              }
-	      errorCount++;
-	    }
-	  }
-	}
-      }
     }
   }
+  free(check.mismatch);
 
-  if (errorCount) {
-    printf("Outer product summation failed with %d deviations (max error %g)\n\n", errorCount, maxError);
+  if (check.count) {
+    printf("Outer product summation failed with %llu deviations (max error %g)\n\n", check.count, check.max_error);
   } else {
-    printf("Outer product summation successful (max error %g)\n\n", maxError);
+    printf("Outer product summation successful (max error %g)\n\n", check.max_error);
+  }
+}
+
+// Interleave the bytes of four consecutive time samples of row bytes each,
+// i.e. out[4*r+k] = in[k*row+r] for k = 0..3, over r in [begin,end).
+static void interleave4(signed char *out, const signed char *in, size_t row, size_t begin, size_t end)
+{
+  const signed char *in0 = in;
+  const signed char *in1 = in + row;
+  const signed char *in2 = in + 2*row;
+  const signed char *in3 = in + 3*row;
+  size_t r = begin;
+
+#if defined(__AVX2__)
+  for(; r+32 <= end; r+=32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(in0+r));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(in1+r));
+    __m256i c = _mm256_loadu_si256((const __m256i *)(in2+r));
+    __m256i d = _mm256_loadu_si256((const __m256i *)(in3+r));
+    __m256i ab_lo = _mm256_unpacklo_epi8(a, b);
+    __m256i ab_hi = _mm256_unpackhi_epi8(a, b);
+    __m256i cd_lo = _mm256_unpacklo_epi8(c, d);
+    __m256i cd_hi = _mm256_unpackhi_epi8(c, d);
+    // Each 128-bit lane of q0..q3 now holds four interleaved r, with the
+    // upper lanes holding r+16
+    __m256i q0 = _mm256_unpacklo_epi16(ab_lo, cd_lo);
+    __m256i q1 = _mm256_unpackhi_epi16(ab_lo, cd_lo);
+    __m256i q2 = _mm256_unpacklo_epi16(ab_hi, cd_hi);
+    __m256i q3 = _mm256_unpackhi_epi16(ab_hi, cd_hi);
+    __m256i *o = (__m256i *)(out + 4*r);
+    _mm256_storeu_si256(o+0, _mm256_permute2x128_si256(q0, q1, 0x20));
+    _mm256_storeu_si256(o+1, _mm256_permute2x128_si256(q2, q3, 0x20));
+    _mm256_storeu_si256(o+2, _mm256_permute2x128_si256(q0, q1, 0x31));
+    _mm256_storeu_si256(o+3, _mm256_permute2x128_si256(q2, q3, 0x31));
+  }
+#endif
+
+#if defined(__SSE2__)
+  for(; r+16 <= end; r+=16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(in0+r));
+    __m128i b = _mm_loadu_si128((const __m128i *)(in1+r));
+    __m128i c = _mm_loadu_si128((const __m128i *)(in2+r));
+    __m128i d = _mm_loadu_si128((const __m128i *)(in3+r));
+    __m128i ab_lo = _mm_unpacklo_epi8(a, b);
+    __m128i ab_hi = _mm_unpackhi_epi8(a, b);
+    __m128i cd_lo = _mm_unpacklo_epi8(c, d);
+    __m128i cd_hi = _mm_unpackhi_epi8(c, d);
+    __m128i *o = (__m128i *)(out + 4*r);
+    _mm_storeu_si128(o+0, _mm_unpacklo_epi16(ab_lo, cd_lo));
+    _mm_storeu_si128(o+1, _mm_unpackhi_epi16(ab_lo, cd_lo));
+    _mm_storeu_si128(o+2, _mm_unpacklo_epi16(ab_hi, cd_hi));
+    _mm_storeu_si128(o+3, _mm_unpackhi_epi16(ab_hi, cd_hi));
   }
+#elif defined(__ARM_NEON)
+  for(; r+16 <= end; r+=16) {
+    int8x16x4_t v;
+    v.val[0] = vld1q_s8(in0+r);
+    v.val[1] = vld1q_s8(in1+r);
+    v.val[2] = vld1q_s8(in2+r);
+    v.val[3] = vld1q_s8(in3+r);
+    vst4q_s8(out + 4*r, v);
+  }
+#endif
 
+  for(; r<end; r++) {
+    out[4*r+0] = in0[r];
+    out[4*r+1] = in1[r];
+    out[4*r+2] = in2[r];
+    out[4*r+3] = in3[r];
+  }
+}
+
+// Size, in bytes of one time sample, of the tiles into which each group of
+// four time samples is split for swizzling
+#define SWIZZLE_TILE 4096
+
+// Swizzle ntime (a multiple of 4) time samples from in to out.  The work is
+// split into tiles of SWIZZLE_TILE bytes of four time samples, which are
+// swizzled in parallel.
+static void swizzleTimes(const XGPUInfo *sizing, signed char *o, const signed char *i, unsigned int ntime)
+{
+  // bytes of input per time sample
+  const size_t row = (size_t)sizing->nfrequency * sizing->nstation * NPOL * sizeof(ComplexInput);
+  const long ntile = (row + SWIZZLE_TILE - 1) / SWIZZLE_TILE;
+  const long nwork = (long)(ntime/4) * ntile;
+  long w;
+
+#pragma omp parallel for schedule(static)
+  for(w=0; w<nwork; w++) {
+    size_t t4 = w / ntile;
+    size_t begin = (w % ntile) * SWIZZLE_TILE;
+    size_t end = begin + SWIZZLE_TILE < row ? begin + SWIZZLE_TILE : row;
+    interleave4(o + t4*4*row, i + t4*4*row, row, begin, end);
+  }
 }
 
 // reorder the input array - separate real/imag and corner turn in time, depth 4
 void xgpuSwizzleInput(ComplexInput *out, const ComplexInput *in) {
-  printf("Swizzling input\n");
-
-  signed char *o = (signed char*)out;
-  const signed char *i = (signed char*)in;
-  int t, f, s, p, c;
-
-  for (t=0; t<NTIME; t++) {
-    for (f=0; f<NFREQUENCY; f++) {
-      for(s=0; s<NSTATION; s++) {
-	for (p=0; p<NPOL; p++) {
-	  for (c=0; c<2; c++) {
-	    o[((((t/4*NFREQUENCY+f)*NSTATION+s)*NPOL+p)*2+c)*4+t%4] =
-	      i[( ( (t*NFREQUENCY+f)*NSTATION+s )*NPOL+p )*2 + c];
-	  }
-	}
-      }
-    }
-  }
+  XGPUInfo sizing;
+  xgpuInfo(&sizing);
+  xgpuSwizzleInputSized(&sizing, out, in);
+}
+
+// The output is in [t/4][f][s][p][c][t%4] order (or [t/4][f][s][p][t%4] for
+// INT4), i.e. each group of four time samples of the input is
+// byte-interleaved.
+void xgpuSwizzleInputSized(const XGPUInfo *sizing, ComplexInput *out, const ComplexInput *in) {
+  swizzleTimes(sizing, (signed char*)out, (const signed char*)in, sizing->ntime);
+}
 
+void xgpuSwizzleInputChunk(ComplexInput *out, const ComplexInput *in, unsigned int chunk) {
+  XGPUInfo sizing;
+  xgpuInfo(&sizing);
+  xgpuSwizzleInputChunkSized(&sizing, out, in, chunk);
+}
+
+void xgpuSwizzleInputChunkSized(const XGPUInfo *sizing, ComplexInput *out, const ComplexInput *in, unsigned int chunk) {
+  size_t offset = (size_t)chunk * sizing->vecLengthPipe;
+  swizzleTimes(sizing, (signed char*)(out + offset), (const signed char*)(in + offset), sizing->ntimepipe);
 }
 
 // Extracts the full matrix from the packed Hermitian form
 void xgpuExtractMatrix(Complex *matrix, Complex *packed) {
+  XGPUInfo sizing;
+  xgpuInfo(&sizing);
+  xgpuExtractMatrixSized(&sizing, matrix, packed);
+}
+
+void xgpuExtractMatrixSized(const XGPUInfo *sizing, Complex *matrix, Complex *packed) {
+
+  const int nstation = sizing->nstation;
+  const int nfrequency = sizing->nfrequency;
 
   int f, i, j, pol1, pol2;
-  for(f=0; f<NFREQUENCY; f++){
-    for(i=0; i<NSTATION; i++){
+  for(f=0; f<nfrequency*(NPULSAR+1); f++){
+    for(i=0; i<nstation; i++){
       for (j=0; j<=i; j++) {
-	int k = f*(NSTATION+1)*(NSTATION/2) + i*(i+1)/2 + j;
+	int k = f*(nstation+1)*(nstation/2) + i*(i+1)/2 + j;
         for (pol1=0; pol1<NPOL; pol1++) {
 	  for (pol2=0; pol2<NPOL; pol2++) {
 	    int index = (k*NPOL+pol1)*NPOL+pol2;
-	    matrix[(((f*NSTATION + i)*NSTATION + j)*NPOL + pol1)*NPOL+pol2].real = packed[index].real;
-	    matrix[(((f*NSTATION + i)*NSTATION + j)*NPOL + pol1)*NPOL+pol2].imag = packed[index].imag;
-	    matrix[(((f*NSTATION + j)*NSTATION + i)*NPOL + pol2)*NPOL+pol1].real =  packed[index].real;
-	    matrix[(((f*NSTATION + j)*NSTATION + i)*NPOL + pol2)*NPOL+pol1].imag = -packed[index].imag;
+	    matrix[(((f*nstation + i)*nstation + j)*NPOL + pol1)*NPOL+pol2].real = packed[index].real;
+	    matrix[(((f*nstation + i)*nstation + j)*NPOL + pol1)*NPOL+pol2].imag = packed[index].imag;
+	    matrix[(((f*nstation + j)*nstation + i)*NPOL + pol2)*NPOL+pol1].real =  packed[index].real;
+	    matrix[(((f*nstation + j)*nstation + i)*NPOL + pol2)*NPOL+pol1].imag = -packed[index].imag;
 	    //printf("%d %d %d %d %d %d %d\n",f,i,j,k,pol1,pol2,index);
 	  }
 	}
@@ -277,3 +596,28 @@ void xgpuExtractMatrix(Complex *matrix, Complex *packed) {
   }
 
 }
+
+Complex xgpuMatrixElement(const Complex *packed, unsigned int f, unsigned int i, unsigned int j,
+			  unsigned int pol1, unsigned int pol2) {
+  XGPUInfo sizing;
+  xgpuInfo(&sizing);
+  return xgpuMatrixElementSized(&sizing, packed, f, i, j, pol1, pol2);
+}
+
+// The element of the full matrix that xgpuExtractMatrix would have written,
+// read from the packed half (or its conjugate transpose for j > i)
+Complex xgpuMatrixElementSized(const XGPUInfo *sizing, const Complex *packed, unsigned int f,
+			       unsigned int i, unsigned int j, unsigned int pol1, unsigned int pol2) {
+  const size_t nstation = sizing->nstation;
+  int conjugate = j > i;
+  if(conjugate) {
+    unsigned int t = i; i = j; j = t;
+    t = pol1; pol1 = pol2; pol2 = t;
+  }
+  size_t k = f*(nstation+1)*(nstation/2) + (size_t)i*(i+1)/2 + j;
+  Complex element = packed[(k*NPOL+pol1)*NPOL+pol2];
+  if(conjugate) {
+    element.imag = -element.imag;
+  }
+  return element;
+}
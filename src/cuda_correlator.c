@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <math.h>
 #include <limits.h>
+#include <string.h>
 #include <unistd.h>
 
 #ifdef __MACH__
@@ -35,11 +36,19 @@ int clock_gettime(int clk_id, struct timespec *t){
   [channel][station][station][polarization][polarization][complexity]
 */
 
+// Print the library's messages along with our own
+static void logMessage(int level, const char *message, void *user_data)
+{
+  fprintf(level == XGPU_LOG_ERROR ? stderr : stdout, "%s\n", message);
+}
+
 int main(int argc, char** argv) {
 
   int opt;
   int i, j;
   int device = 0;
+  int devices[16];
+  int ndevice = 1;
   unsigned int seed = 1;
   int outer_count = 1;
   int count = 1;
@@ -47,18 +56,31 @@ int main(int argc, char** argv) {
   int finalSyncOp = SYNCOP_DUMP;
   int verbose = 0;
   int hostAlloc = 0;
+  int useGraph = 0;
+  int deviceReorder = 0;
+  int deviceSwizzle = 0;
+  int pipeDepth = 0;
+  int copyStreams = 0;
+  int nsource = -1;
+  const char *tuneCache = NULL;
   XGPUInfo xgpu_info;
   unsigned int npol, nstation, nfrequency;
+  unsigned int opt_nstation = 0, opt_nfrequency = 0, opt_ntime = 0, opt_ntimepipe = 0;
   int xgpu_error = 0;
   Complex *omp_matrix_h = NULL;
   struct timespec outer_start, start, stop, outer_stop;
   double total, per_call, max_bw, gbps;
 #ifdef RUNTIME_STATS
   struct timespec tic, toc;
+  XGPUStats stats;
 #endif
 
-  while ((opt = getopt(argc, argv, "C:c:d:f:ho:rs:v:")) != -1) {
+  while ((opt = getopt(argc, argv, "a:C:c:d:F:f:G:ghk:N:o:P:p:RrSs:T:v:")) != -1) {
     switch (opt) {
+      case 'a':
+        // Autotune the correlator, caching the result in this file
+        tuneCache = optarg;
+        break;
       case 'c':
         // Set number of time to call xgpuCudaXengine
         count = strtoul(optarg, NULL, 0);
@@ -76,8 +98,51 @@ int main(int argc, char** argv) {
         }
         break;
       case 'd':
-        // Set CUDA device number
-        device = strtoul(optarg, NULL, 0);
+        // Set CUDA device number(s)
+        {
+          char *p = optarg;
+          for(ndevice=0; ndevice<16; ndevice++) {
+            devices[ndevice] = strtoul(p, &p, 0);
+            if(*p != ',') {
+              ndevice++;
+              break;
+            }
+            p++;
+          }
+          device = devices[0];
+        }
+        break;
+      case 'F':
+        // Set runtime number of frequency channels
+        opt_nfrequency = strtoul(optarg, NULL, 0);
+        break;
+      case 'G':
+        // Generate point sources in noise rather than noise alone
+        nsource = strtoul(optarg, NULL, 0);
+        break;
+      case 'g':
+        // Replay the input pipeline as a CUDA graph
+        useGraph = 1;
+        break;
+      case 'k':
+        // Set number of host to device copy streams
+        copyStreams = strtoul(optarg, NULL, 0);
+        break;
+      case 'N':
+        // Set runtime number of stations
+        opt_nstation = strtoul(optarg, NULL, 0);
+        break;
+      case 'P':
+        // Set runtime number of time samples per transfer to GPU
+        opt_ntimepipe = strtoul(optarg, NULL, 0);
+        break;
+      case 'p':
+        // Set number of device input buffers
+        pipeDepth = strtoul(optarg, NULL, 0);
+        break;
+      case 'T':
+        // Set runtime number of time samples per integration
+        opt_ntime = strtoul(optarg, NULL, 0);
         break;
       case 'f':
         // Set syncOp for final call
@@ -87,10 +152,18 @@ int main(int argc, char** argv) {
         // Set syncOp
         syncOp = strtoul(optarg, NULL, 0);
         break;
+      case 'R':
+        // Reorder matrix on the GPU when dumping
+        deviceReorder = 1;
+        break;
       case 'r':
         // Register host allocated memory
         hostAlloc = 1;
         break;
+      case 'S':
+        // Swizzle input on the GPU
+        deviceSwizzle = 1;
+        break;
       case 's':
         // Set seed for random data
         seed = strtoul(optarg, NULL, 0);
@@ -103,19 +176,32 @@ int main(int argc, char** argv) {
         fprintf(stderr,
             "Usage: %s [options]\n"
             "Options:\n"
+            "  -a TUNE_CACHE     Autotune the correlator, recording it in TUNE_CACHE\n"
             "  -c INTEG_CALLS    Calls to xgpuCudaXengine per integration [1]\n"
             "  -C INTEG_COUNT    Number of integrations [1]\n"
-            "  -d DEVNUM         GPU device to use [0]\n"
+            "  -d DEVNUM[,...]   GPU device(s) to use, splitting channels [0]\n"
             "  -f FINAL_SYNCOP   Sync operation for final call [1]\n"
+            "  -F NFREQUENCY     Number of frequency channels [compile-time]\n"
+            "  -G NSOURCE        Generate NSOURCE delayed point sources in the noise\n"
+            "                    (with the parallel generator) [noise only]\n"
+            "  -g                Replay input pipeline as a CUDA graph [false]\n"
+            "  -k COPY_STREAMS   Host to device copy streams [1]\n"
+            "  -N NSTATION       Number of stations [compile-time]\n"
             "  -o SYNCOP         Sync operation for all but final call [1]\n"
             "                    Sync operation values are:\n"
             "                         0 (no sync)\n"
             "                         1 (sync and dump)\n"
             "                         2 (sync host to device transfer)\n"
             "                         3 (sync kernel computations)\n"
+            "                         4 (asynchronous dump)\n"
+            "  -p PIPE_DEPTH     Number of device input buffers [2]\n"
+            "  -P NTIME_PIPE     Time samples per transfer to GPU [compile-time]\n"
+            "  -R                Reorder matrix on GPU when dumping [false]\n"
             "  -r                Register host allocated memory [false]\n"
             "                    (otherwise use CUDA allocated memory)\n"
+            "  -S                Swizzle input on GPU [false]\n"
             "  -s SEED           Random number seed [1]\n"
+            "  -T NTIME          Time samples per integration [compile-time]\n"
             "  -v {0|1|2|3}      Verbosity level (debug only) [0]\n"
             "  -h                Show this message\n",
             argv[0]);
@@ -125,8 +211,19 @@ int main(int argc, char** argv) {
 
   srand(seed);
 
-  // Get sizing info from library
+  // Get sizing info from library, overriding with any runtime sizing
   xgpuInfo(&xgpu_info);
+  if(opt_nstation || opt_nfrequency || opt_ntime || opt_ntimepipe) {
+    xgpu_error = xgpuSizedInfo(&xgpu_info,
+        opt_nstation   ? opt_nstation   : xgpu_info.nstation,
+        opt_nfrequency ? opt_nfrequency : xgpu_info.nfrequency,
+        opt_ntime      ? opt_ntime      : xgpu_info.ntime,
+        opt_ntimepipe  ? opt_ntimepipe  : xgpu_info.ntimepipe);
+    if(xgpu_error) {
+      fprintf(stderr, "unsupported sizing (error code %d)\n", xgpu_error);
+      return xgpu_error;
+    }
+  }
   npol = xgpu_info.npol;
   nstation = xgpu_info.nstation;
   nfrequency = xgpu_info.nfrequency;
@@ -142,6 +239,8 @@ int main(int argc, char** argv) {
   // perform host memory allocation
 
   // allocate the GPU X-engine memory
+  xgpuSetLogCallback(logMessage, NULL);
+  xgpuSetTuningCache(tuneCache);
   XGPUContext context;
   if(hostAlloc) {
     context.array_len = xgpu_info.vecLength;
@@ -152,11 +251,26 @@ int main(int argc, char** argv) {
     context.array_h = NULL;
     context.matrix_h = NULL;
   }
-  xgpu_error = xgpuInit(&context, device);
+  int flags = XGPU_PIPELINE_DEPTH(pipeDepth) | XGPU_COPY_STREAMS(copyStreams)
+      | (useGraph ? XGPU_USE_GRAPH : 0)
+      | (deviceReorder ? XGPU_REORDER_ON_DEVICE : 0)
+      | (deviceSwizzle ? XGPU_SWIZZLE_ON_DEVICE : 0);
+  if(ndevice > 1) {
+    xgpu_error = xgpuInitMultiDevice(&context, &xgpu_info, devices, ndevice, flags);
+  } else {
+    xgpu_error = xgpuInitSized(&context, &xgpu_info, device | flags);
+  }
   if(xgpu_error) {
     fprintf(stderr, "xgpuInit returned error code %d\n", xgpu_error);
     goto cleanup;
   }
+  if(tuneCache) {
+    xgpu_error = xgpuAutotune(&context);
+    if(xgpu_error) {
+      fprintf(stderr, "xgpuAutotune returned error code %d\n", xgpu_error);
+      goto cleanup;
+    }
+  }
 
 #ifndef DP4A
   ComplexInput *array_h = context.array_h; // this is pinned memory
@@ -166,11 +280,38 @@ int main(int argc, char** argv) {
 
   Complex *cuda_matrix_h = context.matrix_h;
 
-  // create an array of complex noise
-  xgpuRandomComplex(array_h, xgpu_info.vecLength);
+  if(nsource < 0) {
+    // create an array of complex noise
+    xgpuRandomComplex(array_h, xgpu_info.vecLength);
+  } else {
+    // add point sources of unit amplitude, at random delays of up to 16
+    // samples, to noise of the spread xgpuRandomComplex uses (but not its
+    // samples, see xgpu_signal.h).  The CPU reference below is computed from
+    // this generated input, not from xgpuRandomComplex's.
+    float *delay = malloc((nsource*nstation + 1)*sizeof(float));
+    for(i=0; i<nsource*nstation; i++) {
+      delay[i] = 16.0f*rand()/RAND_MAX;
+    }
+    XGPUSignal signal = {
+      .seed = seed,
+      .noise = 2.5f,
+      .nsource = nsource,
+      .delay = delay
+    };
+    xgpu_error = delay ? xgpuGenerateInputSized(&xgpu_info, array_h, &signal) : XGPU_OUT_OF_MEMORY;
+    free(delay);
+    if(xgpu_error) {
+      fprintf(stderr, "xgpuGenerateInput returned error code %d\n", xgpu_error);
+      goto cleanup;
+    }
+  }
 
 #ifdef DP4A
-  xgpuSwizzleInput(context.array_h, array_h);
+  if(deviceSwizzle) {
+    memcpy(context.array_h, array_h, xgpu_info.vecLength*sizeof(ComplexInput));
+  } else {
+    xgpuSwizzleInputSized(&xgpu_info, context.array_h, array_h);
+  }
 #endif
 
   // ompXengine always uses TRIANGULAR_ORDER
@@ -183,9 +324,9 @@ int main(int argc, char** argv) {
 
 #if (CUBE_MODE == CUBE_DEFAULT && !defined(POWER_LOOP) )
   // Only call CPU X engine if dumping GPU X engine exactly once
-  if(finalSyncOp == SYNCOP_DUMP && count*outer_count == 1) {
+  if((finalSyncOp == SYNCOP_DUMP || finalSyncOp == SYNCOP_DUMP_ASYNC) && count*outer_count == 1) {
     printf("Calling CPU X-Engine\n");
-    xgpuOmpXengine(omp_matrix_h, array_h);
+    xgpuOmpXengineSized(&xgpu_info, omp_matrix_h, array_h);
   }
 #endif
 
@@ -214,6 +355,12 @@ int main(int argc, char** argv) {
           i==count-1 ? " final" : "");
 #endif
     }
+    // Wait for any asynchronous dumps to land
+    xgpu_error = xgpuDumpSynchronize(&context);
+    if(xgpu_error) {
+      fprintf(stderr, "xgpuDumpSynchronize returned error code %d\n", xgpu_error);
+      goto cleanup;
+    }
     clock_gettime(CLOCK_MONOTONIC, &stop);
     total = ELAPSED_MS(start,stop);
     per_call = total/count;
@@ -244,12 +391,30 @@ int main(int argc, char** argv) {
         max_bw, gbps);
   }
 
+#ifdef RUNTIME_STATS
+  // Per-stage device timings (not available for the CPU X-engine)
+  if(xgpuGetStats(&context, &stats) == XGPU_OK) {
+    fprintf(stderr, "stage   count        mean         p50         p99         max ms\n");
+    fprintf(stderr, "h2d    %6llu  %10.6f  %10.6f  %10.6f  %10.6f\n", stats.h2d.count,
+        stats.h2d.mean, stats.h2d.p50, stats.h2d.p99, stats.h2d.max);
+    fprintf(stderr, "kernel %6llu  %10.6f  %10.6f  %10.6f  %10.6f\n", stats.kernel.count,
+        stats.kernel.mean, stats.kernel.p50, stats.kernel.p99, stats.kernel.max);
+    fprintf(stderr, "dump   %6llu  %10.6f  %10.6f  %10.6f  %10.6f\n", stats.dump.count,
+        stats.dump.mean, stats.dump.p50, stats.dump.p99, stats.dump.max);
+    if(stats.dropped) {
+      fprintf(stderr, "%llu stages not timed\n", stats.dropped);
+    }
+  }
+#endif
+
 #if (CUBE_MODE == CUBE_DEFAULT)
   
   // Only compare CPU and GPU X engines if dumping GPU X engine exactly once
-  if(finalSyncOp == SYNCOP_DUMP && count*outer_count == 1) {
-    xgpuReorderMatrix(cuda_matrix_h);
-    xgpuCheckResult(cuda_matrix_h, omp_matrix_h, verbose, array_h);
+  if((finalSyncOp == SYNCOP_DUMP || finalSyncOp == SYNCOP_DUMP_ASYNC) && count*outer_count == 1) {
+    if(!deviceReorder) {
+      xgpuReorderMatrixSized(&xgpu_info, cuda_matrix_h);
+    }
+    xgpuCheckResultSized(&xgpu_info, cuda_matrix_h, omp_matrix_h, verbose, array_h);
   }
 
 #if 0
@@ -257,7 +422,7 @@ int main(int argc, char** argv) {
   Complex *full_matrix_h = (Complex *) malloc(fullMatLength*sizeof(Complex));
 
   // convert from packed triangular to full matrix
-  xgpuExtractMatrix(full_matrix_h, cuda_matrix_h);
+  xgpuExtractMatrixSized(&xgpu_info, full_matrix_h, cuda_matrix_h);
 
   free(full_matrix_h);
 #endif
@@ -11,41 +11,265 @@
  */
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <nvtx3/nvToolsExt.h>
 
 #include "xgpu.h"
 #include "xgpu_info.h"
+#include "xgpu_signal.h"
 #include "xgpu_version.h"
 #include "cube/cube.h"
+#include "fft/fft.h"
+
+// The only file scope state is constant after loading, apart from the log
+// callback and the device attribute cache (see getDeviceAttr), so contexts
+// can be driven concurrently from different host threads.
 
 // whether we are writing the matrix back to device memory (used for benchmarking)
-static int writeMatrix = 1;
+static const int writeMatrix = 1;
 // this must be enabled for this option to work though, slightly hurts performance
 //#define WRITE_OPTION 
 
 // System page size (used for rounding size passed to cudaHostRegister)
-static long page_size = sysconf(_SC_PAGE_SIZE);
+static const long page_size = sysconf(_SC_PAGE_SIZE);
+
+// One in-flight SYNCOP_DUMP_ASYNC dump, passed to the dump host function
+typedef struct XGPUDumpSlotStruct {
+  XGPUContext *context;
+  Complex *matrix_h;
+  XGPUDumpCallback callback;
+  void *user_data;
+  // Number of shards of a multi-device context yet to land this dump
+  int pending;
+} XGPUDumpSlot;
+
+// Durations of one stage of the pipeline collected for xgpuGetStats, binned
+// as in XGPUStageStats
+typedef struct XGPUTimingStruct {
+  long long unsigned int count;
+  double sum;
+  float max;
+  long long unsigned int histogram[XGPU_STATS_NBIN];
+} XGPUTiming;
+
+// Element of the long integration (xgpuSetLongIntegration), wide enough that
+// it holds integrations many times longer than Complex can: 64 bit integers
+// for DP4A, whose int32 Complex would overflow, and doubles otherwise.
+#ifdef DP4A
+typedef longlong2 WideComplex;
+#else
+typedef double2 WideComplex;
+#endif
+
+// What shared2x2 reads a device input buffer through: a texture object, or
+// with ASYNC_COPY the buffer itself, which it copies into shared memory with
+// cp.async (so is neither limited to the maximum texture size nor bound to
+// textures)
+#ifdef ASYNC_COPY
+#ifndef DP4A
+#error ASYNC_COPY requires DP4A
+#endif
+typedef const int2 *InputSource;
+#else
+typedef cudaTextureObject_t InputSource;
+#endif
+
+// Stages timed for xgpuGetStats
+#define STAGE_H2D    0
+#define STAGE_KERNEL 1
+#define STAGE_DUMP   2
+#define NSTAGE       3
 
 typedef struct XGPUInternalContextStruct {
   // Which device this context applies to
   int device;
 
+  // Set while a call of xgpuCudaXengine (or a variant) is using the context
+  int busy;
+
+  // Whether this context correlates on the host (XGPU_CPU_DEVICE) with
+  // xgpuCpuXengineSized, integrating into cpu_matrix rather than matrix_d.
+  // Such a context has no device state at all.
+  bool cpu;
+  Complex *cpu_matrix;
+
+  // Runtime sizing parameters of this context
+  XGPUInfo info;
+
+  // A multi-device context (see xgpuInitMultiDevice) owns the host buffers
+  // but no device state; its channels are correlated by nshard single-device
+  // contexts.  Otherwise nshard is 0.
+  int nshard;
+  XGPUContext *shard;
+
+  // This context correlates channels freq_offset to freq_offset+nfrequency-1
+  // of host buffers holding full_nfrequency channels (i.e. those of a
+  // multi-device context).
+  unsigned int freq_offset;
+  unsigned int full_nfrequency;
+
+  // Number of independent inputs correlated by each call (see
+  // xgpuInitBatched).  Device buffers hold nbatch inputs or matrices.
+  int nbatch;
+
+  // Number of device input buffers and of h2d copy streams
+  int depth;
+  int ncopy;
+
   //memory pointers on the device
-  ComplexInput *array_d[2];
+  ComplexInput *array_d[XGPU_MAX_PIPELINE_DEPTH];
   Complex *matrix_d;
 
-  // used for overlapping comms and compute
-  cudaStream_t streams[2];
-  cudaEvent_t copyCompletion[2];
-  cudaEvent_t kernelCompletion[2];
+  // used for overlapping comms and compute.  Chunk p is copied into
+  // array_d[p%depth] on copy_streams[p%ncopy]; copyCompletion and
+  // kernelCompletion are indexed by input buffer.
+  cudaStream_t compute_stream;
+  cudaStream_t copy_streams[XGPU_MAX_PIPELINE_DEPTH];
+  cudaEvent_t copyCompletion[XGPU_MAX_PIPELINE_DEPTH];
+  cudaEvent_t kernelCompletion[XGPU_MAX_PIPELINE_DEPTH];
+
+  // used to fork and join streams while capturing the graph
+  cudaEvent_t captureEvent;
+
+  // Whether dumps are reordered into TRIANGULAR_ORDER on the device
+  bool reorder;
+
+  // Whether input in array_d is in natural order and is swizzled on the
+  // device into array_swizzled_d (read through texSwizzled) for shared2x2
+  bool swizzle;
+  ComplexInput *array_swizzled_d;
+  InputSource texSwizzled;
+
+  // Whether to correlate with wmma2x2 (tensor cores) rather than shared2x2,
+  // and whether the device and build support it
+  bool use_tensor;
+  bool tensor_capable;
+
+  // Degree of shared memory buffering of shared2x2, 2 or 4 (see xgpuAutotune)
+  int buffer_depth;
+
+  // Per-stage timings (xgpuGetStats).  Chunk p of a call is timed by
+  // chunk_events[4*p] to [4*p+3], bracketing its h2d transfer then its
+  // kernels, and dump_events[2*i] and [2*i+1] bracket the asynchronous dumps
+  // through staging buffer i (i == 2 for synchronous dumps).  chunk_pending
+  // (bit n for stage n) and dump_pending mark those recorded but not yet
+  // collected into timing, which stats_mutex guards against xgpuGetStats.
+  cudaEvent_t *chunk_events;
+  unsigned char *chunk_pending;
+  cudaEvent_t dump_events[6];
+  bool dump_pending[3];
+  XGPUTiming timing[NSTAGE];
+  long long unsigned int dropped;
+  pthread_mutex_t stats_mutex;
+
+  // Whether dumps are packed by packOutput (xgpuSetOutputFormat and
+  // xgpuSetOutputProducts) into output_type elements of the nproduct products
+  // per channel in products_d (all products in TRIANGULAR_ORDER if nproduct
+  // is 0)
+  bool pack;
+  int output_type;
+  float output_scale;
+  unsigned int *products_d;
+  unsigned int nproduct;
+
+  // RFI flagging of each chunk by flagInput (xgpuSetFlagging).  flags_d holds
+  // the bits of the chunk's samples, and weights_d the samples of each
+  // baseline kept in the integration, staged for asynchronous dumps in
+  // weights_dump_d and transferred to weights_h with each dump.
+  bool flag;
+  float flag_threshold;
+  unsigned int *flags_d;
+  unsigned int *weights_d;
+  unsigned int *weights_dump_d[2];
+  unsigned int *weights_h;
+
+  // Long integration (xgpuSetLongIntegration), to which each restart of the
+  // integration by SYNCOP_DUMP_ASYNC or xgpuFoldIntegration adds it, or NULL.
+  // long_dump_d holds it narrowed to Complex, multiplied by long_scale, for
+  // xgpuDumpLongIntegration.  Every fold_interval calls (xgpuSetFoldInterval,
+  // 0 for never) the integration is also folded into it, fold_count being the
+  // calls since the last restart.
+  WideComplex *long_d;
+  Complex *long_dump_d;
+  double long_scale;
+  unsigned int fold_interval;
+  unsigned int fold_count;
+
+  // Integrated F-engine (xgpuSetChannelizer and xgpuCudaFXengine).  Chunk p
+  // of the voltages is copied into voltages_d[p%depth], filtered by ntap
+  // frames of pfb_window_d into fft_d, transformed by fft_launcher (nfft
+  // points) and quantized into array_d[p%depth].  fft_batch is the number of
+  // transforms per chunk, rounded up as the codelet requires.  voltages_hp
+  // is set for the duration of xgpuCudaFXengine.
+  int nfft;
+  int ntap;
+  int first_channel;
+  float fscale;
+  FFT_t fft_launcher;
+  int fft_batch;
+  ComplexInput *voltages_d[XGPU_MAX_PIPELINE_DEPTH];
+  float2 *fft_d;
+  float *pfb_window_d;
+  const ComplexInput *voltages_hp;
+
+  // Externally owned device input buffers (xgpuSetDeviceInputBuffers), each
+  // holding the ntime samples of one call, read in place through the input
+  // source of each of its NTIME_PIPE chunks in input_tex (pipe_length per
+  // buffer, unless swizzled).  input_current is the buffer read by the
+  // current call of xgpuCudaXengineDevice, or -1.
+  int ninput_d;
+  ComplexInput **input_d;
+  InputSource *input_tex;
+  int input_current;
+  cudaEvent_t input_ready;
+  cudaEvent_t input_consumed;
+
+  // Pulsar bin of each channel for every PULSAR_SAMPLES time samples of a
+  // call, in time order (only allocated when NPULSAR > 0)
+  unsigned char *bins_d;
+
+  // Tiles of the triangle (numbered as by blockIdx.x of shared2x2) that hold
+  // a product of two active stations (see xgpuSetStationMask), or NULL to
+  // correlate every tile
+  unsigned int *tiles_d;
+  unsigned int ntile;
+
+  // Asynchronous dumps (SYNCOP_DUMP_ASYNC) alternate between two device
+  // staging buffers (allocated on first use), transferred on dump_stream.
+  // Reordered synchronous dumps also pass through a staging buffer.
+  Complex *matrix_dump_d[2];
+  cudaStream_t dump_stream;
+  cudaEvent_t stagingReady[2];
+  cudaEvent_t dumpCompletion[2];
+  XGPUDumpSlot dump_slot[2];
+  int dump_next;
+  XGPUDumpCallback dump_callback;
+  void *dump_user_data;
 
   // texture channel descriptor
   cudaChannelFormatDesc channelDesc;
 
-  // Texture objects for CUDA 12+ compatibility
-  cudaTextureObject_t tex1dObject;
-  cudaTextureObject_t tex2dObject;
+  // Texture objects for CUDA 12+ compatibility (or buffers for ASYNC_COPY),
+  // one per device input buffer (array_d[i] is read through texObject[i])
+  InputSource texObject[XGPU_MAX_PIPELINE_DEPTH];
+
+  // CUDA graph of the input pipeline (XGPU_USE_GRAPH), captured on the first
+  // call to xgpuCudaXengine
+  bool use_graph;
+  cudaGraph_t graph;
+  cudaGraphExec_t graph_exec;
+  // H2D memcpy node of each NTIME_PIPE chunk in graph
+  cudaGraphNode_t *graph_copy_nodes;
+  // Host input address that graph_exec currently copies from
+  ComplexInput *graph_array_hp;
 
   // Host input array that we allocated and should free
   ComplexInput * free_array_h;
@@ -56,6 +280,9 @@ typedef struct XGPUInternalContextStruct {
   // Whether xgpuSetHostInputBuffer has been called
   bool array_h_set;
   bool register_host_array;
+  // Whether the host input array is registered read only (an input file
+  // mapped by xgpuOpenInputFile)
+  bool read_only_array_h;
 
   // Host output array that we allocated and should free
   Complex * free_matrix_h;
@@ -72,21 +299,39 @@ typedef struct XGPUInternalContextStruct {
 #define TILE_WIDTH 8
 #define NPOL 2
 
-#define REG_TILE_NBASELINE ((NSTATION/2+1)*(NSTATION/4))
-
 // Note: Texture references are deprecated in CUDA 12+
 // Now using texture objects created at runtime
 
-// array holding indices for which matrix we are doing the output to at a given iteration
-#if (NPULSAR > 0)
-static __device__ __constant__ unsigned char tIndex[PIPE_LENGTH*NFREQUENCY];
-#endif
+// Destination of the library's messages (see xgpuSetLogCallback)
+static XGPULogCallback log_callback = NULL;
+static void *log_user_data = NULL;
+
+// Pass a printf style message to the log callback.  Without one, errors go to
+// stderr and other messages are dropped.
+static void xgpuLog(int level, const char *format, ...)
+{
+  if(!log_callback && level != XGPU_LOG_ERROR) {
+    return;
+  }
+
+  char message[256];
+  va_list ap;
+  va_start(ap, format);
+  vsnprintf(message, sizeof(message), format, ap);
+  va_end(ap);
+
+  if(log_callback) {
+    log_callback(level, message, log_user_data);
+  } else {
+    fprintf(stderr, "%s\n", message);
+  }
+}
 
 #define checkCudaError() do {                           \
     cudaError_t error = cudaGetLastError();		\
     if (error != cudaSuccess) {				\
-      fprintf(stderr, "(CUDA) %s", cudaGetErrorString(error));	\
-      fprintf(stderr, " (" __FILE__ ":%d)\n", __LINE__);		\
+      xgpuLog(XGPU_LOG_ERROR, "(CUDA) %s (" __FILE__ ":%d)",	\
+	      cudaGetErrorString(error), __LINE__);		\
       return XGPU_CUDA_ERROR;						\
     }							\
   } while (0)
@@ -101,6 +346,65 @@ static __device__ __constant__ unsigned char tIndex[PIPE_LENGTH*NFREQUENCY];
 
 #include "kernel.cuh"
 
+// Element type of unpacked dumps
+#ifdef DP4A
+#define NATIVE_OUTPUT_TYPE XGPU_INT32
+#else
+#define NATIVE_OUTPUT_TYPE XGPU_FLOAT32
+#endif
+
+// Time samples per entry of the pulsar bin table (PULSAR_STEPS kernel steps)
+#ifdef DP4A
+#define PULSAR_SAMPLES (4*PULSAR_STEPS)
+#else
+#define PULSAR_SAMPLES PULSAR_STEPS
+#endif
+
+// A context's streams do not synchronize with the legacy default stream, so
+// contexts on the same device do not serialize each other.  The CUBE
+// instrumentation modes time against the default stream, and are process
+// wide, so they keep blocking streams and run one call at a time.
+#if CUBE_MODE == CUBE_DEFAULT
+#define XGPU_STREAM_FLAGS cudaStreamNonBlocking
+#define CUBE_LOCK()
+#define CUBE_UNLOCK()
+#else
+#define XGPU_STREAM_FLAGS cudaStreamDefault
+static pthread_mutex_t cube_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define CUBE_LOCK() pthread_mutex_lock(&cube_mutex)
+#define CUBE_UNLOCK() pthread_mutex_unlock(&cube_mutex)
+#endif
+
+// The stream that the input pipeline of a call completes on, and which
+// dumps and other integration buffer operations are ordered on
+static inline cudaStream_t workStream(XGPUInternalContext *internal)
+{
+  return internal->use_graph ? internal->copy_streams[0] : internal->compute_stream;
+}
+
+// Open an NVTX range named name around the host side of a stage of the
+// pipeline, with chunk (or -1) as its payload
+static void pushRange(const char *name, int chunk)
+{
+  nvtxEventAttributes_t attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.version = NVTX_VERSION;
+  attr.size = NVTX_EVENT_ATTRIB_STRUCT_SIZE;
+  attr.messageType = NVTX_MESSAGE_TYPE_ASCII;
+  attr.message.ascii = name;
+  attr.payloadType = NVTX_PAYLOAD_TYPE_INT32;
+  attr.payload.iValue = chunk;
+  nvtxRangePushEx(&attr);
+}
+
+// Record timing event event on stream.  While capturing a graph it is
+// recorded as a node of the graph, so that each launch records it.
+static inline void recordTiming(cudaEvent_t event, cudaStream_t stream, bool capture)
+{
+  cudaEventRecordWithFlags(event, stream, capture ? cudaEventRecordExternal : cudaEventRecordDefault);
+}
+
+#ifndef ASYNC_COPY
 // Helper function to create 1D texture object
 static cudaTextureObject_t createTexture1D(ComplexInput* array_data, cudaChannelFormatDesc channelDesc, size_t size_bytes) {
   cudaResourceDesc resDesc;
@@ -156,14 +460,60 @@ static cudaTextureObject_t createTexture2D(ComplexInput* array_data, cudaChannel
   return texObj;
 }
 
-static XGPUInfo compiletime_info = {
+// Create the texture object through which shared2x2 reads device input
+// buffer array_data (one NTIME_PIPE chunk of the context's sizing for each
+// member of the batch, one after the other).
+static cudaTextureObject_t createInputTexture(XGPUInternalContext *internal, ComplexInput* array_data) {
+  XGPUInfo *info = &internal->info;
+  size_t tex_width = (size_t)info->nfrequency * info->nstation * NPOL;
+  size_t nbatch = internal->nbatch;
+
+#if TEXTURE_DIM == 2
+#ifndef DP4A
+  return createTexture2D(array_data, internal->channelDesc, tex_width, nbatch*info->ntimepipe,
+                         tex_width*sizeof(ComplexInput));
+#else
+  return createTexture2D(array_data, internal->channelDesc, tex_width, nbatch*(info->ntimepipe/4),
+                         tex_width*4*sizeof(ComplexInput));
+#endif
+#else
+#ifndef DP4A
+  return createTexture1D(array_data, internal->channelDesc, tex_width*nbatch*info->ntimepipe*sizeof(ComplexInput));
+#else
+  return createTexture1D(array_data, internal->channelDesc, tex_width*nbatch*(info->ntimepipe/4)*4*sizeof(ComplexInput));
+#endif
+#endif
+}
+#endif // ASYNC_COPY
+
+// The input source through which shared2x2 reads device input buffer
+// array_data
+static InputSource createInputSource(XGPUInternalContext *internal, ComplexInput* array_data) {
+#ifdef ASYNC_COPY
+  return (InputSource)array_data;
+#else
+  return createInputTexture(internal, array_data);
+#endif
+}
+
+static void destroyInputSource(InputSource source) {
+#ifndef ASYNC_COPY
+  if(source) {
+    cudaDestroyTextureObject(source);
+  }
+#endif
+}
+
+static const XGPUInfo compiletime_info = {
   .npol =        NPOL,
   .nstation =    NSTATION,
   .nbaseline =   NBASELINE,
   .nfrequency =  NFREQUENCY,
   .ntime =       NTIME,
   .ntimepipe =   NTIME_PIPE,
-#ifdef FIXED_POINT
+#if defined(INT4)
+  .input_type =  XGPU_INT4,
+#elif defined(FIXED_POINT)
   .input_type =  XGPU_INT8,
 #else
   .input_type =  XGPU_FLOAT32,
@@ -217,15 +567,321 @@ void xgpuInfo(XGPUInfo *pcxs)
   pcxs->complex_block_size = compiletime_info.complex_block_size;
 }
 
+// Populate XGPUInfo structure with runtime sizing parameters.
+int xgpuSizedInfo(XGPUInfo *pcxs, unsigned int nstation, unsigned int nfrequency,
+                  unsigned int ntime, unsigned int ntimepipe)
+{
+  // Each thread block correlates a tile of 2*TILE_WIDTH stations
+  if(nstation == 0 || nstation % (2*TILE_WIDTH) != 0) {
+    return XGPU_INVALID_SIZING;
+  }
+  if(nfrequency == 0) {
+    return XGPU_INVALID_SIZING;
+  }
+#ifndef DP4A
+  if(ntimepipe == 0 || ntimepipe % 4 != 0) {
+#else
+  if(ntimepipe == 0 || ntimepipe % 16 != 0) {
+#endif
+    return XGPU_INVALID_SIZING;
+  }
+  if(ntime == 0 || ntime % ntimepipe != 0) {
+    return XGPU_INVALID_SIZING;
+  }
+
+  // Start with the compile-time parameters that are not part of the sizing
+  xgpuInfo(pcxs);
+
+  pcxs->nstation       = nstation;
+  pcxs->nbaseline      = (nstation+1)*(nstation/2);
+  pcxs->nfrequency     = nfrequency;
+  pcxs->ntime          = ntime;
+  pcxs->ntimepipe      = ntimepipe;
+  pcxs->vecLength      = (long long unsigned int)nfrequency * ntime * nstation * NPOL;
+  pcxs->vecLengthPipe  = (long long unsigned int)nfrequency * ntimepipe * nstation * NPOL;
+#if (MATRIX_ORDER == REGISTER_TILE_TRIANGULAR_ORDER)
+  pcxs->matLength      = (long long unsigned int)nfrequency * ((nstation/2+1)*(nstation/4)*NPOL*NPOL*4) * (NPULSAR + 1);
+#else
+  pcxs->matLength      = (long long unsigned int)nfrequency * ((nstation+1)*(nstation/2)*NPOL*NPOL) * (NPULSAR + 1);
+#endif
+  pcxs->triLength      = (long long unsigned int)nfrequency * ((nstation+1)*(nstation/2)*NPOL*NPOL) * (NPULSAR + 1);
+
+  return XGPU_OK;
+}
+
+void xgpuSetLogCallback(XGPULogCallback callback, void *user_data)
+{
+  log_callback = callback;
+  log_user_data = user_data;
+}
+
+// Attributes of a device needed by xgpuInitBatched
+typedef struct XGPUDeviceAttrStruct {
+  bool valid;
+  // major*10 + minor
+  int compute_capability;
+  int maxTexture1DLinear;
+  int maxTexture2DLinear[2];
+  char name[256];
+} XGPUDeviceAttr;
+
+// Register cap of the build (see the Makefile), part of its tuning cache key
+#ifndef MAXRREGCOUNT
+#define MAXRREGCOUNT 0
+#endif
+
+// Path of the tuning cache (see xgpuSetTuningCache), or NULL, and the lock
+// serializing accesses to it within this process
+static char *tuning_cache = NULL;
+static pthread_mutex_t tuning_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Devices whose attributes are cached by getDeviceAttr
+#define MAX_CACHED_DEVICES 64
+static XGPUDeviceAttr device_attr_cache[MAX_CACHED_DEVICES];
+static pthread_mutex_t device_attr_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Get the attributes of device, querying only that device and only the first
+// time it is asked for (the name only when there is a log callback to report
+// it to or a tuning cache to look it up in, as it needs the much slower
+// cudaGetDeviceProperties)
+static int getDeviceAttr(int device, XGPUDeviceAttr *attr)
+{
+  XGPUDeviceAttr *cached = device < MAX_CACHED_DEVICES ? &device_attr_cache[device] : NULL;
+  if(cached) {
+    pthread_mutex_lock(&device_attr_mutex);
+    bool hit = cached->valid && (cached->name[0] || !(log_callback || tuning_cache));
+    if(hit) {
+      *attr = *cached;
+    }
+    pthread_mutex_unlock(&device_attr_mutex);
+    if(hit) {
+      return XGPU_OK;
+    }
+  }
+
+  int major, minor;
+  memset(attr, 0, sizeof(*attr));
+  cudaDeviceGetAttribute(&major, cudaDevAttrComputeCapabilityMajor, device);
+  cudaDeviceGetAttribute(&minor, cudaDevAttrComputeCapabilityMinor, device);
+  cudaDeviceGetAttribute(&attr->maxTexture1DLinear, cudaDevAttrMaxTexture1DLinearWidth, device);
+  cudaDeviceGetAttribute(&attr->maxTexture2DLinear[0], cudaDevAttrMaxTexture2DLinearWidth, device);
+  cudaDeviceGetAttribute(&attr->maxTexture2DLinear[1], cudaDevAttrMaxTexture2DLinearHeight, device);
+  attr->compute_capability = major*10 + minor;
+  if(log_callback || tuning_cache) {
+    cudaDeviceProp deviceProp;
+    cudaGetDeviceProperties(&deviceProp, device);
+    strncpy(attr->name, deviceProp.name, sizeof(attr->name)-1);
+  }
+  checkCudaError();
+
+  attr->valid = true;
+  if(cached) {
+    pthread_mutex_lock(&device_attr_mutex);
+    *cached = *attr;
+    pthread_mutex_unlock(&device_attr_mutex);
+  }
+  return XGPU_OK;
+}
+
+// Correlator variants among which xgpuAutotune chooses, by name in the tuning
+// cache
+typedef struct XGPUVariantStruct {
+  const char *name;
+  bool tensor;
+  int buffer_depth;
+} XGPUVariant;
+
+static const XGPUVariant tuning_variants[] = {
+  {"shared2x2/4", false, 4},
+  {"shared2x2/2", false, 2},
+#if defined(DP4A) && COMPLEX_BLOCK_SIZE == 1
+  {"wmma2x2", true, 4},
+#endif
+};
+#define NVARIANT ((int)(sizeof(tuning_variants)/sizeof(tuning_variants[0])))
+
+void xgpuSetTuningCache(const char *path)
+{
+  pthread_mutex_lock(&tuning_mutex);
+  free(tuning_cache);
+  tuning_cache = path ? strdup(path) : NULL;
+  pthread_mutex_unlock(&tuning_mutex);
+}
+
+// Write the prefix of the tuning cache line of the sizing and build of
+// internal on the device called name (tab separated device name, build,
+// sizing and variant with its time per integration) into key
+static void tuningKey(const XGPUInternalContext *internal, const char *name, char *key, size_t size)
+{
+  const XGPUInfo *info = &internal->info;
+#ifdef ASYNC_COPY
+  const int texture_dim = 0; // input read with cp.async
+#else
+  const int texture_dim = TEXTURE_DIM;
+#endif
+  snprintf(key, size, "%s\t%s %u %u %zu %zu %u %d %d %d\t%u %u %u %d\t", name, xgpu_version,
+           info->input_type, info->compute_type, info->shared_atomic_size, info->complex_block_size,
+           info->matrix_order, texture_dim, NPULSAR, MAXRREGCOUNT,
+           info->nstation, info->nfrequency, info->ntimepipe, internal->nbatch);
+}
+
+// Select the variant recorded in the tuning cache (if any) for internal on
+// the device called name
+static void loadTuning(XGPUInternalContext *internal, const char *name)
+{
+  char key[512], line[1024], variant[64];
+
+  pthread_mutex_lock(&tuning_mutex);
+  FILE *file = tuning_cache ? fopen(tuning_cache, "r") : NULL;
+  if(file) {
+    tuningKey(internal, name, key, sizeof(key));
+    size_t key_len = strlen(key);
+    while(fgets(line, sizeof(line), file)) {
+      if(strncmp(line, key, key_len) || sscanf(line + key_len, "%63s", variant) != 1) {
+        continue;
+      }
+      for(int v=0; v<NVARIANT; v++) {
+        const XGPUVariant *tuned = &tuning_variants[v];
+        if(!strcmp(tuned->name, variant) && (!tuned->tensor || internal->tensor_capable)) {
+          internal->use_tensor = tuned->tensor;
+          internal->buffer_depth = tuned->buffer_depth;
+          xgpuLog(XGPU_LOG_INFO, "Using tuned variant %s", variant);
+        }
+      }
+    }
+    fclose(file);
+  }
+  pthread_mutex_unlock(&tuning_mutex);
+}
+
+// Record variant (taking ms per integration) as the tuning of internal on the
+// device called name, replacing any previous entry.  The cache is rewritten
+// into a temporary file renamed over it, so readers never see a partial file.
+static int saveTuning(const XGPUInternalContext *internal, const char *name, const char *variant, float ms)
+{
+  char key[512], line[1024];
+  int error = XGPU_OK;
+
+  pthread_mutex_lock(&tuning_mutex);
+  if(tuning_cache) {
+    tuningKey(internal, name, key, sizeof(key));
+    size_t key_len = strlen(key);
+    size_t path_len = strlen(tuning_cache) + 5;
+    char *tmp_path = (char *)malloc(path_len);
+    snprintf(tmp_path, path_len, "%s.tmp", tuning_cache);
+
+    FILE *tmp = fopen(tmp_path, "w");
+    if(tmp) {
+      FILE *file = fopen(tuning_cache, "r");
+      if(file) {
+        while(fgets(line, sizeof(line), file)) {
+          if(strncmp(line, key, key_len)) {
+            fputs(line, tmp);
+          }
+        }
+        fclose(file);
+      }
+      fprintf(tmp, "%s%s\t%.6f\n", key, variant, ms);
+    }
+    if(!tmp || fclose(tmp) || rename(tmp_path, tuning_cache)) {
+      xgpuLog(XGPU_LOG_ERROR, "Cannot write tuning cache %s", tuning_cache);
+      remove(tmp_path);
+      error = XGPU_INVALID_ARGUMENT;
+    }
+    free(tmp_path);
+  }
+  pthread_mutex_unlock(&tuning_mutex);
+
+  return error;
+}
+
+static int prewarmKernels(XGPUInternalContext *internal);
+
+// Finish initializing a context on XGPU_CPU_DEVICE, which needs nothing but
+// its integration and host buffers
+static int initCpu(XGPUContext *context)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  int error;
+
+#ifdef DP4A
+  // xgpuCpuXengineSized does not read the DP4A swizzled input
+  if(!internal->swizzle) {
+    free(internal);
+    context->internal = NULL;
+    return XGPU_INVALID_FLAGS;
+  }
+#endif
+
+  internal->use_graph = false;
+  internal->use_tensor = false;
+  internal->cpu_matrix = (Complex *)calloc(internal->nbatch*internal->info.matLength, sizeof(Complex));
+  if(!internal->cpu_matrix) {
+    free(internal);
+    context->internal = NULL;
+    return XGPU_OUT_OF_MEMORY;
+  }
+  xgpuLog(XGPU_LOG_INFO, "Using the CPU X-engine");
+
+  internal->unregister_array_h = NULL;
+  internal->free_array_h = NULL;
+  if( internal->register_host_array ) {
+    error = xgpuSetHostInputBuffer(context);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+
+  internal->unregister_matrix_h = NULL;
+  internal->free_matrix_h = NULL;
+  if( internal->register_host_matrix ) {
+    error = xgpuSetHostOutputBuffer(context);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+
+  return XGPU_OK;
+}
+
 // Initialize the XGPU.  The device number is intentionally not part of the
 // context because the device number needs to be maintained as part of the
 // internal context (.e.g to ensure consistency with the device on which memory
 // was allocated).
-//
-// TODO Cleanup as needed if returning due to error
 int xgpuInit(XGPUContext *context, int device_flags)
+{
+  return xgpuInitSized(context, &compiletime_info, device_flags);
+}
+
+int xgpuInitSized(XGPUContext *context, const XGPUInfo *sizing, int device_flags)
+{
+  return xgpuInitBatched(context, sizing, 1, device_flags);
+}
+
+// The body of xgpuInitBatched, which releases whatever this has set up if it
+// returns an error
+static int initBatched(XGPUContext *context, const XGPUInfo *sizing, int nbatch, int device_flags)
 {
   int error = XGPU_OK;
+  XGPUInfo info;
+
+  // Validate requested sizing and derive the remaining parameters from it
+  error = xgpuSizedInfo(&info, sizing->nstation, sizing->nfrequency,
+                        sizing->ntime, sizing->ntimepipe);
+  if(error != XGPU_OK) {
+    return error;
+  }
+  if(nbatch < 1) {
+    return XGPU_INVALID_SIZING;
+  }
+
+  int depth = (device_flags >> 20) & 0xf;
+  int ncopy = (device_flags >> 24) & 0xf;
+  if(depth == 0) depth = 2;
+  if(ncopy == 0) ncopy = 1;
+  if(depth > XGPU_MAX_PIPELINE_DEPTH || ncopy > depth) {
+    return XGPU_INVALID_FLAGS;
+  }
 
   CUBE_INIT();
 
@@ -237,12 +893,119 @@ int xgpuInit(XGPUContext *context, int device_flags)
   }
   context->internal = internal;
   internal->device = device_flags & XGPU_DEVICE_MASK;
+  internal->busy = 0;
+  internal->nshard = 0;
+  internal->shard = NULL;
+  internal->freq_offset = 0;
+  internal->full_nfrequency = info.nfrequency;
+  internal->nbatch = nbatch;
+  internal->info = info;
+  internal->depth = depth;
+  internal->ncopy = ncopy;
   internal->array_h_set  = false;
   internal->matrix_h_set = false;
   internal->register_host_array  = true;
   internal->register_host_matrix = true;
-  internal->tex1dObject = 0;
-  internal->tex2dObject = 0;
+  internal->read_only_array_h = false;
+  // Everything xgpuFree releases starts out unset, so that it can clean up
+  // after an error part way through
+  for(int i=0; i<depth; i++) {
+    internal->texObject[i] = 0;
+    internal->array_d[i] = NULL;
+    internal->copyCompletion[i] = NULL;
+    internal->kernelCompletion[i] = NULL;
+    internal->copy_streams[i] = NULL;
+  }
+  internal->matrix_d = NULL;
+  internal->compute_stream = NULL;
+  internal->dump_stream = NULL;
+  internal->captureEvent = NULL;
+  for(int i=0; i<2; i++) {
+    internal->stagingReady[i] = NULL;
+    internal->dumpCompletion[i] = NULL;
+  }
+  internal->unregister_array_h = NULL;
+  internal->free_array_h = NULL;
+  internal->unregister_matrix_h = NULL;
+  internal->free_matrix_h = NULL;
+  internal->graph = NULL;
+  internal->graph_exec = NULL;
+  internal->graph_copy_nodes = NULL;
+  internal->graph_array_hp = NULL;
+  internal->matrix_dump_d[0] = NULL;
+  internal->matrix_dump_d[1] = NULL;
+  internal->dump_next = 0;
+  internal->dump_callback = NULL;
+  internal->dump_user_data = NULL;
+  // Stream capture is incompatible with the synchronizing CUBE modes and
+  // cannot represent the unbounded POWER_LOOP.  Graph replay only repoints
+  // the 1D transfers of unbatched contexts.
+#if CUBE_MODE == CUBE_DEFAULT && !defined(POWER_LOOP)
+  internal->use_graph = (device_flags & XGPU_USE_GRAPH) != 0 && nbatch == 1;
+#else
+  internal->use_graph = false;
+#endif
+#if MATRIX_ORDER == TRIANGULAR_ORDER
+  // Already in the requested order
+  internal->reorder = false;
+#else
+  internal->reorder = (device_flags & XGPU_REORDER_ON_DEVICE) != 0;
+#endif
+#if defined(DP4A) || COMPLEX_BLOCK_SIZE == 32
+  internal->swizzle = (device_flags & XGPU_SWIZZLE_ON_DEVICE) != 0;
+#else
+  // shared2x2 reads natural order input directly
+  internal->swizzle = false;
+#endif
+  internal->array_swizzled_d = NULL;
+  internal->texSwizzled = 0;
+  internal->bins_d = NULL;
+  internal->tiles_d = NULL;
+  internal->ntile = 0;
+  internal->long_d = NULL;
+  internal->long_dump_d = NULL;
+  internal->long_scale = 1.0;
+  internal->fold_interval = 0;
+  internal->fold_count = 0;
+  internal->flag = false;
+  internal->flags_d = NULL;
+  internal->weights_d = NULL;
+  internal->weights_dump_d[0] = NULL;
+  internal->weights_dump_d[1] = NULL;
+  internal->weights_h = NULL;
+  internal->pack = false;
+  internal->output_type = NATIVE_OUTPUT_TYPE;
+  internal->output_scale = 1.0f;
+  internal->products_d = NULL;
+  internal->nproduct = 0;
+  internal->nfft = 0;
+  internal->ntap = 0;
+  internal->first_channel = 0;
+  internal->fscale = 1.0f;
+  internal->fft_launcher = NULL;
+  internal->fft_batch = 0;
+  for(int i=0; i<XGPU_MAX_PIPELINE_DEPTH; i++) {
+    internal->voltages_d[i] = NULL;
+  }
+  internal->fft_d = NULL;
+  internal->pfb_window_d = NULL;
+  internal->voltages_hp = NULL;
+  internal->ninput_d = 0;
+  internal->input_d = NULL;
+  internal->input_tex = NULL;
+  internal->input_current = -1;
+  internal->input_ready = NULL;
+  internal->input_consumed = NULL;
+  internal->chunk_events = NULL;
+  internal->chunk_pending = NULL;
+  for(int i=0; i<6; i++) {
+    internal->dump_events[i] = NULL;
+  }
+  for(int i=0; i<3; i++) {
+    internal->dump_pending[i] = false;
+  }
+  memset(internal->timing, 0, sizeof(internal->timing));
+  internal->dropped = 0;
   if( device_flags & XGPU_DONT_REGISTER_ARRAY ) {
 	  internal->register_host_array = false;
   }
@@ -250,54 +1013,105 @@ int xgpuInit(XGPUContext *context, int device_flags)
 	  internal->register_host_matrix = false;
   }
 
-  long long unsigned int vecLengthPipe = compiletime_info.vecLengthPipe;
-  long long unsigned int matLength = compiletime_info.matLength;
-
-  int deviceCount;
-  cudaGetDeviceCount(&deviceCount);
-  if (deviceCount == 0) {
-    printf("No CUDA devices found");
-    exit(-1);
+  internal->tensor_capable = false;
+  internal->buffer_depth = 4;
+  internal->cpu = internal->device == XGPU_CPU_DEVICE;
+  internal->cpu_matrix = NULL;
+  if(internal->cpu) {
+    return initCpu(context);
   }
+  pthread_mutex_init(&internal->stats_mutex, NULL);
 
-  cudaDeviceProp deviceProp;
-  for(int i=0; i<deviceCount; i++) {
-    cudaGetDeviceProperties(&deviceProp, i);
-    printf("Found device %d: %s\n", i, deviceProp.name);
+  // Device buffers hold every member of a batch
+  long long unsigned int vecLengthPipe = nbatch*info.vecLengthPipe;
+  long long unsigned int matLength = nbatch*info.matLength;
+
+  // Nothing has been allocated on the device yet, so a missing device only
+  // needs the internal context freed
+  int deviceCount = 0;
+  if(cudaGetDeviceCount(&deviceCount) != cudaSuccess || internal->device >= deviceCount) {
+    cudaGetLastError();
+    xgpuLog(XGPU_LOG_ERROR, "CUDA device %d not found (%d devices)", internal->device, deviceCount);
+    free(internal);
+    context->internal = NULL;
+    return XGPU_NO_DEVICE;
   }
 
-  cudaGetDeviceProperties(&deviceProp, internal->device);
-  printf("Using device %d: %s\n", internal->device, deviceProp.name);
+  XGPUDeviceAttr attr;
+  error = getDeviceAttr(internal->device, &attr);
+  if(error != XGPU_OK) {
+    free(internal);
+    context->internal = NULL;
+    return error;
+  }
+  xgpuLog(XGPU_LOG_INFO, "Using device %d: %s", internal->device, attr.name);
 
   //assign the device
   cudaSetDevice(internal->device);
   checkCudaError();
 
+  // Select the tensor core kernel if the device supports 8-bit integer matrix
+  // products and wmma2x2 was compiled for such a device
+#if defined(DP4A) && COMPLEX_BLOCK_SIZE == 1
+  if(!(device_flags & XGPU_NO_TENSOR_CORES) && attr.compute_capability >= 72) {
+    cudaFuncAttributes funcAttr;
+    if(cudaFuncGetAttributes(&funcAttr, wmma2x2) == cudaSuccess && funcAttr.ptxVersion >= 72) {
+      internal->tensor_capable = true;
+    }
+    cudaGetLastError();
+  }
+#endif
+  internal->use_tensor = internal->tensor_capable;
+
+  // Use the variant tuned for this device and sizing, if any
+  loadTuning(internal, attr.name);
+
   // Setup input buffer
   internal->unregister_array_h = NULL;
   internal->free_array_h = NULL;
   if( internal->register_host_array ) {
-	  // TODO error check
-	  xgpuSetHostInputBuffer(context);
+    error = xgpuSetHostInputBuffer(context);
+    if(error != XGPU_OK) {
+      return error;
+    }
   }
 
   // Setup output buffer
   internal->unregister_matrix_h = NULL;
   internal->free_matrix_h = NULL;
   if( internal->register_host_matrix ) {
-	  // TODO error check
-	  xgpuSetHostOutputBuffer(context);
+    error = xgpuSetHostOutputBuffer(context);
+    if(error != XGPU_OK) {
+      return error;
+    }
   }
 
+  // create the streams
+  cudaStreamCreateWithFlags(&(internal->compute_stream), XGPU_STREAM_FLAGS);
+  for(int i=0; i<ncopy; i++) cudaStreamCreateWithFlags(&(internal->copy_streams[i]), XGPU_STREAM_FLAGS);
+  cudaStreamCreateWithFlags(&(internal->dump_stream), XGPU_STREAM_FLAGS);
+  checkCudaError();
+
   //allocate memory on device
-  cudaMalloc((void **) &(internal->array_d[0]), vecLengthPipe*sizeof(ComplexInput));
-  cudaMalloc((void **) &(internal->array_d[1]), vecLengthPipe*sizeof(ComplexInput));
+  for(int i=0; i<depth; i++) {
+    cudaMalloc((void **) &(internal->array_d[i]), vecLengthPipe*sizeof(ComplexInput));
+  }
+  if(internal->swizzle) {
+    cudaMalloc((void **) &(internal->array_swizzled_d), vecLengthPipe*sizeof(ComplexInput));
+  }
   cudaMalloc((void **) &(internal->matrix_d), matLength*sizeof(Complex));
+#if NPULSAR > 0
+  // Every sample is in bin 0 until xgpuSetPulsarBins says otherwise
+  size_t bins_size = (size_t)info.ntime/PULSAR_SAMPLES*info.nfrequency;
+  cudaMalloc((void **) &(internal->bins_d), bins_size);
+  cudaMemsetAsync(internal->bins_d, 0, bins_size, internal->compute_stream);
+#endif
   checkCudaError();
   
   //clear out any previous values
-  cudaMemset(internal->array_d[0], '\0', vecLengthPipe*sizeof(ComplexInput));
-  cudaMemset(internal->array_d[1], '\0', vecLengthPipe*sizeof(ComplexInput));
+  for(int i=0; i<depth; i++) {
+    cudaMemsetAsync(internal->array_d[i], '\0', vecLengthPipe*sizeof(ComplexInput), internal->compute_stream);
+  }
   checkCudaError();
 
   // Clear device integration bufer
@@ -305,56 +1119,64 @@ int xgpuInit(XGPUContext *context, int device_flags)
   if(error != XGPU_OK) {
     return error;
   }
-
-  // create the streams
-  for(int i=0; i<2; i++) cudaStreamCreate(&(internal->streams[i]));
+  // The first transfers into the input buffers are not ordered after the
+  // clearing by any event
+  cudaStreamSynchronize(internal->compute_stream);
   checkCudaError();
 
   // create the events
-  for (int i=0; i<2; i++) {
+  for (int i=0; i<depth; i++) {
     cudaEventCreateWithFlags(&(internal->kernelCompletion[i]), cudaEventDisableTiming);
     cudaEventCreateWithFlags(&(internal->copyCompletion[i]), cudaEventDisableTiming);
   }
+  cudaEventCreateWithFlags(&(internal->captureEvent), cudaEventDisableTiming);
+  for (int i=0; i<2; i++) {
+    cudaEventCreateWithFlags(&(internal->stagingReady[i]), cudaEventDisableTiming);
+    cudaEventCreateWithFlags(&(internal->dumpCompletion[i]), cudaEventDisableTiming);
+  }
+  checkCudaError();
+
+  // create the timing events of xgpuGetStats
+  int pipe_length = info.ntime / info.ntimepipe;
+  internal->chunk_events = (cudaEvent_t *)calloc(4*pipe_length, sizeof(cudaEvent_t));
+  internal->chunk_pending = (unsigned char *)calloc(pipe_length, 1);
+  if(!internal->chunk_events || !internal->chunk_pending) {
+    return XGPU_OUT_OF_MEMORY;
+  }
+  for (int i=0; i<4*pipe_length; i++) {
+    cudaEventCreate(&(internal->chunk_events[i]));
+  }
+  for (int i=0; i<6; i++) {
+    cudaEventCreate(&(internal->dump_events[i]));
+  }
   checkCudaError();
 
 #ifndef FIXED_POINT
   internal->channelDesc = cudaCreateChannelDesc<float2>();
 #else
-#ifdef DP4A
+#if defined(INT4)
+  internal->channelDesc = cudaCreateChannelDesc<int>();
+#elif defined(DP4A)
   internal->channelDesc = cudaCreateChannelDesc<int2>();
 #else
   internal->channelDesc = cudaCreateChannelDesc<char2>();
 #endif // DP4A
 #endif // FIXED_POINT
 
-#if NPULSAR > 0
-  unsigned char timeIndex[PIPE_LENGTH*NFREQUENCY];
-  for (int tf=0; tf<PIPE_LENGTH*NFREQUENCY; tf++) timeIndex[tf] = 0;
-  cudaMemcpyToSymbol(tIndex, timeIndex, PIPE_LENGTH*NFREQUENCY*sizeof(unsigned char), cudaMemcpyHostToDevice);
-
-  checkCudaError();
-
-  // check symbols are copied over
-  unsigned char timeIndex2[PIPE_LENGTH*NFREQUENCY];
-  cudaMemcpyFromSymbol(timeIndex2[t], tIndex[t], PIPE_LENGTH*NFREQUENCY*sizeof(unsigned char), cudaMemcpyDeviceToHost);  
-  for (int tf=0; tf<PIPE_LENGTH*NFREQUENCY; tf++) {
-    for (int f=0; f<NFREQUENCY; f++) 
-      if (timeIndex[t][f] != timeIndex2[t][f]) 
-	fprintf(stderr, "Index copy failed: t = %d, f = %d, original = %d, copy = %d\n", 
-	       t, f, timeIndex[t][f], timeIndex2[t][f]);
-  }
-#endif
-
-  // check whether texture dimensions are ok
-#if TEXTURE_DIM == 2
+  // check whether texture dimensions are ok (the members of a batch follow
+  // one another in time).  cp.async has no such limit.
+  size_t tex_width = (size_t)info.nfrequency * info.nstation * NPOL;
+#if defined(ASYNC_COPY)
+  (void)tex_width;
+#elif TEXTURE_DIM == 2
 #ifdef DP4A
-  if((NFREQUENCY * NSTATION * NPOL > deviceProp.maxTexture2DLinear[0]) ||
-     (NTIME_PIPE/4 > deviceProp.maxTexture2DLinear[1])) {
+  if((tex_width > (size_t)attr.maxTexture2DLinear[0]) ||
+     (nbatch*(info.ntimepipe/4) > (size_t)attr.maxTexture2DLinear[1])) {
     return XGPU_INSUFFICIENT_TEXTURE_MEMORY;
   }
 #else
-  if((NFREQUENCY * NSTATION * NPOL > deviceProp.maxTexture2DLinear[0]) ||
-     (NTIME_PIPE > deviceProp.maxTexture2DLinear[1])) {
+  if((tex_width > (size_t)attr.maxTexture2DLinear[0]) ||
+     (nbatch*info.ntimepipe > (size_t)attr.maxTexture2DLinear[1])) {
     return XGPU_INSUFFICIENT_TEXTURE_MEMORY;
   }
 #endif
@@ -365,32 +1187,168 @@ int xgpuInit(XGPUContext *context, int device_flags)
   // bytes of 1D texture without any problems.  Perhaps the value of
   // maxTexture1D returned by cudaGetDeviceProperties is wrong?
 #ifdef DP4A
-  if (NFREQUENCY * NSTATION * NPOL * (NTIME_PIPE/4) > deviceProp.maxTexture1DLinear) {
+  if (tex_width * nbatch*(info.ntimepipe/4) > (size_t)attr.maxTexture1DLinear) {
     return XGPU_INSUFFICIENT_TEXTURE_MEMORY;
   }
 #else
-  if (NFREQUENCY * NSTATION * NPOL * NTIME_PIPE > deviceProp.maxTexture1DLinear) {
+  if (tex_width * nbatch*info.ntimepipe > (size_t)attr.maxTexture1DLinear) {
     return XGPU_INSUFFICIENT_TEXTURE_MEMORY;
   }
 #endif
 #endif 
 
-  return XGPU_OK;
+  // Create the texture objects once since the device input buffers never move
+  for(int i=0; i<depth; i++) {
+    internal->texObject[i] = createInputSource(internal, internal->array_d[i]);
+  }
+  if(internal->swizzle) {
+    internal->texSwizzled = createInputSource(internal, internal->array_swizzled_d);
+  }
+  checkCudaError();
+
+  if(device_flags & XGPU_PREWARM) {
+    return prewarmKernels(internal);
+  }
+
+  return XGPU_OK;
+}
+
+int xgpuInitBatched(XGPUContext *context, const XGPUInfo *sizing, int nbatch, int device_flags)
+{
+  void *previous = context->internal;
+  int error = initBatched(context, sizing, nbatch, device_flags);
+
+  // Release the internal context allocated by this call, if it is still there
+  if(error != XGPU_OK && context->internal && context->internal != previous) {
+    xgpuFree(context);
+    cudaGetLastError();
+  }
+
+  return error;
+}
+
+int xgpuInitMultiDevice(XGPUContext *context, const XGPUInfo *sizing,
+                        const int *devices, int ndevice, int device_flags)
+{
+  int error = XGPU_OK;
+  XGPUInfo info;
+
+  error = xgpuSizedInfo(&info, sizing->nstation, sizing->nfrequency,
+                        sizing->ntime, sizing->ntimepipe);
+  if(error != XGPU_OK) {
+    return error;
+  }
+  if(ndevice < 1) {
+    return XGPU_INVALID_FLAGS;
+  }
+  if((unsigned int)ndevice > info.nfrequency) {
+    return XGPU_INVALID_SIZING;
+  }
+  // The shards must all be GPUs
+  for(int i=0; i<ndevice; i++) {
+    if((devices[i] & XGPU_DEVICE_MASK) == XGPU_CPU_DEVICE) {
+      return XGPU_INVALID_FLAGS;
+    }
+  }
+
+  // Allocate internal context
+  XGPUInternalContext *internal = (XGPUInternalContext *)calloc(1, sizeof(XGPUInternalContext));
+  if(!internal) {
+    return XGPU_OUT_OF_MEMORY;
+  }
+  context->internal = internal;
+  internal->device = devices[0] & XGPU_DEVICE_MASK;
+  internal->info = info;
+  internal->full_nfrequency = info.nfrequency;
+  internal->nbatch = 1;
+  internal->output_type = NATIVE_OUTPUT_TYPE;
+  internal->output_scale = 1.0f;
+  internal->register_host_array = !(device_flags & XGPU_DONT_REGISTER_ARRAY);
+  internal->register_host_matrix = !(device_flags & XGPU_DONT_REGISTER_MATRIX);
+
+  internal->shard = (XGPUContext *)calloc(ndevice, sizeof(XGPUContext));
+  if(!internal->shard) {
+    free(internal);
+    context->internal = NULL;
+    return XGPU_OUT_OF_MEMORY;
+  }
+  internal->nshard = ndevice;
+
+  // The shards read and write the host buffers of this context, with 2D
+  // transfers that graph replay does not support
+  int shard_flags = (device_flags & ~XGPU_DEVICE_MASK & ~XGPU_USE_GRAPH) | XGPU_DONT_REGISTER;
+
+  // Split the channels as evenly as possible, in order of devices
+  unsigned int freq_offset = 0;
+  for(int i=0; i<ndevice; i++) {
+    XGPUInfo shard_sizing;
+    unsigned int nfrequency = info.nfrequency / ndevice + ((unsigned int)i < info.nfrequency % ndevice);
+    error = xgpuSizedInfo(&shard_sizing, info.nstation, nfrequency, info.ntime, info.ntimepipe);
+    if(error == XGPU_OK) {
+      error = xgpuInitSized(&internal->shard[i], &shard_sizing, shard_flags | (devices[i] & XGPU_DEVICE_MASK));
+    }
+    if(error != XGPU_OK) {
+      xgpuFree(context);
+      return error;
+    }
+    XGPUInternalContext *shard = (XGPUInternalContext *)internal->shard[i].internal;
+    shard->freq_offset = freq_offset;
+    shard->full_nfrequency = info.nfrequency;
+    freq_offset += nfrequency;
+  }
+
+  // Setup host buffers
+  if( internal->register_host_array ) {
+    error = xgpuSetHostInputBuffer(context);
+  }
+  if( error == XGPU_OK && internal->register_host_matrix ) {
+    error = xgpuSetHostOutputBuffer(context);
+  }
+  if(error != XGPU_OK) {
+    xgpuFree(context);
+    cudaGetLastError();
+    return error;
+  }
+
+  return XGPU_OK;
+}
+
+// Bytes of the weights of the integration
+static size_t weightsSize(XGPUInternalContext *internal)
+{
+  return (size_t)internal->nbatch*internal->info.nfrequency*internal->info.nbaseline*sizeof(unsigned int);
 }
 
 // Clear the device integration buffer
 int xgpuClearDeviceIntegrationBuffer(XGPUContext *context)
 {
-  long long unsigned int matLength = compiletime_info.matLength;
-
   XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
   if(!internal) {
     return XGPU_NOT_INITIALIZED;
   }
+  for(int i=0; i<internal->nshard; i++) {
+    int error = xgpuClearDeviceIntegrationBuffer(&internal->shard[i]);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+  if(internal->nshard) {
+    return XGPU_OK;
+  }
+  long long unsigned int matLength = internal->nbatch*internal->info.matLength;
+  if(internal->cpu) {
+    memset(internal->cpu_matrix, '\0', matLength*sizeof(Complex));
+    return XGPU_OK;
+  }
   //assign the device
   cudaSetDevice(internal->device);
 
-  cudaMemset(internal->matrix_d, '\0', matLength*sizeof(Complex));
+  // Ordered after the kernels adding to the integration
+  cudaStream_t stream = workStream(internal);
+  cudaMemsetAsync(internal->matrix_d, '\0', matLength*sizeof(Complex), stream);
+  if(internal->weights_d) {
+    cudaMemsetAsync(internal->weights_d, '\0', weightsSize(internal), stream);
+  }
   checkCudaError();
   return XGPU_OK;
 }
@@ -411,6 +1369,27 @@ int xgpuSetHostInputBuffer(XGPUContext *context)
   }
 
   internal->array_h_set = true;
+  // The buffer of a multi-device context is pinned for all of its devices
+  bool portable = internal->nshard > 0;
+
+  if(internal->cpu) {
+    // Nothing is pinned for the CPU X-engine, which keeps the buffer it
+    // allocated unless given another
+    if(context->array_h != internal->free_array_h) {
+      free(internal->free_array_h);
+      internal->free_array_h = NULL;
+    }
+    if(!context->array_h) {
+      context->array_len = internal->nbatch*internal->info.vecLength;
+      context->array_h = (ComplexInput *)malloc(context->array_len*sizeof(ComplexInput));
+      if(!context->array_h) {
+        return XGPU_OUT_OF_MEMORY;
+      }
+      internal->free_array_h = context->array_h;
+    }
+    context->input_offset = 0;
+    return XGPU_OK;
+  }
 
   //assign the device
   CLOCK_GETTIME(CLOCK_MONOTONIC, &a);
@@ -437,10 +1416,10 @@ int xgpuSetHostInputBuffer(XGPUContext *context)
       // Round address down to nearest page_size boundary
       uintptr_t ptr_in = (uintptr_t)context->array_h;
       uintptr_t ptr_aligned = ptr_in - (ptr_in % page_size);
-      // Compute length starting with compile time requirement
+      // Compute length starting with sizing requirement
       size_t length = context->array_len * sizeof(ComplexInput);
       // TODO Verify that length is at least
-      // "compiletime_info.vecLength*sizeof(ComplexInput)"
+      // "internal->info.vecLength*sizeof(ComplexInput)"
 
       // Add in any rounding that was done to the input pointer
       length += (ptr_in - ptr_aligned);
@@ -450,8 +1429,12 @@ int xgpuSetHostInputBuffer(XGPUContext *context)
       fprintf(stderr, "page aligned context->array_h = %p\n", ptr_aligned);
       fprintf(stderr, "length = %lx\n", length);
 #endif
+      unsigned int flags = portable ? cudaHostRegisterPortable : 0;
+      if(internal->read_only_array_h) {
+        flags |= cudaHostRegisterReadOnly;
+      }
       CLOCK_GETTIME(CLOCK_MONOTONIC, &a);
-      cudaHostRegister((void *)ptr_aligned, length, 0);
+      cudaHostRegister((void *)ptr_aligned, length, flags);
       CLOCK_GETTIME(CLOCK_MONOTONIC, &b);
       PRINT_ELAPASED("cudaHostRegister", ELAPSED_NS(a,b));
       internal->unregister_array_h = (ComplexInput *)ptr_aligned;
@@ -464,9 +1447,10 @@ int xgpuSetHostInputBuffer(XGPUContext *context)
     }
   } else {
     // allocate host memory
-    context->array_len = compiletime_info.vecLength;
+    context->array_len = internal->nbatch*internal->info.vecLength;
     CLOCK_GETTIME(CLOCK_MONOTONIC, &a);
-    cudaMallocHost(&(context->array_h), context->array_len*sizeof(ComplexInput));
+    cudaHostAlloc(&(context->array_h), context->array_len*sizeof(ComplexInput),
+                  portable ? cudaHostAllocPortable : cudaHostAllocDefault);
     CLOCK_GETTIME(CLOCK_MONOTONIC, &b);
     PRINT_ELAPASED("cudaMallocHost", ELAPSED_NS(a,b));
     internal->free_array_h = context->array_h;
@@ -477,6 +1461,18 @@ int xgpuSetHostInputBuffer(XGPUContext *context)
   // Init input_offset to 0
   context->input_offset = 0;
 
+  // The shards of a multi-device context read their channels directly from
+  // this buffer
+  for(int i=0; i<internal->nshard; i++) {
+    internal->shard[i].array_h = context->array_h;
+    internal->shard[i].array_len = context->array_len;
+    ((XGPUInternalContext *)internal->shard[i].internal)->read_only_array_h = internal->read_only_array_h;
+    int error = xgpuSetHostInputBuffer(&internal->shard[i]);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+
   return XGPU_OK;
 }
 
@@ -489,6 +1485,26 @@ int xgpuSetHostOutputBuffer(XGPUContext *context)
   }
 
   internal->matrix_h_set = true;
+  // The buffer of a multi-device context is pinned for all of its devices
+  bool portable = internal->nshard > 0;
+
+  if(internal->cpu) {
+    // As for xgpuSetHostInputBuffer
+    if(context->matrix_h != internal->free_matrix_h) {
+      free(internal->free_matrix_h);
+      internal->free_matrix_h = NULL;
+    }
+    if(!context->matrix_h) {
+      context->matrix_len = internal->nbatch*internal->info.matLength;
+      context->matrix_h = (Complex *)malloc(context->matrix_len*sizeof(Complex));
+      if(!context->matrix_h) {
+        return XGPU_OUT_OF_MEMORY;
+      }
+      internal->free_matrix_h = context->matrix_h;
+    }
+    context->output_offset = 0;
+    return XGPU_OK;
+  }
 
   //assign the device
   cudaSetDevice(internal->device);
@@ -508,10 +1524,10 @@ int xgpuSetHostOutputBuffer(XGPUContext *context)
       // Round address down to nearest page_size boundary
       uintptr_t ptr_in = (uintptr_t)context->matrix_h;
       uintptr_t ptr_aligned = ptr_in - (ptr_in % page_size);
-      // Compute length starting with compile time requirement
+      // Compute length starting with sizing requirement
       size_t length = context->matrix_len * sizeof(Complex);
       // TODO Verify that length is at least
-      // "compiletime_info.matLength*sizeof(Complex)"
+      // "internal->info.matLength*sizeof(Complex)"
 
       // Add in any rounding that was done to the input pointer
       length += (ptr_in - ptr_aligned);
@@ -521,7 +1537,7 @@ int xgpuSetHostOutputBuffer(XGPUContext *context)
       fprintf(stderr, "page aligned context->matrix_h = %p\n", ptr_aligned);
       fprintf(stderr, "length = %lx\n", length);
 #endif
-      cudaHostRegister((void *)ptr_aligned, length, 0);
+      cudaHostRegister((void *)ptr_aligned, length, portable ? cudaHostRegisterPortable : 0);
       internal->unregister_matrix_h = (Complex *)ptr_aligned;
       internal->free_matrix_h = NULL;
       checkCudaError();
@@ -532,8 +1548,9 @@ int xgpuSetHostOutputBuffer(XGPUContext *context)
     }
   } else {
     // allocate host memory
-    context->matrix_len = compiletime_info.matLength;
-    cudaMallocHost(&(context->matrix_h), context->matrix_len*sizeof(Complex));
+    context->matrix_len = internal->nbatch*internal->info.matLength;
+    cudaHostAlloc(&(context->matrix_h), context->matrix_len*sizeof(Complex),
+                  portable ? cudaHostAllocPortable : cudaHostAllocDefault);
     internal->free_matrix_h = context->matrix_h;
     internal->unregister_matrix_h = NULL;
     checkCudaError();
@@ -542,30 +1559,160 @@ int xgpuSetHostOutputBuffer(XGPUContext *context)
   // Init output_offset to 0
   context->output_offset = 0;
 
+  // The shards of a multi-device context write their channels directly to
+  // this buffer
+  for(int i=0; i<internal->nshard; i++) {
+    internal->shard[i].matrix_h = context->matrix_h;
+    internal->shard[i].matrix_len = context->matrix_len;
+    int error = xgpuSetHostOutputBuffer(&internal->shard[i]);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+
   return XGPU_OK;
 }
 
+// Discard the captured graph, if any, so that the next call recaptures it
+static void discardGraph(XGPUInternalContext *internal)
+{
+  if(internal->graph_exec) {
+    cudaGraphExecDestroy(internal->graph_exec);
+  }
+  if(internal->graph) {
+    cudaGraphDestroy(internal->graph);
+  }
+  free(internal->graph_copy_nodes);
+  internal->graph_exec = NULL;
+  internal->graph = NULL;
+  internal->graph_copy_nodes = NULL;
+}
+
+// Free the device buffers of RFI flagging
+static void freeFlagging(XGPUInternalContext *internal)
+{
+  cudaFree(internal->flags_d);
+  cudaFree(internal->weights_d);
+  cudaFree(internal->weights_dump_d[0]);
+  cudaFree(internal->weights_dump_d[1]);
+  internal->flags_d = NULL;
+  internal->weights_d = NULL;
+  internal->weights_dump_d[0] = NULL;
+  internal->weights_dump_d[1] = NULL;
+}
+
+// Forget the registered device input buffers (which are not ours to free)
+static void freeDeviceInput(XGPUInternalContext *internal)
+{
+  if(internal->input_tex) {
+    int pipe_length = internal->info.ntime / internal->info.ntimepipe;
+    for(int i=0; i<internal->ninput_d*pipe_length; i++) {
+      destroyInputSource(internal->input_tex[i]);
+    }
+  }
+  free(internal->input_d);
+  free(internal->input_tex);
+  internal->input_d = NULL;
+  internal->input_tex = NULL;
+  internal->ninput_d = 0;
+}
+
+// Free the device buffers of the F-engine
+static void freeChannelizer(XGPUInternalContext *internal)
+{
+  for(int i=0; i<XGPU_MAX_PIPELINE_DEPTH; i++) {
+    cudaFree(internal->voltages_d[i]);
+    internal->voltages_d[i] = NULL;
+  }
+  cudaFree(internal->fft_d);
+  cudaFree(internal->pfb_window_d);
+  internal->fft_d = NULL;
+  internal->pfb_window_d = NULL;
+  internal->nfft = 0;
+}
+
 // Free up the memory on the host and device
 void xgpuFree(XGPUContext *context)
 {
   XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
 
-  if(internal) {
+  if(internal && internal->cpu) {
+    free(internal->cpu_matrix);
+    if(internal->free_array_h) {
+      free(internal->free_array_h);
+      context->array_h = NULL;
+    }
+    if(internal->free_matrix_h) {
+      free(internal->free_matrix_h);
+      context->matrix_h = NULL;
+    }
+    free(internal);
+    context->internal = NULL;
+  } else if(internal) {
     //assign the device
     cudaSetDevice(internal->device);
 
-    // Destroy texture objects
-    if(internal->tex1dObject) {
-      cudaDestroyTextureObject(internal->tex1dObject);
-    }
-    if(internal->tex2dObject) {
-      cudaDestroyTextureObject(internal->tex2dObject);
-    }
+    if(internal->nshard) {
+      // The shards never own the host buffers
+      for(int i=0; i<internal->nshard; i++) {
+        xgpuFree(&internal->shard[i]);
+      }
+      free(internal->shard);
+      cudaSetDevice(internal->device);
+    } else {
+      discardGraph(internal);
 
-    for(int i=0; i<2; i++) {
-      cudaStreamDestroy(internal->streams[i]);
-      cudaEventDestroy(internal->copyCompletion[i]);
-      cudaEventDestroy(internal->kernelCompletion[i]);
+      for(int i=0; i<internal->depth; i++) {
+        // Destroy texture objects
+        destroyInputSource(internal->texObject[i]);
+
+        cudaEventDestroy(internal->copyCompletion[i]);
+        cudaEventDestroy(internal->kernelCompletion[i]);
+        cudaFree(internal->array_d[i]);
+      }
+      for(int i=0; i<internal->ncopy; i++) {
+        cudaStreamDestroy(internal->copy_streams[i]);
+      }
+      cudaStreamDestroy(internal->compute_stream);
+      cudaEventDestroy(internal->captureEvent);
+
+      // Let any asynchronous dump land before releasing its buffers
+      cudaStreamSynchronize(internal->dump_stream);
+      cudaStreamDestroy(internal->dump_stream);
+      for(int i=0; i<2; i++) {
+        cudaEventDestroy(internal->stagingReady[i]);
+        cudaEventDestroy(internal->dumpCompletion[i]);
+        if(internal->matrix_dump_d[i]) {
+          cudaFree(internal->matrix_dump_d[i]);
+        }
+      }
+
+      destroyInputSource(internal->texSwizzled);
+      cudaFree(internal->array_swizzled_d);
+      cudaFree(internal->bins_d);
+      cudaFree(internal->tiles_d);
+      cudaFree(internal->long_d);
+      cudaFree(internal->long_dump_d);
+      cudaFree(internal->products_d);
+      freeFlagging(internal);
+      freeChannelizer(internal);
+      freeDeviceInput(internal);
+      cudaFree(internal->matrix_d);
+
+      int nchunk_event = internal->chunk_events ? 4*(internal->info.ntime / internal->info.ntimepipe) : 0;
+      for(int i=0; i<nchunk_event; i++) {
+        if(internal->chunk_events[i]) {
+          cudaEventDestroy(internal->chunk_events[i]);
+        }
+      }
+      for(int i=0; i<6; i++) {
+        if(internal->dump_events[i]) {
+          cudaEventDestroy(internal->dump_events[i]);
+        }
+      }
+      free(internal->chunk_events);
+      free(internal->chunk_pending);
+      pthread_mutex_destroy(&internal->stats_mutex);
     }
 
     if(internal->free_array_h) {
@@ -585,10 +1732,6 @@ void xgpuFree(XGPUContext *context)
       context->matrix_h = NULL;
     }
 
-    cudaFree(internal->array_d[1]);
-    cudaFree(internal->array_d[0]);
-    cudaFree(internal->matrix_d);
-
     free(internal);
     context->internal = NULL;
   }
@@ -596,55 +1739,230 @@ void xgpuFree(XGPUContext *context)
   CUBE_WRITE();
 }
 
-int xgpuCudaXengine(XGPUContext *context, int syncOp)
+// Station counts for which shared2x2 is specialized at compile time.  All other
+// station counts use the generic shared2x2<0> instances.
+#define SHARED2X2_CASE(ns)						\
+  case ns:								\
+    return depth2 ? shared2x2<ns, 2> : shared2x2<ns, 4>;
+
+typedef decltype(&shared2x2<0, 4>) Shared2x2Kernel;
+
+// The instance of shared2x2 for the station count and buffer depth of internal
+static Shared2x2Kernel shared2x2Kernel(const XGPUInternalContext *internal)
 {
-  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
-  if(!internal) {
-    return XGPU_NOT_INITIALIZED;
+  const bool depth2 = internal->buffer_depth == 2;
+  switch(internal->info.nstation) {
+    SHARED2X2_CASE(64)
+    SHARED2X2_CASE(128)
+    SHARED2X2_CASE(256)
+    SHARED2X2_CASE(512)
+#if NSTATION != 64 && NSTATION != 128 && NSTATION != 256 && NSTATION != 512
+    SHARED2X2_CASE(NSTATION)
+#endif
   }
+  return depth2 ? shared2x2<0, 2> : shared2x2<0, 4>;
+}
 
-  // xgpuSetHostInputBuffer and xgpuSetHostOutputBuffer must have been called
-  if( !internal->array_h_set || !internal->matrix_h_set ) {
-    return XGPU_HOST_BUFFER_NOT_SET;
-  }
+#undef SHARED2X2_CASE
 
-  //assign the device
-  cudaSetDevice(internal->device);
+// Launch shared2x2 (or wmma2x2) for NTIME_PIPE chunk p read through texObj.
+static void launchShared2x2(XGPUInternalContext *internal, cudaStream_t stream, InputSource texObj, int p)
+{
+  XGPUInfo *info = &internal->info;
 
-  ComplexInput **array_d = internal->array_d;
-  cudaStream_t *streams = internal->streams;
-  cudaEvent_t *copyCompletion = internal->copyCompletion;
-  cudaEvent_t *kernelCompletion = internal->kernelCompletion;
-  cudaChannelFormatDesc channelDesc = internal->channelDesc;
+  // pulsar bins of chunk p
+  const unsigned char *bins_d = NULL;
+  if(internal->bins_d) {
+    bins_d = internal->bins_d + (size_t)p*(info->ntimepipe/PULSAR_SAMPLES)*info->nfrequency;
+  }
 
   // set pointers to the real and imaginary components of the device matrix
 #ifndef DP4A
   float4 *matrix_real_d = (float4 *)(internal->matrix_d);
-  float4 *matrix_imag_d = (float4 *)(internal->matrix_d + compiletime_info.matLength/2);
+  float4 *matrix_imag_d = (float4 *)(internal->matrix_d + info->matLength/2);
 #else
   int4 *matrix_real_d = (int4 *)(internal->matrix_d);
-  int4 *matrix_imag_d = (int4 *)(internal->matrix_d + compiletime_info.matLength/2);
+  int4 *matrix_imag_d = (int4 *)(internal->matrix_d + info->matLength/2);
 #endif
 
-  int Nblock = compiletime_info.nstation/min(TILE_HEIGHT,TILE_WIDTH);
-  ComplexInput *array_load;
-  ComplexInput *array_compute; 
-
+  int Nblock = info->nstation/min(TILE_HEIGHT,TILE_WIDTH);
   dim3 dimBlock(TILE_WIDTH,TILE_HEIGHT,1);
-  //allocated exactly as many thread blocks as are needed
-  dim3 dimGrid(((Nblock/2+1)*(Nblock/2))/2, compiletime_info.nfrequency);
+  //allocated exactly as many thread blocks as are needed, i.e. one per tile
+  //of the triangle, or of the active tiles
+  dim3 dimGrid(((Nblock/2+1)*(Nblock/2))/2, info->nfrequency, internal->nbatch);
+  if(internal->tiles_d) {
+    if(!internal->ntile) {
+      return;
+    }
+    dimGrid.x = internal->ntile;
+  }
 
-  CUBE_ASYNC_START(ENTIRE_PIPELINE);
+#if defined(DP4A) && COMPLEX_BLOCK_SIZE == 1
+  if(internal->use_tensor) {
+    // two layers of threads so that each block has four warps
+    dim3 dimBlockTensor(TILE_WIDTH,TILE_HEIGHT,2);
+    CUBE_ASYNC_KERNEL_CALL(wmma2x2, dimGrid, dimBlockTensor, 0, stream,
+			   matrix_real_d, matrix_imag_d, info->nstation, info->nfrequency,
+			   info->ntimepipe, writeMatrix, texObj, bins_d, internal->tiles_d);
+    return;
+  }
+#endif
+
+  Shared2x2Kernel shared2x2_variant = shared2x2Kernel(internal);
+  CUBE_ASYNC_KERNEL_CALL(shared2x2_variant, dimGrid, dimBlock, 0, stream,
+			 matrix_real_d, matrix_imag_d, info->nstation, info->nfrequency,
+			 info->ntimepipe, writeMatrix, texObj, bins_d, internal->tiles_d);
+}
+
+// Launch swizzleInput to reorder one NTIME_PIPE chunk of natural order input
+// into array_swizzled_d.
+static void launchSwizzleInput(XGPUInternalContext *internal, cudaStream_t stream, ComplexInput *array_load)
+{
+#if defined(DP4A) || COMPLEX_BLOCK_SIZE == 32
+  XGPUInfo *info = &internal->info;
+  unsigned int row = info->nfrequency * info->nstation * NPOL * sizeof(ComplexInput);
+  // The members of a batch follow one another in time
+  unsigned int ntime = internal->nbatch * info->ntimepipe;
+
+  dim3 dimBlock(256);
+  dim3 dimGrid(((long long unsigned int)row*ntime/4 + dimBlock.x - 1) / dimBlock.x);
+  CUBE_ASYNC_KERNEL_CALL(swizzleInput, dimGrid, dimBlock, 0, stream,
+			 internal->array_swizzled_d, array_load, row, ntime);
+#endif
+}
+
+// Launch flagInput to flag one NTIME_PIPE chunk of natural order input in
+// array_load, and accumulateWeights to count the samples it kept.
+static void launchFlagInput(XGPUInternalContext *internal, cudaStream_t stream, ComplexInput *array_load)
+{
+  XGPUInfo *info = &internal->info;
+
+  dim3 dimBlock(256);
+  dim3 dimGrid((info->nfrequency*info->nstation + dimBlock.x - 1) / dimBlock.x, internal->nbatch);
+  CUBE_ASYNC_KERNEL_CALL(flagInput, dimGrid, dimBlock, 0, stream,
+			 array_load, internal->flags_d, info->nstation, info->nfrequency,
+			 info->ntimepipe, internal->flag_threshold);
+
+  dim3 dimGridWeights((info->nbaseline + dimBlock.x - 1) / dimBlock.x, info->nfrequency, internal->nbatch);
+  CUBE_ASYNC_KERNEL_CALL(accumulateWeights, dimGridWeights, dimBlock, 0, stream,
+			 internal->weights_d, internal->flags_d, info->nstation, info->nfrequency,
+			 info->ntimepipe);
+}
+
+// Load the kernels of the pipeline and of dumps onto the device, which would
+// otherwise happen (along with any JIT compilation) on their first launch in
+// the first call.  The correlator is launched once on the zeroed first input
+// buffer, which adds nothing to the integration.
+static int prewarmKernels(XGPUInternalContext *internal)
+{
+  cudaStream_t stream = internal->compute_stream;
+  cudaFuncAttributes attr;
+
+  if(internal->swizzle) {
+    launchSwizzleInput(internal, stream, internal->array_d[0]);
+    launchShared2x2(internal, stream, internal->texSwizzled, 0);
+  } else {
+    launchShared2x2(internal, stream, internal->texObject[0], 0);
+  }
+  cudaFuncGetAttributes(&attr, flagInput);
+  cudaFuncGetAttributes(&attr, accumulateWeights);
+  cudaFuncGetAttributes(&attr, packOutput);
+  cudaFuncGetAttributes(&attr, foldIntegration);
+  cudaFuncGetAttributes(&attr, narrowIntegration);
+#if MATRIX_ORDER != TRIANGULAR_ORDER
+  cudaFuncGetAttributes(&attr, reorderMatrix);
+#endif
+  cudaStreamSynchronize(stream);
+  checkCudaError();
+
+  return XGPU_OK;
+}
+
+// Launch the F-engine on chunk of voltages in voltages_d[b], writing the
+// channelized chunk into array_d[b] as natural order input.
+static void launchChannelizer(XGPUInternalContext *internal, cudaStream_t stream, int b)
+{
+  XGPUInfo *info = &internal->info;
+  int ninput = info->nstation * NPOL;
+
+  dim3 dimBlock(256);
+  dim3 dimGridPfb((internal->nfft + dimBlock.x - 1) / dimBlock.x, ninput, info->ntimepipe);
+  CUBE_ASYNC_KERNEL_CALL(pfbFrontEnd, dimGridPfb, dimBlock, 0, stream,
+			 internal->fft_d, internal->voltages_d[b], internal->pfb_window_d,
+			 ninput, internal->nfft, internal->ntap);
+
+  internal->fft_launcher(internal->fft_d, internal->fft_batch, stream);
+
+  dim3 dimGridQuantize((ninput + dimBlock.x - 1) / dimBlock.x, info->nfrequency, info->ntimepipe);
+  CUBE_ASYNC_KERNEL_CALL(quantizeSpectra, dimGridQuantize, dimBlock, 0, stream,
+			 internal->array_d[b], internal->fft_d, ninput, info->nfrequency,
+			 internal->nfft, internal->first_channel, internal->fscale);
+}
+
+// Issue the h2d transfer of chunk p into input buffer p%depth (or of the
+// voltages of chunk p into voltages_d[p%depth] for xgpuCudaFXengine).  The transfer
+// only starts once the kernel that last read that buffer has completed.  For
+// p < depth that kernel belongs to the previous call, which a captured graph
+// leaves to the ordering of the graph launches.
+static void issueCopy(XGPUInternalContext *internal, ComplexInput *array_hp, int p, bool capture)
+{
+  XGPUInfo *info = &internal->info;
+  int b = p % internal->depth;
+  cudaStream_t stream = internal->copy_streams[p % internal->ncopy];
+  long long unsigned int vecLengthPipe = info->vecLengthPipe;
+
+  pushRange("xgpu h2d", p);
+  if(!capture || p >= internal->depth) {
+    cudaStreamWaitEvent(stream, internal->kernelCompletion[b], 0);
+  }
+  recordTiming(internal->chunk_events[4*p], stream, capture);
+  if(internal->voltages_hp) {
+    // The ntimepipe frames of chunk p and the ntap-1 frames that follow them
+    size_t frame = (size_t)internal->nfft * info->nstation * NPOL;
+    CUBE_ASYNC_COPY_CALL(internal->voltages_d[b], internal->voltages_hp + p*info->ntimepipe*frame,
+			 (info->ntimepipe + internal->ntap - 1)*frame*sizeof(ComplexInput),
+			 cudaMemcpyHostToDevice, stream);
+  } else if(internal->nbatch > 1) {
+    // Chunk p of every member of the batch
+    cudaMemcpy2DAsync(internal->array_d[b], vecLengthPipe*sizeof(ComplexInput),
+                      array_hp+p*vecLengthPipe, info->vecLength*sizeof(ComplexInput),
+                      vecLengthPipe*sizeof(ComplexInput), internal->nbatch, cudaMemcpyHostToDevice, stream);
+  } else if(internal->full_nfrequency == info->nfrequency) {
+    CUBE_ASYNC_COPY_CALL(internal->array_d[b], array_hp+p*vecLengthPipe, vecLengthPipe*sizeof(ComplexInput), cudaMemcpyHostToDevice, stream);
+  } else {
+    // Gather this shard's channels from each row (time sample, or group of
+    // four for DP4A) of the input
+#ifdef DP4A
+    size_t rows = internal->swizzle ? info->ntimepipe : info->ntimepipe/4;
+#else
+    size_t rows = info->ntimepipe;
+#endif
+    size_t width = vecLengthPipe / rows * sizeof(ComplexInput);
+    size_t pitch = width / info->nfrequency * internal->full_nfrequency;
+    const char *src = (const char *)array_hp + p*rows*pitch + internal->freq_offset*(width / info->nfrequency);
+    cudaMemcpy2DAsync(internal->array_d[b], width, src, pitch, width, rows, cudaMemcpyHostToDevice, stream);
+  }
+  cudaEventRecord(internal->copyCompletion[b], stream); // record the completion of the h2d transfer
+  recordTiming(internal->chunk_events[4*p+1], stream, capture);
+  internal->chunk_pending[p] |= 1<<STAGE_H2D;
+  nvtxRangePop();
+}
+
+// Issue the h2d transfers and kernel launches for one call of
+// xgpuCudaXengine, reading the input from array_hp.  The transfers run up to
+// depth chunks ahead of the kernels on the compute stream.
+static int issuePipeline(XGPUInternalContext *internal, ComplexInput *array_hp, bool capture)
+{
+  XGPUInfo *info = &internal->info;
+  int depth = internal->depth;
+  cudaStream_t compute_stream = internal->compute_stream;
+
+  int pipe_length = info->ntime / info->ntimepipe;
 
   // Need to fill pipeline before loop
-  long long unsigned int vecLengthPipe = compiletime_info.vecLengthPipe;
-  ComplexInput *array_hp = context->array_h + context->input_offset;
-  // Only start the transfer once the kernel has completed processing input
-  // buffer 0.  This is a no-op unless previous call to xgpuCudaXengine() had
-  // SYNCOP_NONE or SYNCOP_SYNC_TRANSFER.
-  cudaStreamWaitEvent(streams[0], kernelCompletion[0], 0);
-  CUBE_ASYNC_COPY_CALL(array_d[0], array_hp, vecLengthPipe*sizeof(ComplexInput), cudaMemcpyHostToDevice, streams[0]);
-  cudaEventRecord(copyCompletion[0], streams[0]); // record the completion of the h2d transfer
+  for (int p=0; p<depth && p<pipe_length; p++) {
+    issueCopy(internal, array_hp, p, capture);
+  }
   checkCudaError();
 
   CUBE_ASYNC_START(PIPELINE_LOOP);
@@ -652,106 +1970,2130 @@ int xgpuCudaXengine(XGPUContext *context, int syncOp)
 #ifdef POWER_LOOP
   for (int q=0; ; q++)
 #endif
-  for (int p=1; p<PIPE_LENGTH; p++) {
-    array_compute = array_d[(p+1)%2];
-    array_load = array_d[p%2];
+  for (int p=0; p<pipe_length; p++) {
+    int b = p % depth;
 
-    // Kernel Calculation - Create texture object
-    if(internal->tex1dObject) {
-      cudaDestroyTextureObject(internal->tex1dObject);
+    pushRange("xgpu kernel", p);
+    cudaStreamWaitEvent(compute_stream, internal->copyCompletion[b], 0); // only start the kernel once the h2d transfer is complete
+    recordTiming(internal->chunk_events[4*p+2], compute_stream, capture);
+    if(internal->voltages_hp) {
+      launchChannelizer(internal, compute_stream, b);
     }
-    if(internal->tex2dObject) {
-      cudaDestroyTextureObject(internal->tex2dObject);
+    if(internal->flag) {
+      launchFlagInput(internal, compute_stream, internal->array_d[b]);
     }
+    if(internal->swizzle) {
+      // array_d[b] is free for the next transfer once it has been swizzled
+      launchSwizzleInput(internal, compute_stream, internal->array_d[b]);
+      cudaEventRecord(internal->kernelCompletion[b], compute_stream);
+      launchShared2x2(internal, compute_stream, internal->texSwizzled, p);
+    } else {
+      launchShared2x2(internal, compute_stream, internal->texObject[b], p);
+      cudaEventRecord(internal->kernelCompletion[b], compute_stream); // record the completion of the kernel
+    }
+    recordTiming(internal->chunk_events[4*p+3], compute_stream, capture);
+    internal->chunk_pending[p] |= 1<<STAGE_KERNEL;
+    nvtxRangePop();
+    checkCudaError();
 
-#if TEXTURE_DIM == 2
-#ifndef DP4A
-    internal->tex2dObject = createTexture2D(array_compute, channelDesc, NFREQUENCY*NSTATION*NPOL, NTIME_PIPE,
-                                           NFREQUENCY*NSTATION*NPOL*sizeof(ComplexInput));
-#else
-    internal->tex2dObject = createTexture2D(array_compute, channelDesc, NFREQUENCY*NSTATION*NPOL, NTIME_PIPE/4,
-                                           NFREQUENCY*NSTATION*NPOL*2*sizeof(char4));
-#endif
-#else
-#ifndef DP4A
-    internal->tex1dObject = createTexture1D(array_compute, channelDesc, NFREQUENCY*NSTATION*NPOL*NTIME_PIPE*sizeof(ComplexInput));
-#else
-    internal->tex1dObject = createTexture1D(array_compute, channelDesc, NFREQUENCY*NSTATION*NPOL*(NTIME_PIPE/4)*sizeof(int2));
-#endif
-#endif
-    cudaStreamWaitEvent(streams[1], copyCompletion[(p+1)%2], 0); // only start the kernel once the h2d transfer is complete
-#if TEXTURE_DIM == 2
-    CUBE_ASYNC_KERNEL_CALL(shared2x2, dimGrid, dimBlock, 0, streams[1], 
-			   matrix_real_d, matrix_imag_d, NSTATION, writeMatrix, internal->tex2dObject);
-#else
-    CUBE_ASYNC_KERNEL_CALL(shared2x2, dimGrid, dimBlock, 0, streams[1], 
-			   matrix_real_d, matrix_imag_d, NSTATION, writeMatrix, internal->tex1dObject);
+    // Download next chunk of input data into the buffer just consumed
+    if(p+depth < pipe_length) {
+      issueCopy(internal, array_hp, p+depth, capture);
+      checkCudaError();
+    }
+  }
+
+  CUBE_ASYNC_END(PIPELINE_LOOP);
+
+  return XGPU_OK;
+}
+
+// Issue the kernel launches for one call of xgpuCudaXengineDevice, reading
+// registered device input buffer input_current in place once the
+// input_ready event (if any) has completed, and recording input_consumed (if
+// any) once the last kernel reading it has completed.
+static int issueDevicePipeline(XGPUInternalContext *internal)
+{
+  XGPUInfo *info = &internal->info;
+  cudaStream_t compute_stream = internal->compute_stream;
+  int buffer = internal->input_current;
+
+  int pipe_length = info->ntime / info->ntimepipe;
+
+  if(internal->input_ready) {
+    cudaStreamWaitEvent(compute_stream, internal->input_ready, 0);
+  }
+
+  CUBE_ASYNC_START(PIPELINE_LOOP);
+
+#ifdef POWER_LOOP
+  for (int q=0; ; q++)
 #endif
-    cudaEventRecord(kernelCompletion[(p+1)%2], streams[1]); // record the completion of the kernel
-    checkCudaError();
+  for (int p=0; p<pipe_length; p++) {
+    ComplexInput *array_load = internal->input_d[buffer] + p*info->vecLengthPipe;
 
-    // Download next chunk of input data
-    cudaStreamWaitEvent(streams[0], kernelCompletion[p%2], 0); // only start the transfer once the kernel has completed
-    CUBE_ASYNC_COPY_CALL(array_load, array_hp+p*vecLengthPipe, vecLengthPipe*sizeof(ComplexInput), cudaMemcpyHostToDevice, streams[0]);
-    cudaEventRecord(copyCompletion[p%2], streams[0]); // record the completion of the h2d transfer
+    pushRange("xgpu kernel", p);
+    recordTiming(internal->chunk_events[4*p+2], compute_stream, false);
+    if(internal->flag) {
+      launchFlagInput(internal, compute_stream, array_load);
+    }
+    if(internal->swizzle) {
+      launchSwizzleInput(internal, compute_stream, array_load);
+      if(p == pipe_length-1 && internal->input_consumed) {
+        cudaEventRecord(internal->input_consumed, compute_stream);
+      }
+      launchShared2x2(internal, compute_stream, internal->texSwizzled, p);
+    } else {
+      launchShared2x2(internal, compute_stream, internal->input_tex[buffer*pipe_length + p], p);
+    }
+    recordTiming(internal->chunk_events[4*p+3], compute_stream, false);
+    internal->chunk_pending[p] |= 1<<STAGE_KERNEL;
+    nvtxRangePop();
     checkCudaError();
   }
 
+  if(!internal->swizzle && internal->input_consumed) {
+    cudaEventRecord(internal->input_consumed, compute_stream);
+  }
+
   CUBE_ASYNC_END(PIPELINE_LOOP);
 
-  array_compute = array_d[(PIPE_LENGTH+1)%2];
-  // Final kernel calculation - Create texture object
-  if(internal->tex1dObject) {
-    cudaDestroyTextureObject(internal->tex1dObject);
+  checkCudaError();
+
+  return XGPU_OK;
+}
+
+// Capture the work of issuePipeline into internal->graph_exec, with
+// copy_streams[0] as the origin stream, and locate the h2d memcpy node of
+// each NTIME_PIPE chunk.
+static int captureGraph(XGPUInternalContext *internal, ComplexInput *array_hp)
+{
+  XGPUInfo *info = &internal->info;
+  cudaStream_t origin = internal->copy_streams[0];
+  int pipe_length = info->ntime / info->ntimepipe;
+
+  cudaStreamBeginCapture(origin, cudaStreamCaptureModeThreadLocal);
+  // Fork the other copy streams into the capture; the compute stream joins
+  // through its waits on copyCompletion
+  cudaEventRecord(internal->captureEvent, origin);
+  for(int i=1; i<internal->ncopy; i++) {
+    cudaStreamWaitEvent(internal->copy_streams[i], internal->captureEvent, 0);
   }
-  if(internal->tex2dObject) {
-    cudaDestroyTextureObject(internal->tex2dObject);
+  int error = issuePipeline(internal, array_hp, true);
+  // Join the compute and other copy streams back into the origin stream
+  cudaEventRecord(internal->captureEvent, internal->compute_stream);
+  cudaStreamWaitEvent(origin, internal->captureEvent, 0);
+  for(int i=1; i<internal->ncopy; i++) {
+    cudaEventRecord(internal->captureEvent, internal->copy_streams[i]);
+    cudaStreamWaitEvent(origin, internal->captureEvent, 0);
+  }
+  cudaStreamEndCapture(origin, &internal->graph);
+  if(error != XGPU_OK) {
+    return error;
   }
+  checkCudaError();
 
-#if TEXTURE_DIM == 2
-#ifndef DP4A
-  internal->tex2dObject = createTexture2D(array_compute, channelDesc, NFREQUENCY*NSTATION*NPOL, NTIME_PIPE,
-                                         NFREQUENCY*NSTATION*NPOL*sizeof(ComplexInput));
-#else
-  internal->tex2dObject = createTexture2D(array_compute, channelDesc, NFREQUENCY*NSTATION*NPOL, NTIME_PIPE/4,
-                                         NFREQUENCY*NSTATION*NPOL*2*sizeof(char4));
-#endif
-#else
-#ifndef DP4A
-  internal->tex1dObject = createTexture1D(array_compute, channelDesc, NFREQUENCY*NSTATION*NPOL*NTIME_PIPE*sizeof(ComplexInput));
-#else
-  internal->tex1dObject = createTexture1D(array_compute, channelDesc, NFREQUENCY*NSTATION*NPOL*(NTIME_PIPE/4)*sizeof(int2));
-#endif
-#endif
-  cudaStreamWaitEvent(streams[1], copyCompletion[(PIPE_LENGTH+1)%2], 0);
-#if TEXTURE_DIM == 2
-  CUBE_ASYNC_KERNEL_CALL(shared2x2, dimGrid, dimBlock, 0, streams[1], matrix_real_d, matrix_imag_d,
-			 NSTATION, writeMatrix, internal->tex2dObject);
-#else
-  CUBE_ASYNC_KERNEL_CALL(shared2x2, dimGrid, dimBlock, 0, streams[1], matrix_real_d, matrix_imag_d,
-			 NSTATION, writeMatrix, internal->tex1dObject);
-#endif
+  cudaGraphInstantiate(&internal->graph_exec, internal->graph, 0);
+  checkCudaError();
 
-  if(syncOp == SYNCOP_DUMP) {
-    checkCudaError();
-    //copy the data back, employing a similar strategy as above
-    CUBE_COPY_CALL(context->matrix_h + context->output_offset, internal->matrix_d, compiletime_info.matLength*sizeof(Complex), cudaMemcpyDeviceToHost);
-    checkCudaError();
-  } else if(syncOp == SYNCOP_SYNC_COMPUTE) {
-    // Synchronize on the compute stream (i.e. wait for it to complete)
-    cudaStreamSynchronize(streams[1]);
-  } else {
-      // record the completion of the kernel for next call
-      cudaEventRecord(kernelCompletion[(PIPE_LENGTH+1)%2], streams[1]);
-      checkCudaError();
+  internal->graph_copy_nodes = (cudaGraphNode_t *)malloc(pipe_length*sizeof(cudaGraphNode_t));
+  if(!internal->graph_copy_nodes) {
+    return XGPU_OUT_OF_MEMORY;
+  }
 
-      if(syncOp == SYNCOP_SYNC_TRANSFER) {
-        // Synchronize on the transfer stream (i.e. wait for it to complete)
-        cudaStreamSynchronize(streams[0]);
-      }
+  size_t num_nodes = 0;
+  cudaGraphGetNodes(internal->graph, NULL, &num_nodes);
+  cudaGraphNode_t *nodes = (cudaGraphNode_t *)malloc(num_nodes*sizeof(cudaGraphNode_t));
+  if(!nodes) {
+    return XGPU_OUT_OF_MEMORY;
   }
+  cudaGraphGetNodes(internal->graph, nodes, &num_nodes);
 
-  CUBE_ASYNC_END(ENTIRE_PIPELINE);
+  // The only memcpy nodes are the h2d transfers, identified by their source
+  for(size_t i=0; i<num_nodes; i++) {
+    cudaGraphNodeType type;
+    cudaGraphNodeGetType(nodes[i], &type);
+    if(type == cudaGraphNodeTypeMemcpy) {
+      cudaMemcpy3DParms params;
+      cudaGraphMemcpyNodeGetParams(nodes[i], &params);
+      ComplexInput *src = (ComplexInput *)((char *)params.srcPtr.ptr + params.srcPos.x);
+      internal->graph_copy_nodes[(src - array_hp) / info->vecLengthPipe] = nodes[i];
+    }
+  }
+  free(nodes);
+  checkCudaError();
+
+  internal->graph_array_hp = array_hp;
+
+  return XGPU_OK;
+}
+
+// Replay the captured pipeline on copy_streams[0], capturing it first if
+// needed.
+static int launchGraph(XGPUInternalContext *internal, ComplexInput *array_hp)
+{
+  XGPUInfo *info = &internal->info;
+  int pipe_length = info->ntime / info->ntimepipe;
+
+  if(!internal->graph_exec) {
+    int error = captureGraph(internal, array_hp);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  } else if(array_hp != internal->graph_array_hp) {
+    // Point each h2d transfer at the new host input
+    for(int p=0; p<pipe_length; p++) {
+      cudaGraphExecMemcpyNodeSetParams1D(internal->graph_exec, internal->graph_copy_nodes[p],
+          internal->array_d[p%internal->depth], array_hp + p*info->vecLengthPipe,
+          info->vecLengthPipe*sizeof(ComplexInput), cudaMemcpyHostToDevice);
+    }
+    checkCudaError();
+    internal->graph_array_hp = array_hp;
+  }
+
+  pushRange("xgpu graph", -1);
+  cudaGraphLaunch(internal->graph_exec, internal->copy_streams[0]);
+  nvtxRangePop();
+  checkCudaError();
+
+  // Each launch records the timing events of every chunk
+  for(int p=0; p<pipe_length; p++) {
+    internal->chunk_pending[p] = 1<<STAGE_H2D | 1<<STAGE_KERNEL;
+  }
+
+  return XGPU_OK;
+}
+
+// Host function run on dump_stream once an asynchronous dump has landed
+static void CUDART_CB dumpHostFunc(void *data)
+{
+  XGPUDumpSlot *slot = (XGPUDumpSlot *)data;
+  slot->callback(slot->context, slot->matrix_h, slot->user_data);
+}
+
+// Bytes per element of output type type
+static size_t outputElementSize(int type)
+{
+  return type == XGPU_FLOAT16 || type == XGPU_INT16 ? 2*sizeof(short) : sizeof(Complex);
+}
+
+// Bytes per batch member of a packed dump
+static size_t outputSize(XGPUInternalContext *internal)
+{
+  XGPUInfo *info = &internal->info;
+  size_t nproduct = internal->nproduct ? internal->nproduct : NPOL*NPOL*info->nbaseline;
+  return (NPULSAR+1) * info->nfrequency * nproduct * outputElementSize(internal->output_type);
+}
+
+// Snapshot matrix_d (the integration, or the long integration) into staging
+// buffer i on stream, packing or reordering it if requested.
+static int stageMatrix(XGPUInternalContext *internal, int i, cudaStream_t stream, const Complex *matrix_d)
+{
+  long long unsigned int matLength = internal->info.matLength;
+  size_t matrix_size = internal->nbatch*matLength*sizeof(Complex);
+
+  if(!internal->matrix_dump_d[i]) {
+    cudaMalloc((void **) &(internal->matrix_dump_d[i]), matrix_size);
+    // Reordering leaves the padding past the triangular matrix untouched
+    cudaMemsetAsync(internal->matrix_dump_d[i], '\0', matrix_size, stream);
+    checkCudaError();
+  }
+
+  // Wait for the previous dump from this staging buffer, including its
+  // callback, before reusing the buffer and its slot
+  cudaEventSynchronize(internal->dumpCompletion[i]);
+
+  if(internal->pack) {
+    size_t output_size = outputSize(internal);
+    long long unsigned int length = output_size / outputElementSize(internal->output_type);
+    unsigned int nproduct = internal->nproduct ? internal->nproduct : NPOL*NPOL*internal->info.nbaseline;
+    dim3 dimBlock(256);
+    dim3 dimGrid((length + dimBlock.x - 1) / dimBlock.x);
+    for(int b=0; b<internal->nbatch; b++) {
+      CUBE_ASYNC_KERNEL_CALL(packOutput, dimGrid, dimBlock, 0, stream,
+			     (char *)internal->matrix_dump_d[i] + b*output_size, matrix_d + b*matLength,
+			     internal->products_d, nproduct, internal->info.nstation, matLength,
+			     length, internal->output_type, internal->output_scale);
+    }
+  } else
+#if MATRIX_ORDER != TRIANGULAR_ORDER
+  if(internal->reorder) {
+    dim3 dimBlock(256);
+    dim3 dimGrid((matLength + dimBlock.x - 1) / dimBlock.x);
+    for(int b=0; b<internal->nbatch; b++) {
+      CUBE_ASYNC_KERNEL_CALL(reorderMatrix, dimGrid, dimBlock, 0, stream,
+			     internal->matrix_dump_d[i] + b*matLength, matrix_d + b*matLength,
+			     internal->info.nstation, matLength);
+    }
+  } else
+#endif
+  {
+    cudaMemcpyAsync(internal->matrix_dump_d[i], matrix_d, matrix_size, cudaMemcpyDeviceToDevice, stream);
+  }
+  checkCudaError();
+
+  return XGPU_OK;
+}
+
+// Transfer a matrix of this context (the integration, or a staging buffer)
+// to the host output buffer matrix_h on stream.  A shard of a multi-device
+// context writes its channels into the multi-device context's matrix.
+static int copyMatrixToHost(XGPUInternalContext *internal, Complex *matrix_h, const Complex *matrix_d, cudaStream_t stream)
+{
+  XGPUInfo *info = &internal->info;
+  size_t size = internal->pack ? outputSize(internal) : info->matLength*sizeof(Complex);
+
+  if(internal->full_nfrequency == info->nfrequency) {
+    CUBE_ASYNC_COPY_CALL(matrix_h, matrix_d, internal->nbatch*size, cudaMemcpyDeviceToHost, stream);
+  } else {
+    // channel is the slowest varying index of each pulsar bin, and of the real
+    // and imaginary halves unless the matrix is in triangular order
+    int nplane = NPULSAR+1;
+    if(MATRIX_ORDER != TRIANGULAR_ORDER && !internal->reorder && !internal->pack) {
+      nplane *= 2;
+    }
+    size_t plane = size/nplane;
+    size_t full_plane = plane/info->nfrequency*internal->full_nfrequency;
+    char *plane_h = (char *)matrix_h + internal->freq_offset*(plane/info->nfrequency);
+    for(int k=0; k<nplane; k++) {
+      CUBE_ASYNC_COPY_CALL(plane_h + k*full_plane, (const char *)matrix_d + k*plane, plane, cudaMemcpyDeviceToHost, stream);
+    }
+  }
+  checkCudaError();
+
+  return XGPU_OK;
+}
+
+// Transfer the weights weights_d of the integration to the host on stream, if
+// there is a host buffer for them.
+static void copyWeightsToHost(XGPUInternalContext *internal, const unsigned int *weights_d, cudaStream_t stream)
+{
+  if(internal->weights_d && internal->weights_h) {
+    cudaMemcpyAsync(internal->weights_h, weights_d, weightsSize(internal), cudaMemcpyDeviceToHost, stream);
+  }
+}
+
+// Restart the integration on stream, adding it to the long integration if
+// there is one.
+static void restartIntegration(XGPUInternalContext *internal, cudaStream_t stream)
+{
+  long long unsigned int matLength = internal->nbatch*internal->info.matLength;
+
+  if(internal->long_d) {
+    dim3 dimBlock(256);
+    dim3 dimGrid((matLength + dimBlock.x - 1) / dimBlock.x);
+    CUBE_ASYNC_KERNEL_CALL(foldIntegration, dimGrid, dimBlock, 0, stream,
+			   internal->long_d, internal->matrix_d, matLength);
+  } else {
+    cudaMemsetAsync(internal->matrix_d, '\0', matLength*sizeof(Complex), stream);
+  }
+  if(internal->weights_d) {
+    cudaMemsetAsync(internal->weights_d, '\0', weightsSize(internal), stream);
+  }
+  internal->fold_count = 0;
+}
+
+// Add the time between completed events start and stop to the timing of
+// stage
+static void addTiming(XGPUInternalContext *internal, int stage, cudaEvent_t start, cudaEvent_t stop)
+{
+  float ms;
+  if(cudaEventElapsedTime(&ms, start, stop) != cudaSuccess) {
+    cudaGetLastError();
+    return;
+  }
+  float us = 1000*ms;
+  int bin = us > 1 ? (int)(4*log2f(us)) : 0;
+  if(bin >= XGPU_STATS_NBIN) {
+    bin = XGPU_STATS_NBIN-1;
+  }
+
+  XGPUTiming *timing = &internal->timing[stage];
+  pthread_mutex_lock(&internal->stats_mutex);
+  timing->count++;
+  timing->sum += ms;
+  if(ms > timing->max) {
+    timing->max = ms;
+  }
+  timing->histogram[bin]++;
+  pthread_mutex_unlock(&internal->stats_mutex);
+}
+
+// Collect the timings of the chunks and dumps of previous calls that have
+// completed.  If drop, those that have not are discarded, as their events are
+// about to be recorded again, apart from asynchronous dumps (see dumpAsync).
+static void collectTimings(XGPUInternalContext *internal, bool drop)
+{
+  int pipe_length = internal->info.ntime / internal->info.ntimepipe;
+  int ndropped = 0;
+
+  for(int p=0; p<pipe_length; p++) {
+    for(int stage=STAGE_H2D; stage<=STAGE_KERNEL; stage++) {
+      const cudaEvent_t *events = internal->chunk_events + 4*p + 2*stage;
+      if(!(internal->chunk_pending[p] & 1<<stage)) {
+        continue;
+      }
+      if(cudaEventQuery(events[1]) == cudaSuccess) {
+        addTiming(internal, stage, events[0], events[1]);
+      } else if(drop) {
+        ndropped++;
+      } else {
+        continue;
+      }
+      internal->chunk_pending[p] &= ~(1<<stage);
+    }
+  }
+
+  for(int i=0; i<3; i++) {
+    if(!internal->dump_pending[i]) {
+      continue;
+    }
+    if(cudaEventQuery(internal->dump_events[2*i+1]) == cudaSuccess) {
+      addTiming(internal, STAGE_DUMP, internal->dump_events[2*i], internal->dump_events[2*i+1]);
+    } else if(drop && i == 2) {
+      ndropped++;
+    } else {
+      continue;
+    }
+    internal->dump_pending[i] = false;
+  }
+
+  if(ndropped) {
+    pthread_mutex_lock(&internal->stats_mutex);
+    internal->dropped += ndropped;
+    pthread_mutex_unlock(&internal->stats_mutex);
+  }
+}
+
+// Transfer the integration to the host output buffer on the stream the final
+// kernel was issued to, reordering or packing it into a staging buffer first
+// if needed.
+static int dumpSync(XGPUContext *context)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  cudaStream_t stream = workStream(internal);
+  const Complex *matrix_d = internal->matrix_d;
+  int error;
+
+  recordTiming(internal->dump_events[4], stream, false);
+  if(internal->reorder || internal->pack) {
+    error = stageMatrix(internal, internal->dump_next, stream, internal->matrix_d);
+    if(error != XGPU_OK) {
+      return error;
+    }
+    matrix_d = internal->matrix_dump_d[internal->dump_next];
+  }
+  error = copyMatrixToHost(internal, context->matrix_h + context->output_offset, matrix_d, stream);
+  if(error != XGPU_OK) {
+    return error;
+  }
+  copyWeightsToHost(internal, internal->weights_d, stream);
+  recordTiming(internal->dump_events[5], stream, false);
+  internal->dump_pending[2] = true;
+
+  return XGPU_OK;
+}
+
+// Snapshot the integration into a staging buffer and restart it, all on the
+// stream the final kernel was issued to, then transfer the staging buffer to
+// the host output buffer on dump_stream.
+static int dumpAsync(XGPUContext *context)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  cudaStream_t stream = workStream(internal);
+  int i = internal->dump_next;
+
+  // The previous dump through staging buffer i has to land before the buffer
+  // is reused (see stageMatrix), so collect its timing first
+  if(internal->dump_pending[i]) {
+    cudaEventSynchronize(internal->dump_events[2*i+1]);
+    addTiming(internal, STAGE_DUMP, internal->dump_events[2*i], internal->dump_events[2*i+1]);
+    internal->dump_pending[i] = false;
+  }
+  recordTiming(internal->dump_events[2*i], stream, false);
+
+  int error = stageMatrix(internal, i, stream, internal->matrix_d);
+  if(error != XGPU_OK) {
+    return error;
+  }
+  if(internal->weights_d) {
+    cudaMemcpyAsync(internal->weights_dump_d[i], internal->weights_d, weightsSize(internal), cudaMemcpyDeviceToDevice, stream);
+  }
+  restartIntegration(internal, stream);
+  cudaEventRecord(internal->stagingReady[i], stream);
+  checkCudaError();
+
+  XGPUDumpSlot *slot = &internal->dump_slot[i];
+  slot->context = context;
+  slot->matrix_h = context->matrix_h + context->output_offset;
+  slot->callback = internal->dump_callback;
+  slot->user_data = internal->dump_user_data;
+
+  cudaStreamWaitEvent(internal->dump_stream, internal->stagingReady[i], 0);
+  error = copyMatrixToHost(internal, slot->matrix_h, internal->matrix_dump_d[i], internal->dump_stream);
+  if(error != XGPU_OK) {
+    return error;
+  }
+  copyWeightsToHost(internal, internal->weights_dump_d[i], internal->dump_stream);
+  recordTiming(internal->dump_events[2*i+1], internal->dump_stream, false);
+  internal->dump_pending[i] = true;
+  if(slot->callback) {
+    cudaLaunchHostFunc(internal->dump_stream, dumpHostFunc, slot);
+  }
+  cudaEventRecord(internal->dumpCompletion[i], internal->dump_stream);
+  checkCudaError();
+
+  internal->dump_next = (i+1) % 2;
+
+  return XGPU_OK;
+}
+
+int xgpuSetDumpCallback(XGPUContext *context, XGPUDumpCallback callback, void *user_data)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+
+  internal->dump_callback = callback;
+  internal->dump_user_data = user_data;
+
+  return XGPU_OK;
+}
+
+int xgpuDumpQuery(XGPUContext *context)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  // The dumps of the CPU X-engine land before xgpuCudaXengine returns
+  if(internal->cpu) {
+    return XGPU_OK;
+  }
+
+  for(int i=0; i<internal->nshard; i++) {
+    int error = xgpuDumpQuery(&internal->shard[i]);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+  if(internal->nshard) {
+    return XGPU_OK;
+  }
+
+  //assign the device
+  cudaSetDevice(internal->device);
+
+  // Dumps complete in order, so only the most recent one matters
+  cudaError_t status = cudaEventQuery(internal->dumpCompletion[(internal->dump_next+1) % 2]);
+  if(status == cudaErrorNotReady) {
+    return XGPU_NOT_READY;
+  }
+  checkCudaError();
+
+  return XGPU_OK;
+}
+
+int xgpuDumpSynchronize(XGPUContext *context)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(internal->cpu) {
+    return XGPU_OK;
+  }
+
+  for(int i=0; i<internal->nshard; i++) {
+    int error = xgpuDumpSynchronize(&internal->shard[i]);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+  if(internal->nshard) {
+    return XGPU_OK;
+  }
+
+  //assign the device
+  cudaSetDevice(internal->device);
+
+  cudaStreamSynchronize(internal->dump_stream);
+  checkCudaError();
+
+  return XGPU_OK;
+}
+
+int xgpuSetPulsarBins(XGPUContext *context, const unsigned char *bins)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  // Not available on the CPU X-engine
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+  XGPUInfo *info = &internal->info;
+
+  for(long long unsigned int i=0; i<(long long unsigned int)info->ntime*internal->full_nfrequency; i++) {
+    if(bins[i] > NPULSAR) {
+      return XGPU_INVALID_ARGUMENT;
+    }
+  }
+
+  for(int i=0; i<internal->nshard; i++) {
+    int error = xgpuSetPulsarBins(&internal->shard[i], bins);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+  if(!internal->bins_d) {
+    return XGPU_OK;
+  }
+
+  // Keep the first sample of each PULSAR_SAMPLES, and only this context's
+  // channels
+  size_t nrow = info->ntime/PULSAR_SAMPLES;
+  unsigned char *bins_h = (unsigned char *)malloc(nrow*info->nfrequency);
+  if(!bins_h) {
+    return XGPU_OUT_OF_MEMORY;
+  }
+  for(size_t r=0; r<nrow; r++) {
+    memcpy(bins_h + r*info->nfrequency,
+           bins + r*PULSAR_SAMPLES*internal->full_nfrequency + internal->freq_offset,
+           info->nfrequency);
+  }
+
+  //assign the device
+  cudaSetDevice(internal->device);
+
+  // The kernels of previous calls read the table on this stream
+  cudaStream_t stream = workStream(internal);
+  cudaMemcpyAsync(internal->bins_d, bins_h, nrow*info->nfrequency, cudaMemcpyHostToDevice, stream);
+  cudaStreamSynchronize(stream);
+  free(bins_h);
+  checkCudaError();
+
+  return XGPU_OK;
+}
+
+int xgpuSetStationMask(XGPUContext *context, const unsigned char *active)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  // Not available on the CPU X-engine
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+
+  // Every device correlates all stations of its channels
+  for(int i=0; i<internal->nshard; i++) {
+    int error = xgpuSetStationMask(&internal->shard[i], active);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+  if(internal->nshard) {
+    return XGPU_OK;
+  }
+
+  XGPUInfo *info = &internal->info;
+  //assign the device
+  cudaSetDevice(internal->device);
+
+  // The kernels of previous calls read the old list on this stream, and a
+  // captured pipeline launches a grid of its size
+  cudaStream_t stream = workStream(internal);
+  cudaStreamSynchronize(stream);
+  discardGraph(internal);
+  cudaFree(internal->tiles_d);
+  internal->tiles_d = NULL;
+  internal->ntile = 0;
+  checkCudaError();
+  if(!active) {
+    return XGPU_OK;
+  }
+
+  // Each thread of a tile computes a 2x2 block of stations
+  const unsigned int width = 2*TILE_WIDTH;
+  const unsigned int nside = info->nstation / width;
+  const unsigned int ntriangle = (nside+1)*nside/2;
+  unsigned int *tiles_h = (unsigned int *)malloc(ntriangle*sizeof(unsigned int));
+  bool *live = (bool *)calloc(nside, sizeof(bool));
+  if(!tiles_h || !live) {
+    free(tiles_h);
+    free(live);
+    return XGPU_OUT_OF_MEMORY;
+  }
+  for(unsigned int s=0; s<info->nstation; s++) {
+    if(active[s]) {
+      live[s / width] = true;
+    }
+  }
+  // Keep the order of the full triangle
+  unsigned int ntile = 0;
+  for(unsigned int blockY=0; blockY<nside; blockY++) {
+    for(unsigned int blockX=0; blockX<=blockY; blockX++) {
+      if(live[blockX] && live[blockY]) {
+        tiles_h[ntile++] = ((blockY+1)*blockY)/2 + blockX;
+      }
+    }
+  }
+
+  cudaMalloc((void **) &(internal->tiles_d), ntriangle*sizeof(unsigned int));
+  cudaMemcpyAsync(internal->tiles_d, tiles_h, ntile*sizeof(unsigned int), cudaMemcpyHostToDevice, stream);
+  cudaStreamSynchronize(stream);
+  internal->ntile = ntile;
+  free(tiles_h);
+  free(live);
+  checkCudaError();
+
+  return XGPU_OK;
+}
+
+int xgpuSetLongIntegration(XGPUContext *context, int enable)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+  for(int i=0; i<internal->nshard; i++) {
+    int error = xgpuSetLongIntegration(&internal->shard[i], enable);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+  if(internal->nshard) {
+    return XGPU_OK;
+  }
+  long long unsigned int matLength = internal->nbatch*internal->info.matLength;
+  //assign the device
+  cudaSetDevice(internal->device);
+
+  if(!enable) {
+    // cudaFree waits for any fold still using the buffers
+    cudaFree(internal->long_d);
+    cudaFree(internal->long_dump_d);
+    internal->long_d = NULL;
+    internal->long_dump_d = NULL;
+  } else if(!internal->long_d) {
+    cudaMalloc((void **) &(internal->long_d), matLength*sizeof(WideComplex));
+    cudaMalloc((void **) &(internal->long_dump_d), matLength*sizeof(Complex));
+    checkCudaError();
+    cudaMemsetAsync(internal->long_d, '\0', matLength*sizeof(WideComplex), workStream(internal));
+  }
+  checkCudaError();
+
+  return XGPU_OK;
+}
+
+int xgpuFoldIntegration(XGPUContext *context)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+  for(int i=0; i<internal->nshard; i++) {
+    int error = xgpuFoldIntegration(&internal->shard[i]);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+  if(internal->nshard) {
+    return XGPU_OK;
+  }
+  //assign the device
+  cudaSetDevice(internal->device);
+
+  restartIntegration(internal, workStream(internal));
+  checkCudaError();
+
+  return XGPU_OK;
+}
+
+int xgpuSetFoldInterval(XGPUContext *context, unsigned int ncall)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+  for(int i=0; i<internal->nshard; i++) {
+    int error = xgpuSetFoldInterval(&internal->shard[i], ncall);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+  internal->fold_interval = ncall;
+
+  return XGPU_OK;
+}
+
+int xgpuSetLongIntegrationScale(XGPUContext *context, double scale)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+  for(int i=0; i<internal->nshard; i++) {
+    int error = xgpuSetLongIntegrationScale(&internal->shard[i], scale);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+  internal->long_scale = scale;
+
+  return XGPU_OK;
+}
+
+int xgpuDumpLongIntegration(XGPUContext *context, Complex *matrix_h)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+  for(int i=0; i<internal->nshard; i++) {
+    int error = xgpuDumpLongIntegration(&internal->shard[i], matrix_h);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+  if(internal->nshard) {
+    return XGPU_OK;
+  }
+  if(!internal->long_d) {
+    return XGPU_INVALID_ARGUMENT;
+  }
+  long long unsigned int matLength = internal->nbatch*internal->info.matLength;
+  cudaStream_t stream = workStream(internal);
+  int error;
+
+  //assign the device
+  cudaSetDevice(internal->device);
+
+  // narrow to Complex, reorder or pack into a staging buffer if needed, then
+  // copy that back
+  dim3 dimBlock(256);
+  dim3 dimGrid((matLength + dimBlock.x - 1) / dimBlock.x);
+  CUBE_ASYNC_KERNEL_CALL(narrowIntegration, dimGrid, dimBlock, 0, stream,
+			 internal->long_dump_d, internal->long_d, internal->long_scale, matLength);
+  const Complex *matrix_d = internal->long_dump_d;
+  if(internal->reorder || internal->pack) {
+    error = stageMatrix(internal, internal->dump_next, stream, internal->long_dump_d);
+    if(error != XGPU_OK) {
+      return error;
+    }
+    matrix_d = internal->matrix_dump_d[internal->dump_next];
+  }
+  error = copyMatrixToHost(internal, matrix_h, matrix_d, stream);
+  if(error != XGPU_OK) {
+    return error;
+  }
+  cudaMemsetAsync(internal->long_d, '\0', matLength*sizeof(WideComplex), stream);
+  cudaStreamSynchronize(stream);
+  checkCudaError();
+
+  return XGPU_OK;
+}
+
+int xgpuSetOutputFormat(XGPUContext *context, int output_type, float scale)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+  if(output_type != NATIVE_OUTPUT_TYPE && output_type != XGPU_FLOAT16 && output_type != XGPU_INT16) {
+    return XGPU_INVALID_ARGUMENT;
+  }
+  for(int i=0; i<internal->nshard; i++) {
+    int error = xgpuSetOutputFormat(&internal->shard[i], output_type, scale);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+
+  internal->output_type = output_type;
+  internal->output_scale = scale;
+  internal->pack = output_type != NATIVE_OUTPUT_TYPE || internal->nproduct;
+
+  return XGPU_OK;
+}
+
+int xgpuSetOutputProducts(XGPUContext *context, const unsigned int *products, unsigned int nproduct)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+  if(!products) {
+    nproduct = 0;
+  }
+  for(unsigned int p=0; p<nproduct; p++) {
+    if(products[p] >= NPOL*NPOL*internal->info.nbaseline) {
+      return XGPU_INVALID_ARGUMENT;
+    }
+  }
+  for(int i=0; i<internal->nshard; i++) {
+    int error = xgpuSetOutputProducts(&internal->shard[i], products, nproduct);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+
+  internal->nproduct = nproduct;
+  internal->pack = internal->output_type != NATIVE_OUTPUT_TYPE || nproduct;
+  if(internal->nshard) {
+    return XGPU_OK;
+  }
+
+  //assign the device
+  cudaSetDevice(internal->device);
+
+  // cudaFree waits for any dump still packing the previous products
+  cudaFree(internal->products_d);
+  internal->products_d = NULL;
+  if(nproduct) {
+    cudaMalloc((void **) &(internal->products_d), nproduct*sizeof(unsigned int));
+    checkCudaError();
+    cudaMemcpyAsync(internal->products_d, products, nproduct*sizeof(unsigned int), cudaMemcpyHostToDevice, workStream(internal));
+    cudaStreamSynchronize(workStream(internal));
+  }
+  checkCudaError();
+
+  return XGPU_OK;
+}
+
+size_t xgpuOutputSize(XGPUContext *context)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return 0;
+  }
+  if(internal->pack) {
+    return internal->nbatch*outputSize(internal);
+  }
+  return internal->nbatch*internal->info.matLength*sizeof(Complex);
+}
+
+int xgpuSetFlagging(XGPUContext *context, float threshold, unsigned int *weights_h)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+  for(int i=0; i<internal->nshard; i++) {
+    XGPUInternalContext *shard = (XGPUInternalContext *)internal->shard[i].internal;
+    unsigned int *shard_weights_h = weights_h ? weights_h + (size_t)shard->freq_offset*internal->info.nbaseline : NULL;
+    int error = xgpuSetFlagging(&internal->shard[i], threshold, shard_weights_h);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+  if(internal->nshard) {
+    internal->flag = threshold > 0;
+    internal->flag_threshold = threshold;
+    internal->weights_h = weights_h;
+    return XGPU_OK;
+  }
+
+#if defined(DP4A) || COMPLEX_BLOCK_SIZE == 32
+  // flagInput needs natural order input
+  if(threshold > 0 && !internal->swizzle) {
+    return XGPU_INVALID_FLAGS;
+  }
+#endif
+
+  XGPUInfo *info = &internal->info;
+  //assign the device
+  cudaSetDevice(internal->device);
+
+  // A captured pipeline has or lacks the flagging kernels, which hold the
+  // threshold as an argument
+  if(internal->flag != (threshold > 0) || (threshold > 0 && internal->flag_threshold != threshold)) {
+    discardGraph(internal);
+  }
+
+  internal->flag = threshold > 0;
+  internal->flag_threshold = threshold;
+  internal->weights_h = weights_h;
+  if(!internal->flag) {
+    // cudaFree waits for the kernels still using the buffers
+    freeFlagging(internal);
+  } else if(!internal->weights_d) {
+    size_t flags_size = (size_t)internal->nbatch*info->nfrequency*info->nstation*FLAG_WORDS(info->ntimepipe)*sizeof(unsigned int);
+    cudaMalloc((void **) &(internal->flags_d), flags_size);
+    cudaMalloc((void **) &(internal->weights_d), weightsSize(internal));
+    for(int i=0; i<2; i++) {
+      cudaMalloc((void **) &(internal->weights_dump_d[i]), weightsSize(internal));
+    }
+    checkCudaError();
+    // The weights start with the integration, i.e. count the samples since its
+    // last restart
+    cudaMemsetAsync(internal->weights_d, '\0', weightsSize(internal), workStream(internal));
+  }
+  checkCudaError();
+
+  return XGPU_OK;
+}
+
+int xgpuSetChannelizer(XGPUContext *context, int nfft, int ntap, int first_channel, float scale)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+
+  FFT_t fft_launcher = NULL;
+  int granularity = 1;
+  switch(nfft) {
+    case 0: break;
+    case 8: fft_launcher = FFT8; granularity = 64; break;
+    case 16: fft_launcher = FFT16; granularity = 64; break;
+    case 64: fft_launcher = FFT64; granularity = 8; break;
+    case 256: fft_launcher = FFT256; granularity = 4; break;
+    case 512: fft_launcher = FFT512; break;
+    case 1024: fft_launcher = FFT1024; break;
+    case 2048: fft_launcher = FFT2048; break;
+    case 4096: fft_launcher = FFT4096; break;
+    case 8192: fft_launcher = FFT8192; break;
+    default: return XGPU_INVALID_ARGUMENT;
+  }
+  // The parent checks all the channels before configuring any shard, each
+  // shard only its own (its first_channel includes its freq_offset)
+  XGPUInfo *info = &internal->info;
+  if(nfft && (ntap < 1 || first_channel < 0 || first_channel + info->nfrequency > (unsigned int)nfft)) {
+    return XGPU_INVALID_ARGUMENT;
+  }
+
+  for(int i=0; i<internal->nshard; i++) {
+    XGPUInternalContext *shard = (XGPUInternalContext *)internal->shard[i].internal;
+    int error = xgpuSetChannelizer(&internal->shard[i], nfft, ntap, first_channel + shard->freq_offset, scale);
+    if(error != XGPU_OK) {
+      // The failed shard has lost any previous channelizer, so remove that
+      // of every shard rather than leave them mixed
+      for(int k=0; k<=i; k++) {
+        xgpuSetChannelizer(&internal->shard[k], 0, 0, 0, 0.0f);
+      }
+      internal->nfft = 0;
+      internal->ntap = 0;
+      return error;
+    }
+  }
+  if(internal->nshard) {
+    internal->nfft = nfft;
+    internal->ntap = ntap;
+    return XGPU_OK;
+  }
+
+  if(nfft && internal->nbatch > 1) {
+    return XGPU_INVALID_ARGUMENT;
+  }
+#if defined(DP4A) || COMPLEX_BLOCK_SIZE == 32
+  // quantizeSpectra writes natural order input
+  if(nfft && !internal->swizzle) {
+    return XGPU_INVALID_FLAGS;
+  }
+#endif
+
+  //assign the device
+  cudaSetDevice(internal->device);
+
+  // cudaFree waits for the kernels still using the buffers
+  freeChannelizer(internal);
+  checkCudaError();
+  if(!nfft) {
+    return XGPU_OK;
+  }
+
+  internal->ntap = ntap;
+  internal->first_channel = first_channel;
+  internal->fscale = scale;
+  internal->fft_launcher = fft_launcher;
+  int ninput = info->nstation * NPOL;
+  internal->fft_batch = (ninput*info->ntimepipe + granularity - 1) / granularity * granularity;
+
+  size_t voltages_size = (size_t)(info->ntimepipe + ntap - 1) * nfft * ninput * sizeof(ComplexInput);
+  for(int i=0; i<internal->depth; i++) {
+    cudaMalloc((void **) &(internal->voltages_d[i]), voltages_size);
+  }
+  cudaMalloc((void **) &(internal->fft_d), (size_t)internal->fft_batch * nfft * sizeof(float2));
+  cudaMalloc((void **) &(internal->pfb_window_d), (size_t)ntap * nfft * sizeof(float));
+  checkCudaError();
+  // The transforms that round up the batch read whatever is there
+  cudaMemsetAsync(internal->fft_d, '\0', (size_t)internal->fft_batch * nfft * sizeof(float2), internal->compute_stream);
+
+  // Sinc filter of ntap channels' width, tapered by a Hann window
+  size_t nwindow = (size_t)ntap * nfft;
+  float *window_h = (float *)malloc(nwindow * sizeof(float));
+  if(!window_h) {
+    freeChannelizer(internal);
+    return XGPU_OUT_OF_MEMORY;
+  }
+  for(size_t i=0; i<nwindow; i++) {
+    if(ntap == 1) {
+      window_h[i] = 1.0f;
+    } else {
+      double x = M_PI * ((double)i - nwindow/2.0 + 0.5) / nfft;
+      double sinc = x == 0.0 ? 1.0 : sin(x) / x;
+      window_h[i] = sinc * (0.5 - 0.5*cos(2.0*M_PI*(i + 0.5) / nwindow));
+    }
+  }
+  cudaMemcpyAsync(internal->pfb_window_d, window_h, nwindow * sizeof(float), cudaMemcpyHostToDevice, internal->compute_stream);
+  cudaStreamSynchronize(internal->compute_stream);
+  free(window_h);
+  checkCudaError();
+
+  internal->nfft = nfft;
+
+  return XGPU_OK;
+}
+
+// Issue the pipeline of one call of xgpuCudaXengine and any dump, without
+// waiting for them.
+static int enqueueXengine(XGPUContext *context, int syncOp)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+
+  //assign the device
+  cudaSetDevice(internal->device);
+
+  ComplexInput *array_hp = context->array_h + context->input_offset;
+  int error;
+
+  // The events of the previous call are about to be recorded again
+  collectTimings(internal, true);
+
+  if(internal->input_current >= 0) {
+    error = issueDevicePipeline(internal);
+  } else if(internal->use_graph) {
+    error = launchGraph(internal, array_hp);
+  } else {
+    error = issuePipeline(internal, array_hp, false);
+  }
+  if(error != XGPU_OK) {
+    return error;
+  }
+
+  if(syncOp == SYNCOP_DUMP || syncOp == SYNCOP_DUMP_ASYNC) {
+    pushRange("xgpu dump", internal->dump_next);
+    error = syncOp == SYNCOP_DUMP ? dumpSync(context) : dumpAsync(context);
+    nvtxRangePop();
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+
+  // Fold into the long integration before the integration can overflow.  A
+  // call whose SYNCOP_DUMP_ASYNC restarted the integration has already done
+  // so, and leaves nothing to count.
+  if(internal->long_d && internal->fold_interval && syncOp != SYNCOP_DUMP_ASYNC &&
+     ++internal->fold_count >= internal->fold_interval) {
+    restartIntegration(internal, workStream(internal));
+    checkCudaError();
+  }
+
+  return XGPU_OK;
+}
+
+// Wait for the work issued by enqueueXengine as requested by syncOp.
+static int finishXengine(XGPUContext *context, int syncOp)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+
+  //assign the device
+  cudaSetDevice(internal->device);
+
+  cudaStream_t stream = workStream(internal);
+
+  if(syncOp == SYNCOP_DUMP) {
+    cudaStreamSynchronize(stream);
+  } else if(syncOp == SYNCOP_DUMP_ASYNC) {
+    // Completion is reported by xgpuDumpQuery and the dump callback
+  } else if(internal->use_graph) {
+    // A graph completes on the stream it was launched into, and the next
+    // graph launch is ordered after this one by that stream
+    if(syncOp != SYNCOP_NONE) {
+      cudaStreamSynchronize(internal->copy_streams[0]);
+    }
+  } else if(syncOp == SYNCOP_SYNC_COMPUTE) {
+    // Synchronize on the compute stream (i.e. wait for it to complete)
+    cudaStreamSynchronize(internal->compute_stream);
+  } else if(syncOp == SYNCOP_SYNC_TRANSFER) {
+    // Synchronize on the transfer streams (i.e. wait for them to complete)
+    for(int i=0; i<internal->ncopy; i++) {
+      cudaStreamSynchronize(internal->copy_streams[i]);
+    }
+  }
+  checkCudaError();
+
+  collectTimings(internal, false);
+
+  return XGPU_OK;
+}
+
+// Dump callback of the shards of a multi-device context.  The dump of the
+// multi-device context has landed once those of all of its shards have.
+static void shardDumpCallback(XGPUContext *shard, Complex *matrix_h, void *user_data)
+{
+  XGPUDumpSlot *slot = (XGPUDumpSlot *)user_data;
+  if(__sync_sub_and_fetch(&slot->pending, 1) == 0) {
+    slot->callback(slot->context, slot->matrix_h, slot->user_data);
+  }
+}
+
+// Run one call of xgpuCudaXengine on every shard of a multi-device context.
+// The work of all shards is issued before waiting for any of them, so the
+// devices run concurrently.
+static int multiXengine(XGPUContext *context, int syncOp)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  int error;
+
+  if(syncOp == SYNCOP_DUMP_ASYNC) {
+    // The shards' dumps alternate between staging buffers in step with this
+    // context, so dump slot i covers staging buffer i of every shard
+    int i = internal->dump_next;
+    XGPUDumpSlot *slot = &internal->dump_slot[i];
+
+    // Wait for the previous dump of every shard from this slot, including its
+    // callbacks, before reusing the slot
+    for(int s=0; s<internal->nshard; s++) {
+      XGPUInternalContext *shard = (XGPUInternalContext *)internal->shard[s].internal;
+      cudaSetDevice(shard->device);
+      cudaEventSynchronize(shard->dumpCompletion[i]);
+    }
+    checkCudaError();
+
+    slot->context = context;
+    slot->matrix_h = context->matrix_h + context->output_offset;
+    slot->callback = internal->dump_callback;
+    slot->user_data = internal->dump_user_data;
+    slot->pending = internal->nshard;
+    for(int s=0; s<internal->nshard; s++) {
+      XGPUInternalContext *shard = (XGPUInternalContext *)internal->shard[s].internal;
+      shard->dump_callback = slot->callback ? shardDumpCallback : NULL;
+      shard->dump_user_data = slot;
+    }
+
+    internal->dump_next = (i+1) % 2;
+  }
+
+  for(int s=0; s<internal->nshard; s++) {
+    XGPUContext *shard = &internal->shard[s];
+    shard->array_h = context->array_h;
+    shard->input_offset = context->input_offset;
+    shard->matrix_h = context->matrix_h;
+    shard->output_offset = context->output_offset;
+    error = enqueueXengine(shard, syncOp);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+
+  for(int s=0; s<internal->nshard; s++) {
+    error = finishXengine(&internal->shard[s], syncOp);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+
+  return XGPU_OK;
+}
+
+// Run one call of xgpuCudaXengine on the host (XGPU_CPU_DEVICE).  Dumps are
+// complete on return, asynchronous ones calling the dump callback (if any)
+// before returning too.
+static int cpuXengine(XGPUContext *context, int syncOp)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  const XGPUInfo *info = &internal->info;
+  int matrix_order = internal->reorder ? TRIANGULAR_ORDER : MATRIX_ORDER;
+
+  for(int b=0; b<internal->nbatch; b++) {
+    xgpuCpuXengineSized(info, internal->cpu_matrix + b*info->matLength,
+                        context->array_h + context->input_offset + b*info->vecLength,
+                        matrix_order, internal->swizzle, 1);
+  }
+
+  if(syncOp == SYNCOP_DUMP || syncOp == SYNCOP_DUMP_ASYNC) {
+    Complex *matrix_h = context->matrix_h + context->output_offset;
+    size_t matLength = internal->nbatch*info->matLength;
+    memcpy(matrix_h, internal->cpu_matrix, matLength*sizeof(Complex));
+    if(syncOp == SYNCOP_DUMP_ASYNC) {
+      // Restart the integration, as on the GPU
+      memset(internal->cpu_matrix, '\0', matLength*sizeof(Complex));
+      if(internal->dump_callback) {
+        internal->dump_callback(context, matrix_h, internal->dump_user_data);
+      }
+    }
+  }
+
+  return XGPU_OK;
+}
+
+// Claim the context for one call of xgpuCudaXengine (or a variant), failing
+// if another thread is in the middle of one.  In CUBE builds, also wait for
+// any call on another context to finish.
+static int acquireContext(XGPUInternalContext *internal)
+{
+  if(__sync_lock_test_and_set(&internal->busy, 1)) {
+    return XGPU_CONTEXT_BUSY;
+  }
+  CUBE_LOCK();
+  return XGPU_OK;
+}
+
+static void releaseContext(XGPUInternalContext *internal)
+{
+  CUBE_UNLOCK();
+  __sync_lock_release(&internal->busy);
+}
+
+int xgpuCudaXengine(XGPUContext *context, int syncOp)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+
+  // xgpuSetHostInputBuffer and xgpuSetHostOutputBuffer must have been called
+  if( !internal->array_h_set || !internal->matrix_h_set ) {
+    return XGPU_HOST_BUFFER_NOT_SET;
+  }
+
+  int error = acquireContext(internal);
+  if(error != XGPU_OK) {
+    return error;
+  }
+
+  CUBE_ASYNC_START(ENTIRE_PIPELINE);
+
+  if(internal->nshard) {
+    error = multiXengine(context, syncOp);
+  } else if(internal->cpu) {
+    error = cpuXengine(context, syncOp);
+  } else {
+    error = enqueueXengine(context, syncOp);
+    if(error == XGPU_OK) {
+      error = finishXengine(context, syncOp);
+    }
+  }
+  releaseContext(internal);
+  if(error != XGPU_OK) {
+    return error;
+  }
+
+  CUBE_ASYNC_END(ENTIRE_PIPELINE);
+
+  return XGPU_OK;
+}
+
+int xgpuCudaFXengine(XGPUContext *context, const ComplexInput *voltages_h, int syncOp)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+
+  // xgpuSetHostOutputBuffer must have been called
+  if( !internal->matrix_h_set ) {
+    return XGPU_HOST_BUFFER_NOT_SET;
+  }
+  // A captured graph copies from the host input buffer
+  if(!internal->nfft || internal->use_graph) {
+    return XGPU_INVALID_FLAGS;
+  }
+
+  int error = acquireContext(internal);
+  if(error != XGPU_OK) {
+    return error;
+  }
+
+  internal->voltages_hp = voltages_h;
+  for(int i=0; i<internal->nshard; i++) {
+    ((XGPUInternalContext *)internal->shard[i].internal)->voltages_hp = voltages_h;
+  }
+
+  CUBE_ASYNC_START(ENTIRE_PIPELINE);
+
+  if(internal->nshard) {
+    error = multiXengine(context, syncOp);
+  } else {
+    error = enqueueXengine(context, syncOp);
+    if(error == XGPU_OK) {
+      error = finishXengine(context, syncOp);
+    }
+  }
+
+  internal->voltages_hp = NULL;
+  for(int i=0; i<internal->nshard; i++) {
+    ((XGPUInternalContext *)internal->shard[i].internal)->voltages_hp = NULL;
+  }
+  releaseContext(internal);
+  if(error != XGPU_OK) {
+    return error;
+  }
+
+  CUBE_ASYNC_END(ENTIRE_PIPELINE);
+
+  return XGPU_OK;
+}
+
+int xgpuSetDeviceInputBuffers(XGPUContext *context, ComplexInput **buffers_d, int nbuffer)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+  // Device pointers belong to one device, each buffer holds one input, and a
+  // captured graph reads the device input buffers
+  if(internal->nshard || internal->nbatch > 1 || internal->use_graph) {
+    return XGPU_INVALID_FLAGS;
+  }
+  if(nbuffer < 0 || (nbuffer > 0 && !buffers_d)) {
+    return XGPU_INVALID_ARGUMENT;
+  }
+
+  XGPUInfo *info = &internal->info;
+  int pipe_length = info->ntime / info->ntimepipe;
+
+  //assign the device
+  cudaSetDevice(internal->device);
+
+  // Wait for the kernels still reading the old buffers
+  cudaStreamSynchronize(internal->compute_stream);
+  freeDeviceInput(internal);
+  checkCudaError();
+  if(nbuffer == 0) {
+    return XGPU_OK;
+  }
+
+  // Every chunk is bound to a texture (or copied an int at a time by
+  // cp.async), so must be suitably aligned
+  int alignment = 1;
+  if(!internal->swizzle) {
+#ifdef ASYNC_COPY
+    alignment = sizeof(int2);
+#else
+    cudaDeviceGetAttribute(&alignment, cudaDevAttrTextureAlignment, internal->device);
+    checkCudaError();
+#endif
+  }
+  for(int i=0; i<nbuffer; i++) {
+    for(int p=0; p<pipe_length; p++) {
+      if(!buffers_d[i] || (uintptr_t)(buffers_d[i] + p*info->vecLengthPipe) % alignment) {
+        return XGPU_INVALID_ARGUMENT;
+      }
+    }
+  }
+
+  internal->input_d = (ComplexInput **)malloc(nbuffer*sizeof(ComplexInput *));
+  if(!internal->swizzle) {
+    internal->input_tex = (InputSource *)calloc(nbuffer*pipe_length, sizeof(InputSource));
+  }
+  if(!internal->input_d || (!internal->swizzle && !internal->input_tex)) {
+    freeDeviceInput(internal);
+    return XGPU_OUT_OF_MEMORY;
+  }
+  internal->ninput_d = nbuffer;
+  for(int i=0; i<nbuffer; i++) {
+    internal->input_d[i] = buffers_d[i];
+    for(int p=0; !internal->swizzle && p<pipe_length; p++) {
+      internal->input_tex[i*pipe_length + p] = createInputSource(internal, buffers_d[i] + p*info->vecLengthPipe);
+    }
+  }
+  checkCudaError();
+
+  return XGPU_OK;
+}
+
+int xgpuCudaXengineDevice(XGPUContext *context, int buffer, cudaEvent_t ready, cudaEvent_t consumed, int syncOp)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+
+  // xgpuSetHostOutputBuffer must have been called
+  if( !internal->matrix_h_set ) {
+    return XGPU_HOST_BUFFER_NOT_SET;
+  }
+  if(buffer < 0 || buffer >= internal->ninput_d) {
+    return XGPU_INVALID_ARGUMENT;
+  }
+
+  int error = acquireContext(internal);
+  if(error != XGPU_OK) {
+    return error;
+  }
+
+  internal->input_current = buffer;
+  internal->input_ready = ready;
+  internal->input_consumed = consumed;
+
+  CUBE_ASYNC_START(ENTIRE_PIPELINE);
+
+  error = enqueueXengine(context, syncOp);
+  if(error == XGPU_OK) {
+    error = finishXengine(context, syncOp);
+  }
+
+  internal->input_current = -1;
+  internal->input_ready = NULL;
+  internal->input_consumed = NULL;
+  releaseContext(internal);
+  if(error != XGPU_OK) {
+    return error;
+  }
+
+  CUBE_ASYNC_END(ENTIRE_PIPELINE);
+
+  return XGPU_OK;
+}
+
+// Add the timings collected by internal (or by each of its shards) to timing
+// and dropped.  The calls collect their own timings, so this does not touch
+// the events of a context another thread may be driving.
+static void mergeTimings(XGPUInternalContext *internal, XGPUTiming *timing, long long unsigned int *dropped)
+{
+  if(internal->nshard) {
+    for(int i=0; i<internal->nshard; i++) {
+      mergeTimings((XGPUInternalContext *)internal->shard[i].internal, timing, dropped);
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&internal->stats_mutex);
+  for(int stage=0; stage<NSTAGE; stage++) {
+    const XGPUTiming *from = &internal->timing[stage];
+    timing[stage].count += from->count;
+    timing[stage].sum += from->sum;
+    if(from->max > timing[stage].max) {
+      timing[stage].max = from->max;
+    }
+    for(int k=0; k<XGPU_STATS_NBIN; k++) {
+      timing[stage].histogram[k] += from->histogram[k];
+    }
+  }
+  *dropped += internal->dropped;
+  pthread_mutex_unlock(&internal->stats_mutex);
+}
+
+// Duration below which a fraction q of timing falls, interpolated
+// geometrically within its bin and capped at the longest duration
+static float timingPercentile(const XGPUTiming *timing, double q)
+{
+  double target = q*timing->count;
+  long long unsigned int below = 0;
+  for(int k=0; k<XGPU_STATS_NBIN; k++) {
+    long long unsigned int n = timing->histogram[k];
+    if(n && below + n >= target) {
+      float ms = 1e-3f * exp2f((k + (float)((target - below) / n)) / 4);
+      return ms < timing->max ? ms : timing->max;
+    }
+    below += n;
+  }
+  return timing->max;
+}
+
+int xgpuGetStats(XGPUContext *context, XGPUStats *stats)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+  if(!stats) {
+    return XGPU_INVALID_ARGUMENT;
+  }
+
+  XGPUTiming timing[NSTAGE];
+  memset(timing, 0, sizeof(timing));
+  stats->dropped = 0;
+  mergeTimings(internal, timing, &stats->dropped);
+
+  XGPUStageStats *stage_stats[NSTAGE] = {&stats->h2d, &stats->kernel, &stats->dump};
+  for(int stage=0; stage<NSTAGE; stage++) {
+    XGPUStageStats *out = stage_stats[stage];
+    out->count = timing[stage].count;
+    out->mean = timing[stage].count ? timing[stage].sum / timing[stage].count : 0;
+    out->p50 = timingPercentile(&timing[stage], 0.5);
+    out->p99 = timingPercentile(&timing[stage], 0.99);
+    out->max = timing[stage].max;
+    memcpy(out->histogram, timing[stage].histogram, sizeof(out->histogram));
+  }
+
+  return XGPU_OK;
+}
+
+int xgpuResetStats(XGPUContext *context)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+
+  for(int i=0; i<internal->nshard; i++) {
+    xgpuResetStats(&internal->shard[i]);
+  }
+  if(internal->nshard) {
+    return XGPU_OK;
+  }
+
+  pthread_mutex_lock(&internal->stats_mutex);
+  memset(internal->timing, 0, sizeof(internal->timing));
+  internal->dropped = 0;
+  pthread_mutex_unlock(&internal->stats_mutex);
+
+  return XGPU_OK;
+}
+
+int xgpuKernelOccupancy(XGPUContext *context, float *occupancy)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+  if(!occupancy) {
+    return XGPU_INVALID_ARGUMENT;
+  }
+  // The shards differ only in their number of channels
+  if(internal->nshard) {
+    return xgpuKernelOccupancy(&internal->shard[0], occupancy);
+  }
+
+  //assign the device
+  cudaSetDevice(internal->device);
+
+  int nthread = TILE_WIDTH*TILE_HEIGHT;
+  int nblock = 0;
+#if defined(DP4A) && COMPLEX_BLOCK_SIZE == 1
+  if(internal->use_tensor) {
+    nthread *= 2;
+    cudaOccupancyMaxActiveBlocksPerMultiprocessor(&nblock, wmma2x2, nthread, 0);
+  } else
+#endif
+  {
+    cudaOccupancyMaxActiveBlocksPerMultiprocessor(&nblock, shared2x2Kernel(internal), nthread, 0);
+  }
+  int max_threads = 0;
+  cudaDeviceGetAttribute(&max_threads, cudaDevAttrMaxThreadsPerMultiProcessor, internal->device);
+  checkCudaError();
+
+  *occupancy = max_threads ? (float)(nblock*nthread) / max_threads : 0;
+
+  return XGPU_OK;
+}
+
+// Number of timed integrations of each variant, of which xgpuAutotune takes
+// the fastest
+#define TUNING_REPEATS 3
+
+// Time the correlator launches of one integration with the current variant
+// of internal into ms, adding to the device integration buffer
+static int timeCorrelator(XGPUInternalContext *internal, cudaEvent_t start, cudaEvent_t stop, float *ms)
+{
+  cudaStream_t stream = internal->compute_stream;
+  int pipe_length = internal->info.ntime / internal->info.ntimepipe;
+
+  // The first launch loads the variant onto the device
+  launchShared2x2(internal, stream, internal->swizzle ? internal->texSwizzled : internal->texObject[0], 0);
+
+  *ms = -1;
+  for(int r=0; r<TUNING_REPEATS; r++) {
+    cudaEventRecord(start, stream);
+    for(int p=0; p<pipe_length; p++) {
+      InputSource texObj = internal->swizzle ? internal->texSwizzled : internal->texObject[p % internal->depth];
+      launchShared2x2(internal, stream, texObj, p);
+    }
+    cudaEventRecord(stop, stream);
+    cudaEventSynchronize(stop);
+    checkCudaError();
+
+    float elapsed;
+    cudaEventElapsedTime(&elapsed, start, stop);
+    if(*ms < 0 || elapsed < *ms) {
+      *ms = elapsed;
+    }
+  }
+
+  return XGPU_OK;
+}
+
+// Time every variant of the correlator on internal and select the fastest,
+// leaving the device integration buffer as it was
+static int tuneXengine(XGPUInternalContext *internal)
+{
+  size_t matrix_size = internal->nbatch*internal->info.matLength*sizeof(Complex);
+  cudaStream_t stream = internal->compute_stream;
+  Complex *saved_d = NULL;
+  cudaEvent_t start, stop;
+  int best = -1;
+  float best_ms = 0;
+  bool use_tensor = internal->use_tensor;
+  int buffer_depth = internal->buffer_depth;
+  int error;
+
+  XGPUDeviceAttr attr;
+  error = getDeviceAttr(internal->device, &attr);
+  if(error != XGPU_OK) {
+    return error;
+  }
+
+  // The trial launches add to the integration, so keep a copy of it once
+  // everything adding to it has completed
+  cudaMalloc((void **) &saved_d, matrix_size);
+  cudaEventCreate(&start);
+  cudaEventCreate(&stop);
+  cudaStreamSynchronize(workStream(internal));
+  cudaMemcpyAsync(saved_d, internal->matrix_d, matrix_size, cudaMemcpyDeviceToDevice, stream);
+  checkCudaError();
+
+  for(int v=0; v<NVARIANT; v++) {
+    const XGPUVariant *variant = &tuning_variants[v];
+    float ms;
+    if(variant->tensor && !internal->tensor_capable) {
+      continue;
+    }
+    internal->use_tensor = variant->tensor;
+    internal->buffer_depth = variant->buffer_depth;
+    error = timeCorrelator(internal, start, stop, &ms);
+    if(error != XGPU_OK) {
+      break;
+    }
+    xgpuLog(XGPU_LOG_INFO, "Variant %s: %.3f ms per integration", variant->name, ms);
+    if(best < 0 || ms < best_ms) {
+      best = v;
+      best_ms = ms;
+    }
+  }
+  if(error == XGPU_OK) {
+    internal->use_tensor = tuning_variants[best].tensor;
+    internal->buffer_depth = tuning_variants[best].buffer_depth;
+  } else {
+    // Leave the context as it was
+    internal->use_tensor = use_tensor;
+    internal->buffer_depth = buffer_depth;
+  }
+  // A captured pipeline launches the variant in use when it was captured
+  discardGraph(internal);
+
+  cudaMemcpyAsync(internal->matrix_d, saved_d, matrix_size, cudaMemcpyDeviceToDevice, stream);
+  cudaStreamSynchronize(stream);
+  cudaFree(saved_d);
+  cudaEventDestroy(start);
+  cudaEventDestroy(stop);
+  if(error != XGPU_OK) {
+    return error;
+  }
+  checkCudaError();
+
+  return saveTuning(internal, attr.name, tuning_variants[best].name, best_ms);
+}
+
+int xgpuAutotune(XGPUContext *context)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(internal->cpu) {
+    return XGPU_INVALID_FLAGS;
+  }
+
+  // Each device of a multi-device context is tuned for its own share
+  for(int i=0; i<internal->nshard; i++) {
+    int error = xgpuAutotune(&internal->shard[i]);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+  if(internal->nshard) {
+    return XGPU_OK;
+  }
+
+  int error = acquireContext(internal);
+  if(error != XGPU_OK) {
+    return error;
+  }
+
+  //assign the device
+  cudaSetDevice(internal->device);
+
+  error = tuneXengine(internal);
+  releaseContext(internal);
+
+  return error;
+}
+
+// Wait for all the work queued on internal (or its shards), including the
+// transfers of asynchronous dumps, so that its host buffers can be replaced
+static void waitForContext(XGPUInternalContext *internal)
+{
+  for(int i=0; i<internal->nshard; i++) {
+    waitForContext((XGPUInternalContext *)internal->shard[i].internal);
+  }
+  if(internal->cpu || internal->nshard) {
+    return;
+  }
+  cudaSetDevice(internal->device);
+  for(int i=0; i<internal->ncopy; i++) {
+    cudaStreamSynchronize(internal->copy_streams[i]);
+  }
+  cudaStreamSynchronize(internal->compute_stream);
+  cudaStreamSynchronize(internal->dump_stream);
+}
+
+// Bytes of each dump of context into its host output buffer, as written by
+// copyMatrixToHost (for a multi-device context, by all of its shards)
+static size_t dumpSize(XGPUInternalContext *internal)
+{
+  if(internal->nshard) {
+    internal = (XGPUInternalContext *)internal->shard[0].internal;
+  }
+  XGPUInfo *info = &internal->info;
+  size_t size = internal->pack ? outputSize(internal) : info->matLength*sizeof(Complex);
+  return internal->nbatch*(size/info->nfrequency*internal->full_nfrequency);
+}
+
+// Make the window of file of the records from first on the context's host
+// input or output buffer, registering it as xgpuSetHostInputBuffer or
+// xgpuSetHostOutputBuffer does, once the records of the previous window are
+// no longer in use, which are then dropped from the page cache (or written
+// back) while the records of the next window are read ahead.
+static int mapFileWindow(XGPUContext *context, XGPUFile *file, size_t first)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  size_t window = file->window < file->nrecord - first ? file->window : file->nrecord - first;
+  char *start = file->map + file->offset + first*file->record;
+  int error;
+
+  waitForContext(internal);
+  if(file->output) {
+    context->matrix_h = (Complex *)start;
+    context->matrix_len = window*file->record/sizeof(Complex);
+    error = xgpuSetHostOutputBuffer(context);
+  } else {
+    context->array_h = (ComplexInput *)start;
+    context->array_len = window*file->record/sizeof(ComplexInput);
+    error = xgpuSetHostInputBuffer(context);
+  }
+  if(error != XGPU_OK) {
+    return error;
+  }
+
+  // The previous window, if any, is done with
+  if(file->first < first) {
+    size_t offset = file->offset + file->first*file->record;
+    size_t length = (first - file->first)*file->record;
+    if(file->output) {
+      uintptr_t page = (uintptr_t)(file->map + offset) - (uintptr_t)(file->map + offset) % page_size;
+      msync((void *)page, (uintptr_t)(file->map + offset + length) - page, MS_ASYNC);
+    } else {
+      posix_fadvise(file->fd, offset, length, POSIX_FADV_DONTNEED);
+    }
+  }
+  file->first = first;
+
+  // Read the next window ahead while this one is in use
+  if(!file->output && first + window < file->nrecord) {
+    size_t ahead = file->window < file->nrecord - first - window ? file->window : file->nrecord - first - window;
+    posix_fadvise(file->fd, file->offset + (first + window)*file->record, ahead*file->record, POSIX_FADV_WILLNEED);
+  }
+
+  return XGPU_OK;
+}
+
+// Map the file at path (whose length is at least offset plus the nrecord
+// records of file) with prot, from a file opened with flags.  The records of
+// file and its window must be set.
+static int mapFile(XGPUFile *file, const char *path, int flags, int prot)
+{
+  file->fd = open(path, flags, 0644);
+  if(file->fd < 0) {
+    return XGPU_FILE_ERROR;
+  }
+  file->length = file->offset + file->nrecord*file->record;
+  if(flags & O_CREAT) {
+    int error = posix_fallocate(file->fd, 0, file->length);
+    if(error) {
+      errno = error;
+    }
+    if(error || ftruncate(file->fd, file->length)) {
+      close(file->fd);
+      return XGPU_FILE_ERROR;
+    }
+  }
+  void *map = mmap(NULL, file->length, prot, MAP_SHARED, file->fd, 0);
+  if(map == MAP_FAILED) {
+    close(file->fd);
+    return XGPU_FILE_ERROR;
+  }
+  file->map = (char *)map;
+  madvise(map, file->length, MADV_SEQUENTIAL);
+  file->next = 0;
+  file->first = 0;
+  if(file->window == 0 || file->window > file->nrecord) {
+    file->window = file->nrecord;
+  }
+
+  return XGPU_OK;
+}
+
+int xgpuOpenInputFile(XGPUContext *context, XGPUFile *file, const char *path, size_t window)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+
+  struct stat st;
+  if(stat(path, &st)) {
+    return XGPU_FILE_ERROR;
+  }
+  file->output = 0;
+  file->offset = 0;
+  file->record = internal->nbatch*internal->info.vecLength*sizeof(ComplexInput);
+  file->nrecord = st.st_size/file->record;
+  file->window = window;
+  if(file->nrecord == 0) {
+    return XGPU_INVALID_ARGUMENT;
+  }
+  int error = mapFile(file, path, O_RDONLY, PROT_READ);
+  if(error != XGPU_OK) {
+    return error;
+  }
+
+  internal->read_only_array_h = true;
+  error = mapFileWindow(context, file, 0);
+  if(error != XGPU_OK) {
+    xgpuCloseFile(context, file);
+  }
+
+  return error;
+}
+
+int xgpuOpenOutputFile(XGPUContext *context, XGPUFile *file, const char *path, size_t ndump, size_t window)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(ndump == 0) {
+    return XGPU_INVALID_ARGUMENT;
+  }
+
+  // Each dump starts at a Complex of the host output buffer, and the first at
+  // a page of the file
+  file->output = 1;
+  file->offset = (sizeof(XGPUFileHeader) + page_size - 1) / page_size * page_size;
+  file->record = (dumpSize(internal) + sizeof(Complex) - 1) / sizeof(Complex) * sizeof(Complex);
+  file->nrecord = ndump;
+  file->window = window;
+  int error = mapFile(file, path, O_RDWR | O_CREAT | O_TRUNC, PROT_READ | PROT_WRITE);
+  if(error != XGPU_OK) {
+    return error;
+  }
+
+  XGPUInternalContext *sizing = internal->nshard ? (XGPUInternalContext *)internal->shard[0].internal : internal;
+  XGPUFileHeader *header = (XGPUFileHeader *)file->map;
+  memset(header, 0, sizeof(XGPUFileHeader));
+  header->magic = XGPU_FILE_MAGIC;
+  header->version = XGPU_FILE_VERSION;
+  header->nbatch = internal->nbatch;
+  header->output_type = sizing->output_type;
+  header->nproduct = sizing->pack ? (sizing->nproduct ? sizing->nproduct : NPOL*NPOL*sizing->info.nbaseline) : 0;
+  header->header_size = file->offset;
+  header->dump_size = file->record;
+  header->ndump = 0;
+  header->info = internal->info;
+
+  error = mapFileWindow(context, file, 0);
+  if(error != XGPU_OK) {
+    xgpuCloseFile(context, file);
+  }
+
+  return error;
+}
+
+int xgpuNextFileRecord(XGPUContext *context, XGPUFile *file)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  if(file->next == file->nrecord) {
+    return XGPU_END_OF_FILE;
+  }
+  if(file->next >= file->first + file->window) {
+    int error = mapFileWindow(context, file, file->next);
+    if(error != XGPU_OK) {
+      return error;
+    }
+  }
+
+  size_t offset = (file->next - file->first)*file->record;
+  if(file->output) {
+    context->output_offset = offset/sizeof(Complex);
+    ((XGPUFileHeader *)file->map)->ndump = file->next + 1;
+  } else {
+    context->input_offset = offset/sizeof(ComplexInput);
+  }
+  file->next++;
+
+  return XGPU_OK;
+}
+
+int xgpuCloseFile(XGPUContext *context, XGPUFile *file)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+
+  // Give the context buffers of its own again before the mapping goes
+  waitForContext(internal);
+  int error;
+  if(file->output) {
+    context->matrix_h = NULL;
+    error = xgpuSetHostOutputBuffer(context);
+  } else {
+    internal->read_only_array_h = false;
+    context->array_h = NULL;
+    error = xgpuSetHostInputBuffer(context);
+  }
+
+  // Trim an output file to the dumps written
+  if(file->output) {
+    size_t length = file->offset + file->next*file->record;
+    if(msync(file->map, file->length, MS_SYNC) || ftruncate(file->fd, length)) {
+      error = XGPU_FILE_ERROR;
+    }
+  }
+  munmap(file->map, file->length);
+  if(close(file->fd) && file->output) {
+    error = XGPU_FILE_ERROR;
+  }
+  file->map = NULL;
+  file->fd = -1;
+
+  return error;
+}
+
+int xgpuGenerateDeviceInput(XGPUContext *context, ComplexInput *array_d, const XGPUSignal *signal)
+{
+  XGPUInternalContext *internal = (XGPUInternalContext *)context->internal;
+  if(!internal) {
+    return XGPU_NOT_INITIALIZED;
+  }
+  // Device pointers belong to one device
+  if(internal->cpu || internal->nshard) {
+    return XGPU_INVALID_FLAGS;
+  }
+  if(!array_d || !signal) {
+    return XGPU_INVALID_ARGUMENT;
+  }
+
+  XGPUInfo *info = &internal->info;
+  cudaStream_t stream = internal->compute_stream;
+  long long unsigned int n = (long long unsigned int)internal->nbatch * info->vecLength;
+  size_t table_size = (signal->nsource * (info->nstation+1) + 1) * sizeof(float);
+
+  float *table_h = (float *)malloc(table_size);
+  if(!table_h) {
+    return XGPU_OUT_OF_MEMORY;
+  }
+  signalTable(table_h, signal, info->nstation);
+
+  //assign the device
+  cudaSetDevice(internal->device);
+
+  float *table_d = NULL;
+  ComplexInput *natural_d = array_d;
+  cudaMalloc((void **) &table_d, table_size);
+#if defined(DP4A) || COMPLEX_BLOCK_SIZE == 32
+  // Unless the correlator swizzles its input itself, generate it elsewhere
+  // and swizzle it into array_d
+  if(!internal->swizzle) {
+    natural_d = NULL;
+    cudaMalloc((void **) &natural_d, n*sizeof(ComplexInput));
+  }
+#endif
+  // Only generate if the buffers were allocated, but free them either way
+  // (the error is still there for checkCudaError after that)
+  if(cudaPeekAtLastError() == cudaSuccess) {
+    cudaMemcpyAsync(table_d, table_h, table_size, cudaMemcpyHostToDevice, stream);
+
+    dim3 dimBlock(256);
+    dim3 dimGrid((n + dimBlock.x - 1) / dimBlock.x);
+    CUBE_ASYNC_KERNEL_CALL(generateInput, dimGrid, dimBlock, 0, stream,
+			   natural_d, table_d, signal->nsource, info->nstation, info->nfrequency,
+			   signal->noise, signal->seed, signal->time, n);
+#if defined(DP4A) || COMPLEX_BLOCK_SIZE == 32
+    if(natural_d != array_d) {
+      // The members of a batch follow one another in time
+      unsigned int ntime = internal->nbatch * info->ntime;
+      unsigned int row = info->nfrequency * info->nstation * NPOL * sizeof(ComplexInput);
+      dim3 dimGridSwizzle(((long long unsigned int)row*ntime/4 + dimBlock.x - 1) / dimBlock.x);
+      CUBE_ASYNC_KERNEL_CALL(swizzleInput, dimGridSwizzle, dimBlock, 0, stream,
+			     array_d, natural_d, row, ntime);
+    }
+#endif
+    cudaStreamSynchronize(stream);
+  }
+
+  if(natural_d != array_d) {
+    cudaFree(natural_d);
+  }
+  cudaFree(table_d);
+  free(table_h);
+  checkCudaError();
 
   return XGPU_OK;
 }
@@ -40,7 +40,7 @@ __global__ void FFT1024_device( float2 *dst, float2 *src )
     store<16>( a, dst, 64 );
 }   
     
-extern "C" void FFT1024( float2 *work, int batch )
+extern "C" void FFT1024( float2 *work, int batch, cudaStream_t stream )
 {	
-    FFT1024_device<<< grid2D(batch), 64 >>>( work, work );
+    FFT1024_device<<< grid2D(batch), 64, 0, stream >>>( work, work );
 }	
@@ -22,7 +22,7 @@ __global__ void FFT16_device( float2 *dst, float2 *src )
     store<16>( a, dst, 64 );
 }	
     
-extern "C" void FFT16( float2 *work, int batch )
+extern "C" void FFT16( float2 *work, int batch, cudaStream_t stream )
 {	
-    FFT16_device<<< grid2D(batch/64), 64 >>>( work, work );
+    FFT16_device<<< grid2D(batch/64), 64, 0, stream >>>( work, work );
 }	
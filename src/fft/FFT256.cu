@@ -34,7 +34,7 @@ __global__ void FFT256_device( float2 *dst, float2 *src )
     store<16>( a, dst, 16 );
 }	
     
-extern "C" void FFT256( float2 *work, int batch )
+extern "C" void FFT256( float2 *work, int batch, cudaStream_t stream )
 {	
-    FFT256_device<<< grid2D(batch/4), 64 >>>( work, work );
+    FFT256_device<<< grid2D(batch/4), 64, 0, stream >>>( work, work );
 }	
@@ -32,7 +32,7 @@ __global__ void FFT512_device( float2 *work )
     store<8>( a, work, 64 );
 }	
     
-extern "C" void FFT512( float2 *work, int batch )
+extern "C" void FFT512( float2 *work, int batch, cudaStream_t stream )
 {	
-    FFT512_device<<< grid2D(batch), 64 >>>( work );
+    FFT512_device<<< grid2D(batch), 64, 0, stream >>>( work );
 }	
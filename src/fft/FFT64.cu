@@ -32,7 +32,7 @@ __global__ void FFT64_device( float2 *work )
     store<8>( a, work, 64 );
 }	
     
-extern "C" void FFT64( float2 *work, int batch )
+extern "C" void FFT64( float2 *work, int batch, cudaStream_t stream )
 {	
-    FFT64_device<<< grid2D(batch/8), 64 >>>( work );
+    FFT64_device<<< grid2D(batch/8), 64, 0, stream >>>( work );
 }	
@@ -19,7 +19,7 @@ __global__ void FFT8_device( float2 *work )
     store<8>( a, work, 64 );
 }	
     
-extern "C" void FFT8( float2 *work, int batch )
+extern "C" void FFT8( float2 *work, int batch, cudaStream_t stream )
 {	
-    FFT8_device<<< grid2D(batch/64), 64 >>>( work );
+    FFT8_device<<< grid2D(batch/64), 64, 0, stream >>>( work );
 }	
@@ -26,8 +26,8 @@ __global__ void FFT16_device_( float2 *work )
     store<rank>( a, work, 512 );
 }	
 
-extern "C" void FFT8192( float2 *work, int batch )
+extern "C" void FFT8192( float2 *work, int batch, cudaStream_t stream )
 {	
-    FFT16_device_<<< grid2D(batch*(8192/rank)/64), 64 >>>( work );
-    FFT512_device<<< grid2D(batch*rank), 64 >>>( work );
+    FFT16_device_<<< grid2D(batch*(8192/rank)/64), 64, 0, stream >>>( work );
+    FFT512_device<<< grid2D(batch*rank), 64, 0, stream >>>( work );
 }	
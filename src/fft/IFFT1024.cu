@@ -40,7 +40,7 @@ __global__ void IFFT1024_device( float2 *dst, float2 *src )
     store<16>( a, dst, 64 );
 }   
     
-extern "C" void IFFT1024( float2 *work, int batch )
+extern "C" void IFFT1024( float2 *work, int batch, cudaStream_t stream )
 {	
-    IFFT1024_device<<< grid2D(batch), 64 >>>( work, work );
+    IFFT1024_device<<< grid2D(batch), 64, 0, stream >>>( work, work );
 }	
@@ -22,7 +22,7 @@ __global__ void IFFT16_device( float2 *dst, float2 *src )
     store<16>( a, dst, 64 );
 }	
     
-extern "C" void IFFT16( float2 *work, int batch )
+extern "C" void IFFT16( float2 *work, int batch, cudaStream_t stream )
 {	
-    IFFT16_device<<< grid2D(batch/64), 64 >>>( work, work );
+    IFFT16_device<<< grid2D(batch/64), 64, 0, stream >>>( work, work );
 }	
@@ -27,8 +27,8 @@ __global__ void IFFT4_device_( float2 *work )
     store<rank>( a, work, 512 );
 }	
 
-extern "C" void IFFT2048( float2 *work, int batch )
+extern "C" void IFFT2048( float2 *work, int batch, cudaStream_t stream )
 {	
-    IFFT512_device<<< grid2D(batch*rank), 64 >>>( work );
-    IFFT4_device_<<< grid2D(batch*(N/rank)/64), 64 >>>( work );
+    IFFT512_device<<< grid2D(batch*rank), 64, 0, stream >>>( work );
+    IFFT4_device_<<< grid2D(batch*(N/rank)/64), 64, 0, stream >>>( work );
 }	
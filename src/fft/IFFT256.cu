@@ -34,7 +34,7 @@ __global__ void IFFT256_device( float2 *dst, float2 *src )
     store<16>( a, dst, 16 );
 }	
     
-extern "C" void IFFT256( float2 *work, int batch )
+extern "C" void IFFT256( float2 *work, int batch, cudaStream_t stream )
 {	
-    IFFT256_device<<< grid2D(batch/4), 64 >>>( work, work );
+    IFFT256_device<<< grid2D(batch/4), 64, 0, stream >>>( work, work );
 }	
@@ -26,8 +26,8 @@ __global__ void IFFT8_device_( float2 *work )
     store<rank>( a, work, 512 );
 }	
 
-extern "C" void IFFT4096( float2 *work, int batch )
+extern "C" void IFFT4096( float2 *work, int batch, cudaStream_t stream )
 {	
-    IFFT512_device<<< grid2D(batch*rank), 64 >>>( work );
-    IFFT8_device_<<< grid2D(batch*(4096/rank)/64), 64 >>>( work );
+    IFFT512_device<<< grid2D(batch*rank), 64, 0, stream >>>( work );
+    IFFT8_device_<<< grid2D(batch*(4096/rank)/64), 64, 0, stream >>>( work );
 }	
@@ -32,7 +32,7 @@ __global__ void IFFT512_device( float2 *work )
     store<8>( a, work, 64 );
 }	
     
-extern "C" void IFFT512( float2 *work, int batch )
+extern "C" void IFFT512( float2 *work, int batch, cudaStream_t stream )
 {	
-    IFFT512_device<<< grid2D(batch), 64 >>>( work );
+    IFFT512_device<<< grid2D(batch), 64, 0, stream >>>( work );
 }	
@@ -32,7 +32,7 @@ __global__ void IFFT64_device( float2 *work )
     store<8>( a, work, 64 );
 }	
     
-extern "C" void IFFT64( float2 *work, int batch )
+extern "C" void IFFT64( float2 *work, int batch, cudaStream_t stream )
 {	
-    IFFT64_device<<< grid2D(batch/8), 64 >>>( work );
+    IFFT64_device<<< grid2D(batch/8), 64, 0, stream >>>( work );
 }	
@@ -19,7 +19,7 @@ __global__ void IFFT8_device( float2 *work )
     store<8>( a, work, 64 );
 }	
     
-extern "C" void IFFT8( float2 *work, int batch )
+extern "C" void IFFT8( float2 *work, int batch, cudaStream_t stream )
 {	
-    IFFT8_device<<< grid2D(batch/64), 64 >>>( work );
+    IFFT8_device<<< grid2D(batch/64), 64, 0, stream >>>( work );
 }	
@@ -371,6 +371,10 @@ template<int radix>inline __device__ void itwiddle_straight( float2 *a, int i, i
 //
 //  transpose via shared memory, input is in bit-reversed layout
 //
+//  Steps without a __syncthreads (within-warp permutations) still need a
+//  __syncwarp, since the threads of a warp do not run in lockstep on Volta and
+//  later devices
+//
 /* 
    s - initial store pointer
    ds - store stride
@@ -379,24 +383,24 @@ template<int radix>inline __device__ void itwiddle_straight( float2 *a, int i, i
  */
 template<int n> inline __device__ void transpose_br( float2 *a, float *s, int ds, float *l, int dl, int sync = 0xf )
 {
-    storex<n>( a, s, ds );	if( sync&8 ) __syncthreads();
-    loadx<n> ( a, l, dl );	if( sync&4 ) __syncthreads();
-    storey<n>( a, s, ds );	if( sync&2 ) __syncthreads();
-    loady<n> ( a, l, dl );  if( sync&1 ) __syncthreads();
+    storex<n>( a, s, ds );	if( sync&8 ) __syncthreads(); else __syncwarp();
+    loadx<n> ( a, l, dl );	if( sync&4 ) __syncthreads(); else __syncwarp();
+    storey<n>( a, s, ds );	if( sync&2 ) __syncthreads(); else __syncwarp();
+    loady<n> ( a, l, dl );  if( sync&1 ) __syncthreads(); else __syncwarp();
 }
 
 template<int n> inline __device__ void transpose_br( float2 *a, float *s, int ds, float *l, int *il, int sync = 0xf )
 {
-    storex<n>( a, s, ds );  if( sync&8 ) __syncthreads();
-    loadx<n> ( a, l, il );  if( sync&4 ) __syncthreads();
-    storey<n>( a, s, ds );  if( sync&2 ) __syncthreads();
-    loady<n> ( a, l, il );  if( sync&1 ) __syncthreads();
+    storex<n>( a, s, ds );  if( sync&8 ) __syncthreads(); else __syncwarp();
+    loadx<n> ( a, l, il );  if( sync&4 ) __syncthreads(); else __syncwarp();
+    storey<n>( a, s, ds );  if( sync&2 ) __syncthreads(); else __syncwarp();
+    loady<n> ( a, l, il );  if( sync&1 ) __syncthreads(); else __syncwarp();
 }
 
 inline __device__ void transpose4x4( float2 *a, float *s, int ds, float *l, int dl, int sync = 0xf )
 {
-    storex4x4( a, s, ds );  if( sync&8 ) __syncthreads();
-    loadx<16>( a, l, dl );  if( sync&4 ) __syncthreads();
-    storey4x4( a, s, ds );  if( sync&2 ) __syncthreads();
-    loady<16>( a, l, dl );  if( sync&1 ) __syncthreads();
+    storex4x4( a, s, ds );  if( sync&8 ) __syncthreads(); else __syncwarp();
+    loadx<16>( a, l, dl );  if( sync&4 ) __syncthreads(); else __syncwarp();
+    storey4x4( a, s, ds );  if( sync&2 ) __syncthreads(); else __syncwarp();
+    loady<16>( a, l, dl );  if( sync&1 ) __syncthreads(); else __syncwarp();
 }
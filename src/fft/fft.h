@@ -0,0 +1,32 @@
+// Written by Vasily Volkov.
+// Copyright (c) 2008-2009, The Regents of the University of California. 
+// All rights reserved.
+
+#pragma once
+
+#include <cuda_runtime.h>
+
+//
+//  in-place forward (FFTn) and inverse (IFFTn) transforms of batch contiguous
+//  vectors of n points on stream.  FFT8 and FFT16 need batch to be a multiple
+//  of 64, FFT64 of 8 and FFT256 of 4.
+//
+extern "C" void FFT8( float2 *work, int batch, cudaStream_t stream );
+extern "C" void FFT16( float2 *work, int batch, cudaStream_t stream );
+extern "C" void FFT64( float2 *work, int batch, cudaStream_t stream );
+extern "C" void FFT256( float2 *work, int batch, cudaStream_t stream );
+extern "C" void FFT512( float2 *work, int batch, cudaStream_t stream );
+extern "C" void FFT1024( float2 *work, int batch, cudaStream_t stream );
+extern "C" void FFT2048( float2 *work, int batch, cudaStream_t stream );
+extern "C" void FFT4096( float2 *work, int batch, cudaStream_t stream );
+extern "C" void FFT8192( float2 *work, int batch, cudaStream_t stream );
+extern "C" void IFFT8( float2 *work, int batch, cudaStream_t stream );
+extern "C" void IFFT16( float2 *work, int batch, cudaStream_t stream );
+extern "C" void IFFT64( float2 *work, int batch, cudaStream_t stream );
+extern "C" void IFFT256( float2 *work, int batch, cudaStream_t stream );
+extern "C" void IFFT512( float2 *work, int batch, cudaStream_t stream );
+extern "C" void IFFT1024( float2 *work, int batch, cudaStream_t stream );
+extern "C" void IFFT2048( float2 *work, int batch, cudaStream_t stream );
+extern "C" void IFFT4096( float2 *work, int batch, cudaStream_t stream );
+extern "C" void IFFT8192( float2 *work, int batch, cudaStream_t stream );
+typedef void (*FFT_t)( float2 *work, int batch, cudaStream_t stream );
@@ -17,7 +17,7 @@
     unsigned int n_iterations;	\
     for( n_iterations = 1; n_iterations < 0x80000000; n_iterations *= 2 )\
     {\
-        Q( cudaThreadSynchronize( ) );\
+        Q( cudaDeviceSynchronize( ) );\
         Q( cudaEventRecord( start, 0 ) );\
         for( unsigned int iteration = 0; iteration < n_iterations; iteration++ ){
 
@@ -35,25 +35,7 @@
 
 #define Q( condition ) {if( (condition) != 0 ) { printf( "\n FAILURE in %s, line %d\n", __FILE__, __LINE__ );exit( 1 );}}
 
-extern "C" void FFT8( float2 *work, int batch );
-extern "C" void FFT16( float2 *work, int batch );
-extern "C" void FFT64( float2 *work, int batch );
-extern "C" void FFT256( float2 *work, int batch );
-extern "C" void FFT512( float2 *work, int batch );
-extern "C" void FFT1024( float2 *work, int batch );
-extern "C" void FFT2048( float2 *work, int batch );
-extern "C" void FFT4096( float2 *work, int batch );
-extern "C" void FFT8192( float2 *work, int batch );
-extern "C" void IFFT8( float2 *work, int batch );
-extern "C" void IFFT16( float2 *work, int batch );
-extern "C" void IFFT64( float2 *work, int batch );
-extern "C" void IFFT256( float2 *work, int batch );
-extern "C" void IFFT512( float2 *work, int batch );
-extern "C" void IFFT1024( float2 *work, int batch );
-extern "C" void IFFT2048( float2 *work, int batch );
-extern "C" void IFFT4096( float2 *work, int batch );
-extern "C" void IFFT8192( float2 *work, int batch );
-typedef void (*FFT_t)( float2 *work, int batch );
+#include "fft.h"
 
 const float ulp =  1.192092896e-07f;
 
@@ -256,7 +238,7 @@ int main( int argc, char **argv )
         {
             //  upload / compute / download
             Q( cudaMemcpy( work, source, n_bytes, cudaMemcpyHostToDevice ) );
-            FFT( work, batch );
+            FFT( work, batch, 0 );
             Q( cudaMemcpy( result, work, n_bytes, cudaMemcpyDeviceToHost ) );
             if( n >= 2048 )
                 transpose( result, result, n*batch, n/512, 512, 1 );
@@ -270,7 +252,7 @@ int main( int argc, char **argv )
                 transpose( result, source, n*batch, 512/n, 8, n/8 );
             
             Q( cudaMemcpy( work, result, n_bytes, cudaMemcpyHostToDevice ) );
-            FFT( work, batch );
+            FFT( work, batch, 0 );
             Q( cudaMemcpy( result, work, n_bytes, cudaMemcpyDeviceToHost ) );
             
             if( n == 16 )
@@ -282,17 +264,17 @@ int main( int argc, char **argv )
         ulps = relative_error( reference, result, n, batch );
         
         //  time
-        FFT( work, batch );
+        FFT( work, batch, 0 );
         BEGIN_TIMING( );
-            FFT( work, batch );
+            FFT( work, batch, 0 );
         END_TIMING( s );
 
         printf( " %7.1f %6.1f %5.1f", Gflop/s, GB/s, ulps );
         
         //test forward+inverse
         Q( cudaMemcpy( work, source, n_bytes, cudaMemcpyHostToDevice ) );
-        FFT( work, batch );
-        IFFT( work, batch );
+        FFT( work, batch, 0 );
+        IFFT( work, batch, 0 );
         Q( cudaMemcpy( result, work, n_bytes, cudaMemcpyDeviceToHost ) );
         //normalize output
         for( int i = 0; i < n_entries; i++ )
@@ -305,11 +287,11 @@ int main( int argc, char **argv )
         
         //  time
         double s2;
-        FFT( work, batch );
-        IFFT( work, batch );
+        FFT( work, batch, 0 );
+        IFFT( work, batch, 0 );
         BEGIN_TIMING( );
-            FFT( work, batch );
-            IFFT( work, batch );
+            FFT( work, batch, 0 );
+            IFFT( work, batch, 0 );
         END_TIMING( s2 );
 
         printf( "  %7.1f %5.1f\n", 2*Gflop/s2, ulps2 );
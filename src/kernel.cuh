@@ -1,11 +1,14 @@
-//determine row and column from blockIdx.x
-CUBE_DEVICE(static void, findPosition, unsigned int &Col, unsigned int &Row, unsigned int &blockX, unsigned int &blockY) {
-  unsigned int k = blockIdx.x;
-#if NSTATION >= 512
-  blockY = -0.5 + sqrt(0.25 + 2*k);
-#else
-  blockY = -0.5f + sqrtf(0.25f + 2*k);
-#endif  
+//determine row and column from blockIdx.x, which indexes the tiles of the
+//triangle, or the list of tiles to correlate if tiles is not NULL
+CUBE_DEVICE(static void, findPosition, unsigned int &Col, unsigned int &Row, unsigned int &blockX, unsigned int &blockY, const int Nstation,
+	    const unsigned int *tiles) {
+  unsigned int k = tiles ? tiles[blockIdx.x] : blockIdx.x;
+  // single precision loses integer accuracy for large triangles
+  if (Nstation >= 512) {
+    blockY = -0.5 + sqrt(0.25 + 2*k);
+  } else {
+    blockY = -0.5f + sqrtf(0.25f + 2*k);
+  }
   blockX = k - (((blockY+1)*(blockY)) >> 1);
   Row = (blockY*TILE_HEIGHT + threadIdx.y);
   Col = (blockX*TILE_WIDTH + threadIdx.x);
@@ -18,6 +21,12 @@ __device__ static void operator+=( T &a, const T b ) {
  a = t;
 }
 
+// The pulsar bin of a channel can change every PULSAR_STEPS steps of the
+// correlation kernels, i.e. every PULSAR_STEPS time samples, or every
+// 4*PULSAR_STEPS for DP4A where each step is a word of four samples.  This is
+// the unit of the software pipeline, of which NTIME_PIPE is already a multiple.
+#define PULSAR_STEPS 4
+
 #ifndef DP4A
 
 #ifdef FIXED_POINT
@@ -27,7 +36,7 @@ __device__ static void operator+=( T &a, const T b ) {
 #endif
 
 // device function to write out the matrix elements
-CUBE_DEVICE(static void, write2x2, unsigned int &Col, unsigned int &Row, float4 *matrix_real, float4 *matrix_imag, 
+CUBE_DEVICE(static void, write2x2, unsigned int &Col, unsigned int &Row, float4 *matrix_real, float4 *matrix_imag, const int Nstation,
 	    float sum11XXreal, float sum11XXimag, float sum11XYreal, float sum11XYimag,
 	    float sum11YXreal, float sum11YXimag, float sum11YYreal, float sum11YYimag,
 	    float sum12XXreal, float sum12XXimag, float sum12XYreal, float sum12XYimag,
@@ -47,72 +56,75 @@ CUBE_DEVICE(static void, write2x2, unsigned int &Col, unsigned int &Row, float4
 #endif // FIXED_POINT
 
 #if (MATRIX_ORDER == REGISTER_TILE_TRIANGULAR_ORDER) // write out the register tiles separately
-  matrix_real[f*4*REG_TILE_NBASELINE + REG_TILE_NBASELINE*0 + (Row*(Row+1)/2) + Col] += 
+  const int reg_tile_nbaseline = (Nstation/2+1)*(Nstation/4);
+  matrix_real[f*4*reg_tile_nbaseline + reg_tile_nbaseline*0 + (Row*(Row+1)/2) + Col] += 
     make_float4_rnd(SCALE*sum11XXreal, SCALE*sum11XYreal, SCALE*sum11YXreal, SCALE*sum11YYreal);
-  matrix_imag[f*4*REG_TILE_NBASELINE + REG_TILE_NBASELINE*0 + (Row*(Row+1)/2) + Col] += 
+  matrix_imag[f*4*reg_tile_nbaseline + reg_tile_nbaseline*0 + (Row*(Row+1)/2) + Col] += 
     make_float4_rnd(SCALE*sum11XXimag, SCALE*sum11XYimag, SCALE*sum11YXimag, SCALE*sum11YYimag);
 
-  matrix_real[f*4*REG_TILE_NBASELINE + REG_TILE_NBASELINE*1 + (Row*(Row+1)/2) + Col] += 
+  matrix_real[f*4*reg_tile_nbaseline + reg_tile_nbaseline*1 + (Row*(Row+1)/2) + Col] += 
     make_float4_rnd(SCALE*sum21XXreal, SCALE*sum21XYreal, SCALE*sum21YXreal, SCALE*sum21YYreal);
-  matrix_imag[f*4*REG_TILE_NBASELINE + REG_TILE_NBASELINE*1 + (Row*(Row+1)/2) + Col] += 
+  matrix_imag[f*4*reg_tile_nbaseline + reg_tile_nbaseline*1 + (Row*(Row+1)/2) + Col] += 
     make_float4_rnd(SCALE*sum21XXimag, SCALE*sum21XYimag, SCALE*sum21YXimag, SCALE*sum21YYimag);
 
-  matrix_real[f*4*REG_TILE_NBASELINE + REG_TILE_NBASELINE*3 + (Row*(Row+1)/2) + Col] += 
+  matrix_real[f*4*reg_tile_nbaseline + reg_tile_nbaseline*3 + (Row*(Row+1)/2) + Col] += 
     make_float4_rnd(SCALE*sum22XXreal, SCALE*sum22XYreal, SCALE*sum22YXreal, SCALE*sum22YYreal);
-  matrix_imag[f*4*REG_TILE_NBASELINE + REG_TILE_NBASELINE*3 + (Row*(Row+1)/2) + Col] += 
+  matrix_imag[f*4*reg_tile_nbaseline + reg_tile_nbaseline*3 + (Row*(Row+1)/2) + Col] += 
     make_float4_rnd(SCALE*sum22XXimag, SCALE*sum22XYimag, SCALE*sum22YXimag, SCALE*sum22YYimag);
   
   // Test if entire tile needs to be written or just 3 of 4 parts (exclude top-right)
   if (Col<Row) {
-    matrix_real[f*4*REG_TILE_NBASELINE + REG_TILE_NBASELINE*2 + (Row*(Row+1)/2) + Col] += 
+    matrix_real[f*4*reg_tile_nbaseline + reg_tile_nbaseline*2 + (Row*(Row+1)/2) + Col] += 
       make_float4_rnd(SCALE*sum12XXreal, SCALE*sum12XYreal, SCALE*sum12YXreal, SCALE*sum12YYreal);
-    matrix_imag[f*4*REG_TILE_NBASELINE + REG_TILE_NBASELINE*2 + (Row*(Row+1)/2) + Col] += 
+    matrix_imag[f*4*reg_tile_nbaseline + reg_tile_nbaseline*2 + (Row*(Row+1)/2) + Col] += 
       make_float4_rnd(SCALE*sum12XXimag, SCALE*sum12XYimag, SCALE*sum12YXimag, SCALE*sum12YYimag);
   }
 #elif (MATRIX_ORDER == REAL_IMAG_TRIANGULAR_ORDER) // write out the real and imaginary components separately
+  const int nbaseline = (Nstation+1)*(Nstation/2);
   Col*=2; Row*=2;
-  matrix_real[f*NBASELINE + (Row*(Row+1)/2) + Col] += 
+  matrix_real[f*nbaseline + (Row*(Row+1)/2) + Col] += 
     make_float4_rnd(SCALE*sum11XXreal, SCALE*sum11XYreal, SCALE*sum11YXreal, SCALE*sum11YYreal);
-  matrix_imag[f*NBASELINE + (Row*(Row+1)/2) + Col] += 
+  matrix_imag[f*nbaseline + (Row*(Row+1)/2) + Col] += 
     make_float4_rnd(SCALE*sum11XXimag, SCALE*sum11XYimag, SCALE*sum11YXimag, SCALE*sum11YYimag);
 
-  matrix_real[f*NBASELINE + ((Row+1)*(Row+2)/2) + Col] += 
+  matrix_real[f*nbaseline + ((Row+1)*(Row+2)/2) + Col] += 
     make_float4_rnd(SCALE*sum21XXreal, SCALE*sum21XYreal, SCALE*sum21YXreal, SCALE*sum21YYreal);
-  matrix_imag[f*NBASELINE + ((Row+1)*(Row+2)/2) + Col] += 
+  matrix_imag[f*nbaseline + ((Row+1)*(Row+2)/2) + Col] += 
     make_float4_rnd(SCALE*sum21XXimag, SCALE*sum21XYimag, SCALE*sum21YXimag, SCALE*sum21YYimag);
 
-  matrix_real[f*NBASELINE + ((Row+1)*(Row+2)/2) + (Col+1)] += 
+  matrix_real[f*nbaseline + ((Row+1)*(Row+2)/2) + (Col+1)] += 
     make_float4_rnd(SCALE*sum22XXreal, SCALE*sum22XYreal, SCALE*sum22YXreal, SCALE*sum22YYreal);
-  matrix_imag[f*NBASELINE + ((Row+1)*(Row+2)/2) + (Col+1)] += 
+  matrix_imag[f*nbaseline + ((Row+1)*(Row+2)/2) + (Col+1)] += 
     make_float4_rnd(SCALE*sum22XXimag, SCALE*sum22XYimag, SCALE*sum22YXimag, SCALE*sum22YYimag);
   
   // Test if entire tile needs to be written or just 3 of 4 parts (exclude top-right)
   if (Col<Row) {
-    matrix_real[f*NBASELINE + (Row*(Row+1)/2) + (Col+1)] += 
+    matrix_real[f*nbaseline + (Row*(Row+1)/2) + (Col+1)] += 
       make_float4_rnd(SCALE*sum12XXreal, SCALE*sum12XYreal, SCALE*sum12YXreal, SCALE*sum12YYreal);
-    matrix_imag[f*NBASELINE + (Row*(Row+1)/2) + (Col+1)] += 
+    matrix_imag[f*nbaseline + (Row*(Row+1)/2) + (Col+1)] += 
       make_float4_rnd(SCALE*sum12XXimag, SCALE*sum12XYimag, SCALE*sum12YXimag, SCALE*sum12YYimag);
   }
 #else  // standard triangular packed order
+  const int nbaseline = (Nstation+1)*(Nstation/2);
   Col*=2; Row*=2;
-  matrix_real[(f*NBASELINE + (Row*(Row+1)/2) + Col)*NPOL + 0] += 
+  matrix_real[(f*nbaseline + (Row*(Row+1)/2) + Col)*NPOL + 0] += 
     make_float4_rnd(SCALE*sum11XXreal, SCALE*sum11XXimag, SCALE*sum11XYreal, SCALE*sum11XYimag);
-  matrix_real[(f*NBASELINE + (Row*(Row+1)/2) + Col)*NPOL + 1] += 
+  matrix_real[(f*nbaseline + (Row*(Row+1)/2) + Col)*NPOL + 1] += 
     make_float4_rnd(SCALE*sum11YXreal, SCALE*sum11YXimag, SCALE*sum11YYreal, SCALE*sum11YYimag);
-  matrix_real[(f*NBASELINE + ((Row+1)*(Row+2)/2) + Col)*NPOL + 0] += 
+  matrix_real[(f*nbaseline + ((Row+1)*(Row+2)/2) + Col)*NPOL + 0] += 
     make_float4_rnd(SCALE*sum21XXreal, SCALE*sum21XXimag, SCALE*sum21XYreal, SCALE*sum21XYimag);
-  matrix_real[(f*NBASELINE + ((Row+1)*(Row+2)/2) + Col)*NPOL + 1] += 
+  matrix_real[(f*nbaseline + ((Row+1)*(Row+2)/2) + Col)*NPOL + 1] += 
     make_float4_rnd(SCALE*sum21YXreal, SCALE*sum21YXimag, SCALE*sum21YYreal, SCALE*sum21YYimag);
-  matrix_real[(f*NBASELINE + ((Row+1)*(Row+2)/2) + (Col+1))*NPOL + 0] += 
+  matrix_real[(f*nbaseline + ((Row+1)*(Row+2)/2) + (Col+1))*NPOL + 0] += 
     make_float4_rnd(SCALE*sum22XXreal, SCALE*sum22XXimag, SCALE*sum22XYreal, SCALE*sum22XYimag);
-  matrix_real[(f*NBASELINE + ((Row+1)*(Row+2)/2) + (Col+1))*NPOL + 1] += 
+  matrix_real[(f*nbaseline + ((Row+1)*(Row+2)/2) + (Col+1))*NPOL + 1] += 
     make_float4_rnd(SCALE*sum22YXreal, SCALE*sum22YXimag, SCALE*sum22YYreal, SCALE*sum22YYimag);
   
   // Test if entire tile needs to be written or just 3 of 4 parts (exclude top-right)
   if (Col<Row) {
-    matrix_real[(f*NBASELINE + (Row*(Row+1)/2) + (Col+1))*NPOL + 0] += 
+    matrix_real[(f*nbaseline + (Row*(Row+1)/2) + (Col+1))*NPOL + 0] += 
       make_float4_rnd(SCALE*sum12XXreal, SCALE*sum12XXimag, SCALE*sum12XYreal, SCALE*sum12XYimag);
-    matrix_real[(f*NBASELINE + (Row*(Row+1)/2) + (Col+1))*NPOL + 1] += 
+    matrix_real[(f*nbaseline + (Row*(Row+1)/2) + (Col+1))*NPOL + 1] += 
       make_float4_rnd(SCALE*sum12YXreal, SCALE*sum12YXimag, SCALE*sum12YYreal, SCALE*sum12YYimag);
   }
 #endif
@@ -122,7 +134,7 @@ CUBE_DEVICE(static void, write2x2, unsigned int &Col, unsigned int &Row, float4
 #else
 
 // device function to write out the matrix elements
-CUBE_DEVICE(static void, write2x2, unsigned int &Col, unsigned int &Row, int4 *matrix_real, int4 *matrix_imag, 
+CUBE_DEVICE(static void, write2x2, unsigned int &Col, unsigned int &Row, int4 *matrix_real, int4 *matrix_imag, const int Nstation,
 	    int sum11XXreal, int sum11XXimag, int sum11XYreal, int sum11XYimag,
 	    int sum11YXreal, int sum11YXimag, int sum11YYreal, int sum11YYimag,
 	    int sum12XXreal, int sum12XXimag, int sum12XYreal, int sum12XYimag,
@@ -135,72 +147,75 @@ CUBE_DEVICE(static void, write2x2, unsigned int &Col, unsigned int &Row, int4 *m
   int f=blockIdx.y;
 
 #if (MATRIX_ORDER == REGISTER_TILE_TRIANGULAR_ORDER) // write out the register tiles separately
-  matrix_real[f*4*REG_TILE_NBASELINE + REG_TILE_NBASELINE*0 + (Row*(Row+1)/2) + Col] += 
+  const int reg_tile_nbaseline = (Nstation/2+1)*(Nstation/4);
+  matrix_real[f*4*reg_tile_nbaseline + reg_tile_nbaseline*0 + (Row*(Row+1)/2) + Col] += 
     make_int4(sum11XXreal, sum11XYreal, sum11YXreal, sum11YYreal);
-  matrix_imag[f*4*REG_TILE_NBASELINE + REG_TILE_NBASELINE*0 + (Row*(Row+1)/2) + Col] += 
+  matrix_imag[f*4*reg_tile_nbaseline + reg_tile_nbaseline*0 + (Row*(Row+1)/2) + Col] += 
     make_int4(sum11XXimag, sum11XYimag, sum11YXimag, sum11YYimag);
 
-  matrix_real[f*4*REG_TILE_NBASELINE + REG_TILE_NBASELINE*1 + (Row*(Row+1)/2) + Col] += 
+  matrix_real[f*4*reg_tile_nbaseline + reg_tile_nbaseline*1 + (Row*(Row+1)/2) + Col] += 
     make_int4(sum21XXreal, sum21XYreal, sum21YXreal, sum21YYreal);
-  matrix_imag[f*4*REG_TILE_NBASELINE + REG_TILE_NBASELINE*1 + (Row*(Row+1)/2) + Col] += 
+  matrix_imag[f*4*reg_tile_nbaseline + reg_tile_nbaseline*1 + (Row*(Row+1)/2) + Col] += 
     make_int4(sum21XXimag, sum21XYimag, sum21YXimag, sum21YYimag);
 
-  matrix_real[f*4*REG_TILE_NBASELINE + REG_TILE_NBASELINE*3 + (Row*(Row+1)/2) + Col] += 
+  matrix_real[f*4*reg_tile_nbaseline + reg_tile_nbaseline*3 + (Row*(Row+1)/2) + Col] += 
     make_int4(sum22XXreal, sum22XYreal, sum22YXreal, sum22YYreal);
-  matrix_imag[f*4*REG_TILE_NBASELINE + REG_TILE_NBASELINE*3 + (Row*(Row+1)/2) + Col] += 
+  matrix_imag[f*4*reg_tile_nbaseline + reg_tile_nbaseline*3 + (Row*(Row+1)/2) + Col] += 
     make_int4(sum22XXimag, sum22XYimag, sum22YXimag, sum22YYimag);
   
   // Test if entire tile needs to be written or just 3 of 4 parts (exclude top-right)
   if (Col<Row) {
-    matrix_real[f*4*REG_TILE_NBASELINE + REG_TILE_NBASELINE*2 + (Row*(Row+1)/2) + Col] += 
+    matrix_real[f*4*reg_tile_nbaseline + reg_tile_nbaseline*2 + (Row*(Row+1)/2) + Col] += 
       make_int4(sum12XXreal, sum12XYreal, sum12YXreal, sum12YYreal);
-    matrix_imag[f*4*REG_TILE_NBASELINE + REG_TILE_NBASELINE*2 + (Row*(Row+1)/2) + Col] += 
+    matrix_imag[f*4*reg_tile_nbaseline + reg_tile_nbaseline*2 + (Row*(Row+1)/2) + Col] += 
       make_int4(sum12XXimag, sum12XYimag, sum12YXimag, sum12YYimag);
   }
 #elif (MATRIX_ORDER == REAL_IMAG_TRIANGULAR_ORDER) // write out the real and imaginary components separately
+  const int nbaseline = (Nstation+1)*(Nstation/2);
   Col*=2; Row*=2;
-  matrix_real[f*NBASELINE + (Row*(Row+1)/2) + Col] += 
+  matrix_real[f*nbaseline + (Row*(Row+1)/2) + Col] += 
     make_int4(sum11XXreal, sum11XYreal, sum11YXreal, sum11YYreal);
-  matrix_imag[f*NBASELINE + (Row*(Row+1)/2) + Col] += 
+  matrix_imag[f*nbaseline + (Row*(Row+1)/2) + Col] += 
     make_int4(sum11XXimag, sum11XYimag, sum11YXimag, sum11YYimag);
 
-  matrix_real[f*NBASELINE + ((Row+1)*(Row+2)/2) + Col] += 
+  matrix_real[f*nbaseline + ((Row+1)*(Row+2)/2) + Col] += 
     make_int4(sum21XXreal, sum21XYreal, sum21YXreal, sum21YYreal);
-  matrix_imag[f*NBASELINE + ((Row+1)*(Row+2)/2) + Col] += 
+  matrix_imag[f*nbaseline + ((Row+1)*(Row+2)/2) + Col] += 
     make_int4(sum21XXimag, sum21XYimag, sum21YXimag, sum21YYimag);
 
-  matrix_real[f*NBASELINE + ((Row+1)*(Row+2)/2) + (Col+1)] += 
+  matrix_real[f*nbaseline + ((Row+1)*(Row+2)/2) + (Col+1)] += 
     make_int4(sum22XXreal, sum22XYreal, sum22YXreal, sum22YYreal);
-  matrix_imag[f*NBASELINE + ((Row+1)*(Row+2)/2) + (Col+1)] += 
+  matrix_imag[f*nbaseline + ((Row+1)*(Row+2)/2) + (Col+1)] += 
     make_int4(sum22XXimag, sum22XYimag, sum22YXimag, sum22YYimag);
   
   // Test if entire tile needs to be written or just 3 of 4 parts (exclude top-right)
   if (Col<Row) {
-    matrix_real[f*NBASELINE + (Row*(Row+1)/2) + (Col+1)] += 
+    matrix_real[f*nbaseline + (Row*(Row+1)/2) + (Col+1)] += 
       make_int4(sum12XXreal, sum12XYreal, sum12YXreal, sum12YYreal);
-    matrix_imag[f*NBASELINE + (Row*(Row+1)/2) + (Col+1)] += 
+    matrix_imag[f*nbaseline + (Row*(Row+1)/2) + (Col+1)] += 
       make_int4(sum12XXimag, sum12XYimag, sum12YXimag, sum12YYimag);
   }
 #else  // standard triangular packed order
+  const int nbaseline = (Nstation+1)*(Nstation/2);
   Col*=2; Row*=2;
-  matrix_real[(f*NBASELINE + (Row*(Row+1)/2) + Col)*NPOL + 0] += 
+  matrix_real[(f*nbaseline + (Row*(Row+1)/2) + Col)*NPOL + 0] += 
     make_int4(sum11XXreal, sum11XXimag, sum11XYreal, sum11XYimag);
-  matrix_real[(f*NBASELINE + (Row*(Row+1)/2) + Col)*NPOL + 1] += 
+  matrix_real[(f*nbaseline + (Row*(Row+1)/2) + Col)*NPOL + 1] += 
     make_int4(sum11YXreal, sum11YXimag, sum11YYreal, sum11YYimag);
-  matrix_real[(f*NBASELINE + ((Row+1)*(Row+2)/2) + Col)*NPOL + 0] += 
+  matrix_real[(f*nbaseline + ((Row+1)*(Row+2)/2) + Col)*NPOL + 0] += 
     make_int4(sum21XXreal, sum21XXimag, sum21XYreal, sum21XYimag);
-  matrix_real[(f*NBASELINE + ((Row+1)*(Row+2)/2) + Col)*NPOL + 1] += 
+  matrix_real[(f*nbaseline + ((Row+1)*(Row+2)/2) + Col)*NPOL + 1] += 
     make_int4(sum21YXreal, sum21YXimag, sum21YYreal, sum21YYimag);
-  matrix_real[(f*NBASELINE + ((Row+1)*(Row+2)/2) + (Col+1))*NPOL + 0] += 
+  matrix_real[(f*nbaseline + ((Row+1)*(Row+2)/2) + (Col+1))*NPOL + 0] += 
     make_int4(sum22XXreal, sum22XXimag, sum22XYreal, sum22XYimag);
-  matrix_real[(f*NBASELINE + ((Row+1)*(Row+2)/2) + (Col+1))*NPOL + 1] += 
+  matrix_real[(f*nbaseline + ((Row+1)*(Row+2)/2) + (Col+1))*NPOL + 1] += 
     make_int4(sum22YXreal, sum22YXimag, sum22YYreal, sum22YYimag);
   
   // Test if entire tile needs to be written or just 3 of 4 parts (exclude top-right)
   if (Col<Row) {
-    matrix_real[(f*NBASELINE + (Row*(Row+1)/2) + (Col+1))*NPOL + 0] += 
+    matrix_real[(f*nbaseline + (Row*(Row+1)/2) + (Col+1))*NPOL + 0] += 
       make_int4(sum12XXreal, sum12XXimag, sum12XYreal, sum12XYimag);
-    matrix_real[(f*NBASELINE + (Row*(Row+1)/2) + (Col+1))*NPOL + 1] += 
+    matrix_real[(f*nbaseline + (Row*(Row+1)/2) + (Col+1))*NPOL + 1] += 
       make_int4(sum12YXreal, sum12YXimag, sum12YYreal, sum12YYimag);
   }
 #endif
@@ -217,6 +232,10 @@ CUBE_DEVICE(static void, write2x2, unsigned int &Col, unsigned int &Row, int4 *m
 #error COMPLEX_BLOCK_SIZE must be 1 or 32
 #endif
 
+#if defined(INT4) && COMPLEX_BLOCK_SIZE != 1
+#error COMPLEX_BLOCK_SIZE must be 1 for INT4
+#endif
+
 //#define STRUCT_OF_ARRAY
 
 #ifdef DP4A
@@ -235,16 +254,18 @@ CUBE_DEVICE(static void, write2x2, unsigned int &Col, unsigned int &Row, int4 *m
 
 #ifndef DP4A
 
-CUBE_KERNEL(static shared2x2, float4 *matrix_real, float4 *matrix_imag, const int Nstation, const int write, cudaTextureObject_t texObj)
+// NSTATION_T is the station count when specialized at compile time, or 0 for
+// the generic instance that uses the nstation argument.  BUFFER_DEPTH_T is the
+// degree of shared memory buffering, 2 (Fermi optimal) or 4 (Kepler optimal),
+// which is chosen at runtime (see xgpuAutotune).
+template <int NSTATION_T, int BUFFER_DEPTH_T>
+CUBE_KERNEL(static shared2x2, float4 *matrix_real, float4 *matrix_imag, const int nstation, const int Nfrequency,
+	    const unsigned int Ntimepipe, const int write, cudaTextureObject_t texObj,
+	    const unsigned char *bins, const unsigned int *tiles)
 {
   CUBE_START;
 
-// Set the degree of shared memory buffering to use
-#if __CUDA_ARCH__ < 300 
-#define BUFFER_DEPTH 2 // Fermi optimal setting
-#else 
-#define BUFFER_DEPTH 4 // Kepler optimal setting
-#endif
+  const int Nstation = NSTATION_T ? NSTATION_T : nstation;
 
   //get local thread ID
   unsigned int ty = threadIdx.y;
@@ -254,61 +275,55 @@ CUBE_KERNEL(static shared2x2, float4 *matrix_real, float4 *matrix_imag, const in
   //set frequency number from blockIdx.y
   unsigned int f = blockIdx.y;
 
+  //set batch member from blockIdx.z.  Its input follows that of the previous
+  //members in time, and it has its own integration buffer, the second half of
+  //which starts at matrix_imag.
+  unsigned int batch_row = blockIdx.z*Ntimepipe;
+  const long long int batch_stride = 2*(matrix_imag - matrix_real);
+  matrix_real += blockIdx.z*batch_stride;
+  matrix_imag += blockIdx.z*batch_stride;
+#if NPULSAR > 0
+  //the integration buffers of the pulsar bins follow each other, in each half
+  //of the batch member's buffer unless it is in triangular order
+#if MATRIX_ORDER == TRIANGULAR_ORDER
+  const long long int bin_stride = batch_stride/(NPULSAR+1);
+#else
+  const long long int bin_stride = batch_stride/(2*(NPULSAR+1));
+#endif
+#endif
+
   unsigned int Row, Col, blockX, blockY;
-  CUBE_DEVICE_CALL(findPosition, Col, Row, blockX, blockY);
+  CUBE_DEVICE_CALL(findPosition, Col, Row, blockX, blockY, Nstation, tiles);
 
-  //declare shared memory for input coalescing
+  //declare shared memory for input coalescing (buffers are indexed modulo
+  //BUFFER_DEPTH_T, so that the branches of the other depth stay in bounds)
 
 #if SHARED_ATOMIC_SIZE == 4
-  __shared__ float input[BUFFER_DEPTH][16*TILE_WIDTH + 1]; // 4* for float4, 4* for 2x2 tile size, +1 to avoid bank conflicts
+  __shared__ float input[BUFFER_DEPTH_T][16*TILE_WIDTH + 1]; // 4* for float4, 4* for 2x2 tile size, +1 to avoid bank conflicts
   float *input0_p = input[0] + tid;
   float *input1_p = input[1] + tid;
-#if BUFFER_DEPTH == 4
-  float *input2_p = input[2] + tid;
-  float *input3_p = input[3] + tid;
-#endif // BUFFER_DEPTH==4
+  float *input2_p = input[2 % BUFFER_DEPTH_T] + tid;
+  float *input3_p = input[3 % BUFFER_DEPTH_T] + tid;
 #else
-  __shared__ float2 input[BUFFER_DEPTH][8*TILE_WIDTH + 1]; // 2* for float4/float2, 4* for 2x2 tile size, +1 to avoid bank conflicts
+  __shared__ float2 input[BUFFER_DEPTH_T][8*TILE_WIDTH + 1]; // 2* for float4/float2, 4* for 2x2 tile size, +1 to avoid bank conflicts
 
 #ifdef STRUCT_OF_ARRAY
   unsigned swizzled_tid = ((tid & 0x1c) >> 1) | ((tid & 2)    << 3) | (tid & 0x21);
   float2 *input0_p = input[0] + swizzled_tid;
   float2 *input1_p = input[1] + swizzled_tid;
-#if BUFFER_DEPTH == 4
-  float2 *input2_p = input[2] + swizzled_tid;
-  float2 *input3_p = input[3] + swizzled_tid;
-#endif // BUFFER_DEPTH==4
+  float2 *input2_p = input[2 % BUFFER_DEPTH_T] + swizzled_tid;
+  float2 *input3_p = input[3 % BUFFER_DEPTH_T] + swizzled_tid;
 
 #else
 
   float2 *input0_p = input[0] + tid;
   float2 *input1_p = input[1] + tid;
-#if BUFFER_DEPTH == 4
-  float2 *input2_p = input[2] + tid;
-  float2 *input3_p = input[3] + tid;
-#endif // BUFFER_DEPTH==4
+  float2 *input2_p = input[2 % BUFFER_DEPTH_T] + tid;
+  float2 *input3_p = input[3 % BUFFER_DEPTH_T] + tid;
 #endif // STRUCT_OF_ARRAY
 
 #endif
 
-  //instantiate sum variables
-  float sum11XXreal = 0.0, sum11XXimag = 0.0;
-  float sum11XYreal = 0.0, sum11XYimag = 0.0;
-  float sum11YXreal = 0.0, sum11YXimag = 0.0;
-  float sum11YYreal = 0.0, sum11YYimag = 0.0;
-  float sum12XXreal = 0.0, sum12XXimag = 0.0;
-  float sum12XYreal = 0.0, sum12XYimag = 0.0;
-  float sum12YXreal = 0.0, sum12YXimag = 0.0;
-  float sum12YYreal = 0.0, sum12YYimag = 0.0;
-  float sum21XXreal = 0.0, sum21XXimag = 0.0;
-  float sum21XYreal = 0.0, sum21XYimag = 0.0;
-  float sum21YXreal = 0.0, sum21YXimag = 0.0;
-  float sum21YYreal = 0.0, sum21YYimag = 0.0;
-  float sum22XXreal = 0.0, sum22XXimag = 0.0;
-  float sum22XYreal = 0.0, sum22XYimag = 0.0;
-  float sum22YXreal = 0.0, sum22YXimag = 0.0;
-  float sum22YYreal = 0.0, sum22YYimag = 0.0;
-
 #if SHARED_ATOMIC_SIZE == 8
 #if COMPLEX_BLOCK_SIZE != 1
 #error COMPLEX_BLOCK_SIZE must be 1 for SHARED_ATOMIC_SIZE == 8 (for now)
@@ -327,20 +342,53 @@ CUBE_KERNEL(static shared2x2, float4 *matrix_real, float4 *matrix_imag, const in
     // threads 32..63 now have offset 64..95
     input0_p += 4*TILE_WIDTH;
     input1_p += 4*TILE_WIDTH;
-#if BUFFER_DEPTH==4
     input2_p += 4*TILE_WIDTH;
     input3_p += 4*TILE_WIDTH;
-#endif // BUFFER_DEPTH=4
 #endif
   }
 
-#if BUFFER_DEPTH==2
-  LOAD(0, 0);
-#elif BUFFER_DEPTH==4
-  LOAD(0, 0);
-  LOAD(1, 1);
+#if NPULSAR > 0
+  // Correlate each run of steps that channel f places in the same pulsar bin
+  // separately, and integrate it into that bin.  bins has an entry per channel
+  // for every PULSAR_STEPS steps.
+  for(unsigned int run=0, run_end; run<Ntimepipe; run=run_end) {
+    const unsigned int bin = bins[(run/PULSAR_STEPS)*Nfrequency + f];
+    for(run_end=run+PULSAR_STEPS; run_end<Ntimepipe &&
+	  bins[(run_end/PULSAR_STEPS)*Nfrequency + f] == bin; run_end+=PULSAR_STEPS);
+    const unsigned int row0 = batch_row + run;
+    const unsigned int Nrun = run_end - run;
+    const long long int bin_offset = bin*bin_stride;
+#else
+  const unsigned int row0 = batch_row;
+  const unsigned int Nrun = Ntimepipe;
+  const long long int bin_offset = 0;
 #endif
 
+  //instantiate sum variables
+  float sum11XXreal = 0.0, sum11XXimag = 0.0;
+  float sum11XYreal = 0.0, sum11XYimag = 0.0;
+  float sum11YXreal = 0.0, sum11YXimag = 0.0;
+  float sum11YYreal = 0.0, sum11YYimag = 0.0;
+  float sum12XXreal = 0.0, sum12XXimag = 0.0;
+  float sum12XYreal = 0.0, sum12XYimag = 0.0;
+  float sum12YXreal = 0.0, sum12YXimag = 0.0;
+  float sum12YYreal = 0.0, sum12YYimag = 0.0;
+  float sum21XXreal = 0.0, sum21XXimag = 0.0;
+  float sum21XYreal = 0.0, sum21XYimag = 0.0;
+  float sum21YXreal = 0.0, sum21YXimag = 0.0;
+  float sum21YYreal = 0.0, sum21YYimag = 0.0;
+  float sum22XXreal = 0.0, sum22XXimag = 0.0;
+  float sum22XYreal = 0.0, sum22XYimag = 0.0;
+  float sum22YXreal = 0.0, sum22YXimag = 0.0;
+  float sum22YYreal = 0.0, sum22YYimag = 0.0;
+
+  if(BUFFER_DEPTH_T == 2) {
+    LOAD(0, 0);
+  } else {
+    LOAD(0, 0);
+    LOAD(1, 1);
+  }
+
 #if __CUDA_ARCH__ >= 700
 #pragma unroll 4
 #elif __CUDA_ARCH__ >= 600
@@ -350,62 +398,66 @@ CUBE_KERNEL(static shared2x2, float4 *matrix_real, float4 *matrix_imag, const in
 #else
 #pragma unroll 1
 #endif
-  for(unsigned int t=0; t<NTIME_PIPE-BUFFER_DEPTH; t+=BUFFER_DEPTH){
+  for(unsigned int t=0; t<Nrun-BUFFER_DEPTH_T; t+=BUFFER_DEPTH_T){
 
     __syncthreads();
 
-#if BUFFER_DEPTH==2
-    TWO_BY_TWO_COMPUTE(0);
-    LOAD(1, t+1);
-#elif BUFFER_DEPTH==4
-    TWO_BY_TWO_COMPUTE(0);
-    TWO_BY_TWO_COMPUTE(1);
-    LOAD(2, t+2);
-    LOAD(3, t+3);
-#endif
+    if(BUFFER_DEPTH_T == 2) {
+      TWO_BY_TWO_COMPUTE(0);
+      LOAD(1, t+1);
+    } else {
+      TWO_BY_TWO_COMPUTE(0);
+      TWO_BY_TWO_COMPUTE(1);
+      LOAD(2, t+2);
+      LOAD(3, t+3);
+    }
 
     __syncthreads();
 
 
-#if BUFFER_DEPTH==2
-    TWO_BY_TWO_COMPUTE(1);
-    LOAD(0, t+2);
-#elif BUFFER_DEPTH==4
-    TWO_BY_TWO_COMPUTE(2);
-    TWO_BY_TWO_COMPUTE(3);
-    LOAD(0, t+4);
-    LOAD(1, t+5);
-#endif
+    if(BUFFER_DEPTH_T == 2) {
+      TWO_BY_TWO_COMPUTE(1);
+      LOAD(0, t+2);
+    } else {
+      TWO_BY_TWO_COMPUTE(2);
+      TWO_BY_TWO_COMPUTE(3);
+      LOAD(0, t+4);
+      LOAD(1, t+5);
+    }
 
   } 
 
   __syncthreads();  
 
-#if BUFFER_DEPTH==2
-  TWO_BY_TWO_COMPUTE(0);
-  LOAD(1, NTIME_PIPE-1);
-#elif BUFFER_DEPTH==4
-  TWO_BY_TWO_COMPUTE(0);
-  TWO_BY_TWO_COMPUTE(1);
-  LOAD(2, NTIME_PIPE-2);
-  LOAD(3, NTIME_PIPE-1);
-#endif
+  if(BUFFER_DEPTH_T == 2) {
+    TWO_BY_TWO_COMPUTE(0);
+    LOAD(1, Nrun-1);
+  } else {
+    TWO_BY_TWO_COMPUTE(0);
+    TWO_BY_TWO_COMPUTE(1);
+    LOAD(2, Nrun-2);
+    LOAD(3, Nrun-1);
+  }
 
   __syncthreads();
 
-#if BUFFER_DEPTH==2
-  TWO_BY_TWO_COMPUTE(1);
-#elif BUFFER_DEPTH==4
-  TWO_BY_TWO_COMPUTE(2);
-  TWO_BY_TWO_COMPUTE(3);
-#endif
+  if(BUFFER_DEPTH_T == 2) {
+    TWO_BY_TWO_COMPUTE(1);
+  } else {
+    TWO_BY_TWO_COMPUTE(2);
+    TWO_BY_TWO_COMPUTE(3);
+  }
 
+#if NPULSAR > 0
+  if (Col <= Row) {
+#else
   if (Col > Row) return; // writes seem faster when this is pulled up here
+#endif
 
 #ifdef WRITE_OPTION
   if (write) {
 #endif
-    CUBE_DEVICE_CALL(write2x2, Col, Row, matrix_real, matrix_imag,
+    CUBE_DEVICE_CALL(write2x2, Col, Row, matrix_real + bin_offset, matrix_imag + bin_offset, Nstation,
 		     sum11XXreal, sum11XXimag, sum11XYreal, sum11XYimag, 
 		     sum11YXreal, sum11YXimag, sum11YYreal, sum11YYimag, 
 		     sum12XXreal, sum12XXimag, sum12XYreal, sum12XYimag, 
@@ -420,7 +472,13 @@ CUBE_KERNEL(static shared2x2, float4 *matrix_real, float4 *matrix_imag, const in
   }
 #endif
 
-  CUBE_ADD_FLOPS(NTIME_PIPE*(Col < Row ? 128 : 96));
+#if NPULSAR > 0
+    CUBE_ADD_FLOPS(Nrun*(Col < Row ? 128 : 96));
+  }
+  }
+#else
+  CUBE_ADD_FLOPS(Ntimepipe*(Col < Row ? 128 : 96));
+#endif
 
   CUBE_END;
 }
@@ -428,16 +486,18 @@ CUBE_KERNEL(static shared2x2, float4 *matrix_real, float4 *matrix_imag, const in
 
 #else // doing DP4A computation
 
-CUBE_KERNEL(static shared2x2, int4 *matrix_real, int4 *matrix_imag, const int Nstation, const int write, cudaTextureObject_t texObj)
+// NSTATION_T is the station count when specialized at compile time, or 0 for
+// the generic instance that uses the nstation argument.  BUFFER_DEPTH_T is the
+// degree of shared memory buffering, 2 (Fermi optimal) or 4 (Kepler optimal),
+// which is chosen at runtime (see xgpuAutotune).
+template <int NSTATION_T, int BUFFER_DEPTH_T>
+CUBE_KERNEL(static shared2x2, int4 *matrix_real, int4 *matrix_imag, const int nstation, const int Nfrequency,
+	    const unsigned int Ntimepipe, const int write, InputSource source,
+	    const unsigned char *bins, const unsigned int *tiles)
 {
   CUBE_START;
 
-// Set the degree of shared memory buffering to use
-#if __CUDA_ARCH__ < 300 
-#define BUFFER_DEPTH 2 // Fermi optimal setting
-#else 
-#define BUFFER_DEPTH 4 // Kepler optimal setting
-#endif
+  const int Nstation = NSTATION_T ? NSTATION_T : nstation;
 
   //get local thread ID
   unsigned int ty = threadIdx.y;
@@ -447,41 +507,38 @@ CUBE_KERNEL(static shared2x2, int4 *matrix_real, int4 *matrix_imag, const int Ns
   //set frequency number from blockIdx.y
   unsigned int f = blockIdx.y;
 
+  //set batch member from blockIdx.z.  Its input follows that of the previous
+  //members in time, and it has its own integration buffer, the second half of
+  //which starts at matrix_imag.
+  unsigned int batch_row = blockIdx.z*(Ntimepipe/4);
+  const long long int batch_stride = 2*(matrix_imag - matrix_real);
+  matrix_real += blockIdx.z*batch_stride;
+  matrix_imag += blockIdx.z*batch_stride;
+#if NPULSAR > 0
+  //the integration buffers of the pulsar bins follow each other, in each half
+  //of the batch member's buffer unless it is in triangular order
+#if MATRIX_ORDER == TRIANGULAR_ORDER
+  const long long int bin_stride = batch_stride/(NPULSAR+1);
+#else
+  const long long int bin_stride = batch_stride/(2*(NPULSAR+1));
+#endif
+#endif
+
   unsigned int Row, Col, blockX, blockY;
-  CUBE_DEVICE_CALL(findPosition, Col, Row, blockX, blockY);
+  CUBE_DEVICE_CALL(findPosition, Col, Row, blockX, blockY, Nstation, tiles);
 
   //declare shared memory for input coalescing
 
 #if SHARED_ATOMIC_SIZE == 4
-  __shared__ int input[BUFFER_DEPTH][16*TILE_WIDTH + 1]; // 16 = complex * pol * 2x2 tile size, +1 to avoid bank conflicts
+  __shared__ int input[BUFFER_DEPTH_T][16*TILE_WIDTH + 1]; // 16 = complex * pol * 2x2 tile size, +1 to avoid bank conflicts
   int *input0_p = input[0] + tid;
   int *input1_p = input[1] + tid;
-#if BUFFER_DEPTH == 4
-  int *input2_p = input[2] + tid;
-  int *input3_p = input[3] + tid;
-#endif // BUFFER_DEPTH==4
+  int *input2_p = input[2 % BUFFER_DEPTH_T] + tid;
+  int *input3_p = input[3 % BUFFER_DEPTH_T] + tid;
 #else
 #error SHARED_ATOMIC_SIZE == 8 not supported for dp4a 
 #endif
 
-  //instantiate sum variables
-  int sum11XXreal = 0, sum11XXimag1 = 0, sum11XXimag2 = 0;
-  int sum11XYreal = 0, sum11XYimag1 = 0, sum11XYimag2 = 0;
-  int sum11YXreal = 0, sum11YXimag1 = 0, sum11YXimag2 = 0;
-  int sum11YYreal = 0, sum11YYimag1 = 0, sum11YYimag2 = 0;
-  int sum12XXreal = 0, sum12XXimag1 = 0, sum12XXimag2 = 0;
-  int sum12XYreal = 0, sum12XYimag1 = 0, sum12XYimag2 = 0;
-  int sum12YXreal = 0, sum12YXimag1 = 0, sum12YXimag2 = 0;
-  int sum12YYreal = 0, sum12YYimag1 = 0, sum12YYimag2 = 0;
-  int sum21XXreal = 0, sum21XXimag1 = 0, sum21XXimag2 = 0;
-  int sum21XYreal = 0, sum21XYimag1 = 0, sum21XYimag2 = 0;
-  int sum21YXreal = 0, sum21YXimag1 = 0, sum21YXimag2 = 0;
-  int sum21YYreal = 0, sum21YYimag1 = 0, sum21YYimag2 = 0;
-  int sum22XXreal = 0, sum22XXimag1 = 0, sum22XXimag2 = 0;
-  int sum22XYreal = 0, sum22XYimag1 = 0, sum22XYimag2 = 0;
-  int sum22YXreal = 0, sum22YXimag1 = 0, sum22YXimag2 = 0;
-  int sum22YYreal = 0, sum22YYimag1 = 0, sum22YYimag2 = 0;
-
 #if SHARED_ATOMIC_SIZE == 8
 #if COMPLEX_BLOCK_SIZE != 1
 #error COMPLEX_BLOCK_SIZE must be 1 for SHARED_ATOMIC_SIZE == 8 (for now)
@@ -500,20 +557,54 @@ CUBE_KERNEL(static shared2x2, int4 *matrix_real, int4 *matrix_imag, const int Ns
     // threads 32..63 now have offset 64..95
     input0_p += 4*TILE_WIDTH;
     input1_p += 4*TILE_WIDTH;
-#if BUFFER_DEPTH==4
     input2_p += 4*TILE_WIDTH;
     input3_p += 4*TILE_WIDTH;
-#endif // BUFFER_DEPTH=4
 #endif
   }
 
-#if BUFFER_DEPTH==2
-  LOAD(0, 0);
-#elif BUFFER_DEPTH==4
-  LOAD(0, 0);
-  LOAD(1, 1);
+#if NPULSAR > 0
+  // Correlate each run of steps that channel f places in the same pulsar bin
+  // separately, and integrate it into that bin.  bins has an entry per channel
+  // for every PULSAR_STEPS steps.
+  for(unsigned int run=0, run_end; run<Ntimepipe/4; run=run_end) {
+    const unsigned int bin = bins[(run/PULSAR_STEPS)*Nfrequency + f];
+    for(run_end=run+PULSAR_STEPS; run_end<Ntimepipe/4 &&
+	  bins[(run_end/PULSAR_STEPS)*Nfrequency + f] == bin; run_end+=PULSAR_STEPS);
+    const unsigned int row0 = batch_row + run;
+    const unsigned int Nrun = run_end - run;
+    const long long int bin_offset = bin*bin_stride;
+#else
+  const unsigned int row0 = batch_row;
+  const unsigned int Nrun = Ntimepipe/4;
+  const long long int bin_offset = 0;
 #endif
 
+  //instantiate sum variables
+  int sum11XXreal = 0, sum11XXimag1 = 0, sum11XXimag2 = 0;
+  int sum11XYreal = 0, sum11XYimag1 = 0, sum11XYimag2 = 0;
+  int sum11YXreal = 0, sum11YXimag1 = 0, sum11YXimag2 = 0;
+  int sum11YYreal = 0, sum11YYimag1 = 0, sum11YYimag2 = 0;
+  int sum12XXreal = 0, sum12XXimag1 = 0, sum12XXimag2 = 0;
+  int sum12XYreal = 0, sum12XYimag1 = 0, sum12XYimag2 = 0;
+  int sum12YXreal = 0, sum12YXimag1 = 0, sum12YXimag2 = 0;
+  int sum12YYreal = 0, sum12YYimag1 = 0, sum12YYimag2 = 0;
+  int sum21XXreal = 0, sum21XXimag1 = 0, sum21XXimag2 = 0;
+  int sum21XYreal = 0, sum21XYimag1 = 0, sum21XYimag2 = 0;
+  int sum21YXreal = 0, sum21YXimag1 = 0, sum21YXimag2 = 0;
+  int sum21YYreal = 0, sum21YYimag1 = 0, sum21YYimag2 = 0;
+  int sum22XXreal = 0, sum22XXimag1 = 0, sum22XXimag2 = 0;
+  int sum22XYreal = 0, sum22XYimag1 = 0, sum22XYimag2 = 0;
+  int sum22YXreal = 0, sum22YXimag1 = 0, sum22YXimag2 = 0;
+  int sum22YYreal = 0, sum22YYimag1 = 0, sum22YYimag2 = 0;
+
+  if(BUFFER_DEPTH_T == 2) {
+    LOAD(0, 0);
+  } else {
+    LOAD(0, 0);
+    LOAD(1, 1);
+  }
+  LOAD_WAIT();
+
 #if __CUDA_ARCH__ >= 700
 #pragma unroll 4
 #elif __CUDA_ARCH__ >= 600
@@ -523,62 +614,57 @@ CUBE_KERNEL(static shared2x2, int4 *matrix_real, int4 *matrix_imag, const int Ns
 #else
 #pragma unroll 1
 #endif
-  for(unsigned int t=0; t<NTIME_PIPE/4-BUFFER_DEPTH; t+=BUFFER_DEPTH){
+  for(unsigned int t=0; t<Nrun-BUFFER_DEPTH_T; t+=BUFFER_DEPTH_T){
 
     __syncthreads();
 
-#if BUFFER_DEPTH==2
-    TWO_BY_TWO_COMPUTE(0);
-    LOAD(1, t+1);
-#elif BUFFER_DEPTH==4
-    TWO_BY_TWO_COMPUTE(0);
-    TWO_BY_TWO_COMPUTE(1);
-    LOAD(2, t+2);
-    LOAD(3, t+3);
-#endif
+    if(BUFFER_DEPTH_T == 2) {
+      COMPUTE_AND_LOAD(TWO_BY_TWO_COMPUTE(0), LOAD(1, t+1));
+    } else {
+      COMPUTE_AND_LOAD(TWO_BY_TWO_COMPUTE(0); TWO_BY_TWO_COMPUTE(1),
+		       LOAD(2, t+2); LOAD(3, t+3));
+    }
 
     __syncthreads();
 
 
-#if BUFFER_DEPTH==2
-    TWO_BY_TWO_COMPUTE(1);
-    LOAD(0, t+2);
-#elif BUFFER_DEPTH==4
-    TWO_BY_TWO_COMPUTE(2);
-    TWO_BY_TWO_COMPUTE(3);
-    LOAD(0, t+4);
-    LOAD(1, t+5);
-#endif
+    if(BUFFER_DEPTH_T == 2) {
+      COMPUTE_AND_LOAD(TWO_BY_TWO_COMPUTE(1), LOAD(0, t+2));
+    } else {
+      COMPUTE_AND_LOAD(TWO_BY_TWO_COMPUTE(2); TWO_BY_TWO_COMPUTE(3),
+		       LOAD(0, t+4); LOAD(1, t+5));
+    }
 
   } 
 
   __syncthreads();  
 
-#if BUFFER_DEPTH==2
-  TWO_BY_TWO_COMPUTE(0);
-  LOAD(1, NTIME_PIPE/4-1);
-#elif BUFFER_DEPTH==4
-  TWO_BY_TWO_COMPUTE(0);
-  TWO_BY_TWO_COMPUTE(1);
-  LOAD(2, NTIME_PIPE/4-2);
-  LOAD(3, NTIME_PIPE/4-1);
-#endif
+  if(BUFFER_DEPTH_T == 2) {
+    COMPUTE_AND_LOAD(TWO_BY_TWO_COMPUTE(0), LOAD(1, Nrun-1));
+  } else {
+    COMPUTE_AND_LOAD(TWO_BY_TWO_COMPUTE(0); TWO_BY_TWO_COMPUTE(1),
+		     LOAD(2, Nrun-2); LOAD(3, Nrun-1));
+  }
 
   __syncthreads();
 
-#if BUFFER_DEPTH==2
-  TWO_BY_TWO_COMPUTE(1);
-#elif BUFFER_DEPTH==4
-  TWO_BY_TWO_COMPUTE(2);
-  TWO_BY_TWO_COMPUTE(3);
-#endif
+  if(BUFFER_DEPTH_T == 2) {
+    TWO_BY_TWO_COMPUTE(1);
+  } else {
+    TWO_BY_TWO_COMPUTE(2);
+    TWO_BY_TWO_COMPUTE(3);
+  }
 
+#if NPULSAR > 0
+  if (Col <= Row) {
+#else
   if (Col > Row) return; // writes seem faster when this is pulled up here
+#endif
 
 #ifdef WRITE_OPTION
   if (write) {
 #endif
-    CUBE_DEVICE_CALL(write2x2, Col, Row, matrix_real, matrix_imag,
+    CUBE_DEVICE_CALL(write2x2, Col, Row, matrix_real + bin_offset, matrix_imag + bin_offset, Nstation,
 		     sum11XXreal, sum11XXimag1-sum11XXimag2, sum11XYreal, sum11XYimag1-sum11XYimag2,
 		     sum11YXreal, sum11YXimag1-sum11YXimag2, sum11YYreal, sum11YYimag1-sum11YYimag2,
 		     sum12XXreal, sum12XXimag1-sum12XXimag2, sum12XYreal, sum12XYimag1-sum12XYimag2,
@@ -593,13 +679,669 @@ CUBE_KERNEL(static shared2x2, int4 *matrix_real, int4 *matrix_imag, const int Ns
   }
 #endif
 
-  CUBE_ADD_FLOPS(NTIME_PIPE*(Col < Row ? 128 : 96));
+#if NPULSAR > 0
+    CUBE_ADD_FLOPS(4*Nrun*(Col < Row ? 128 : 96));
+  }
+  }
+#else
+  CUBE_ADD_FLOPS(Ntimepipe*(Col < Row ? 128 : 96));
+#endif
 
   CUBE_END;
 }
 
+#if COMPLEX_BLOCK_SIZE == 1
+#include <mma.h>
+
+// Read the real and imaginary words of four time samples of one station and
+// polarization, as LOAD does.
+#if defined(ASYNC_COPY)
+#define WMMA_FETCH(t, re, im)						\
+  { int2 c = __ldg(source + array_index + ((t)+row0)*Nfrequency*Nstation*NPOL); \
+    CUBE_ADD_BYTES(4*sizeof(ComplexInput));				\
+    re = c.x;								\
+    im = c.y;}
+#elif defined(INT4)
+#define WMMA_FETCH(t, re, im)						\
+  { int c = FETCH_INT4(t);						\
+    CUBE_ADD_BYTES(4*sizeof(ComplexInput));				\
+    re = c & 0xf0f0f0f0;						\
+    im = ((unsigned int)c << 4) & 0xf0f0f0f0;}
+#elif TEXTURE_DIM == 1
+#define WMMA_FETCH(t, re, im)						\
+  { int2 c = tex1Dfetch<int2>(source, array_index + ((t)+row0)*Nfrequency*Nstation*NPOL); \
+    CUBE_ADD_BYTES(4*sizeof(ComplexInput));				\
+    re = c.x;								\
+    im = c.y;}
+#else
+#define WMMA_FETCH(t, re, im)						\
+  { int2 c = tex2D<int2>(source, array_index, (t)+row0);			\
+    CUBE_ADD_BYTES(4*sizeof(ComplexInput));				\
+    re = c.x;								\
+    im = c.y;}
+#endif
+
+// Tensor core version of shared2x2, using 8-bit integer matrix products
+// (compute capability 7.2 and later).  Each block of 8x8x2 threads computes
+// the same 16x16 station tile as shared2x2: the 32x32 station/polarization
+// products are four 16x16 matrix products per 16 time samples (one per warp).
+// The threads of the first 8x8 layer then write the same 2x2 register tiles
+// as shared2x2, so the output is identical.
+CUBE_KERNEL(static wmma2x2, int4 *matrix_real, int4 *matrix_imag, const int Nstation, const int Nfrequency,
+	    const unsigned int Ntimepipe, const int write, InputSource source,
+	    const unsigned char *bins, const unsigned int *tiles)
+{
+  CUBE_START;
+
+#if __CUDA_ARCH__ >= 720
+  using namespace nvcuda;
+
+  //get local thread ID
+  unsigned int ty = threadIdx.y;
+  unsigned int tx = threadIdx.x;
+  unsigned int tz = threadIdx.z;
+  unsigned int tid = ty*TILE_WIDTH + tx;
+
+  // warp w multiplies row station/polarizations 16*(w/2) to 16*(w/2)+15 by
+  // column station/polarizations 16*(w%2) to 16*(w%2)+15
+  unsigned int warp = (tz*TILE_HEIGHT*TILE_WIDTH + tid) / 32;
+  unsigned int wr = warp / 2;
+  unsigned int wc = warp % 2;
+
+  //set frequency number from blockIdx.y
+  unsigned int f = blockIdx.y;
+
+  //set batch member from blockIdx.z.  Its input follows that of the previous
+  //members in time, and it has its own integration buffer, the second half of
+  //which starts at matrix_imag.
+  unsigned int batch_row = blockIdx.z*(Ntimepipe/4);
+  const long long int batch_stride = 2*(matrix_imag - matrix_real);
+  matrix_real += blockIdx.z*batch_stride;
+  matrix_imag += blockIdx.z*batch_stride;
+#if NPULSAR > 0
+  //the integration buffers of the pulsar bins follow each other, in each half
+  //of the batch member's buffer unless it is in triangular order
+#if MATRIX_ORDER == TRIANGULAR_ORDER
+  const long long int bin_stride = batch_stride/(NPULSAR+1);
+#else
+  const long long int bin_stride = batch_stride/(2*(NPULSAR+1));
+#endif
+#endif
+
+  unsigned int Row, Col, blockX, blockY;
+  CUBE_DEVICE_CALL(findPosition, Col, Row, blockX, blockY, Nstation, tiles);
+
+  // 16 time samples of the 32 column (0-31) and 32 row (32-63)
+  // station/polarizations, i.e. 16x16 8-bit matrices with a leading dimension
+  // of 16 bytes
+  __shared__ __align__(32) int input_real[8*TILE_WIDTH][4];
+  __shared__ __align__(32) int input_imag[8*TILE_WIDTH][4];
+
+  unsigned int array_index = f*Nstation*NPOL + tid;
+
+  if (tid < 4*TILE_WIDTH) {
+    // Read in column in first warp
+    array_index += 2*blockX*TILE_WIDTH*NPOL;
+  } else {
+    // Read in row in second warp
+    array_index += 2*blockY*TILE_WIDTH*NPOL - 4*TILE_HEIGHT;
+  }
+
+#if NPULSAR > 0
+  // as shared2x2, correlate each run of steps in the same pulsar bin separately
+  for(unsigned int run=0, run_end; run<Ntimepipe/4; run=run_end) {
+    const unsigned int bin = bins[(run/PULSAR_STEPS)*Nfrequency + f];
+    for(run_end=run+PULSAR_STEPS; run_end<Ntimepipe/4 &&
+	  bins[(run_end/PULSAR_STEPS)*Nfrequency + f] == bin; run_end+=PULSAR_STEPS);
+    const unsigned int row0 = batch_row + run;
+    const unsigned int Nrun = run_end - run;
+    const long long int bin_offset = bin*bin_stride;
+#else
+  const unsigned int row0 = batch_row;
+  const unsigned int Nrun = Ntimepipe/4;
+  const long long int bin_offset = 0;
+#endif
+
+  wmma::fragment<wmma::matrix_a, 16, 16, 16, signed char, wmma::row_major> rowReal, rowImag;
+  wmma::fragment<wmma::matrix_b, 16, 16, 16, signed char, wmma::col_major> colReal, colImag;
+  wmma::fragment<wmma::accumulator, 16, 16, 16, int> sumReal, sumImag1, sumImag2;
+  wmma::fill_fragment(sumReal, 0);
+  wmma::fill_fragment(sumImag1, 0);
+  wmma::fill_fragment(sumImag2, 0);
+
+  // layer tz reads words tz and tz+2 of each group of four
+  int real0, imag0, real1, imag1;
+  WMMA_FETCH(tz, real0, imag0);
+  WMMA_FETCH(tz+2, real1, imag1);
+
+  for(unsigned int t=0; t<Nrun; t+=4){
+
+    __syncthreads();
+
+    input_real[tid][tz] = real0;
+    input_imag[tid][tz] = imag0;
+    input_real[tid][tz+2] = real1;
+    input_imag[tid][tz+2] = imag1;
+
+    __syncthreads();
+
+    if (t+4 < Nrun) {
+      WMMA_FETCH(t+4+tz, real0, imag0);
+      WMMA_FETCH(t+6+tz, real1, imag1);
+    }
+
+    wmma::load_matrix_sync(rowReal, (const signed char *)input_real[4*TILE_HEIGHT + 16*wr], 16);
+    wmma::load_matrix_sync(rowImag, (const signed char *)input_imag[4*TILE_HEIGHT + 16*wr], 16);
+    wmma::load_matrix_sync(colReal, (const signed char *)input_real[16*wc], 16);
+    wmma::load_matrix_sync(colImag, (const signed char *)input_imag[16*wc], 16);
+
+    wmma::mma_sync(sumReal, rowReal, colReal, sumReal);
+    wmma::mma_sync(sumReal, rowImag, colImag, sumReal);
+    wmma::mma_sync(sumImag1, rowImag, colReal, sumImag1);
+    wmma::mma_sync(sumImag2, rowReal, colImag, sumImag2);
+  }
+
+  for(int i=0; i<sumImag1.num_elements; i++) {
+    sumImag1.x[i] -= sumImag2.x[i];
+  }
+
+  // Products of row (first index) and column station/polarizations
+  __shared__ __align__(32) int product_real[4*TILE_HEIGHT][4*TILE_WIDTH];
+  __shared__ __align__(32) int product_imag[4*TILE_HEIGHT][4*TILE_WIDTH];
+  wmma::store_matrix_sync(&product_real[16*wr][16*wc], sumReal, 4*TILE_WIDTH, wmma::mem_row_major);
+  wmma::store_matrix_sync(&product_imag[16*wr][16*wc], sumImag1, 4*TILE_WIDTH, wmma::mem_row_major);
+
+  __syncthreads();
+
+#if NPULSAR > 0
+  if (tz == 0 && Col <= Row) {
+#else
+  if (tz != 0 || Col > Row) return;
+#endif
+
+  // Product of polarization p of station a (0 or 1) of the row 2x2 tile and
+  // polarization q of station b of the column 2x2 tile
+#define WMMA_SUM(a, p, b, q)						\
+  product_real[4*ty + 2*(a) + (p)][4*tx + 2*(b) + (q)],		\
+  product_imag[4*ty + 2*(a) + (p)][4*tx + 2*(b) + (q)]
+
+#ifdef WRITE_OPTION
+  if (write) {
+#endif
+    CUBE_DEVICE_CALL(write2x2, Col, Row, matrix_real + bin_offset, matrix_imag + bin_offset, Nstation,
+		     WMMA_SUM(0,0,0,0), WMMA_SUM(0,0,0,1), WMMA_SUM(0,1,0,0), WMMA_SUM(0,1,0,1),
+		     WMMA_SUM(0,0,1,0), WMMA_SUM(0,0,1,1), WMMA_SUM(0,1,1,0), WMMA_SUM(0,1,1,1),
+		     WMMA_SUM(1,0,0,0), WMMA_SUM(1,0,0,1), WMMA_SUM(1,1,0,0), WMMA_SUM(1,1,0,1),
+		     WMMA_SUM(1,0,1,0), WMMA_SUM(1,0,1,1), WMMA_SUM(1,1,1,0), WMMA_SUM(1,1,1,1));
+
+    CUBE_ADD_BYTES(Col < Row ? 256 : 192); // need load and save
+#ifdef WRITE_OPTION
+  }
+#endif
+
+#if NPULSAR > 0
+    CUBE_ADD_FLOPS(4*Nrun*(Col < Row ? 128 : 96));
+  }
+  }
+#else
+  CUBE_ADD_FLOPS(Ntimepipe*(Col < Row ? 128 : 96));
+#endif
+
+#undef WMMA_SUM
+#endif // __CUDA_ARCH__ >= 720
+
+  CUBE_END;
+}
+
+#undef WMMA_FETCH
+#endif // COMPLEX_BLOCK_SIZE == 1
+
+#endif
+
+// Invert k == row*(row+1)/2 + col, the index of the baseline of stations
+// col <= row in TRIANGULAR_ORDER, correcting for rounding of the sqrt
+__device__ static inline void invertBaseline(unsigned int k, unsigned int &row, unsigned int &col)
+{
+  row = (unsigned int)((sqrt(8.0*k+1.0)-1.0)/2.0);
+  while(row*(row+1)/2 > k) row--;
+  while((row+1)*(row+2)/2 <= k) row++;
+  col = k - row*(row+1)/2;
+}
+
+// Words of flag bits per station and channel of an NTIME_PIPE chunk
+#define FLAG_WORDS(ntime) (((ntime) + 31) / 32)
+
+#ifdef INT4
+#define ZERO_INPUT(z) ((z).reim = 0)
+#else
+#define ZERO_INPUT(z) ((z).real = 0, (z).imag = 0)
+#endif
+
+// Power of a station summed over polarizations
+__device__ static inline float inputPower(const ComplexInput *z)
+{
+  float p = 0.0f;
+  for(int pol=0; pol<NPOL; pol++) {
+    float re = XGPU_INPUT_REAL(z[pol]);
+    float im = XGPU_INPUT_IMAG(z[pol]);
+    p += re*re + im*im;
+  }
+  return p;
+}
+
+// Flag (zero) the samples of an NTIME_PIPE chunk of natural order input whose
+// power exceeds the mean power of that station and channel over the chunk by
+// threshold standard deviations.  Each thread handles one station of one
+// channel of batch member blockIdx.y, and sets a bit in flags for each sample
+// it keeps.
+CUBE_KERNEL(static flagInput, ComplexInput *array, unsigned int *flags, const int Nstation,
+	    const int Nfrequency, const unsigned int Ntimepipe, const float threshold)
+{
+  CUBE_START;
+
+  // f*Nstation + station
+  unsigned int s = blockIdx.x*blockDim.x + threadIdx.x;
+
+  if(s < Nfrequency*Nstation) {
+    const long long unsigned int row = (long long unsigned int)Nfrequency*Nstation*NPOL;
+    ComplexInput *in = array + blockIdx.y*Ntimepipe*row + s*NPOL;
+    unsigned int *mask = flags + ((long long unsigned int)blockIdx.y*Nfrequency*Nstation + s)*FLAG_WORDS(Ntimepipe);
+
+    float sum = 0.0f, sum2 = 0.0f;
+    for(unsigned int t=0; t<Ntimepipe; t++) {
+      float p = inputPower(in + t*row);
+      sum += p;
+      sum2 += p*p;
+    }
+    float mean = sum / Ntimepipe;
+    float limit = mean + threshold*sqrtf(fmaxf(sum2/Ntimepipe - mean*mean, 0.0f));
+
+    for(unsigned int w=0; w<FLAG_WORDS(Ntimepipe); w++) {
+      unsigned int bits = 0;
+      for(unsigned int b=0; b<32 && 32*w+b<Ntimepipe; b++) {
+	ComplexInput *z = in + (32*w+b)*row;
+	if(inputPower(z) <= limit) {
+	  bits |= 1u << b;
+	} else {
+	  for(int pol=0; pol<NPOL; pol++) ZERO_INPUT(z[pol]);
+	}
+      }
+      mask[w] = bits;
+    }
+    CUBE_ADD_BYTES(2*Ntimepipe*NPOL*sizeof(ComplexInput));
+  }
+
+  CUBE_END;
+}
+
+// Add the number of samples of an NTIME_PIPE chunk kept by flagInput for both
+// stations of each baseline to weights, in TRIANGULAR_ORDER.  Each thread
+// handles one baseline of channel blockIdx.y of batch member blockIdx.z.
+CUBE_KERNEL(static accumulateWeights, unsigned int *weights, const unsigned int *flags, const int Nstation,
+	    const int Nfrequency, const unsigned int Ntimepipe)
+{
+  CUBE_START;
+
+  unsigned int k = blockIdx.x*blockDim.x + threadIdx.x;
+  const unsigned int nbaseline = (Nstation+1)*(Nstation/2);
+
+  if(k < nbaseline) {
+    unsigned int row, col;
+    invertBaseline(k, row, col);
+
+    long long unsigned int fs = ((long long unsigned int)blockIdx.z*Nfrequency + blockIdx.y)*Nstation;
+    const unsigned int *row_mask = flags + (fs + row)*FLAG_WORDS(Ntimepipe);
+    const unsigned int *col_mask = flags + (fs + col)*FLAG_WORDS(Ntimepipe);
+    unsigned int n = 0;
+    for(unsigned int w=0; w<FLAG_WORDS(Ntimepipe); w++) {
+      n += __popc(row_mask[w] & col_mask[w]);
+    }
+    weights[((long long unsigned int)blockIdx.z*Nfrequency + blockIdx.y)*nbaseline + k] += n;
+    CUBE_ADD_BYTES(2*FLAG_WORDS(Ntimepipe)*sizeof(unsigned int) + 2*sizeof(unsigned int));
+  }
+
+  CUBE_END;
+}
+
+// Offset in the FFT buffer of point k of transform b of nfft points as read
+// (output false) or written (output true) by its fft codelet.  The codelets
+// of fewer than 256 points read each group of transforms transposed, and
+// those of 2048 or more points write each transform transposed, as undone on
+// the host by fft/main.cpp.  Every other size is in natural order.
+__device__ static inline long long unsigned int fftIndex(long long unsigned int b, unsigned int k,
+							   const int nfft, const bool output)
+{
+  long long unsigned int l = b*nfft + k;
+  unsigned int sz, sy, sx;
+  if(nfft >= 2048) {
+    if(!output) {
+      return l;
+    }
+    sz = nfft/512; sy = 512; sx = 1;
+  } else if(nfft >= 256) {
+    return l;
+  } else if(nfft == 16) {
+    sz = output ? 16 : 64; sy = output ? 64 : 16; sx = 1;
+  } else {
+    sz = output ? 8 : 512/nfft; sy = output ? 512/nfft : 8; sx = nfft/8;
+  }
+
+  // Each record of sz*sy*sx points is a [sz][sy][sx] array transposed to
+  // [sy][sz][sx] by the codelet's input (or from it by its output)
+  unsigned int record = sz*sy*sx;
+  unsigned int r = l % record;
+  unsigned int x = r % sx, q = r / sx;
+  if(!output) {
+    return l - r + sx*(q/sy + (q%sy)*sz) + x;
+  }
+  return l - r + sx*((q%sz)*sy + q/sz) + x;
+}
+
+// Polyphase filterbank front end of the integrated F-engine: weight and sum
+// ntap overlapping frames of nfft voltage samples of each input into the FFT
+// buffer, so that frame t of input is transform t*Ninput + input.  The
+// voltages are [sample][input] with Ninput = Nstation*NPOL, and window holds
+// the ntap*nfft filter coefficients.  Each thread handles point blockIdx.x*
+// blockDim.x + threadIdx.x of input blockIdx.y in frame blockIdx.z.
+CUBE_KERNEL(static pfbFrontEnd, float2 *fft, const ComplexInput *voltages, const float *window,
+	    const int Ninput, const int nfft, const int ntap)
+{
+  CUBE_START;
+
+  int k = blockIdx.x*blockDim.x + threadIdx.x;
+
+  if(k < nfft) {
+#ifdef INT4
+    // XGPU_INPUT_REAL/IMAG leave the 4 bit values in the top nibble
+    const float vscale = 1.0f/16.0f;
+#else
+    const float vscale = 1.0f;
+#endif
+    float2 sum = make_float2(0.0f, 0.0f);
+    for(int tap=0; tap<ntap; tap++) {
+      ComplexInput v = voltages[((long long unsigned int)(blockIdx.z + tap)*nfft + k)*Ninput + blockIdx.y];
+      float w = vscale*window[tap*nfft + k];
+      sum.x += w*XGPU_INPUT_REAL(v);
+      sum.y += w*XGPU_INPUT_IMAG(v);
+    }
+    fft[fftIndex((long long unsigned int)blockIdx.z*Ninput + blockIdx.y, k, nfft, false)] = sum;
+    CUBE_ADD_BYTES(ntap*(sizeof(ComplexInput) + sizeof(float)) + sizeof(float2));
+  }
+
+  CUBE_END;
+}
+
+// Round x to the nearest integer, saturating at +/-limit
+__device__ static inline int saturate(float x, int limit)
+{
+  return max(-limit, min(limit, __float2int_rn(x)));
+}
+
+// Select channels first_channel to first_channel+Nfrequency-1 of the
+// transformed frames in fft, multiply them by scale and write them to array
+// as the natural order input of the X-engine, saturating to the range of
+// ComplexInput.  Each thread handles one input of channel blockIdx.y of frame
+// blockIdx.z.
+CUBE_KERNEL(static quantizeSpectra, ComplexInput *array, const float2 *fft, const int Ninput,
+	    const int Nfrequency, const int nfft, const int first_channel, const float scale)
+{
+  CUBE_START;
+
+  int input = blockIdx.x*blockDim.x + threadIdx.x;
+
+  if(input < Ninput) {
+    float2 z = fft[fftIndex((long long unsigned int)blockIdx.z*Ninput + input, first_channel + blockIdx.y, nfft, true)];
+    ComplexInput *out = array + ((long long unsigned int)blockIdx.z*Nfrequency + blockIdx.y)*Ninput + input;
+#ifdef INT4
+    out->reim = (signed char)(((saturate(scale*z.x, 7) & 0xf) << 4) | (saturate(scale*z.y, 7) & 0xf));
+#elif defined(FIXED_POINT)
+    out->real = saturate(scale*z.x, 127);
+    out->imag = saturate(scale*z.y, 127);
+#else
+    out->real = scale*z.x;
+    out->imag = scale*z.y;
+#endif
+    CUBE_ADD_BYTES(sizeof(float2) + sizeof(ComplexInput));
+  }
+
+  CUBE_END;
+}
+
+// Generate the synthetic input of xgpu_signal.h into array, n samples in
+// natural order starting from time sample time.  table is as built by
+// signalTable.  Each thread generates one sample.
+CUBE_KERNEL(static generateInput, ComplexInput *array, const float *table, const unsigned int nsource,
+	    const int Nstation, const int Nfrequency, const float noise, const unsigned long long seed,
+	    const unsigned long long time, const long long unsigned int n)
+{
+  CUBE_START;
+
+  long long unsigned int i = (long long unsigned int)blockIdx.x*blockDim.x + threadIdx.x;
+
+  if(i < n) {
+    unsigned int p = i % NPOL;
+    unsigned int s = (i / NPOL) % Nstation;
+    unsigned int f = (i / (NPOL*Nstation)) % Nfrequency;
+    unsigned long long t = i / ((long long unsigned int)NPOL*Nstation*Nfrequency);
+    float a, b;
+    signalSample(&a, &b, table, nsource, Nstation, Nfrequency, noise, seed, time + t, f, s, p);
+    quantizeSample(array + i, a, b);
+    CUBE_ADD_BYTES(nsource*(Nstation+1)*sizeof(float) + sizeof(ComplexInput));
+  }
+
+  CUBE_END;
+}
+
+#include <cuda_fp16.h>
+
+// Gather the products of each channel (and pulsar bin) of the device
+// integration buffer into out in TRIANGULAR_ORDER, converted to type (the
+// native Complex, or XGPU_FLOAT16 or XGPU_INT16 multiplied by scale).  Product
+// p of a channel is products[p], or p if products is NULL, indexing the
+// products of a channel in TRIANGULAR_ORDER.  Each thread moves one element,
+// writing consecutive elements of the output.
+CUBE_KERNEL(static packOutput, void *out, const Complex *matrix, const unsigned int *products,
+	    const unsigned int Nproduct, const int Nstation, const long long unsigned int matLength,
+	    const long long unsigned int length, const int type, const float scale)
+{
+  CUBE_START;
+
+  long long unsigned int idx = (long long unsigned int)blockIdx.x*blockDim.x + threadIdx.x;
+
+  if(idx < length) {
+    unsigned int f = idx / Nproduct;
+    unsigned int product = products ? products[idx % Nproduct] : idx % Nproduct;
+    unsigned int pol = product % (NPOL*NPOL);
+    unsigned int k = product / (NPOL*NPOL);
+    Complex c;
+#if MATRIX_ORDER == TRIANGULAR_ORDER
+    c = matrix[((long long unsigned int)f*(Nstation+1)*(Nstation/2) + k)*NPOL*NPOL + pol];
+#else
+#ifndef DP4A
+    const float *in = (const float *)matrix;
+#else
+    const int *in = (const int *)matrix;
+#endif
+#if MATRIX_ORDER == REGISTER_TILE_TRIANGULAR_ORDER
+    unsigned int row, col;
+    invertBaseline(k, row, col);
+
+    // as reorderMatrix, station 2*i+rx of row tile i and 2*j+ry of column tile j
+    const unsigned int ntile = (Nstation/2+1)*(Nstation/4);
+    unsigned int i = row/2, rx = row%2;
+    unsigned int j = col/2, ry = col%2;
+    long long unsigned int src = (((long long unsigned int)f*4 + 2*ry+rx)*ntile + i*(i+1)/2 + j)*NPOL*NPOL + pol;
+#elif MATRIX_ORDER == REAL_IMAG_TRIANGULAR_ORDER
+    long long unsigned int src = ((long long unsigned int)f*(Nstation+1)*(Nstation/2) + k)*NPOL*NPOL + pol;
+#endif
+    c.real = in[src];
+    c.imag = in[src+matLength];
+#endif
+
+    if(type == XGPU_FLOAT16) {
+      ((__half2 *)out)[idx] = __floats2half2_rn(scale*c.real, scale*c.imag);
+    } else if(type == XGPU_INT16) {
+      ((short2 *)out)[idx] = make_short2(__float2int_rn(fminf(fmaxf(scale*c.real, -32767.0f), 32767.0f)),
+					 __float2int_rn(fminf(fmaxf(scale*c.imag, -32767.0f), 32767.0f)));
+    } else {
+      ((Complex *)out)[idx] = c;
+    }
+    CUBE_ADD_BYTES(2*sizeof(Complex));
+  }
+
+  CUBE_END;
+}
+
+// Add the integration to the long integration and restart it, i.e. clear it
+// as xgpuClearDeviceIntegrationBuffer does, in the same pass over the buffer.
+CUBE_KERNEL(static foldIntegration, WideComplex *long_matrix, Complex *matrix,
+	    const long long unsigned int length)
+{
+  CUBE_START;
+
+  long long unsigned int idx = (long long unsigned int)blockIdx.x*blockDim.x + threadIdx.x;
+
+  if(idx < length) {
+    Complex c = matrix[idx];
+    long_matrix[idx].x += c.real;
+    long_matrix[idx].y += c.imag;
+    matrix[idx].real = 0;
+    matrix[idx].imag = 0;
+    CUBE_ADD_BYTES(2*sizeof(Complex) + 2*sizeof(WideComplex));
+  }
+
+  CUBE_END;
+}
+
+// Narrow the long integration to Complex in out, multiplying it by scale,
+// e.g. to normalize it on the device before the transfer.  For DP4A the
+// elements are rounded and saturated at the limits of int.
+CUBE_KERNEL(static narrowIntegration, Complex *out, const WideComplex *long_matrix,
+	    const double scale, const long long unsigned int length)
+{
+  CUBE_START;
+
+  long long unsigned int idx = (long long unsigned int)blockIdx.x*blockDim.x + threadIdx.x;
+
+  if(idx < length) {
+    WideComplex w = long_matrix[idx];
+#ifdef DP4A
+    out[idx].real = __double2int_rn(fmin(fmax(scale*w.x, -2147483648.0), 2147483647.0));
+    out[idx].imag = __double2int_rn(fmin(fmax(scale*w.y, -2147483648.0), 2147483647.0));
+#else
+    out[idx].real = scale*w.x;
+    out[idx].imag = scale*w.y;
+#endif
+    CUBE_ADD_BYTES(sizeof(WideComplex) + sizeof(Complex));
+  }
+
+  CUBE_END;
+}
+
+#if MATRIX_ORDER != TRIANGULAR_ORDER
+// Reorder the device integration buffer from MATRIX_ORDER into
+// TRIANGULAR_ORDER, i.e. the device equivalent of xgpuReorderMatrix.  Each
+// thread moves one element, reading consecutive elements of the input.
+CUBE_KERNEL(static reorderMatrix, Complex *tri, const Complex *matrix, const int Nstation,
+	    const long long unsigned int matLength)
+{
+  CUBE_START;
+
+  long long unsigned int idx = (long long unsigned int)blockIdx.x*blockDim.x + threadIdx.x;
+#ifndef DP4A
+  const float *in = (const float *)matrix;
+#else
+  const int *in = (const int *)matrix;
+#endif
+
+  if(idx < matLength) {
+#if MATRIX_ORDER == REGISTER_TILE_TRIANGULAR_ORDER
+    // idx == ((f*4 + 2*ry+rx)*ntile + i*(i+1)/2+j)*NPOL*NPOL + pol1*NPOL+pol2
+    const unsigned int ntile = (Nstation/2+1)*(Nstation/4);
+    unsigned int pol = idx % (NPOL*NPOL);
+    long long unsigned int l = idx / (NPOL*NPOL);
+    unsigned int tile = l % ntile;
+    l /= ntile;
+    unsigned int rx = l % 2;
+    unsigned int ry = (l / 2) % 2;
+    unsigned int f = l / 4;
+
+    // invert tile == i*(i+1)/2 + j, correcting for rounding of the sqrt
+    unsigned int i = (unsigned int)((sqrt(8.0*tile+1.0)-1.0)/2.0);
+    while(i*(i+1)/2 > tile) i--;
+    while((i+1)*(i+2)/2 <= tile) i++;
+    unsigned int j = tile - i*(i+1)/2;
+
+    // The diagonal register tiles include the redundant upper element
+    unsigned int row = 2*i+rx;
+    unsigned int col = 2*j+ry;
+    if(col <= row) {
+      long long unsigned int k = (long long unsigned int)f*(Nstation+1)*(Nstation/2) + row*(row+1)/2 + col;
+      tri[k*NPOL*NPOL+pol].real = in[idx];
+      tri[k*NPOL*NPOL+pol].imag = in[idx+matLength];
+    }
+#elif MATRIX_ORDER == REAL_IMAG_TRIANGULAR_ORDER
+    tri[idx].real = in[idx];
+    tri[idx].imag = in[idx+matLength];
+#endif
+    CUBE_ADD_BYTES(2*sizeof(Complex));
+  }
+
+  CUBE_END;
+}
+#endif
+
+#if defined(DP4A) || COMPLEX_BLOCK_SIZE == 32
+// Byte offset, within one time sample of natural order input, of byte r of
+// that time sample in COMPLEX_BLOCK_SIZE order.  With COMPLEX_BLOCK_SIZE == 32
+// each block of 32 ComplexInput (16 stations of both polarizations) holds the
+// 32 real components followed by the 32 imaginary components.
+inline __device__ unsigned int naturalByte(unsigned int r) {
+#if COMPLEX_BLOCK_SIZE == 32
+  unsigned int b = r / 64;
+  unsigned int c = (r / 32) % 2;
+  unsigned int q = r % 32;
+  return 2*(32*b + q) + c;
+#else
+  return r;
+#endif
+}
+
+// Reorder one NTIME_PIPE chunk of input from the natural
+// [time][channel][station][polarization][complexity] order into the order
+// read by shared2x2, i.e. COMPLEX_BLOCK_SIZE order and, with DP4A, each group
+// of four time samples byte-interleaved as by xgpuSwizzleInput.  row is the
+// number of bytes per time sample.  Each thread writes four bytes of output.
+CUBE_KERNEL(static swizzleInput, ComplexInput *out, const ComplexInput *in, const unsigned int row,
+	    const unsigned int Ntimepipe)
+{
+  CUBE_START;
+
+  long long unsigned int w = (long long unsigned int)blockIdx.x*blockDim.x + threadIdx.x;
+  const signed char *i = (const signed char *)in;
+
+  if(w < (long long unsigned int)row*Ntimepipe/4) {
+#ifdef DP4A
+    // Output word w holds byte r of time samples 4*t4 to 4*t4+3
+    long long unsigned int t4 = w / row;
+    const signed char *src = i + 4*t4*row + naturalByte(w % row);
+    ((char4 *)out)[w] = make_char4(src[0], src[row], src[2*row], src[3*row]);
+#else
+    // Output word w holds bytes r to r+3 of time sample t
+    long long unsigned int t = 4*w / row;
+    unsigned int r = 4*w % row;
+    const signed char *src = i + t*row;
+    ((char4 *)out)[w] = make_char4(src[naturalByte(r)], src[naturalByte(r+1)],
+				   src[naturalByte(r+2)], src[naturalByte(r+3)]);
+#endif
+    CUBE_ADD_BYTES(8);
+  }
+
+  CUBE_END;
+}
 #endif
 
 // cleanup macro definitions
 #undef LOAD
+#undef FETCH_INT4
 #undef TWO_BY_TWO_COMPUTE
@@ -1,93 +1,277 @@
 /*
-  Perform the outer product summation (X-engine) 
+  Perform the outer product summation (X-engine) on the CPU
 
-  This only fills in the lower triangular matrix and maps the 1-d
-  baseline index to the (2-d) triangular index from the formula
+  The baselines of each channel are split into tiles of STATION_BLOCK x
+  STATION_BLOCK stations, and each tile is integrated over chunks of
+  TIME_BLOCK time samples.  Each chunk of a tile's stations is first unpacked
+  into 16 bit integers (two copies of each input: z = [re,im] and w =
+  [-im,re] interleaved over time), so that the real and imaginary parts of a
+  product are plain dot products
 
-  row = floor(-0.5 + sqrt(0.25 + 2*k));
-  column = k - row*(row+1)/2
+    real = z_row . z_col,  imag = z_row . w_col
 
-  Not meant to be fast, rather to work in a similar fashion as the GPU
-  implementation.
+  computed with pairwise multiply-add instructions (AVX-512 VNNI vpdpwssd,
+  or AVX2 vpmaddwd, much like the DP4A kernel), and every station's data is
+  read once per tile row or column rather than once per baseline.  OpenMP
+  threads work on different tiles.
 
 */
 
-#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 #include "xgpu.h"
 #include "xgpu_info.h"
 
-#define cxmac(acc,z0,z1)                                                         \
-do {                                                                             \
-  acc.real += (float)z0.real * (float)z1.real + (float)z0.imag * (float)z1.imag; \
-  acc.imag += (float)z0.imag * (float)z1.real - (float)z0.real * (float)z1.imag; \
-} while (0)
-
 #ifndef COMPLEX_BLOCK_SIZE
 #define COMPLEX_BLOCK_SIZE 1
 #elif COMPLEX_BLOCK_SIZE != 1 && COMPLEX_BLOCK_SIZE != 32
 #error COMPLEX_BLOCK_SIZE must be 1 or 32
 #endif
 
-void xgpuOmpXengine(Complex *matrix_h, ComplexInput *array_h) {
-#ifdef _OPENMP
-  int num_procs = omp_get_num_procs();
+#if defined(INT4) && COMPLEX_BLOCK_SIZE != 1
+#error COMPLEX_BLOCK_SIZE must be 1 for INT4
+#endif
+
+// Stations per side of a tile (nstation is always a multiple of 16)
+#define STATION_BLOCK 16
+// Time samples per chunk (a multiple of 16, i.e. of 32 16 bit values)
+#define TIME_BLOCK 128
+
+#ifdef FIXED_POINT
+typedef short Sample;
+typedef long long Sum;
+#else
+typedef float Sample;
+typedef double Sum;
+#endif
+
+// Element type of the real and imaginary planes of the non-triangular orders
+#ifdef DP4A
+typedef int ReIm;
+#else
+typedef float ReIm;
 #endif
 
-  #pragma omp parallel num_threads(num_procs)
+// Unpacked chunk of one station: [pol][z or w][2*TIME_BLOCK]
+#define STATION_STRIDE (NPOL*2*2*TIME_BLOCK)
+
+// Sum the eight dot products of the 2x2 polarization products of row station
+// a and column station b over n values (n/2 time samples), in the order
+// XX.re, XX.im, XY.re, XY.im, YX.re, YX.im, YY.re, YY.im.
+static void dot2x2(const Sample *a, const Sample *b, int n, Sum *out)
+{
+  const Sample *za0 = a, *za1 = a + 4*TIME_BLOCK;
+  const Sample *zb0 = b, *wb0 = b + 2*TIME_BLOCK;
+  const Sample *zb1 = b + 4*TIME_BLOCK, *wb1 = b + 6*TIME_BLOCK;
+  int i = 0;
+
+#if defined(FIXED_POINT) && defined(__AVX512BW__)
+  __m512i acc[8];
+  for(int k=0; k<8; k++) acc[k] = _mm512_setzero_si512();
+#if defined(__AVX512VNNI__)
+#define MADD512(acc, x, y) acc = _mm512_dpwssd_epi32(acc, x, y)
+#else
+#define MADD512(acc, x, y) acc = _mm512_add_epi32(acc, _mm512_madd_epi16(x, y))
+#endif
+  for(; i+32<=n; i+=32) {
+    __m512i a0 = _mm512_loadu_si512((const void *)(za0+i));
+    __m512i a1 = _mm512_loadu_si512((const void *)(za1+i));
+    __m512i b0 = _mm512_loadu_si512((const void *)(zb0+i));
+    __m512i c0 = _mm512_loadu_si512((const void *)(wb0+i));
+    __m512i b1 = _mm512_loadu_si512((const void *)(zb1+i));
+    __m512i c1 = _mm512_loadu_si512((const void *)(wb1+i));
+    MADD512(acc[0], a0, b0); MADD512(acc[1], a0, c0);
+    MADD512(acc[2], a0, b1); MADD512(acc[3], a0, c1);
+    MADD512(acc[4], a1, b0); MADD512(acc[5], a1, c0);
+    MADD512(acc[6], a1, b1); MADD512(acc[7], a1, c1);
+  }
+#undef MADD512
+  for(int k=0; k<8; k++) out[k] += _mm512_reduce_add_epi32(acc[k]);
+#elif defined(FIXED_POINT) && defined(__AVX2__)
+  __m256i acc[8];
+  for(int k=0; k<8; k++) acc[k] = _mm256_setzero_si256();
+#define MADD256(acc, x, y) acc = _mm256_add_epi32(acc, _mm256_madd_epi16(x, y))
+  for(; i+16<=n; i+=16) {
+    __m256i a0 = _mm256_loadu_si256((const __m256i *)(za0+i));
+    __m256i a1 = _mm256_loadu_si256((const __m256i *)(za1+i));
+    __m256i b0 = _mm256_loadu_si256((const __m256i *)(zb0+i));
+    __m256i c0 = _mm256_loadu_si256((const __m256i *)(wb0+i));
+    __m256i b1 = _mm256_loadu_si256((const __m256i *)(zb1+i));
+    __m256i c1 = _mm256_loadu_si256((const __m256i *)(wb1+i));
+    MADD256(acc[0], a0, b0); MADD256(acc[1], a0, c0);
+    MADD256(acc[2], a0, b1); MADD256(acc[3], a0, c1);
+    MADD256(acc[4], a1, b0); MADD256(acc[5], a1, c0);
+    MADD256(acc[6], a1, b1); MADD256(acc[7], a1, c1);
+  }
+#undef MADD256
+  for(int k=0; k<8; k++) {
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc[k]), _mm256_extracti128_si256(acc[k], 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1,0,3,2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2,3,0,1)));
+    out[k] += _mm_cvtsi128_si32(s);
+  }
+#endif
+
+  // Whatever the vector loop left (everything without SIMD support)
+  if(i < n) {
+    Sum s[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    for(; i<n; i++) {
+      s[0] += (Sum)za0[i]*zb0[i]; s[1] += (Sum)za0[i]*wb0[i];
+      s[2] += (Sum)za0[i]*zb1[i]; s[3] += (Sum)za0[i]*wb1[i];
+      s[4] += (Sum)za1[i]*zb0[i]; s[5] += (Sum)za1[i]*wb0[i];
+      s[6] += (Sum)za1[i]*zb1[i]; s[7] += (Sum)za1[i]*wb1[i];
+    }
+    for(int k=0; k<8; k++) out[k] += s[k];
+  }
+}
+
+// Unpack time samples t0 to t0+nt-1 of stations s0 to s0+STATION_BLOCK-1 of
+// channel f into buf, zero padding the chunk to TIME_BLOCK samples.  Input
+// in the COMPLEX_BLOCK_SIZE 32 layout is read as such unless natural_order
+// is set.
+static void unpackBlock(Sample *buf, const XGPUInfo *sizing, const ComplexInput *array,
+                        int f, int s0, size_t t0, int nt, int natural_order)
+{
+  const size_t nstation = sizing->nstation;
+  const size_t nfrequency = sizing->nfrequency;
+#if COMPLEX_BLOCK_SIZE != 32
+  (void)natural_order;
+#endif
+
+  memset(buf, 0, STATION_BLOCK*STATION_STRIDE*sizeof(Sample));
+  for(int t=0; t<nt; t++) {
+    for(int s=0; s<STATION_BLOCK; s++) {
+      size_t i = (((t0+t)*nfrequency + f)*nstation + s0 + s)*NPOL;
+      Sample re[NPOL], im[NPOL];
+#if COMPLEX_BLOCK_SIZE == 32
+      if(!natural_order) {
+        size_t i1 = 32*(i/32) + ((i/2)%16);
+        re[0] = array[i1].real;    im[0] = array[i1+16].real;
+        re[1] = array[i1].imag;    im[1] = array[i1+16].imag;
+      } else
+#endif
+      for(int pol=0; pol<NPOL; pol++) {
+        re[pol] = XGPU_INPUT_REAL(array[i+pol]);
+        im[pol] = XGPU_INPUT_IMAG(array[i+pol]);
+      }
+      for(int pol=0; pol<NPOL; pol++) {
+        Sample *z = buf + s*STATION_STRIDE + pol*4*TIME_BLOCK;
+        Sample *w = z + 2*TIME_BLOCK;
+        z[2*t] = re[pol];  z[2*t+1] = im[pol];
+        w[2*t] = -im[pol]; w[2*t+1] = re[pol];
+      }
+    }
+  }
+}
+
+// Add product pp (pol1*NPOL + pol2) of the baseline of stations s2 <= s1 of
+// channel f to matrix in matrix_order
+static void addProduct(Complex *matrix, const XGPUInfo *sizing, int matrix_order,
+                       int f, int s1, int s2, int pp, Sum re, Sum im)
+{
+  const size_t nstation = sizing->nstation;
+  size_t k = (size_t)f*sizing->nbaseline + (size_t)s1*(s1+1)/2 + s2;
+
+  if(matrix_order == TRIANGULAR_ORDER) {
+    matrix[k*NPOL*NPOL + pp].real += re;
+    matrix[k*NPOL*NPOL + pp].imag += im;
+    return;
+  }
+
+  size_t index = k*NPOL*NPOL + pp;
+  if(matrix_order == REGISTER_TILE_TRIANGULAR_ORDER) {
+    int i = s1/2, rx = s1%2, j = s2/2, ry = s2%2;
+    size_t l = (size_t)f*4*(nstation/2+1)*(nstation/4) + (2*ry+rx)*(nstation/2+1)*(nstation/4) + i*(i+1)/2 + j;
+    index = l*NPOL*NPOL + pp;
+  }
+  ((ReIm *)matrix)[index] += re;
+  ((ReIm *)matrix)[index + sizing->matLength] += im;
+}
+
+void xgpuCpuXengineSized(const XGPUInfo *sizing, Complex *matrix_h, const ComplexInput *array_h,
+                         int matrix_order, int natural_order, int accumulate)
+{
+  const int nfrequency = sizing->nfrequency;
+  const size_t ntime = sizing->ntime;
+  const int nblock = sizing->nstation / STATION_BLOCK;
+  const int ntile = nblock*(nblock+1)/2;
+
+  if(!accumulate) {
+    // Also clears what the GPU's matrix orders leave between the baselines.
+    // TRIANGULAR_ORDER buffers only hold triLength elements.
+    size_t length = matrix_order == TRIANGULAR_ORDER ? sizing->triLength : sizing->matLength;
+    memset(matrix_h, 0, length*sizeof(Complex));
+  }
+
+#ifdef _OPENMP
+  #pragma omp parallel num_threads(omp_get_num_procs())
+#endif
   {
-    int i, t;
+    Sample *rows = (Sample *)malloc(2*STATION_BLOCK*STATION_STRIDE*sizeof(Sample));
+    Sample *cols = rows + STATION_BLOCK*STATION_STRIDE;
+    Sum (*acc)[STATION_BLOCK][8] = (Sum (*)[STATION_BLOCK][8])malloc(STATION_BLOCK*STATION_BLOCK*8*sizeof(Sum));
+    int task;
+
+#ifdef _OPENMP
     #pragma omp for schedule(dynamic)
-    for(i=0; i<NFREQUENCY*NBASELINE; i++){
-      int f = i/NBASELINE;
-      int k = i - f*NBASELINE;
-      int station1 = -0.5 + sqrt(0.25 + 2*k);
-      int station2 = k - ((station1+1)*station1)/2;
-      Complex sumXX; sumXX.real = 0.0; sumXX.imag = 0.0;
-      Complex sumXY; sumXY.real = 0.0; sumXY.imag = 0.0;
-      Complex sumYX; sumYX.real = 0.0; sumYX.imag = 0.0;
-      Complex sumYY; sumYY.real = 0.0; sumYY.imag = 0.0;
-      ComplexInput inputRowX, inputRowY, inputColX, inputColY;
-      for(t=0; t<NTIME; t++){
-#if COMPLEX_BLOCK_SIZE == 1
-	inputRowX = array_h[((t*NFREQUENCY + f)*NSTATION + station1)*NPOL];
-	inputRowY = array_h[((t*NFREQUENCY + f)*NSTATION + station1)*NPOL + 1];
-	inputColX = array_h[((t*NFREQUENCY + f)*NSTATION + station2)*NPOL];
-	inputColY = array_h[((t*NFREQUENCY + f)*NSTATION + station2)*NPOL + 1];
-#else
-	// Probably not the cleanest way to do this...
-	int i1 = ((t*NFREQUENCY + f)*NSTATION + station1)*NPOL;
-	int i2 = ((t*NFREQUENCY + f)*NSTATION + station2)*NPOL;
-	i1 = 32*(i1/32) + ((i1/2)%16);
-	i2 = 32*(i2/32) + ((i2/2)%16);
-	ComplexInput rowXYreal = array_h[i1];
-	ComplexInput rowXYimag = array_h[i1+16];
-	ComplexInput colXYreal = array_h[i2];
-	ComplexInput colXYimag = array_h[i2+16];
-	inputRowX.real = rowXYreal.real;
-	inputRowX.imag = rowXYimag.real;
-	inputRowY.real = rowXYreal.imag;
-	inputRowY.imag = rowXYimag.imag;
-	inputColX.real = colXYreal.real;
-	inputColX.imag = colXYimag.real;
-	inputColY.real = colXYreal.imag;
-	inputColY.imag = colXYimag.imag;
 #endif
-	cxmac(sumXX, inputRowX, inputColX);
-	cxmac(sumXY, inputRowX, inputColY);
-	cxmac(sumYX, inputRowY, inputColX);
-	cxmac(sumYY, inputRowY, inputColY);
+    for(task=0; task<nfrequency*ntile; task++) {
+      int f = task / ntile;
+      // Row block rb and column block cb <= rb of tile number tile
+      int tile = task % ntile;
+      int rb = 0;
+      while((rb+1)*(rb+2)/2 <= tile) rb++;
+      int cb = tile - rb*(rb+1)/2;
+      const Sample *col_buf = rb == cb ? rows : cols;
+
+      memset(acc, 0, STATION_BLOCK*STATION_BLOCK*8*sizeof(Sum));
+      for(size_t t0=0; t0<ntime; t0+=TIME_BLOCK) {
+        int nt = ntime-t0 < TIME_BLOCK ? ntime-t0 : TIME_BLOCK;
+        unpackBlock(rows, sizing, array_h, f, rb*STATION_BLOCK, t0, nt, natural_order);
+        if(rb != cb) {
+          unpackBlock(cols, sizing, array_h, f, cb*STATION_BLOCK, t0, nt, natural_order);
+        }
+        // Padding to a whole number of vectors is zero
+        int n = 2*((nt+15)/16*16);
+        for(int r=0; r<STATION_BLOCK; r++) {
+          int cmax = rb == cb ? r : STATION_BLOCK-1;
+          for(int c=0; c<=cmax; c++) {
+            dot2x2(rows + r*STATION_STRIDE, col_buf + c*STATION_STRIDE, n, acc[r][c]);
+          }
+        }
       }
-    
-      matrix_h[4*i    ] = sumXX;
-      matrix_h[4*i + 1] = sumXY;
-      matrix_h[4*i + 2] = sumYX;
-      matrix_h[4*i + 3] = sumYY;
-      // fprintf(stdout,"OUTER:%f %f\n",crealf(matrix_h[4*i]), cimag(matrix_h[4*i]));
-    } //end parallel for loop
-  }  //end parallel segment
+
+      for(int r=0; r<STATION_BLOCK; r++) {
+        int cmax = rb == cb ? r : STATION_BLOCK-1;
+        for(int c=0; c<=cmax; c++) {
+          for(int pp=0; pp<NPOL*NPOL; pp++) {
+            addProduct(matrix_h, sizing, matrix_order, f, rb*STATION_BLOCK + r, cb*STATION_BLOCK + c,
+                       pp, acc[r][c][2*pp], acc[r][c][2*pp+1]);
+          }
+        }
+      }
+    }
+
+    free(rows);
+    free(acc);
+  }
+}
+
+void xgpuOmpXengine(Complex *matrix_h, ComplexInput *array_h) {
+  XGPUInfo sizing;
+  xgpuInfo(&sizing);
+  xgpuOmpXengineSized(&sizing, matrix_h, array_h);
+}
+
+void xgpuOmpXengineSized(const XGPUInfo *sizing, Complex *matrix_h, ComplexInput *array_h) {
+  xgpuCpuXengineSized(sizing, matrix_h, array_h, TRIANGULAR_ORDER, 0, 0);
 }
@@ -4,11 +4,56 @@
 #define TEXTURE_DIM 1
 #endif
 
+#if defined(ASYNC_COPY)
+
+#ifdef INT4
+#error ASYNC_COPY does not support INT4
+#endif
+#include <cuda_pipeline.h>
+
+// Copy int2 of char4 from the device input buffer straight into shared
+// memory with cp.async (the copy engine of compute capability 8.0 and later),
+// as two int copies to avoid bank conflict.  The copies land asynchronously,
+// so are waited for by LOAD_WAIT rather than where they are issued.
+#define LOAD(s, t)							\
+  { const int2 *c = source + array_index + ((t)+row0)*Nfrequency*Nstation*NPOL; \
+    CUBE_ADD_BYTES(4*sizeof(ComplexInput));				\
+    __pipeline_memcpy_async(input##s##_p, &c->x, sizeof(int));		\
+    __pipeline_memcpy_async(input##s##_p + 4*TILE_WIDTH, &c->y, sizeof(int));}
+
+// Wait for the LOADs issued by this thread (which is followed by the barrier
+// that makes them visible to the block)
+#define LOAD_WAIT()							\
+  { __pipeline_commit();						\
+    __pipeline_wait_prior(0); }
+
+// The LOADs of the next buffers are issued before the computation on the
+// current ones, so that they overlap it
+#define COMPUTE_AND_LOAD(compute, load)					\
+  { load; compute; LOAD_WAIT(); }
+
+#elif defined(INT4)
+
 #if TEXTURE_DIM == 1
+#define FETCH_INT4(t) tex1Dfetch<int>(source, array_index + ((t)+row0)*Nfrequency*Nstation*NPOL)
+#else
+#define FETCH_INT4(t) tex2D<int>(source, array_index, (t)+row0)
+#endif
+
+// Read four packed 4-bit complex samples from global, unpack the real and
+// imaginary nibbles into the upper nibbles of the bytes of two ints (i.e. the
+// same as 8-bit input), write ints to shared memory avoid bank conflict.
+#define LOAD(s, t)							\
+  { int c = FETCH_INT4(t);						\
+    CUBE_ADD_BYTES(4*sizeof(ComplexInput));				\
+    *(input##s##_p) = c & 0xf0f0f0f0;					\
+    *(input##s##_p + 4*TILE_WIDTH) = ((unsigned int)c << 4) & 0xf0f0f0f0;}
+
+#elif TEXTURE_DIM == 1
 
 // Read char4 from global, write int to shared memory avoid bank conflict.
 #define LOAD(s, t)							\
-  { int2 c = tex1Dfetch<int2>(texObj, array_index + (t)*NFREQUENCY*NSTATION*NPOL); \
+  { int2 c = tex1Dfetch<int2>(source, array_index + ((t)+row0)*Nfrequency*Nstation*NPOL); \
     CUBE_ADD_BYTES(4*sizeof(ComplexInput));				\
     *(input##s##_p) = c.x;						\
     *(input##s##_p + 4*TILE_WIDTH) = c.y;}
@@ -22,7 +67,7 @@
 // to shared memory avoid bank conflict.  
 // Note: Inline assembly using old texture references removed for CUDA 12+ compatibility
 #define LOAD(s, t)							\
-  { int2 c = tex2D<int2>(texObj, array_index, t);				\
+  { int2 c = tex2D<int2>(source, array_index, (t)+row0);				\
     CUBE_ADD_BYTES(4*sizeof(ComplexInput));				\
     *(input##s##_p) = c.x;						\
     *(input##s##_p + 4*TILE_WIDTH) = c.y;}
@@ -32,7 +77,7 @@
 // Read char4 from global, write individual floats
 // to shared memory avoid bank conflict.
 #define LOAD(s, t)							\
-  { int2 c = tex2D<int2>(texObj, array_index, t);				\
+  { int2 c = tex2D<int2>(source, array_index, (t)+row0);				\
     CUBE_ADD_BYTES(4*sizeof(ComplexInput));				\
     *(input##s##_p) = c.x;						\
     *(input##s##_p + 4*TILE_WIDTH) = c.y;}
@@ -40,44 +85,54 @@
 
 #endif
 
+#ifndef ASYNC_COPY
+// LOAD has landed in shared memory by the time it completes
+#define LOAD_WAIT()
+
+// The LOADs of the next buffers follow the computation on the current ones,
+// whose shared memory reads they would otherwise wait behind
+#define COMPUTE_AND_LOAD(compute, load)					\
+  { compute; load; }
+#endif
+
 // read in shared data as individual floats to avoid bank conflicts
 
 #if COMPLEX_BLOCK_SIZE == 1
 #define TWO_BY_TWO_PRELOAD(s)						\
- {int col1Xreal = input[s][4*tx                                   ];	\
-  int col1Ximag = input[s][4*tx     + 4*TILE_WIDTH                ];	\
-  int col1Yreal = input[s][4*tx + 1                               ];	\
-  int col1Yimag = input[s][4*tx + 1 + 4*TILE_WIDTH                ];	\
-  int col2Xreal = input[s][4*tx + 2                               ];	\
-  int col2Ximag = input[s][4*tx + 2 + 4*TILE_WIDTH                ];	\
-  int col2Yreal = input[s][4*tx + 3                               ];	\
-  int col2Yimag = input[s][4*tx + 3 + 4*TILE_WIDTH                ];	\
-  int row1Xreal = input[s][4*ty                     + 8*TILE_WIDTH];	\
-  int row1Ximag = input[s][4*ty     + 4*TILE_HEIGHT + 8*TILE_WIDTH];	\
-  int row1Yreal = input[s][4*ty + 1                 + 8*TILE_WIDTH];	\
-  int row1Yimag = input[s][4*ty + 1 + 4*TILE_HEIGHT + 8*TILE_WIDTH];	\
-  int row2Xreal = input[s][4*ty + 2                 + 8*TILE_WIDTH];	\
-  int row2Ximag = input[s][4*ty + 2 + 4*TILE_HEIGHT + 8*TILE_WIDTH];	\
-  int row2Yreal = input[s][4*ty + 3                 + 8*TILE_WIDTH];	\
-  int row2Yimag = input[s][4*ty + 3 + 4*TILE_HEIGHT + 8*TILE_WIDTH];
+ {int col1Xreal = input[(s) % BUFFER_DEPTH_T][4*tx                                   ];	\
+  int col1Ximag = input[(s) % BUFFER_DEPTH_T][4*tx     + 4*TILE_WIDTH                ];	\
+  int col1Yreal = input[(s) % BUFFER_DEPTH_T][4*tx + 1                               ];	\
+  int col1Yimag = input[(s) % BUFFER_DEPTH_T][4*tx + 1 + 4*TILE_WIDTH                ];	\
+  int col2Xreal = input[(s) % BUFFER_DEPTH_T][4*tx + 2                               ];	\
+  int col2Ximag = input[(s) % BUFFER_DEPTH_T][4*tx + 2 + 4*TILE_WIDTH                ];	\
+  int col2Yreal = input[(s) % BUFFER_DEPTH_T][4*tx + 3                               ];	\
+  int col2Yimag = input[(s) % BUFFER_DEPTH_T][4*tx + 3 + 4*TILE_WIDTH                ];	\
+  int row1Xreal = input[(s) % BUFFER_DEPTH_T][4*ty                     + 8*TILE_WIDTH];	\
+  int row1Ximag = input[(s) % BUFFER_DEPTH_T][4*ty     + 4*TILE_HEIGHT + 8*TILE_WIDTH];	\
+  int row1Yreal = input[(s) % BUFFER_DEPTH_T][4*ty + 1                 + 8*TILE_WIDTH];	\
+  int row1Yimag = input[(s) % BUFFER_DEPTH_T][4*ty + 1 + 4*TILE_HEIGHT + 8*TILE_WIDTH];	\
+  int row2Xreal = input[(s) % BUFFER_DEPTH_T][4*ty + 2                 + 8*TILE_WIDTH];	\
+  int row2Ximag = input[(s) % BUFFER_DEPTH_T][4*ty + 2 + 4*TILE_HEIGHT + 8*TILE_WIDTH];	\
+  int row2Yreal = input[(s) % BUFFER_DEPTH_T][4*ty + 3                 + 8*TILE_WIDTH];	\
+  int row2Yimag = input[(s) % BUFFER_DEPTH_T][4*ty + 3 + 4*TILE_HEIGHT + 8*TILE_WIDTH];
 #elif COMPLEX_BLOCK_SIZE == 32
 #define TWO_BY_TWO_PRELOAD(s)						\
- {int col1Xreal = input[s][2*tx                                  ];	\
-  int col1Ximag = input[s][2*tx     + 2*TILE_WIDTH               ];	\
-  int col1Yreal = input[s][2*tx     + 4*TILE_WIDTH               ];	\
-  int col1Yimag = input[s][2*tx     + 6*TILE_WIDTH               ];	\
-  int col2Xreal = input[s][2*tx + 1                              ];	\
-  int col2Yreal = input[s][2*tx + 1 + 4*TILE_WIDTH               ];	\
-  int col2Ximag = input[s][2*tx + 1 + 2*TILE_WIDTH               ];	\
-  int col2Yimag = input[s][2*tx + 1 + 6*TILE_WIDTH               ];	\
-  int row1Xreal = input[s][2*ty                    + 8*TILE_WIDTH];	\
-  int row1Ximag = input[s][2*ty     + 2*TILE_WIDTH + 8*TILE_WIDTH];	\
-  int row1Yreal = input[s][2*ty     + 4*TILE_WIDTH + 8*TILE_WIDTH];	\
-  int row1Yimag = input[s][2*ty     + 6*TILE_WIDTH + 8*TILE_WIDTH];	\
-  int row2Xreal = input[s][2*ty + 1                + 8*TILE_WIDTH];	\
-  int row2Yreal = input[s][2*ty + 1 + 4*TILE_WIDTH + 8*TILE_WIDTH];	\
-  int row2Ximag = input[s][2*ty + 1 + 2*TILE_WIDTH + 8*TILE_WIDTH];	\
-  int row2Yimag = input[s][2*ty + 1 + 6*TILE_WIDTH + 8*TILE_WIDTH];
+ {int col1Xreal = input[(s) % BUFFER_DEPTH_T][2*tx                                  ];	\
+  int col1Ximag = input[(s) % BUFFER_DEPTH_T][2*tx     + 2*TILE_WIDTH               ];	\
+  int col1Yreal = input[(s) % BUFFER_DEPTH_T][2*tx     + 4*TILE_WIDTH               ];	\
+  int col1Yimag = input[(s) % BUFFER_DEPTH_T][2*tx     + 6*TILE_WIDTH               ];	\
+  int col2Xreal = input[(s) % BUFFER_DEPTH_T][2*tx + 1                              ];	\
+  int col2Yreal = input[(s) % BUFFER_DEPTH_T][2*tx + 1 + 4*TILE_WIDTH               ];	\
+  int col2Ximag = input[(s) % BUFFER_DEPTH_T][2*tx + 1 + 2*TILE_WIDTH               ];	\
+  int col2Yimag = input[(s) % BUFFER_DEPTH_T][2*tx + 1 + 6*TILE_WIDTH               ];	\
+  int row1Xreal = input[(s) % BUFFER_DEPTH_T][2*ty                    + 8*TILE_WIDTH];	\
+  int row1Ximag = input[(s) % BUFFER_DEPTH_T][2*ty     + 2*TILE_WIDTH + 8*TILE_WIDTH];	\
+  int row1Yreal = input[(s) % BUFFER_DEPTH_T][2*ty     + 4*TILE_WIDTH + 8*TILE_WIDTH];	\
+  int row1Yimag = input[(s) % BUFFER_DEPTH_T][2*ty     + 6*TILE_WIDTH + 8*TILE_WIDTH];	\
+  int row2Xreal = input[(s) % BUFFER_DEPTH_T][2*ty + 1                + 8*TILE_WIDTH];	\
+  int row2Yreal = input[(s) % BUFFER_DEPTH_T][2*ty + 1 + 4*TILE_WIDTH + 8*TILE_WIDTH];	\
+  int row2Ximag = input[(s) % BUFFER_DEPTH_T][2*ty + 1 + 2*TILE_WIDTH + 8*TILE_WIDTH];	\
+  int row2Yimag = input[(s) % BUFFER_DEPTH_T][2*ty + 1 + 6*TILE_WIDTH + 8*TILE_WIDTH];
 #else
 #error COMPLEX_BLOCK_SIZE must be 1 or 32
 #endif // COMPLEX_BLOCK_SIZE
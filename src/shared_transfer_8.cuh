@@ -7,7 +7,7 @@
 #if TEXTURE_DIM == 1
 // Read in column in first warp as float2, row in second warp (still true for 1D?)
 #define LOAD(s, t)							\
-  {float2 temp = tex1Dfetch<float2>(texObj, array_index + (t)*NFREQUENCY*Nstation*NPOL); \
+  {float2 temp = tex1Dfetch<float2>(texObj, array_index + ((t)+row0)*Nfrequency*Nstation*NPOL); \
     CUBE_ADD_BYTES(sizeof(ComplexInput));				\
     *(input##s##_p) = temp; }
 
@@ -20,7 +20,7 @@
 // to shared memory avoid bank conflict.
 // Note: Inline assembly using old texture references removed for CUDA 12+ compatibility
 #define LOAD(s, t)							\
-  { float2 temp = tex2D<float2>(texObj, array_index, t);			\
+  { float2 temp = tex2D<float2>(texObj, array_index, (t)+row0);			\
     CUBE_ADD_BYTES(sizeof(ComplexInput));				\
     *(input##s##_p) = temp; }
 
@@ -28,7 +28,7 @@
 
 // Read in column in first warp as float2, row in second warp
 #define LOAD(s, t)							\
-  {float2 temp = tex2D<float2>(texObj, array_index, t);			\
+  {float2 temp = tex2D<float2>(texObj, array_index, (t)+row0);			\
     CUBE_ADD_BYTES(sizeof(ComplexInput));				\
     *(input##s##_p) = temp; }
 
@@ -53,24 +53,24 @@
  
 #ifdef STRUCT_OF_ARRAY
 #define TWO_BY_TWO_LOAD(s)                              \
-    float2 col1X = input[s][2*tx +  0];                          \
-    float2 col1Y = input[s][2*tx +  1];                          \
-    float2 row1X = input[s][2*ty +  0 + 4*TILE_WIDTH];  \
-    float2 row1Y = input[s][2*ty +  1 + 4*TILE_WIDTH];     \
-    float2 col2X = input[s][2*tx + 16];                          \
-    float2 col2Y = input[s][2*tx + 17];                          \
-    float2 row2X = input[s][2*ty + 16 + 4*TILE_WIDTH];     \
-    float2 row2Y = input[s][2*ty + 17 + 4*TILE_WIDTH];
+    float2 col1X = input[(s) % BUFFER_DEPTH_T][2*tx +  0];                          \
+    float2 col1Y = input[(s) % BUFFER_DEPTH_T][2*tx +  1];                          \
+    float2 row1X = input[(s) % BUFFER_DEPTH_T][2*ty +  0 + 4*TILE_WIDTH];  \
+    float2 row1Y = input[(s) % BUFFER_DEPTH_T][2*ty +  1 + 4*TILE_WIDTH];     \
+    float2 col2X = input[(s) % BUFFER_DEPTH_T][2*tx + 16];                          \
+    float2 col2Y = input[(s) % BUFFER_DEPTH_T][2*tx + 17];                          \
+    float2 row2X = input[(s) % BUFFER_DEPTH_T][2*ty + 16 + 4*TILE_WIDTH];     \
+    float2 row2Y = input[(s) % BUFFER_DEPTH_T][2*ty + 17 + 4*TILE_WIDTH];
 #else
 #define TWO_BY_TWO_LOAD(s)                              \
-    float2 col1X = input[s][4*tx + 0];                           \
-    float2 col1Y = input[s][4*tx + 1];                           \
-    float2 row1X = input[s][4*ty + 0 + 4*TILE_WIDTH];   \
-    float2 row1Y = input[s][4*ty + 1 + 4*TILE_WIDTH]; \
-    float2 col2X = input[s][4*tx + 2];                           \
-    float2 col2Y = input[s][4*tx + 3];                           \
-    float2 row2X = input[s][4*ty + 2 + 4*TILE_WIDTH]; \
-    float2 row2Y = input[s][4*ty + 3 + 4*TILE_WIDTH];
+    float2 col1X = input[(s) % BUFFER_DEPTH_T][4*tx + 0];                           \
+    float2 col1Y = input[(s) % BUFFER_DEPTH_T][4*tx + 1];                           \
+    float2 row1X = input[(s) % BUFFER_DEPTH_T][4*ty + 0 + 4*TILE_WIDTH];   \
+    float2 row1Y = input[(s) % BUFFER_DEPTH_T][4*ty + 1 + 4*TILE_WIDTH]; \
+    float2 col2X = input[(s) % BUFFER_DEPTH_T][4*tx + 2];                           \
+    float2 col2Y = input[(s) % BUFFER_DEPTH_T][4*tx + 3];                           \
+    float2 row2X = input[(s) % BUFFER_DEPTH_T][4*ty + 2 + 4*TILE_WIDTH]; \
+    float2 row2Y = input[(s) % BUFFER_DEPTH_T][4*ty + 3 + 4*TILE_WIDTH];
 #endif // STRUCT_OF_ARRAY
 
  
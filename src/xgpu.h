@@ -19,10 +19,33 @@ typedef float ReImInput;
 typedef signed char ReImInput;
 #endif // FIXED_POINT
 
+// If INT4 is defined (which requires DP4A), each ComplexInput packs a 4 bit
+// two's complement real component into its upper nibble and imaginary
+// component into its lower nibble, halving the size of the input.
+#ifdef INT4
+#ifndef DP4A
+#error INT4 requires DP4A
+#endif
+typedef struct ComplexInputStruct {
+  signed char reim;
+} ComplexInput;
+#else
 typedef struct ComplexInputStruct {
   ReImInput real;
   ReImInput imag;
 } ComplexInput;
+#endif // INT4
+
+// Real and imaginary components of a ComplexInput.  For INT4 these are
+// scaled by 16, i.e. the same as 4 bit samples shifted left by 4 into 8 bit
+// input.
+#ifdef INT4
+#define XGPU_INPUT_REAL(z) ((signed char)((z).reim & 0xf0))
+#define XGPU_INPUT_IMAG(z) ((signed char)(((z).reim & 0x0f) << 4))
+#else
+#define XGPU_INPUT_REAL(z) ((z).real)
+#define XGPU_INPUT_IMAG(z) ((z).imag)
+#endif
 
 #ifndef DP4A
 typedef struct ComplexStruct {
@@ -40,6 +63,10 @@ typedef struct ComplexStruct {
 #define XGPU_INT8    (0)
 #define XGPU_FLOAT32 (1)
 #define XGPU_INT32   (2)
+#define XGPU_INT4    (3)
+// Additional types of output (see xgpuSetOutputFormat)
+#define XGPU_FLOAT16 (4)
+#define XGPU_INT16   (5)
 
 // Used to indicate matrix ordering
 #define TRIANGULAR_ORDER 1000
@@ -48,16 +75,33 @@ typedef struct ComplexStruct {
 
 // Flags for xgpuInit
 #define XGPU_DEVICE_MASK          ((1<<16)-1)
+// Device index selecting the CPU X-engine (see xgpuInit)
+#define XGPU_CPU_DEVICE           XGPU_DEVICE_MASK
 #define XGPU_DONT_REGISTER_ARRAY  (1<<16)
 #define XGPU_DONT_REGISTER_MATRIX (1<<17)
 #define XGPU_DONT_REGISTER        (XGPU_DONT_REGISTER_ARRAY | \
                                    XGPU_DONT_REGISTER_MATRIX)
-
-// XGPUInfo is used to convey the compile-time X engine sizing
-// parameters of the XGPU library.  It should be allocated by the caller and
-// passed (via a pointer) to xInfo() which will fill in the fields.  Note that
-// the input values of these fields are currently ignored completely by xInfo()
-// (i.e. they are informational only).
+#define XGPU_USE_GRAPH            (1<<18)
+#define XGPU_REORDER_ON_DEVICE    (1<<19)
+#define XGPU_SWIZZLE_ON_DEVICE    (1<<28)
+#define XGPU_NO_TENSOR_CORES      (1<<29)
+#define XGPU_PREWARM              (1<<30)
+
+// Pipeline depth (number of device input buffers) and number of host to
+// device copy streams, encoded into bits 20-23 and 24-27 of xgpuInit's
+// device_flags.  A value of 0 selects the default of 2 buffers and 1 copy
+// stream.
+#define XGPU_MAX_PIPELINE_DEPTH   8
+#define XGPU_PIPELINE_DEPTH(n)    (((n) & 0xf) << 20)
+#define XGPU_COPY_STREAMS(n)      (((n) & 0xf) << 24)
+
+// XGPUInfo is used to convey the X engine sizing parameters of the XGPU
+// library.  It should be allocated by the caller and passed (via a pointer) to
+// xgpuInfo(), which will fill in the compile-time (i.e. default) sizing, or to
+// xgpuSizedInfo(), which will fill in the fields for a runtime sizing.  Note
+// that the input values of these fields are ignored completely by both
+// functions (i.e. they are informational only).  A populated XGPUInfo can be
+// passed to xgpuInitSized() to initialize a context with that sizing.
 typedef struct XGPUInfoStruct {
   // Number of polarizations (NB: will be rolled into a new "ninputs" field)
   unsigned int npol;
@@ -71,7 +115,7 @@ typedef struct XGPUInfoStruct {
   unsigned int ntime;
   // Number of per-channel time samples per transfer to GPU
   unsigned int ntimepipe;
-  // Type of input.  One of XGPU_INT8, XGPU_FLOAT32, XGPU_INT32.
+  // Type of input.  One of XGPU_INT8, XGPU_FLOAT32, XGPU_INT32, XGPU_INT4.
   unsigned int input_type;
   // Type of computation.  One of XGPU_INT8 or XGPU_FLOAT32
   unsigned int compute_type;
@@ -119,14 +163,58 @@ typedef struct XGPUContextStruct {
 #define XGPU_INSUFFICIENT_TEXTURE_MEMORY (3)
 #define XGPU_NOT_INITIALIZED             (4)
 #define XGPU_HOST_BUFFER_NOT_SET         (5)
+#define XGPU_INVALID_SIZING              (6)
+#define XGPU_INVALID_FLAGS               (7)
+#define XGPU_NOT_READY                   (8)
+#define XGPU_INVALID_ARGUMENT            (9)
+#define XGPU_NO_DEVICE                   (10)
+#define XGPU_CONTEXT_BUSY                (11)
+#define XGPU_FILE_ERROR                  (12)
+#define XGPU_END_OF_FILE                 (13)
 
 // Values for xgpuCudaXengine's syncOp parameter
 #define SYNCOP_NONE           0
 #define SYNCOP_DUMP           1
 #define SYNCOP_SYNC_TRANSFER  2
 #define SYNCOP_SYNC_COMPUTE   3
+#define SYNCOP_DUMP_ASYNC     4
+
+// Called (from a CUDA host thread) once an asynchronous dump has landed in the
+// host output buffer at matrix_h.  The callback must not make CUDA calls,
+// including calls to XGPU functions.
+typedef void (*XGPUDumpCallback)(XGPUContext *context, Complex *matrix_h, void *user_data);
+
+// Severity of the messages passed to an XGPULogCallback
+#define XGPU_LOG_ERROR 0
+#define XGPU_LOG_INFO  1
+
+// Called with each message of the library (without a trailing newline)
+typedef void (*XGPULogCallback)(int level, const char *message, void *user_data);
 
 // Functions in cuda_xengine.cu
+//
+// Different contexts may be used concurrently from different host threads
+// (e.g. one per NIC queue).  Each context has its own streams, which do not
+// synchronize with the legacy default stream or with other contexts, and
+// every function makes the context's device current for the calling thread.
+// A context must only be used by one thread at a time: xgpuCudaXengine (and
+// its variants) return XGPU_CONTEXT_BUSY if the context is in use by
+// another thread.  xgpuSetLogCallback should be called before any context is
+// initialized.  In builds with a CUBE instrumentation mode, whose counters are
+// process wide, calls of xgpuCudaXengine are serialized across contexts.
+
+// Send the library's messages to callback (for every context), or restore
+// the default of writing errors to stderr and dropping other messages if
+// callback is NULL.
+void xgpuSetLogCallback(XGPULogCallback callback, void *user_data);
+
+// Look up the correlator variant of each new context (for its device model,
+// sizing and build) in the tuning cache file at path, which xgpuAutotune
+// records its results in, or stop using a tuning cache if path is NULL.  Like
+// xgpuSetLogCallback, this should be called before any context is
+// initialized.  Without a cache entry, a context uses wmma2x2 where
+// available and otherwise shared2x2 with 4 shared memory buffers.
+void xgpuSetTuningCache(const char *path);
 
 // Get pointer to library version string.
 //
@@ -139,6 +227,17 @@ const char * xgpuVersionString();
 // compile-time sizing parameters.
 void xgpuInfo(XGPUInfo *pcxs);
 
+// Get sizing parameters for a runtime sizing.
+//
+// The XGPUInfo structure pointed to by pcxs is populated for the given number
+// of stations, frequency channels, time samples per integration and time
+// samples per transfer to GPU.  Fields other than the sizing (e.g. input_type,
+// matrix_order) are set as for xgpuInfo().  Returns XGPU_INVALID_SIZING if
+// nstation is not a multiple of 16, ntimepipe is not a multiple of 4 (16 for
+// DP4A), or ntime is not a multiple of ntimepipe; XGPU_OK otherwise.
+int xgpuSizedInfo(XGPUInfo *pcxs, unsigned int nstation, unsigned int nfrequency,
+                  unsigned int ntime, unsigned int ntimepipe);
+
 // Initialize the XGPU.
 //
 // In addition to allocating device memory and initializing private internal
@@ -161,12 +260,126 @@ void xgpuInfo(XGPUInfo *pcxs);
 //   XGPU_DONT_REGISTER_ARRAY   Disables registering (pinning) of host array
 //   XGPU_DONT_REGISTER_MATRIX  Disables registering (pinning) of host matrix
 //   XGPU_DONT_REGISTER         Disables registering (pinning) of all host mem
+//   XGPU_USE_GRAPH             Replay the input pipeline as a CUDA graph
+//   XGPU_REORDER_ON_DEVICE     Dump the matrix in TRIANGULAR_ORDER
+//   XGPU_SWIZZLE_ON_DEVICE     Take input in natural order (see below)
+//   XGPU_NO_TENSOR_CORES       Never use the tensor core kernel (see below)
+//   XGPU_PREWARM               Load the kernels during initialization
+//   XGPU_PIPELINE_DEPTH(n)     Use n device input buffers [2]
+//   XGPU_COPY_STREAMS(n)       Spread host to device copies over n streams [1]
 // E.g., xgpuInit(&ctx, device_idx | XGPU_DONT_REGISTER_ARRAY);
 //
 // Note that if registering is disabled, the corresponding xgpuSetHost*Buffer
 // function _must_ be called prior to calling xgpuCudaXengine.
+//
+// With XGPU_USE_GRAPH, the first call to xgpuCudaXengine captures the
+// host-to-device transfers and kernel launches of one call into a CUDA graph,
+// and subsequent calls replay that graph with a single launch, only updating
+// the host source address when context->array_h + context->input_offset
+// changes.  Because the graph is launched as a unit, the first transfer of a
+// call does not overlap the last kernel of the previous call.  This flag is
+// ignored when built with a CUBE timing/counting mode or with POWER_LOOP.
+//
+// With XGPU_REORDER_ON_DEVICE, SYNCOP_DUMP and SYNCOP_DUMP_ASYNC reorder the
+// integration from the compiled MATRIX_ORDER into TRIANGULAR_ORDER on the GPU
+// as part of the dump, so the output buffer must not be passed to
+// xgpuReorderMatrix.  This uses one extra matrix of device memory.
+//
+// With XGPU_SWIZZLE_ON_DEVICE, the host input is in the natural
+// [time][channel][station][polarization][complexity] order even for DP4A or
+// COMPLEX_BLOCK_SIZE == 32 builds.  Each transferred chunk is reordered on the
+// GPU before being correlated, so xgpuSwizzleInput must not be used.  This
+// uses one extra input buffer of device memory.  The flag is a no-op for
+// builds that correlate natural order input directly.
+//
+// DP4A builds with COMPLEX_BLOCK_SIZE == 1 correlate on the tensor cores
+// (8-bit integer matrix products) when the device has compute capability 7.2
+// or later and the library was compiled for such a device (CUDA_ARCH=sm_72
+// or later).  Otherwise, or with XGPU_NO_TENSOR_CORES, the DP4A kernel is
+// used.  Both produce identical output.
+//
+// Initialization only queries the selected device (caching what it needs so
+// that later contexts on the same device skip the query), and returns
+// XGPU_NO_DEVICE if that device does not exist.  With XGPU_PREWARM, the
+// kernels are loaded onto the device (compiling them from PTX if necessary)
+// and the correlator is launched once before returning, so the first call of
+// xgpuCudaXengine does not pay for it.
+//
+// Passing XGPU_CPU_DEVICE as the device correlates on the host instead, with
+// xgpuCpuXengineSized on all processors.  Such a context behaves like one on a
+// GPU (including batching, XGPU_REORDER_ON_DEVICE and XGPU_SWIZZLE_ON_DEVICE,
+// which DP4A builds require), except that every call completes before
+// returning and that pulsar binning, long integrations, output formats and
+// products, flagging, the F-engine and device input buffers are not
+// available (their functions return XGPU_INVALID_FLAGS).  Host buffers are
+// never pinned.
+//
+// The transfer of NTIME_PIPE chunk p into device input buffer p % n starts as
+// soon as the kernel processing chunk p-n has completed, so a deeper pipeline
+// lets transfers run further ahead of the kernels and absorbs variations in
+// transfer time.  Each buffer uses vecLengthPipe elements of device memory.
+// The number of copy streams must not exceed the pipeline depth, which must
+// not exceed XGPU_MAX_PIPELINE_DEPTH, otherwise XGPU_INVALID_FLAGS is
+// returned.
 int xgpuInit(XGPUContext *context, int device_flags);
 
+// Initialize the XGPU with a runtime sizing.
+//
+// Same as xgpuInit(), but the context is sized according to the nstation,
+// nfrequency, ntime and ntimepipe fields of the XGPUInfo structure pointed to
+// by sizing (e.g. as populated by xgpuSizedInfo()) rather than the
+// compile-time sizing.  The other fields of *sizing are ignored.  The
+// context's array_len and matrix_len (and any caller-allocated buffers) must
+// be consistent with this sizing.  Returns XGPU_INVALID_SIZING if the sizing
+// is not supported.  xgpuInit(context, flags) is equivalent to calling this
+// function with the output of xgpuInfo().
+int xgpuInitSized(XGPUContext *context, const XGPUInfo *sizing, int device_flags);
+
+// Initialize the XGPU to correlate a batch of independent inputs.
+//
+// Same as xgpuInitSized(), but each call of xgpuCudaXengine correlates nbatch
+// independent inputs of the given sizing (e.g. subarrays) into nbatch
+// independent matrices, sharing one pipeline and one kernel launch per
+// NTIME_PIPE chunk.  This keeps large devices busy with small station counts.
+// The host input buffer holds the nbatch inputs one after the other
+// (vecLength elements each), and the host output buffer holds the nbatch
+// matrices one after the other (matLength elements each), so array_len and
+// matrix_len must be nbatch times those of one input and one matrix.
+// XGPU_USE_GRAPH is ignored for nbatch > 1.  Returns XGPU_INVALID_SIZING if
+// nbatch is less than 1.  xgpuInitSized(context, sizing, flags) is equivalent
+// to xgpuInitBatched(context, sizing, 1, flags).
+int xgpuInitBatched(XGPUContext *context, const XGPUInfo *sizing, int nbatch, int device_flags);
+
+// Initialize the XGPU across several devices.
+//
+// Same as xgpuInitSized(), but the frequency channels are split as evenly as
+// possible across the ndevice GPUs listed in devices (in order, so the first
+// device correlates the lowest channels).  The device index bits of
+// device_flags are ignored; the other flags apply to every device, except
+// XGPU_USE_GRAPH which is ignored.  The context is used exactly like a
+// single-device context, with the same host buffer sizes and layouts: each
+// call of xgpuCudaXengine transfers every device's channels directly from
+// context->array_h and gathers every device's output directly into
+// context->matrix_h, with all devices running concurrently.  The host buffers
+// are pinned for all of the devices.  Returns XGPU_INVALID_FLAGS if ndevice
+// is less than 1 and XGPU_INVALID_SIZING if it exceeds the number of
+// channels.
+int xgpuInitMultiDevice(XGPUContext *context, const XGPUInfo *sizing,
+                        const int *devices, int ndevice, int device_flags);
+
+// Time each variant of the correlator kernel compiled into the library
+// (shared2x2 with 2 or 4 shared memory buffers, and wmma2x2 where available)
+// with CUDA events over one integration at the context's sizing, and use the
+// fastest from then on, recording it in the tuning cache if there is one
+// (see xgpuSetTuningCache).  The current integration is preserved.  The
+// shards of a multi-device context are tuned separately.  Returns
+// XGPU_INVALID_FLAGS on XGPU_CPU_DEVICE, and XGPU_INVALID_ARGUMENT if the
+// tuning cache cannot be written (the fastest variant is used regardless).
+// Knobs fixed at compile time (SHARED_ATOMIC_SIZE, TEXTURE_DIM and
+// MAXRREGCOUNT, see the Makefile) are part of the entry's key, so builds can
+// be compared through the cache.
+int xgpuAutotune(XGPUContext *context);
+
 // Clear the device integration buffer
 //
 // Sets the device integration buffer to all zeros, effectively starting a new
@@ -216,23 +429,448 @@ void xgpuFree(XGPUContext *context);
 //                        but not necessrily all computations.
 // SYNCOP_SYNC_COMPUTE  - Waits for all computations (and transfers) to
 //                        complete, but does not dump.
+// SYNCOP_DUMP_ASYNC - Without waiting, queues a copy of the integration to
+//                     a device staging buffer, restarts the integration
+//                     (i.e. clears the device integration buffer, see
+//                     xgpuSetLongIntegration), and
+//                     queues the transfer of the staging buffer to
+//                     "context->matrix_h + context->output_offset" on a
+//                     separate stream.  The next call's computations can
+//                     start while the transfer is in progress.  The output
+//                     buffer must not be touched until the dump completes
+//                     (see xgpuSetDumpCallback, xgpuDumpQuery and
+//                     xgpuDumpSynchronize).  Two staging buffers are used, so
+//                     this waits for the dump before last to complete.
 int xgpuCudaXengine(XGPUContext *context, int syncOp);
 
+// Set the function called when each subsequent SYNCOP_DUMP_ASYNC dump
+// completes, or NULL for no callback.
+int xgpuSetDumpCallback(XGPUContext *context, XGPUDumpCallback callback, void *user_data);
+
+// Returns XGPU_OK if all SYNCOP_DUMP_ASYNC dumps (and their callbacks) have
+// completed, XGPU_NOT_READY if one is still in progress.
+int xgpuDumpQuery(XGPUContext *context);
+
+// Waits for all SYNCOP_DUMP_ASYNC dumps (and their callbacks) to complete.
+int xgpuDumpSynchronize(XGPUContext *context);
+
+// Set the pulsar bin of every time sample and channel of subsequent calls to
+// xgpuCudaXengine (initially, every sample is in bin 0).  bins[t*nfrequency+f]
+// is the bin in which sample t of channel f is integrated, 0 to NPULSAR.  The
+// integration has a matrix per bin, each laid out as though it held nfrequency
+// further channels of the previous, so that bin 0 is the usual matrix.  A bin
+// can only change every 4 samples (16 for DP4A), so only the first sample of
+// each such group is used.  Waits for the computations already queued to
+// complete.  Returns XGPU_INVALID_ARGUMENT if a bin exceeds NPULSAR.
+int xgpuSetPulsarBins(XGPUContext *context, const unsigned char *bins);
+
+// Correlate only the stations of subsequent calls to xgpuCudaXengine for which
+// active (nstation values) is non-zero, or all stations if active is NULL
+// (initially).  Only the 16x16 station tiles of the matrix holding products
+// of two active stations are launched, so the time taken falls with the
+// square of the tiles in use; the products of the other tiles are left as
+// they are, i.e. zero if the mask is set before the integration starts.
+// Waits for the computations already queued to complete.
+int xgpuSetStationMask(XGPUContext *context, const unsigned char *active);
+
+// Enable (enable != 0) or disable a long integration on the device, alongside
+// the (short) integration of xgpuCudaXengine.  While enabled, every restart of
+// the integration by SYNCOP_DUMP_ASYNC or xgpuFoldIntegration first adds it to
+// the long integration, in the same pass over the device buffer that clears
+// it.  Short integrations can then be dumped, e.g. every K calls, while the
+// long integration only leaves the GPU when xgpuDumpLongIntegration is called.
+// The long integration holds 64 bit integers for DP4A (doubles otherwise), so
+// that it does not overflow as the int32 integration would after some 2^16
+// samples of full scale input.  Enabling starts the long integration at zero.
+int xgpuSetLongIntegration(XGPUContext *context, int enable);
+
+// Fold the integration into the long integration, on the device, at the end of
+// every ncall-th call to xgpuCudaXengine since the integration was last
+// restarted (0, the default, never does), so that integrations of minutes need
+// neither overflow nor dump.  The integration is restarted by each fold, so
+// SYNCOP_DUMP then sees only the calls since the last.  For DP4A, ncall*ntime
+// <= 65536 keeps the integration exact for any input.  Has no effect unless
+// the long integration is enabled.
+int xgpuSetFoldInterval(XGPUContext *context, unsigned int ncall);
+
+// Set the factor by which xgpuDumpLongIntegration multiplies the long
+// integration on the device as it narrows it to Complex (1 by default), e.g.
+// 1/16129.0 to normalize FIXED_POINT integrations to full scale input of 1,
+// or the reciprocal of the number of samples integrated.  For DP4A the
+// products are rounded and saturated at the limits of int.
+int xgpuSetLongIntegrationScale(XGPUContext *context, double scale);
+
+// Restart the integration in place of xgpuClearDeviceIntegrationBuffer (after
+// a SYNCOP_DUMP, say), adding it to the long integration if it is enabled.
+// The restart is queued after the computations of previous calls, without
+// waiting.
+int xgpuFoldIntegration(XGPUContext *context);
+
+// Wait for the computations already queued, transfer the long integration to
+// matrix_h in the same layout as dumps of the integration, and restart it.
+// Returns XGPU_INVALID_ARGUMENT if the long integration is not enabled.
+int xgpuDumpLongIntegration(XGPUContext *context, Complex *matrix_h);
+
+// Set the type of the elements of subsequent dumps (by xgpuCudaXengine or
+// xgpuDumpLongIntegration).  output_type is XGPU_FLOAT32 (XGPU_INT32 for
+// DP4A), i.e. Complex, the default; XGPU_FLOAT16, i.e. pairs of IEEE half
+// precision (real, imag); or XGPU_INT16, i.e. pairs of int16_t rounded and
+// saturated at +/-32767.  Reduced precision elements are multiplied by scale,
+// e.g. the reciprocal of the number of samples integrated.  Dumps of another
+// type than Complex are packed like those of xgpuSetOutputProducts.  Returns
+// XGPU_INVALID_ARGUMENT for other types.
+int xgpuSetOutputFormat(XGPUContext *context, int output_type, float scale);
+
+// Select the products of each channel included in subsequent dumps, which are
+// then gathered on the device into a packed buffer before transfer to the
+// host.  products[p], p < nproduct, is the index of the product in a channel
+// of TRIANGULAR_ORDER, i.e. (row*(row+1)/2 + col)*npol*npol + pol1*npol + pol2
+// for stations col <= row.  A packed dump holds nproduct elements per channel
+// (and pulsar bin, then batch member), in order.  nproduct == 0 or products
+// == NULL selects every product, i.e. a TRIANGULAR_ORDER dump.  Returns
+// XGPU_INVALID_ARGUMENT if a product is out of range.
+int xgpuSetOutputProducts(XGPUContext *context, const unsigned int *products, unsigned int nproduct);
+
+// Returns the size in bytes of the dumps of context, as set by
+// xgpuSetOutputFormat and xgpuSetOutputProducts.
+size_t xgpuOutputSize(XGPUContext *context);
+
+// Enable RFI flagging of the input of subsequent calls to xgpuCudaXengine
+// (threshold > 0), or disable it (threshold <= 0).  Before correlation, each
+// transfer's worth of input is flagged on the device: samples of a station and
+// channel whose power (summed over polarizations) exceeds the mean power of
+// that station and channel by threshold standard deviations are zeroed.  The
+// number of samples kept for both stations of each baseline is counted in
+// weights alongside the integration, and restarted with it.  Each dump
+// transfers the weights (unsigned int, nfrequency*nbaseline per batch member in
+// TRIANGULAR_ORDER) to weights_h, unless it is NULL.  Pulsar bins and the
+// long integration share the weights of the integration.  Returns
+// XGPU_INVALID_FLAGS if the input is not in natural order on the device (for
+// DP4A, or COMPLEX_BLOCK_SIZE 32, without XGPU_SWIZZLE_ON_DEVICE).
+int xgpuSetFlagging(XGPUContext *context, float threshold, unsigned int *weights_h);
+
+// Configure the integrated F-engine of xgpuCudaFXengine (or release it, if
+// nfft is 0).  Each input (station and polarization) is channelized by a
+// polyphase filterbank of ntap taps (a sinc filter tapered by a Hann window,
+// or no filter if ntap is 1) followed by an nfft point FFT, where nfft is 8,
+// 16, 64, 256, 512, 1024, 2048, 4096 or 8192.  Channels first_channel to
+// first_channel+nfrequency-1 of the spectra are multiplied by scale and
+// correlated, saturating to the range of ComplexInput.  Returns
+// XGPU_INVALID_ARGUMENT for unsupported sizes or batched contexts, and
+// XGPU_INVALID_FLAGS if the input is not in natural order on the device (for
+// DP4A, or COMPLEX_BLOCK_SIZE 32, without XGPU_SWIZZLE_ON_DEVICE).
+int xgpuSetChannelizer(XGPUContext *context, int nfft, int ntap, int first_channel, float scale);
+
+// Same as xgpuCudaXengine, but channelizes the ntime time samples of the
+// input on the device (see xgpuSetChannelizer) from ((ntime+ntap-1)*nfft
+// voltage samples of each station and polarization at voltages_h, ordered
+// [sample][station][pol]; the first (ntap-1)*nfft samples of a call repeat the
+// last ones of the previous call.  The host input buffer is not used.
+// voltages_h should be page locked for the transfers to overlap the kernels,
+// and must not be modified until they have completed (as for array_h).
+// Returns XGPU_INVALID_FLAGS without xgpuSetChannelizer or with
+// XGPU_USE_GRAPH.
+int xgpuCudaFXengine(XGPUContext *context, const ComplexInput *voltages_h, int syncOp);
+
+// Register nbuffer externally owned buffers in device memory as input slots
+// of xgpuCudaXengineDevice (replacing any registered before, or none if
+// nbuffer is 0), so input written directly to the device (e.g. by a GPUDirect
+// RDMA capable NIC, or by another process through cudaIpcOpenMemHandle) or
+// mapped host memory (through cudaHostGetDevicePointer) is correlated without
+// staging it in the host input buffer.  Each buffer holds the input of one
+// call, laid out as the host input buffer.  The buffers remain owned by the
+// caller and must outlive their registration.  Returns XGPU_INVALID_ARGUMENT
+// if a buffer is not aligned as textures require, and XGPU_INVALID_FLAGS for
+// multi-device or batched contexts or with XGPU_USE_GRAPH.
+int xgpuSetDeviceInputBuffers(XGPUContext *context, ComplexInput **buffers_d, int nbuffer);
+
+// Same as xgpuCudaXengine, but correlates the input in registered device
+// input buffer number buffer (see xgpuSetDeviceInputBuffers) in place.  The
+// kernels wait for the CUDA event ready (e.g. recorded by whoever wrote the
+// buffer, possibly in another process through cudaIpcOpenEventHandle)
+// unless it is NULL, and consumed is recorded once they no longer read the
+// buffer unless it is NULL.  Flagging (see xgpuSetFlagging) zeroes flagged
+// samples in the buffer itself.
+struct CUevent_st;
+int xgpuCudaXengineDevice(XGPUContext *context, int buffer, struct CUevent_st *ready,
+                          struct CUevent_st *consumed, int syncOp);
+
+// Number of bins of each XGPUStageStats histogram.  Bin k counts the
+// durations from 2^(k/4) to 2^((k+1)/4) microseconds, the first bin also
+// counting anything shorter and the last anything longer.
+#define XGPU_STATS_NBIN 96
+
+// Distribution of the durations of one stage of the pipeline, measured on the
+// device with CUDA events.  Times are in milliseconds; the percentiles are
+// interpolated within their bin of the histogram.
+typedef struct XGPUStageStatsStruct {
+  long long unsigned int count;
+  float mean;
+  float p50;
+  float p99;
+  float max;
+  long long unsigned int histogram[XGPU_STATS_NBIN];
+} XGPUStageStats;
+
+// Per-stage timings of the calls to xgpuCudaXengine (or a variant) of a
+// context since it was initialized or last reset (see xgpuResetStats).
+typedef struct XGPUStatsStruct {
+  // Each NTIME_PIPE chunk's h2d transfer, and its kernels (channelizer,
+  // flagging, swizzling and correlation)
+  XGPUStageStats h2d;
+  XGPUStageStats kernel;
+  // Each dump, from the staging of the integration to its landing in the host
+  // output buffer
+  XGPUStageStats dump;
+  // Number of chunks or dumps not yet complete by the time their events were
+  // needed again, which are not counted (e.g. with SYNCOP_NONE)
+  long long unsigned int dropped;
+} XGPUStats;
+
+// Fill in stats with the timings of context, merged over the devices of a
+// multi-device context.  The timings of each call are collected by the next
+// call, or once the call has waited for them (as with SYNCOP_DUMP), so this
+// may be called from another thread to watch a running correlator, e.g. for
+// stalls of the h2d transfers.  Each stage is also marked by an NVTX range
+// (see NVTX_DISABLE) for inspection with Nsight Systems.  Returns
+// XGPU_INVALID_FLAGS for contexts on XGPU_CPU_DEVICE.
+int xgpuGetStats(XGPUContext *context, XGPUStats *stats);
+
+// Discard the timings collected so far.
+int xgpuResetStats(XGPUContext *context);
+
+// Set occupancy to the theoretical occupancy of the correlator kernel that
+// context launches, i.e. the fraction of the resident threads of a
+// multiprocessor that its blocks can fill given their registers and shared
+// memory.  Returns XGPU_INVALID_FLAGS for contexts on XGPU_CPU_DEVICE.
+int xgpuKernelOccupancy(XGPUContext *context, float *occupancy);
+
+// Memory-mapped files, for re-correlating captured input with no copies in
+// user space.  An input file is the raw input of successive calls of
+// xgpuCudaXengine (nbatch*vecLength elements each), and an output file an
+// XGPUFileHeader followed by successive dumps.  The file is mapped whole, and
+// a window of its records (calls' input or dumps) at a time is made the
+// context's host input or output buffer, i.e. registered as by
+// xgpuSetHostInputBuffer or xgpuSetHostOutputBuffer, which chunk transfers
+// then read or write in place.  The next window of an input file is read
+// ahead, and records are dropped from the page cache once their window is done
+// with.
+typedef struct XGPUFileStruct {
+  // Mapping of the file, and its length in bytes
+  char *map;
+  size_t length;
+  // Offset in bytes of the first record, the length of each, and their
+  // number in the file
+  size_t offset;
+  size_t record;
+  size_t nrecord;
+  // Records per window, the first record of the current window, and the
+  // number of the next record
+  size_t window;
+  size_t first;
+  size_t next;
+  int fd;
+  int output;
+} XGPUFile;
+
+#define XGPU_FILE_MAGIC   0x55504758 // "XGPU"
+#define XGPU_FILE_VERSION 1
+
+// Header of the output files of xgpuOpenOutputFile.  Dump k starts at
+// header_size + k*dump_size bytes, in the layout that xgpuCudaXengine writes
+// to context->matrix_h + context->output_offset.
+typedef struct XGPUFileHeaderStruct {
+  // XGPU_FILE_MAGIC and XGPU_FILE_VERSION
+  unsigned int magic;
+  unsigned int version;
+  // Members of the batch of each dump, the type of its elements (see
+  // xgpuSetOutputFormat), and the number of products of each channel in a
+  // packed dump (see xgpuSetOutputProducts), or 0
+  unsigned int nbatch;
+  unsigned int output_type;
+  unsigned int nproduct;
+  unsigned int reserved;
+  long long unsigned int header_size;
+  long long unsigned int dump_size;
+  // Number of dumps in the file
+  long long unsigned int ndump;
+  // Sizing of the correlator
+  XGPUInfo info;
+} XGPUFileHeader;
+
+// Map the input file at path for context in file, window calls' input at a
+// time (0 for all of it), and make the first window the host input buffer
+// (registered read only).  Any partial call's input at the end of the file is
+// ignored.  Returns XGPU_FILE_ERROR (with errno set) if the file cannot be
+// mapped, or XGPU_INVALID_ARGUMENT if it is shorter than one call's input.
+int xgpuOpenInputFile(XGPUContext *context, XGPUFile *file, const char *path, size_t window);
+
+// Create (or truncate) the output file at path for ndump dumps of context,
+// with the header of its current sizing and output format, map it in file,
+// window dumps at a time (0 for all of them), and make the first window the
+// host output buffer.  The output format must not change while it is open.
+int xgpuOpenOutputFile(XGPUContext *context, XGPUFile *file, const char *path, size_t ndump, size_t window);
+
+// Point context->input_offset (or output_offset) at the next record of file,
+// i.e. the input of the next call of xgpuCudaXengine or the place of its next
+// dump, moving the window on if needed.  Moving the window waits for the work
+// queued on context to complete.  Returns XGPU_END_OF_FILE once every record
+// has been used.
+int xgpuNextFileRecord(XGPUContext *context, XGPUFile *file);
+
+// Wait for the work queued on context, give it a host input (or output)
+// buffer of its own again, and unmap and close file.  An output file is first
+// written back and trimmed to the dumps requested of it by xgpuNextFileRecord.
+int xgpuCloseFile(XGPUContext *context, XGPUFile *file);
+
+// Synthetic input for load testing, generated by xgpuGenerateInput on the
+// host or xgpuGenerateDeviceInput on the device.  Each sample is Gaussian
+// noise plus nsource point sources common to all stations, then quantized as
+// by xgpuRandomComplex.  The data is a pure function of seed and the sample's
+// time, channel and input, so the host and device versions agree (up to the
+// rounding of their transcendental functions, which can occasionally change
+// a quantized sample by one step), and successive integrations continue the
+// same signal by advancing time.
+typedef struct XGPUSignalStruct {
+  // Key of the random number generator
+  unsigned long long seed;
+  // Time sample number of the first time sample generated
+  unsigned long long time;
+  // Standard deviation of the noise of each input (xgpuRandomComplex uses
+  // 2.5)
+  float noise;
+  // Number of point sources and, for each, its amplitude (standard deviation)
+  // or NULL for 1.0, and its delay at each station (nsource*nstation values)
+  // in samples of the full band, or NULL for none.  A delay of d turns
+  // channel f by -2*pi*d*f/nfrequency.
+  unsigned int nsource;
+  const float *amplitude;
+  const float *delay;
+  // Delay of each station (nstation values) added to that of every source,
+  // or NULL for none
+  const float *station_delay;
+} XGPUSignal;
+
+// Generate nbatch integrations (see xgpuInitBatched) of the synthetic input
+// signal in natural order directly into array_d, a device input buffer of
+// context (e.g. one given to xgpuSetDeviceInputBuffers), leaving it in the
+// order read by the correlator, i.e. swizzled for DP4A builds unless
+// XGPU_SWIZZLE_ON_DEVICE is set.  Blocks until the input is generated.  Not
+// available for multi-device contexts.
+int xgpuGenerateDeviceInput(XGPUContext *context, ComplexInput *array_d, const XGPUSignal *signal);
+
 // Functions in cpu_util.cc
+//
+// The "Sized" variants operate on data of the sizing given by the XGPUInfo
+// pointed to by sizing.  The other variants use the compile-time sizing.
 
 void xgpuRandomComplex(ComplexInput* random_num, long long unsigned int length);
 
+// Generate one integration of the synthetic input signal into array_h in
+// natural order, on all processors.  Returns XGPU_OUT_OF_MEMORY if the table
+// of the sources cannot be allocated.
+int xgpuGenerateInput(ComplexInput *array_h, const XGPUSignal *signal);
+int xgpuGenerateInputSized(const XGPUInfo *sizing, ComplexInput *array_h, const XGPUSignal *signal);
+
 void xgpuReorderMatrix(Complex *matrix);
+void xgpuReorderMatrixSized(const XGPUInfo *sizing, Complex *matrix);
 
+// Compare the TRIANGULAR_ORDER matrices gpu and cpu, printing a summary (and
+// with verbose=1 each differing element, and with verbose=2 and array_h
+// non-zero each input sample that contributed to it).
 void xgpuCheckResult(Complex *gpu, Complex *cpu, int verbose, ComplexInput *array_h);
+void xgpuCheckResultSized(const XGPUInfo *sizing, Complex *gpu, Complex *cpu, int verbose, ComplexInput *array_h);
+
+// An element of the TRIANGULAR_ORDER matrix found by xgpuCompareResult to
+// differ by more than the tolerance
+typedef struct XGPUMismatchStruct {
+  // Index of the element, and its channel, stations (j <= i) and
+  // polarizations
+  long long unsigned int index;
+  unsigned int f, i, j, pol1, pol2;
+  // Error of the element (see XGPUCheck)
+  double error;
+} XGPUMismatch;
+
+// Parameters and results of xgpuCompareResult.  The error of an element is
+// |gpu-cpu|/|cpu|, or |gpu| where cpu is 0 (GPU values being rounded first
+// for floating point builds with fixed point input).
+typedef struct XGPUCheckStruct {
+  // Set by the caller:
+  // Largest acceptable error, or 0 for the default of xgpuCheckResult
+  double tolerance;
+  // Only compare every baseline_stride-th baseline of every channel_stride-th
+  // channel (0 or 1 for all of them), starting from baseline and channel
+  // number phase modulo the strides, e.g. to sample a different subset on
+  // each call
+  unsigned int baseline_stride;
+  unsigned int channel_stride;
+  unsigned int phase;
+  // Give up after finding this many differing elements (0 for never)
+  long long unsigned int max_count;
+  // Array receiving the first (lowest index) max_mismatch differing elements
+  // in index order, or NULL
+  XGPUMismatch *mismatch;
+  unsigned int max_mismatch;
+
+  // Filled in by xgpuCompareResult:
+  // Number of elements compared, and of those differing
+  long long unsigned int compared;
+  long long unsigned int count;
+  // Number of entries set in mismatch
+  unsigned int nmismatch;
+  // Largest and mean error of the elements compared
+  double max_error;
+  double mean_error;
+  // Whether the comparison stopped early because of max_count
+  int stopped;
+} XGPUCheck;
+
+// Compare the TRIANGULAR_ORDER matrices gpu and cpu (neither of which is
+// modified) as specified by check, walking them in memory order on all
+// processors, and fill in the results of check.  Returns non-zero if any
+// element compared differs.  With sampling, this is cheap enough to run
+// alongside the correlator.
+int xgpuCompareResult(const Complex *gpu, const Complex *cpu, XGPUCheck *check);
+int xgpuCompareResultSized(const XGPUInfo *sizing, const Complex *gpu, const Complex *cpu, XGPUCheck *check);
 
 void xgpuSwizzleInput(ComplexInput *out, const ComplexInput *in);
+void xgpuSwizzleInputSized(const XGPUInfo *sizing, ComplexInput *out, const ComplexInput *in);
+
+// Swizzle only NTIME_PIPE chunk number chunk of the integration buffers out
+// and in (i.e. elements chunk*vecLengthPipe onwards), so that host input can
+// be swizzled incrementally, one transfer's worth at a time, as it arrives.
+void xgpuSwizzleInputChunk(ComplexInput *out, const ComplexInput *in, unsigned int chunk);
+void xgpuSwizzleInputChunkSized(const XGPUInfo *sizing, ComplexInput *out, const ComplexInput *in, unsigned int chunk);
 
 void xgpuExtractMatrix(Complex *matrix, Complex *packed);
+void xgpuExtractMatrixSized(const XGPUInfo *sizing, Complex *matrix, Complex *packed);
+
+// Product pol1, pol2 of stations i and j (in either order) in channel f of
+// the TRIANGULAR_ORDER matrix packed, i.e. element
+// [f][i][j][pol1][pol2] of the full matrix of xgpuExtractMatrix, without
+// extracting it.  Pulsar bins follow as further channels.
+Complex xgpuMatrixElement(const Complex *packed, unsigned int f, unsigned int i, unsigned int j,
+			  unsigned int pol1, unsigned int pol2);
+Complex xgpuMatrixElementSized(const XGPUInfo *sizing, const Complex *packed, unsigned int f,
+			       unsigned int i, unsigned int j, unsigned int pol1, unsigned int pol2);
 
 // Functions in omp_util.cc
 
 void xgpuOmpXengine(Complex *matrix_h, ComplexInput *array_h);
+void xgpuOmpXengineSized(const XGPUInfo *sizing, Complex *matrix_h, ComplexInput *array_h);
+
+// Correlate the input in array_h (as read by xgpuCudaXengine, or in natural
+// order if natural_order is non-zero) into matrix_h in matrix_order
+// (TRIANGULAR_ORDER, matrix_h holding sizing->triLength elements, or the
+// compiled MATRIX_ORDER, matrix_h holding sizing->matLength), adding to its contents if accumulate is
+// non-zero.  Tiles of stations are integrated over chunks of time with 16-bit
+// integer multiply-adds (AVX-512 VNNI or AVX2 when compiled for them, e.g.
+// with HOST_ARCH=native), so the output is exact.
+// xgpuOmpXengineSized is the same as TRIANGULAR_ORDER without accumulation,
+// so its matrix_h need only hold sizing->triLength elements.
+void xgpuCpuXengineSized(const XGPUInfo *sizing, Complex *matrix_h, const ComplexInput *array_h,
+                         int matrix_order, int natural_order, int accumulate);
 
 #ifdef __cplusplus
 }
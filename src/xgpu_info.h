@@ -45,8 +45,12 @@
 // Derived from NSTATION (do not change)
 #define NBASELINE ((NSTATION+1)*(NSTATION/2))
 
-// how many pulsars are we binning for (Not implemented yet)
+// How many pulsar bins the integration has in addition to bin 0 (see
+// xgpuSetPulsarBins).  Each bin has its own integration, following that of
+// the previous bin as though it were NFREQUENCY further channels.
+#ifndef NPULSAR
 #define NPULSAR 0
+#endif
 
 // Define MATRIX_ORDER based on which MATRIX_ORDER_XXX is defined.
 // There are three matrix packing options:
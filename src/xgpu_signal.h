@@ -0,0 +1,135 @@
+#ifndef XGPU_SIGNAL_H
+#define XGPU_SIGNAL_H
+
+// Synthetic input shared by xgpuGenerateInput and the generateInput kernel.
+// Every sample is a pure function of the seed and its time, channel and
+// input, via the Philox4x32-10 counter-based generator, so it does not depend
+// on the order of generation or the number of threads.  The host and the
+// device produce matching data up to the rounding of the transcendental
+// functions (their logf, sinf and cosf can differ by a few ulps), which can
+// occasionally move a sample across a quantization boundary.
+
+#include <math.h>
+
+#include "xgpu.h"
+#include "xgpu_info.h" // For NPOL
+
+#ifdef __CUDACC__
+#define SIGNAL_FUNC static inline __host__ __device__
+#else
+#define SIGNAL_FUNC static inline
+#endif
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+// Top bit of the input word of the counter of source samples, which keeps
+// them apart from the noise of the inputs
+#define SIGNAL_SOURCE 0x80000000u
+
+// Apply the ten rounds of Philox4x32 with key k0, k1 to the counter c
+SIGNAL_FUNC void philox4x32(unsigned int c[4], unsigned int k0, unsigned int k1)
+{
+  int round;
+  for(round=0; round<10; round++) {
+    unsigned long long p0 = (unsigned long long)PHILOX_M0 * c[0];
+    unsigned long long p1 = (unsigned long long)PHILOX_M1 * c[2];
+    unsigned int x0 = (unsigned int)(p1 >> 32) ^ c[1] ^ k0;
+    unsigned int x2 = (unsigned int)(p0 >> 32) ^ c[3] ^ k1;
+    c[1] = (unsigned int)p1;
+    c[3] = (unsigned int)p0;
+    c[0] = x0;
+    c[2] = x2;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+}
+
+// A pair of independent normally distributed values with unit standard
+// deviation for counter c0..c3, by the Box-Muller transform
+SIGNAL_FUNC void philoxGaussian(float *a, float *b, unsigned long long seed,
+				unsigned int c0, unsigned int c1, unsigned int c2, unsigned int c3)
+{
+  unsigned int c[4] = {c0, c1, c2, c3};
+  philox4x32(c, (unsigned int)seed, (unsigned int)(seed >> 32));
+  // u1 is never 0
+  float u1 = ((float)c[0] + 0.5f) * 2.3283064e-10f;
+  float u2 = (float)c[1] * 2.3283064e-10f;
+  float r = sqrtf(-2.0f*logf(u1));
+  float theta = 6.28318531f*u2;
+  *a = r*cosf(theta);
+  *b = r*sinf(theta);
+}
+
+// Sample of polarization p of station s in channel f at time t: noise of
+// standard deviation noise plus nsource sources, each the same at every
+// station but for a delay.  table holds nstation+1 entries per source, its
+// amplitude followed by its total delay at each station in samples of the
+// full band (see signalTable), which turns it by -2*pi*delay*f/nfrequency.
+SIGNAL_FUNC void signalSample(float *re, float *im, const float *table, unsigned int nsource,
+			      unsigned int nstation, unsigned int nfrequency, float noise,
+			      unsigned long long seed, unsigned long long t,
+			      unsigned int f, unsigned int s, unsigned int p)
+{
+  unsigned int t0 = (unsigned int)t, t1 = (unsigned int)(t >> 32);
+  unsigned int k;
+  float a, b;
+
+  philoxGaussian(&a, &b, seed, t0, t1, f, s*NPOL + p);
+  a *= noise;
+  b *= noise;
+
+  for(k=0; k<nsource; k++) {
+    const float *source = table + k*(nstation+1);
+    float x, y, turns, c, sn;
+    philoxGaussian(&x, &y, seed, t0, t1, f, SIGNAL_SOURCE | (k*NPOL + p));
+    // Keep only the fraction of a turn, which float holds to full precision
+    turns = source[1+s] * f / nfrequency;
+    turns -= floorf(turns);
+    c = source[0]*cosf(6.28318531f*turns);
+    sn = source[0]*sinf(6.28318531f*turns);
+    a += x*c + y*sn;
+    b += y*c - x*sn;
+  }
+
+  *re = a;
+  *im = b;
+}
+
+// Quantize a sample as xgpuRandomComplex does: round to an integer,
+// saturate to -7..+7, and, for fixed point input, scale by 16 (or, for INT4,
+// pack into nibbles).
+SIGNAL_FUNC void quantizeSample(ComplexInput *out, float a, float b)
+{
+  a = fminf(fmaxf(roundf(a), -7.0f), 7.0f);
+  b = fminf(fmaxf(roundf(b), -7.0f), 7.0f);
+#ifndef FIXED_POINT
+  out->real = a;
+  out->imag = b;
+#elif defined(INT4)
+  out->reim = ((((int)a) & 0xf) << 4) | (((int)b) & 0xf);
+#else
+  out->real = ((int)a) << 4;
+  out->imag = ((int)b) << 4;
+#endif
+}
+
+// Fill table (signal->nsource*(nstation+1) floats) with the amplitude of
+// each source of signal followed by its delay at each station, including
+// that station's own delay.
+static inline void signalTable(float *table, const XGPUSignal *signal, unsigned int nstation)
+{
+  unsigned int k, s;
+  for(k=0; k<signal->nsource; k++) {
+    float *source = table + k*(nstation+1);
+    source[0] = signal->amplitude ? signal->amplitude[k] : 1.0f;
+    for(s=0; s<nstation; s++) {
+      source[1+s] = (signal->delay ? signal->delay[k*nstation + s] : 0.0f)
+	+ (signal->station_delay ? signal->station_delay[s] : 0.0f);
+    }
+  }
+}
+
+#endif // XGPU_SIGNAL_H
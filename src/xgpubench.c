@@ -0,0 +1,481 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <cuda_runtime_api.h>
+
+#include "xgpu.h"
+
+/*
+  Parameter sweep benchmark.  Every combination of the station counts,
+  channel counts, integration lengths, transfer lengths, sync operations and
+  variants given on the command line is correlated (with random input) by a
+  fresh context, and measured with one record per combination of:
+
+  - end-to-end throughput (TFLOP/s, counting 8 operations per complex
+    multiply-accumulate) and input bandwidth, from the wall time of the calls
+  - kernel throughput and achieved h2d (PCIe) bandwidth, from the per-stage
+    device timings of xgpuGetStats
+  - theoretical occupancy of the correlator kernel (xgpuKernelOccupancy)
+  - percentiles of the latency of each call, and of the stages
+
+  Records are written to stdout as CSV (with a header row unless -H) or as
+  JSON (one object per line, in an array).  Each names the device, toolkit and
+  library build, so the records of different builds (e.g. DP4A=yes/no,
+  TEXTURE_DIM=1/2, which are compile-time options of the library) and
+  machines can be collected together; see the sweep script.
+*/
+
+#ifndef TEXTURE_DIM
+#define TEXTURE_DIM 1
+#endif
+
+// Largest number of values of each swept parameter
+#define MAX_VALUES 32
+
+// Device flags of each variant of the correlator that can be selected at
+// runtime
+static const struct {
+  const char *name;
+  int flags;
+} variants[] = {
+  {"default",  0},
+  {"graph",    XGPU_USE_GRAPH},
+  {"notensor", XGPU_NO_TENSOR_CORES},
+  {"swizzle",  XGPU_SWIZZLE_ON_DEVICE},
+  {"deep",     XGPU_PIPELINE_DEPTH(4) | XGPU_COPY_STREAMS(2)},
+};
+#define NVARIANT (int)(sizeof(variants)/sizeof(variants[0]))
+
+// Names of the sync operations, indexed by value
+static const char *syncop_names[] = {
+  "none", "dump", "sync_transfer", "sync_compute", "dump_async"
+};
+#define NSYNCOP (int)(sizeof(syncop_names)/sizeof(syncop_names[0]))
+
+// One measurement
+typedef struct RecordStruct {
+  XGPUInfo info;
+  const char *variant;
+  int syncop;
+  int count;
+  double ms_per_call;
+  double tflops;
+  double input_gbps;
+  double kernel_tflops;
+  double h2d_gbps;
+  float occupancy;
+  double latency_p50;
+  double latency_p99;
+  double latency_max;
+  XGPUStats stats;
+} Record;
+
+// Description of the device and build, common to every record
+static char device_name[256] = "unknown";
+static int compute_capability = 0;
+static int runtime_version = 0;
+static int driver_version = 0;
+
+// Whether records are written as JSON rather than CSV, whether CSV starts
+// with a header row, and the number of records written
+static int json = 0;
+static int header = 1;
+static int nrecord = 0;
+
+#define ELAPSED_MS(start,stop) \
+  ((((int64_t)stop.tv_sec-start.tv_sec)*1000*1000*1000+(stop.tv_nsec-start.tv_nsec))/1e6)
+
+// Parse a comma separated list of unsigned integers into values, returning
+// their number, or -1 if there are too many
+static int parseList(const char *arg, unsigned int *values)
+{
+  char *p = (char *)arg;
+  int n;
+  for(n=0; n<MAX_VALUES; ) {
+    values[n++] = strtoul(p, &p, 0);
+    if(*p != ',') {
+      return n;
+    }
+    p++;
+  }
+  return -1;
+}
+
+// Parse a comma separated list of variant names into indexes into variants,
+// returning their number, or -1 for an unknown variant
+static int parseVariants(const char *arg, int *values)
+{
+  char *list = strdup(arg);
+  int n = 0;
+  for(char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+    int v;
+    for(v=0; v<NVARIANT && strcmp(name, variants[v].name); v++);
+    if(v == NVARIANT || n == MAX_VALUES) {
+      free(list);
+      return -1;
+    }
+    values[n++] = v;
+  }
+  free(list);
+  return n;
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+// Fraction q percentile of the n sorted values (the nearest one)
+static double percentile(const double *sorted, int n, double q)
+{
+  return sorted[(int)(q*(n-1) + 0.5)];
+}
+
+// Write s as a CSV or JSON string
+static void writeString(const char *s)
+{
+  putchar('"');
+  for(; *s; s++) {
+    if(*s == '"') {
+      putchar(json ? '\\' : '"');
+    } else if(*s == '\\' && json) {
+      putchar('\\');
+    }
+    putchar(*s);
+  }
+  putchar('"');
+}
+
+// Write field name of a record with value s (if not NULL) or v, or only its
+// name if names (for the CSV header row)
+static void writeField(int names, int *first, const char *name, const char *s, double v)
+{
+  if(!*first) {
+    putchar(',');
+  }
+  *first = 0;
+  if(names) {
+    printf("%s", name);
+    return;
+  }
+  if(json) {
+    printf("\"%s\":", name);
+  }
+  if(s) {
+    writeString(s);
+  } else {
+    printf("%.10g", v);
+  }
+}
+
+// Write record r, or the CSV header row if r is NULL
+static void writeRecord(const Record *r)
+{
+  static const Record empty;
+  int names = !r;
+  int first = 1;
+  if(!r) {
+    r = &empty;
+  }
+  const XGPUInfo *info = &r->info;
+
+  if(json) {
+    printf(nrecord ? ",\n{" : "[\n{");
+  }
+  writeField(names, &first, "version", xgpuVersionString(), 0);
+  writeField(names, &first, "device", device_name, 0);
+  writeField(names, &first, "compute_capability", NULL, compute_capability);
+  writeField(names, &first, "cuda_runtime", NULL, runtime_version);
+  writeField(names, &first, "cuda_driver", NULL, driver_version);
+  writeField(names, &first, "input_type", NULL, info->input_type);
+  writeField(names, &first, "compute_type", NULL, info->compute_type);
+  writeField(names, &first, "matrix_order", NULL, info->matrix_order);
+  writeField(names, &first, "shared_atomic_size", NULL, info->shared_atomic_size);
+  writeField(names, &first, "complex_block_size", NULL, info->complex_block_size);
+  writeField(names, &first, "texture_dim", NULL, TEXTURE_DIM);
+  writeField(names, &first, "nstation", NULL, info->nstation);
+  writeField(names, &first, "nfrequency", NULL, info->nfrequency);
+  writeField(names, &first, "ntime", NULL, info->ntime);
+  writeField(names, &first, "ntimepipe", NULL, info->ntimepipe);
+  writeField(names, &first, "syncop", syncop_names[r->syncop], 0);
+  writeField(names, &first, "variant", r->variant ? r->variant : "", 0);
+  writeField(names, &first, "count", NULL, r->count);
+  writeField(names, &first, "ms_per_call", NULL, r->ms_per_call);
+  writeField(names, &first, "tflops", NULL, r->tflops);
+  writeField(names, &first, "input_gbps", NULL, r->input_gbps);
+  writeField(names, &first, "kernel_tflops", NULL, r->kernel_tflops);
+  writeField(names, &first, "h2d_gbps", NULL, r->h2d_gbps);
+  writeField(names, &first, "occupancy", NULL, r->occupancy);
+  writeField(names, &first, "latency_p50_ms", NULL, r->latency_p50);
+  writeField(names, &first, "latency_p99_ms", NULL, r->latency_p99);
+  writeField(names, &first, "latency_max_ms", NULL, r->latency_max);
+  writeField(names, &first, "h2d_p50_ms", NULL, r->stats.h2d.p50);
+  writeField(names, &first, "h2d_p99_ms", NULL, r->stats.h2d.p99);
+  writeField(names, &first, "kernel_p50_ms", NULL, r->stats.kernel.p50);
+  writeField(names, &first, "kernel_p99_ms", NULL, r->stats.kernel.p99);
+  writeField(names, &first, "dump_p50_ms", NULL, r->stats.dump.p50);
+  writeField(names, &first, "dump_p99_ms", NULL, r->stats.dump.p99);
+  writeField(names, &first, "dropped", NULL, r->stats.dropped);
+  printf(json ? "}" : "\n");
+  fflush(stdout);
+
+  if(!names) {
+    nrecord++;
+  }
+}
+
+// Measure count calls (after warmup calls) of a context of the given sizing
+// on device, filling in r.  Returns an XGPU error code.
+static int measure(int device, const XGPUInfo *sizing, int variant, int syncop,
+                   int count, int warmup, Record *r)
+{
+  XGPUContext context;
+  double *latency = NULL;
+  struct timespec start, stop, tic, toc;
+  int error;
+
+  memset(r, 0, sizeof(*r));
+  r->info = *sizing;
+  r->variant = variants[variant].name;
+  r->syncop = syncop;
+  r->count = count;
+
+  context.array_h = NULL;
+  context.matrix_h = NULL;
+  error = xgpuInitSized(&context, sizing, device | variants[variant].flags);
+  if(error) {
+    return error;
+  }
+  latency = (double *)malloc(count*sizeof(double));
+  if(!latency) {
+    error = XGPU_OUT_OF_MEMORY;
+    goto cleanup;
+  }
+  xgpuRandomComplex(context.array_h, sizing->vecLength);
+
+  // Warm up (capturing any graph), then wait for everything to finish
+  for(int i=0; i<warmup; i++) {
+    error = xgpuCudaXengine(&context, syncop);
+    if(error) {
+      goto cleanup;
+    }
+  }
+  error = xgpuDumpSynchronize(&context);
+  if(error) {
+    goto cleanup;
+  }
+  cudaDeviceSynchronize();
+  xgpuResetStats(&context);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(int i=0; i<count; i++) {
+    clock_gettime(CLOCK_MONOTONIC, &tic);
+    error = xgpuCudaXengine(&context, syncop);
+    clock_gettime(CLOCK_MONOTONIC, &toc);
+    if(error) {
+      goto cleanup;
+    }
+    latency[i] = ELAPSED_MS(tic, toc);
+  }
+  // Wait for any asynchronous dumps, and the work of unsynchronized calls, to
+  // finish
+  error = xgpuDumpSynchronize(&context);
+  if(error) {
+    goto cleanup;
+  }
+  cudaDeviceSynchronize();
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  if(xgpuGetStats(&context, &r->stats) != XGPU_OK) {
+    memset(&r->stats, 0, sizeof(r->stats));
+  }
+  if(xgpuKernelOccupancy(&context, &r->occupancy) != XGPU_OK) {
+    r->occupancy = 0;
+  }
+
+  // 8 operations per complex multiply-accumulate of every product
+  double flop = 8.0 * sizing->nfrequency * sizing->nbaseline * sizing->npol * sizing->npol * sizing->ntime;
+  double input_bytes = (double)sizing->vecLength * sizeof(ComplexInput);
+  int pipe_length = sizing->ntime / sizing->ntimepipe;
+
+  r->ms_per_call = ELAPSED_MS(start, stop) / count;
+  r->tflops = flop / r->ms_per_call / 1e9;
+  r->input_gbps = input_bytes / r->ms_per_call / 1e6;
+  if(r->stats.kernel.count) {
+    r->kernel_tflops = flop / (r->stats.kernel.mean * pipe_length) / 1e9;
+  }
+  if(r->stats.h2d.count) {
+    r->h2d_gbps = input_bytes / pipe_length / r->stats.h2d.mean / 1e6;
+  }
+  qsort(latency, count, sizeof(double), compareDouble);
+  r->latency_p50 = percentile(latency, count, 0.5);
+  r->latency_p99 = percentile(latency, count, 0.99);
+  r->latency_max = latency[count-1];
+
+cleanup:
+  free(latency);
+  xgpuFree(&context);
+
+  return error;
+}
+
+int main(int argc, char** argv)
+{
+  int opt;
+  int device = 0;
+  int count = 100;
+  int warmup = 5;
+  unsigned int nstation[MAX_VALUES], nfrequency[MAX_VALUES];
+  unsigned int ntime[MAX_VALUES], ntimepipe[MAX_VALUES];
+  unsigned int syncop[MAX_VALUES];
+  int variant[MAX_VALUES];
+  int nnstation = 0, nnfrequency = 0, nntime = 0, nntimepipe = 0;
+  int nsyncop = 1, nvariant = 1;
+  int nfailed = 0;
+  XGPUInfo xgpu_info;
+
+  syncop[0] = SYNCOP_DUMP;
+  variant[0] = 0;
+
+  while ((opt = getopt(argc, argv, "c:d:F:HhjN:o:P:T:V:w:")) != -1) {
+    switch (opt) {
+      case 'c':
+        // Set number of measured calls per combination
+        count = strtoul(optarg, NULL, 0);
+        if(count < 1) {
+          fprintf(stderr, "count must be positive\n");
+          return 1;
+        }
+        break;
+      case 'd':
+        // Set CUDA device number
+        device = strtoul(optarg, NULL, 0);
+        break;
+      case 'F':
+        nnfrequency = parseList(optarg, nfrequency);
+        break;
+      case 'H':
+        // Omit the CSV header row (e.g. when appending)
+        header = 0;
+        break;
+      case 'j':
+        json = 1;
+        break;
+      case 'N':
+        nnstation = parseList(optarg, nstation);
+        break;
+      case 'o':
+        nsyncop = parseList(optarg, syncop);
+        for(int i=0; i<nsyncop; i++) {
+          if(syncop[i] >= NSYNCOP) {
+            nsyncop = -1;
+          }
+        }
+        break;
+      case 'P':
+        nntimepipe = parseList(optarg, ntimepipe);
+        break;
+      case 'T':
+        nntime = parseList(optarg, ntime);
+        break;
+      case 'V':
+        nvariant = parseVariants(optarg, variant);
+        break;
+      case 'w':
+        // Set number of unmeasured calls per combination
+        warmup = strtoul(optarg, NULL, 0);
+        break;
+      default: /* '?' */
+        fprintf(stderr,
+            "Usage: %s [options]\n"
+            "Correlates every combination of the comma separated values of the\n"
+            "options, writing a record of its throughput and latency to stdout.\n"
+            "Options:\n"
+            "  -c CALLS          Measured calls to xgpuCudaXengine [100]\n"
+            "  -d DEVNUM         GPU device to use [0]\n"
+            "  -F NFREQUENCY,... Numbers of frequency channels [compile-time]\n"
+            "  -H                Omit the CSV header row\n"
+            "  -j                Write JSON rather than CSV\n"
+            "  -N NSTATION,...   Numbers of stations [compile-time]\n"
+            "  -o SYNCOP,...     Sync operations of the calls [1]\n"
+            "                    (see cuda_correlator)\n"
+            "  -P NTIME_PIPE,... Time samples per transfer to GPU [compile-time]\n"
+            "  -T NTIME,...      Time samples per integration [compile-time]\n"
+            "  -V VARIANT,...    Variants of the correlator [default]\n"
+            "                    default, graph (XGPU_USE_GRAPH), notensor\n"
+            "                    (XGPU_NO_TENSOR_CORES), swizzle\n"
+            "                    (XGPU_SWIZZLE_ON_DEVICE) or deep (4 input\n"
+            "                    buffers, 2 copy streams)\n"
+            "  -w CALLS          Unmeasured warm up calls [5]\n"
+            "  -h                Show this message\n",
+            argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+  if(nnstation < 0 || nnfrequency < 0 || nntime < 0 || nntimepipe < 0 ||
+     nsyncop < 0 || nvariant < 0) {
+    fprintf(stderr, "invalid or too many values (at most %d per option)\n", MAX_VALUES);
+    return 1;
+  }
+
+  // Unswept sizing parameters keep their compile-time value
+  xgpuInfo(&xgpu_info);
+  if(!nnstation) nstation[nnstation++] = xgpu_info.nstation;
+  if(!nnfrequency) nfrequency[nnfrequency++] = xgpu_info.nfrequency;
+  if(!nntime) ntime[nntime++] = xgpu_info.ntime;
+  if(!nntimepipe) ntimepipe[nntimepipe++] = xgpu_info.ntimepipe;
+
+  if(device != XGPU_CPU_DEVICE) {
+    struct cudaDeviceProp prop;
+    if(cudaGetDeviceProperties(&prop, device) == cudaSuccess) {
+      snprintf(device_name, sizeof(device_name), "%s", prop.name);
+      compute_capability = 10*prop.major + prop.minor;
+    }
+  } else {
+    snprintf(device_name, sizeof(device_name), "CPU X-engine");
+  }
+  cudaRuntimeGetVersion(&runtime_version);
+  cudaDriverGetVersion(&driver_version);
+
+  if(!json && header) {
+    writeRecord(NULL);
+  }
+
+  for(int a=0; a<nnstation; a++)
+  for(int b=0; b<nnfrequency; b++)
+  for(int c=0; c<nntime; c++)
+  for(int d=0; d<nntimepipe; d++) {
+    int error = xgpuSizedInfo(&xgpu_info, nstation[a], nfrequency[b], ntime[c], ntimepipe[d]);
+    if(error) {
+      fprintf(stderr, "skipping %u stations, %u channels, ntime %u, ntimepipe %u: "
+              "unsupported sizing (error code %d)\n",
+              nstation[a], nfrequency[b], ntime[c], ntimepipe[d], error);
+      continue;
+    }
+    for(int e=0; e<nsyncop; e++)
+    for(int f=0; f<nvariant; f++) {
+      Record record;
+      fprintf(stderr, "%u stations, %u channels, ntime %u, ntimepipe %u, %s, %s\n",
+              nstation[a], nfrequency[b], ntime[c], ntimepipe[d],
+              syncop_names[syncop[e]], variants[variant[f]].name);
+      error = measure(device, &xgpu_info, variant[f], syncop[e], count, warmup, &record);
+      if(error) {
+        fprintf(stderr, "failed (error code %d)\n", error);
+        nfailed++;
+        continue;
+      }
+      writeRecord(&record);
+    }
+  }
+
+  if(json) {
+    printf(nrecord ? "\n]\n" : "[]\n");
+  }
+
+  return nfailed ? 1 : 0;
+}
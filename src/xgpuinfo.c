@@ -26,6 +26,7 @@ int main(int argc, char** argv)
     case XGPU_INT8:    printf("8 bit integers\n"); break;
     case XGPU_FLOAT32: printf("32 bit floats\n"); break;
     case XGPU_INT32:   printf("32 bit integers\n"); break;
+    case XGPU_INT4:    printf("4 bit integers, packed real/imag\n"); break;
     default: printf("<unknown type code: %d>\n", xgpu_info.input_type);
   }
 
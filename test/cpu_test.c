@@ -0,0 +1,329 @@
+// Behavior tests of the host side of xGPU that need no GPU: the CPU X-engine
+// (xgpuCpuXengineSized) against a reference X-engine for the compiled matrix
+// order, the sampling comparator (xgpuCompareResultSized), and the packed
+// matrix accessor (xgpuMatrixElementSized).
+//
+// Build once per matrix order (see "make test-cpu"), e.g. with
+// -DMATRIX_ORDER_TRIANGULAR or -DMATRIX_ORDER_REAL_IMAG, or neither for the
+// default REGISTER_TILE_TRIANGULAR_ORDER.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "xgpu.h"
+#include "xgpu_info.h"
+
+#define TEST_SEED 12345
+
+// A small sizing with several 16 station tiles and a partial time chunk
+#define TEST_NSTATION 48
+#define TEST_NFREQUENCY 3
+#define TEST_NTIME 200
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do {                   \
+    if (!(cond)) {                              \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__);                    \
+        printf("\n");                           \
+        failures++;                             \
+    }                                           \
+} while (0)
+
+static XGPUInfo test_sizing;
+
+// The unsized helpers of cpu_util.c ask the library for its sizing, which
+// is that of the test here
+void xgpuInfo(XGPUInfo *pcxs) {
+    *pcxs = test_sizing;
+}
+
+// Fill sizing as xgpuSizedInfo would for the compiled matrix order
+static void make_sizing(XGPUInfo *sizing, unsigned int nstation, unsigned int nfrequency, unsigned int ntime) {
+    memset(sizing, 0, sizeof(*sizing));
+    sizing->npol = NPOL;
+    sizing->nstation = nstation;
+    sizing->nbaseline = (nstation+1)*(nstation/2);
+    sizing->nfrequency = nfrequency;
+    sizing->ntime = ntime;
+    sizing->ntimepipe = ntime;
+    sizing->vecLength = (long long unsigned int)nfrequency * ntime * nstation * NPOL;
+    sizing->vecLengthPipe = sizing->vecLength;
+    sizing->triLength = (long long unsigned int)nfrequency * sizing->nbaseline * NPOL*NPOL * (NPULSAR + 1);
+#if MATRIX_ORDER == REGISTER_TILE_TRIANGULAR_ORDER
+    sizing->matLength = (long long unsigned int)nfrequency * ((nstation/2+1)*(nstation/4)*NPOL*NPOL*4) * (NPULSAR + 1);
+#else
+    sizing->matLength = sizing->triLength;
+#endif
+    sizing->matrix_order = MATRIX_ORDER;
+    sizing->shared_atomic_size = SHARED_ATOMIC_SIZE;
+    sizing->complex_block_size = 1;
+}
+
+// Straightforward TRIANGULAR_ORDER X-engine of natural order input, as
+// xgpuOmpXengine used to be
+static void reference_xengine(const XGPUInfo *sizing, Complex *matrix, const ComplexInput *array) {
+    const unsigned int nstation = sizing->nstation;
+    const unsigned int nfrequency = sizing->nfrequency;
+    for (unsigned int f = 0; f < nfrequency; f++) {
+        for (unsigned int i = 0; i < nstation; i++) {
+            for (unsigned int j = 0; j <= i; j++) {
+                size_t k = (size_t)f*sizing->nbaseline + i*(i+1)/2 + j;
+                for (int p1 = 0; p1 < NPOL; p1++) {
+                    for (int p2 = 0; p2 < NPOL; p2++) {
+                        double re = 0, im = 0;
+                        for (unsigned int t = 0; t < sizing->ntime; t++) {
+                            const ComplexInput *row = &array[((t*nfrequency + f)*nstation + i)*NPOL + p1];
+                            const ComplexInput *col = &array[((t*nfrequency + f)*nstation + j)*NPOL + p2];
+                            re += (double)row->real*col->real + (double)row->imag*col->imag;
+                            im += (double)row->imag*col->real - (double)row->real*col->imag;
+                        }
+                        matrix[(k*NPOL + p1)*NPOL + p2].real = re;
+                        matrix[(k*NPOL + p1)*NPOL + p2].imag = im;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Number of elements of a and b (n of each) that differ
+static size_t count_differences(const Complex *a, const Complex *b, size_t n) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (a[i].real != b[i].real || a[i].imag != b[i].imag) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void test_cpu_xengine(const ComplexInput *array, const Complex *reference) {
+    const XGPUInfo *sizing = &test_sizing;
+    Complex *matrix = malloc(sizing->matLength * sizeof(Complex));
+    size_t n;
+
+    // Products of 4 bit samples scaled by 16 are exact, so must match exactly
+    xgpuCpuXengineSized(sizing, matrix, array, TRIANGULAR_ORDER, 1, 0);
+    n = count_differences(matrix, reference, sizing->triLength);
+    CHECK(n == 0, "xgpuCpuXengineSized TRIANGULAR_ORDER: %zu elements differ", n);
+
+    // xgpuOmpXengineSized is TRIANGULAR_ORDER without accumulation, into a
+    // buffer of only triLength elements (plus a guard element that must
+    // survive)
+    Complex *triangular = malloc((sizing->triLength + 1) * sizeof(Complex));
+    memset(triangular, 0x55, (sizing->triLength + 1) * sizeof(Complex));
+    Complex guard = triangular[sizing->triLength];
+    xgpuOmpXengineSized(sizing, triangular, (ComplexInput *)array);
+    n = count_differences(triangular, reference, sizing->triLength);
+    CHECK(n == 0, "xgpuOmpXengineSized: %zu elements differ", n);
+    CHECK(count_differences(&triangular[sizing->triLength], &guard, 1) == 0,
+          "xgpuOmpXengineSized wrote past triLength elements");
+    free(triangular);
+
+    // The compiled matrix order, taken back to TRIANGULAR_ORDER
+    xgpuCpuXengineSized(sizing, matrix, array, MATRIX_ORDER, 1, 0);
+    xgpuReorderMatrixSized(sizing, matrix);
+    n = count_differences(matrix, reference, sizing->triLength);
+    CHECK(n == 0, "xgpuCpuXengineSized MATRIX_ORDER %d: %zu elements differ", MATRIX_ORDER, n);
+
+    // Accumulating a second integration doubles every element
+    xgpuCpuXengineSized(sizing, matrix, array, TRIANGULAR_ORDER, 1, 0);
+    xgpuCpuXengineSized(sizing, matrix, array, TRIANGULAR_ORDER, 1, 1);
+    Complex *twice = malloc(sizing->triLength * sizeof(Complex));
+    for (size_t i = 0; i < sizing->triLength; i++) {
+        twice[i].real = 2*reference[i].real;
+        twice[i].imag = 2*reference[i].imag;
+    }
+    n = count_differences(matrix, twice, sizing->triLength);
+    CHECK(n == 0, "xgpuCpuXengineSized accumulate: %zu elements differ", n);
+
+    free(twice);
+    free(matrix);
+}
+
+static void test_compare_result(const Complex *reference) {
+    const XGPUInfo *sizing = &test_sizing;
+    const size_t nelement = (size_t)sizing->nfrequency * sizing->nbaseline * NPOL*NPOL;
+    Complex *gpu = malloc(nelement * sizeof(Complex));
+    XGPUMismatch mismatch[4];
+    XGPUCheck check;
+
+    // Identical matrices
+    memcpy(gpu, reference, nelement * sizeof(Complex));
+    memset(&check, 0, sizeof(check));
+    CHECK(xgpuCompareResultSized(sizing, gpu, reference, &check) == 0, "identical matrices differ");
+    CHECK(check.compared == nelement, "compared %llu of %zu elements", check.compared, nelement);
+    CHECK(check.count == 0 && check.max_error == 0 && !check.stopped, "identical matrices: count %llu", check.count);
+
+    // Spoil every element of baseline 5 of channel 1, and polarization 3 of
+    // the last baseline of channel 2
+    const size_t spoiled = ((size_t)1*sizing->nbaseline + 5) * NPOL*NPOL;
+    const size_t last = ((size_t)2*sizing->nbaseline + sizing->nbaseline-1) * NPOL*NPOL + 3;
+    for (int p = 0; p < NPOL*NPOL; p++) {
+        gpu[spoiled + p].real += 1000;
+    }
+    gpu[last].imag += 1000;
+
+    memset(&check, 0, sizeof(check));
+    check.mismatch = mismatch;
+    check.max_mismatch = 4;
+    CHECK(xgpuCompareResultSized(sizing, gpu, reference, &check) != 0, "spoiled matrix matches");
+    CHECK(check.count == NPOL*NPOL + 1, "found %llu of %d differences", check.count, NPOL*NPOL + 1);
+    CHECK(check.nmismatch == 4, "recorded %u mismatches", check.nmismatch);
+    // The first four in index order: all of baseline 5 of channel 1
+    for (unsigned int m = 0; m < check.nmismatch; m++) {
+        CHECK(mismatch[m].index == spoiled + m, "mismatch %u at %llu", m, mismatch[m].index);
+        CHECK(mismatch[m].f == 1 && mismatch[m].pol1 == m / NPOL && mismatch[m].pol2 == m % NPOL,
+              "mismatch %u: f %u pol %u,%u", m, mismatch[m].f, mismatch[m].pol1, mismatch[m].pol2);
+    }
+    // Baseline 5 is stations 2 and 2 (k = i*(i+1)/2 + j)
+    CHECK(mismatch[0].i == 2 && mismatch[0].j == 2, "mismatch 0 at stations %u,%u", mismatch[0].i, mismatch[0].j);
+
+    // Baseline stride alone: with 48 stations the last baseline is 1175,
+    // 3 mod 4, and the spoiled baseline 5 is 1 mod 4, so phase 3 of stride 4
+    // finds only the former and phase 1 only the latter
+    const unsigned long long nsample = sizing->nbaseline / 4;
+    memset(&check, 0, sizeof(check));
+    check.baseline_stride = 4;
+    check.phase = 3;
+    xgpuCompareResultSized(sizing, gpu, reference, &check);
+    CHECK(check.compared == nsample * sizing->nfrequency * NPOL*NPOL, "baseline stride: compared %llu",
+          check.compared);
+    CHECK(check.count == 1, "baseline stride, phase 3: found %llu differences", check.count);
+    memset(&check, 0, sizeof(check));
+    check.baseline_stride = 4;
+    check.phase = 1;
+    xgpuCompareResultSized(sizing, gpu, reference, &check);
+    CHECK(check.count == NPOL*NPOL, "baseline stride, phase 1: found %llu differences", check.count);
+
+    // Channel stride alone: every second channel from 0 misses channel 1
+    // but includes channel 2
+    memset(&check, 0, sizeof(check));
+    check.channel_stride = 2;
+    xgpuCompareResultSized(sizing, gpu, reference, &check);
+    CHECK(check.compared == (unsigned long long)sizing->nbaseline * 2 * NPOL*NPOL, "channel stride: compared %llu",
+          check.compared);
+    CHECK(check.count == 1, "channel stride: found %llu differences", check.count);
+
+    // Baseline 5 of channel 2 only (channel phase 5 % 3), which is intact
+    memset(&check, 0, sizeof(check));
+    check.baseline_stride = sizing->nbaseline;
+    check.channel_stride = sizing->nfrequency;
+    check.phase = 5;
+    xgpuCompareResultSized(sizing, gpu, reference, &check);
+    CHECK(check.compared == NPOL*NPOL && check.count == 0, "sampled: compared %llu, found %llu",
+          check.compared, check.count);
+
+    // max_count stops the walk once that many differences are found.  On one
+    // thread it stops right after the block of the first spoiled baseline.
+#ifdef _OPENMP
+    int nthread = omp_get_max_threads();
+    omp_set_num_threads(1);
+#endif
+    memset(&check, 0, sizeof(check));
+    check.max_count = 2;
+    xgpuCompareResultSized(sizing, gpu, reference, &check);
+    CHECK(check.stopped, "max_count: did not stop");
+    CHECK(check.count == NPOL*NPOL, "max_count: found %llu differences", check.count);
+    CHECK(check.compared < nelement, "max_count: compared all %llu elements", check.compared);
+#ifdef _OPENMP
+    omp_set_num_threads(nthread);
+#endif
+    // On any number of threads it finds at least max_count
+    memset(&check, 0, sizeof(check));
+    check.max_count = 2;
+    xgpuCompareResultSized(sizing, gpu, reference, &check);
+    CHECK(check.stopped && check.count >= 2, "max_count: stopped %d with %llu", check.stopped, check.count);
+
+    // A max_count beyond the differences does not stop
+    memset(&check, 0, sizeof(check));
+    check.max_count = 100;
+    xgpuCompareResultSized(sizing, gpu, reference, &check);
+    CHECK(!check.stopped && check.count == NPOL*NPOL + 1, "max_count 100: stopped %d with %llu",
+          check.stopped, check.count);
+
+    free(gpu);
+}
+
+static void test_matrix_element(const Complex *reference) {
+    const XGPUInfo *sizing = &test_sizing;
+    const unsigned int nstation = sizing->nstation;
+    const unsigned int nfrequency = sizing->nfrequency;
+    Complex *full = malloc((size_t)nfrequency * nstation * nstation * NPOL*NPOL * sizeof(Complex));
+    size_t conjugate_errors = 0, extract_errors = 0, packed_errors = 0;
+
+    xgpuExtractMatrixSized(sizing, full, (Complex *)reference);
+
+    for (unsigned int f = 0; f < nfrequency; f++) {
+        for (unsigned int i = 0; i < nstation; i++) {
+            for (unsigned int j = 0; j < nstation; j++) {
+                for (unsigned int p1 = 0; p1 < NPOL; p1++) {
+                    for (unsigned int p2 = 0; p2 < NPOL; p2++) {
+                        Complex e = xgpuMatrixElementSized(sizing, reference, f, i, j, p1, p2);
+                        Complex t = xgpuMatrixElementSized(sizing, reference, f, j, i, p2, p1);
+                        // Hermitian: (i,j,p1,p2) is the conjugate of (j,i,p2,p1)
+                        if (i != j && (e.real != t.real || e.imag != -t.imag)) {
+                            conjugate_errors++;
+                        }
+                        if (j <= i) {
+                            // Straight from the packed half
+                            size_t k = (size_t)f*sizing->nbaseline + i*(i+1)/2 + j;
+                            Complex r = reference[(k*NPOL + p1)*NPOL + p2];
+                            if (e.real != r.real || e.imag != r.imag) {
+                                packed_errors++;
+                            }
+                        } else {
+                            // As xgpuExtractMatrix writes the upper half
+                            Complex r = full[(((size_t)(f*nstation + i)*nstation + j)*NPOL + p1)*NPOL + p2];
+                            if (e.real != r.real || e.imag != r.imag) {
+                                extract_errors++;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    CHECK(conjugate_errors == 0, "xgpuMatrixElementSized: %zu elements not conjugate", conjugate_errors);
+    CHECK(packed_errors == 0, "xgpuMatrixElementSized: %zu packed elements differ", packed_errors);
+    CHECK(extract_errors == 0, "xgpuMatrixElementSized: %zu elements differ from xgpuExtractMatrix",
+          extract_errors);
+
+    // A known element and its conjugate transpose
+    Complex e = xgpuMatrixElementSized(sizing, reference, 1, 7, 3, 0, 1);
+    Complex t = xgpuMatrixElementSized(sizing, reference, 1, 3, 7, 1, 0);
+    size_t k = (size_t)1*sizing->nbaseline + 7*8/2 + 3;
+    CHECK(e.real == reference[k*NPOL*NPOL + 1].real && e.imag == reference[k*NPOL*NPOL + 1].imag,
+          "element (1,7,3,0,1) is not packed element %zu", k*NPOL*NPOL + 1);
+    CHECK(t.real == e.real && t.imag == -e.imag, "element (1,3,7,1,0) is not its conjugate");
+
+    free(full);
+}
+
+int main(void) {
+    make_sizing(&test_sizing, TEST_NSTATION, TEST_NFREQUENCY, TEST_NTIME);
+    printf("xGPU CPU tests: %u stations, %u channels, %u samples, matrix order %d\n",
+           test_sizing.nstation, test_sizing.nfrequency, test_sizing.ntime, MATRIX_ORDER);
+
+    ComplexInput *array = malloc(test_sizing.vecLength * sizeof(ComplexInput));
+    Complex *reference = malloc(test_sizing.triLength * sizeof(Complex));
+    srand(TEST_SEED);
+    xgpuRandomComplex(array, test_sizing.vecLength);
+    reference_xengine(&test_sizing, reference, array);
+
+    test_cpu_xengine(array, reference);
+    test_compare_result(reference);
+    test_matrix_element(reference);
+
+    free(reference);
+    free(array);
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}